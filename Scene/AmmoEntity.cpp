@@ -24,6 +24,12 @@ namespace gen
 	// Will be needed to implement the required shell behaviour in the Update function below
 	extern TEntityUID GetTankUID(int team);
 
+	// Atom for the tank type name, interned once rather than hashed on every lookup
+	static const TAtom TankType = InternAtom("Tank");
+
+	// Time between checks for nearby tanks once the ammo is resting on the ground
+	static const TFloat32 RestingCheckTime = 0.1f;
+
 
 
 	/*-----------------------------------------------------------------------------------------
@@ -36,16 +42,18 @@ namespace gen
 	// class constructor
 	CAmmoEntity::CAmmoEntity
 	(
-		CEntityTemplate* entityTemplate,
-		TEntityUID       UID,
-		const string& name /*=""*/,
+		CEntityTemplate*  entityTemplate,
+		TEntityUID        UID,
+		CEntityArchetype* archetype,
+		TAtom         name /*= kNoAtom*/,
 		const CVector3& position /*= CVector3::kOrigin*/,
 		const CVector3& rotation /*= CVector3( 0.0f, 0.0f, 0.0f )*/,
 		const CVector3& scale /*= CVector3( 1.0f, 1.0f, 1.0f )*/
-	) : CEntity(entityTemplate, UID, name, position, rotation, scale)
+	) : CEntity(entityTemplate, UID, archetype, name, position, rotation, scale)
 	{
 		// Initialise any shell data you add
 		m_UID = UID;
+		m_Landed = false;
 	}
 
 
@@ -55,41 +63,45 @@ namespace gen
 	bool CAmmoEntity::Update(TFloat32 updateTime)
 	{
 		//FALL TO GROUND
-		if (Position().y > 0.5f)
+		if (GetPosition().y > 0.5f)
 		{
 			Matrix().MoveLocalY(-5.0f);
 		}
 		//SEND MESSAGE
-		else
+		// Only once, on landing - each message wakes a sleeping tank, so repeating it while the
+		// ammo rests would keep every tank awake
+		else if (!m_Landed)
 		{
-			EntityManager.BeginEnumEntities("", "", "Tank");
-			CEntity* entity = EntityManager.EnumEntity();
-			while (entity != nullptr)
+			m_Landed = true;
+			CEntitySpan tanks = EntityManager.GetEntitiesOfType(TankType);
+			for (TUInt32 tank = 0; tank < tanks.size(); ++tank)
 			{
 				SMessage msg;
 				msg.type = Msg_Ammo;
 				msg.from = m_UID;
-				Messenger.SendMessage(entity->GetUID(), msg);
-				entity = EntityManager.EnumEntity();  //Moves onto next Entity
+				msg.subject = m_UID;
+				Messenger.SendMessage(tanks[tank]->GetUID(), msg);
 			}
-			EntityManager.EndEnumEntities();
 		}
 
 		//REFILL AMMO
-		EntityManager.BeginEnumEntities("", "", "Tank");
-		CEntity* entity = EntityManager.EnumEntity();
-		while (entity != nullptr)
+		CEntity* nearTank = EntityManager.FindEntityInRadius(GetPosition(), 2.0f, TankType);
+		if (nearTank)
 		{
-			if (Distance(Position(), entity->Position()) < 2.0f)
-			{
-				dynamic_cast<CTankEntity*>(entity)->Restock();
-				return false;
-			}
-
-			entity = EntityManager.EnumEntity();  //Moves onto next Entity
+			// Restocked by message, as the tank may be updating at the same time
+			SMessage msg;
+			msg.type = Msg_Restock;
+			msg.from = m_UID;
+			msg.subject = m_UID;
+			Messenger.SendMessage(nearTank->GetUID(), msg);
+			return false;
 		}
-		EntityManager.EndEnumEntities();
 	
+		// Resting on the ground, only check for tanks every so often
+		if (GetPosition().y <= 0.5f)
+		{
+			EntityManager.SleepEntity(m_UID, RestingCheckTime);
+		}
 
 
 		return true; // Placeholder
@@ -16,6 +16,10 @@ using namespace std;
 
 namespace gen
 {
+	// Handle for templates used to create ammo - ammo uses the base template class
+	typedef CTemplateHandle<CEntityTemplate, Kind_Ammo> TAmmoTemplateHandle;
+
+
 	/*-----------------------------------------------------------------------------------------
 	-------------------------------------------------------------------------------------------
 		Ammo Entity Class
@@ -37,9 +41,10 @@ namespace gen
 		// class constructor
 		CAmmoEntity
 		(
-			CEntityTemplate* entityTemplate,
-			TEntityUID       UID,
-			const string& name = "",
+			CEntityTemplate*  entityTemplate,
+			TEntityUID        UID,
+			CEntityArchetype* archetype,
+			TAtom         name = kNoAtom,
 			const CVector3& position = CVector3::kOrigin,
 			const CVector3& rotation = CVector3(0.0f, 0.0f, 0.0f),
 			const CVector3& scale = CVector3(1.0f, 1.0f, 1.0f)
@@ -65,6 +70,27 @@ namespace gen
 			return m_isAvailable;
 		}
 
+
+		/////////////////////////////////////
+		// Snapshots
+
+		// Ammo data saved in entity snapshots (see EntitySnapshot.h), in addition to the data
+		// common to all entities
+		struct SSnapshotState
+		{
+			TUInt32 landed;
+		};
+
+		// Get or restore the ammo's snapshot data
+		void SaveState(SSnapshotState& state)
+		{
+			state.landed = m_Landed ? 1 : 0;
+		}
+		void LoadState(const SSnapshotState& state)
+		{
+			m_Landed = (state.landed != 0);
+		}
+
 		/////////////////////////////////////
 		//	Private interface
 	private:
@@ -73,6 +99,9 @@ namespace gen
 		// Data
 		bool m_isAvailable;
 		TEntityUID m_UID;
+
+		// Set once the ammo has reached the ground and told the tanks it is there
+		bool m_Landed;
 	};
 
 
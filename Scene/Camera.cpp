@@ -5,13 +5,35 @@
 	Camera class implementation
 ********************************************/
 
-#include <d3dx9.h>
-#include "MathDX.h"
 #include "Camera.h"
 
 namespace gen
 {
 
+//-----------------------------------------------------------------------------
+// Helper functions
+//-----------------------------------------------------------------------------
+
+// Build a left-handed perspective projection matrix from a vertical field of view, viewport
+// aspect ratio and near and far clip distances. Gives the same matrix as D3DX's
+// D3DXMatrixPerspectiveFovLH, but without needing Direct3D, so cameras also work in headless
+// builds
+static CMatrix4x4 PerspectiveFovLH( TFloat32 fovY, TFloat32 aspect,
+                                    TFloat32 nearClip, TFloat32 farClip )
+{
+	TFloat32 yScale = 1.0f / Tan( fovY * 0.5f );
+	TFloat32 xScale = yScale / aspect;
+	TFloat32 zScale = farClip / (farClip - nearClip);
+
+	CMatrix4x4 proj;
+	proj.e00 = xScale; proj.e01 = 0.0f;   proj.e02 = 0.0f;               proj.e03 = 0.0f;
+	proj.e10 = 0.0f;   proj.e11 = yScale; proj.e12 = 0.0f;               proj.e13 = 0.0f;
+	proj.e20 = 0.0f;   proj.e21 = 0.0f;   proj.e22 = zScale;             proj.e23 = 1.0f;
+	proj.e30 = 0.0f;   proj.e31 = 0.0f;   proj.e32 = -nearClip * zScale; proj.e33 = 0.0f;
+	return proj;
+}
+
+
 //-----------------------------------------------------------------------------
 // Constructors
 //-----------------------------------------------------------------------------
@@ -47,8 +69,7 @@ void CCamera::CalculateMatrices()
 	// aspect ratio, and the near and far clipping planes (which define at
     // what distances geometry should be no longer be rendered).
 	float fovY = ATan(Tan( m_FOV * 0.5f ) / m_Aspect) * 2.0f; // Need fovY, storing fovX
-    D3DXMatrixPerspectiveFovLH( ToD3DXMATRIXPtr(&m_MatProj), fovY, m_Aspect,
-	                            m_NearClip, m_FarClip );
+	m_MatProj = PerspectiveFovLH( fovY, m_Aspect, m_NearClip, m_FarClip );
 
 	// Combine the view and projection matrix into a single matrix - this will
 	// be passed to vertex shaders (more efficient this way)
@@ -56,6 +77,7 @@ void CCamera::CalculateMatrices()
 }
 
 
+#ifndef GEN_HEADLESS
 // Controls the camera - uses the current view matrix for local movement
 void CCamera::Control( EKeyCode turnUp, EKeyCode turnDown,
                        EKeyCode turnLeft, EKeyCode turnRight,  
@@ -100,6 +122,7 @@ void CCamera::Control( EKeyCode turnUp, EKeyCode turnDown,
 		m_Matrix.MoveLocalZ( -MoveSpeed );
 	}
 }
+#endif // GEN_HEADLESS
 
 
 //-----------------------------------------------------------------------------
@@ -172,9 +195,10 @@ void CCamera::CalculateFrustrumPlanes( CVector3 points[6], CVector3 vectors[6] )
 	// near clip plane, but it doesn't matter when defining the plane (which extends to infinity)
 	points[2] = points[3] = points[4] = points[5] = cameraPos; 
 
-	// Get (half) width and height of viewport in camera space (the aperture)
-	float apertureHalfHeight = Tan( m_FOV * 0.5f ) * m_NearClip;
-	float apertureHalfWidth = apertureHalfHeight * m_Aspect;
+	// Get (half) width and height of viewport in camera space (the aperture). The FOV is
+	// horizontal (see CalculateMatrices)
+	float apertureHalfWidth = Tan( m_FOV * 0.5f ) * m_NearClip;
+	float apertureHalfHeight = apertureHalfWidth / m_Aspect;
 	
 	// Left plane vector
 	// Point on left of aperture - step left from center of aperture calculated for near clip plane
@@ -9,7 +9,9 @@
 #include "Defines.h"
 #include "CVector3.h"
 #include "CMatrix4x4.h"
+#ifndef GEN_HEADLESS
 #include "Input.h"
+#endif
 
 namespace gen
 {
@@ -96,12 +98,15 @@ public:
 	// Sets up the view and projection transform matrices for the camera
 	void CalculateMatrices();
 
-	// Controls the camera - uses the current view matrix for local movement
+#ifndef GEN_HEADLESS
+	// Controls the camera - uses the current view matrix for local movement. Not available in
+	// headless builds, which have no keyboard input
 	void Control( EKeyCode turnUp, EKeyCode turnDown,
 	              EKeyCode turnLeft, EKeyCode turnRight,  
 	              EKeyCode moveForward, EKeyCode moveBackward,
 	              EKeyCode moveLeft, EKeyCode moveRight,
 				  TFloat32 MoveSpeed, TFloat32 RotSpeed );
+#endif
 
 
 	///////////////////////////
@@ -8,66 +8,207 @@
 #include "TankEntity.h"
 #include "EntityManager.h"
 #include "Messenger.h"
+#include "MatrixKernels.h"
 
 namespace gen
 {
 
+/*-----------------------------------------------------------------------------------------
+-------------------------------------------------------------------------------------------
+	Entity Template Base Class
+-------------------------------------------------------------------------------------------
+-----------------------------------------------------------------------------------------*/
+
+// Set the default bounding sphere from the mesh's node hierarchy - the sphere around the box
+// enclosing the node positions, with a margin for the geometry around each node
+void CEntityTemplate::CalculateBoundingSphere()
+{
+	// Node positions in model space, with the root at the origin
+	TUInt32 numNodes = m_Mesh->GetNumNodes();
+	vector<CMatrix4x4> nodeMatrices( numNodes > 0 ? numNodes : 1 );
+	for (TUInt32 node = 1; node < numNodes; ++node)
+	{
+		nodeMatrices[node] = m_Mesh->GetNode( node ).positionMatrix;
+	}
+	nodeMatrices[0] = CMatrix4x4::kIdentity;
+	MatrixMultiplyHierarchy( &nodeMatrices[0], &nodeMatrices[0], NodeParents(), 1, numNodes );
+
+	CVector3 minPos = CVector3::kOrigin;
+	CVector3 maxPos = CVector3::kOrigin;
+	for (TUInt32 node = 1; node < numNodes; ++node)
+	{
+		const CVector3& pos = nodeMatrices[node].Position();
+		minPos.x = (pos.x < minPos.x) ? pos.x : minPos.x;
+		minPos.y = (pos.y < minPos.y) ? pos.y : minPos.y;
+		minPos.z = (pos.z < minPos.z) ? pos.z : minPos.z;
+		maxPos.x = (pos.x > maxPos.x) ? pos.x : maxPos.x;
+		maxPos.y = (pos.y > maxPos.y) ? pos.y : maxPos.y;
+		maxPos.z = (pos.z > maxPos.z) ? pos.z : maxPos.z;
+	}
+	m_BoundingSphere.centre = (minPos + maxPos) * 0.5f;
+	m_BoundingSphere.radius = (maxPos - minPos).Length() * 0.5f + kDefaultNodeRadius;
+}
+
+
+
 /*-----------------------------------------------------------------------------------------
 -------------------------------------------------------------------------------------------
 	Base Entity Class
 -------------------------------------------------------------------------------------------
 -----------------------------------------------------------------------------------------*/
 
-// Base entity constructor, needs pointer to common template data and UID, may also pass 
-// name, initial position, rotation and scaling. Set up positional matrices for the entity
+// Base entity constructor, needs pointer to common template data, UID and the archetype
+// to store the entity in, may also pass name (as an atom), initial position, rotation and
+// scaling. Set up positional matrices for the entity
 CEntity::CEntity
 (
-	CEntityTemplate* entityTemplate,
-	TEntityUID       UID,
-	const string&    name /*=""*/,
-	const CVector3&  position /*= CVector3::kOrigin*/, 
-	const CVector3&  rotation /*= CVector3( 0.0f, 0.0f, 0.0f )*/,
-	const CVector3&  scale /*= CVector3( 1.0f, 1.0f, 1.0f )*/
+	CEntityTemplate*  entityTemplate,
+	TEntityUID        UID,
+	CEntityArchetype* archetype,
+	TAtom             name /*= kNoAtom*/,
+	const CVector3&   position /*= CVector3::kOrigin*/, 
+	const CVector3&   rotation /*= CVector3( 0.0f, 0.0f, 0.0f )*/,
+	const CVector3&   scale /*= CVector3( 1.0f, 1.0f, 1.0f )*/
 )
 {
 	m_Template = entityTemplate;
 	m_UID = UID;
-	m_Name = name;
+	m_NameAtom = name;
+	m_IsDestroyed = false;
+
+	// Take a row in the archetype for this entity's hot data
+	m_Archetype = archetype;
+	m_Row = m_Archetype->AddRow( this );
+	SetUpdateInterval( m_Template->GetUpdateInterval() );
+
+	// Not in any index yet, the entity manager adds it
+	for (TUInt32 index = 0; index < NumEntityIndices; ++index)
+	{
+		m_Indices[index].list = 0;
+		m_Indices[index].position = 0;
+	}
+	m_GridEntry.bucket = kNoGridBucket;
+	m_GridEntry.position = 0;
 
-	// Allocate space for matrices
+	// Allocate space for matrices, relative and absolute matrices share one pooled array
 	TUInt32 numNodes = m_Template->Mesh()->GetNumNodes();
-	m_RelMatrices = new CMatrix4x4[numNodes];
-	m_Matrices = new CMatrix4x4[numNodes];
+	m_RelMatrices = m_Archetype->GetMatrixArena()->Allocate( numNodes * 2 );
+	m_Matrices = m_RelMatrices + numNodes;
 
 	// Set initial matrices from mesh defaults
-	for (TUInt32 node = 0; node < numNodes; ++node)
+	for (TUInt32 node = 1; node < numNodes; ++node)
 	{
 		m_RelMatrices[node] = m_Template->Mesh()->GetNode( node ).positionMatrix;
 	}
 
-	// Override root matrix with constructor parameters
-	m_RelMatrices[0] = CMatrix4x4( position, rotation, kZXY, scale );
+	// Root matrix comes from constructor parameters. The entity is not awake yet, so this also
+	// lists it as moved and dirty, which adds it to the spatial grid at the next update and
+	// calculates its matrices in the next transform pass
+	Matrix() = CMatrix4x4( position, rotation, kZXY, scale );
+	FrameStartMatrix() = Matrix();
 }
 
 
-// Render the model
-void CEntity::Render()
+// Recalculate the absolute matrices of any nodes that have changed since they were last
+// calculated. Only the dirty range of nodes is visited - the nodes before it are unchanged,
+// so each node in the range either has its parent earlier in the range or is below a node
+// whose absolute matrix is already up to date
+void CEntity::CalculateMatrices()
 {
-	// Get pointer to mesh to simplify code
-	CMesh* Mesh = m_Template->Mesh();
+	SDirtyNodes& dirty = m_Archetype->DirtyNodes( m_Row );
+	if (dirty.begin == dirty.end)
+	{
+		return;
+	}
 
 	// Calculate absolute matrices from relative node matrices & node heirarchy
-	m_Matrices[0] = m_RelMatrices[0];
-	TUInt32 numNodes = Mesh->GetNumNodes();
-	for (TUInt32 node = 1; node < numNodes; ++node)
+	TUInt32 numNodes = m_Template->Mesh()->GetNumNodes();
+	TUInt32 end = (dirty.end < numNodes) ? dirty.end : numNodes;
+	TUInt32 node = dirty.begin;
+	if (node == 0)
 	{
-		m_Matrices[node] = m_RelMatrices[node] * m_Matrices[Mesh->GetNode( node ).parent];
+		m_Matrices[0] = m_Archetype->RootMatrix( m_Row );
+		++node;
+
+		// Moved, so move the bounding sphere too. Scale the radius by the largest axis scale
+		const CMatrix4x4& root = m_Matrices[0];
+		const SBoundingSphere& modelBounds = m_Template->GetBoundingSphere();
+		SBoundingSphere& worldBounds = m_Archetype->WorldBounds( m_Row );
+		MatrixTransformPoint( &worldBounds.centre, root, modelBounds.centre );
+		TFloat32 scaleSq = root.e00 * root.e00 + root.e01 * root.e01 + root.e02 * root.e02;
+		TFloat32 axisSq  = root.e10 * root.e10 + root.e11 * root.e11 + root.e12 * root.e12;
+		scaleSq = (axisSq > scaleSq) ? axisSq : scaleSq;
+		axisSq = root.e20 * root.e20 + root.e21 * root.e21 + root.e22 * root.e22;
+		scaleSq = (axisSq > scaleSq) ? axisSq : scaleSq;
+		worldBounds.radius = modelBounds.radius * Sqrt( scaleSq );
 	}
+	MatrixMultiplyHierarchy( m_Matrices, m_RelMatrices, m_Template->NodeParents(), node, end );
 	// Incorporate any bone<->mesh offsets (only relevant for skinning)
 	// Don't need this step for this exercise
 
+	dirty.begin = dirty.end = 0;
+}
+
+// Render the model
+void CEntity::Render()
+{
+	// Normally already done in the transform pass
+	CalculateMatrices();
+
 	// Render with absolute matrices
-	Mesh->Render( m_Matrices );
+	m_Template->Mesh()->Render( m_Matrices );
+}
+
+// Add commands to render the entity to the given list. The absolute matrices must be up to
+// date (see CalculateMatrices) and must not change until the commands have been executed
+void CEntity::AddRenderCommands( CRenderCommandList* commands, TUInt32 depth )
+{
+	CMesh* mesh = m_Template->Mesh();
+	TUInt32 meshAtom = m_Template->GetMeshAtom();
+	TUInt32 numNodes = mesh->GetNumNodes();
+	for (TUInt32 node = 0; node < numNodes; ++node)
+	{
+		commands->Add( RenderSortKey( meshAtom, node, depth ), mesh, node, &m_Matrices[node] );
+	}
+}
+
+
+// Add the given node and all the nodes below it to the nodes whose absolute matrices need
+// recalculating
+void CEntity::MarkDirty( TUInt32 node )
+{
+	// Nodes are depth first and each parent comes before its children, so the nodes below
+	// this one are those following it whose parent is this node or one after it
+	TUInt32 end = kAllNodes;
+	if (node != 0)
+	{
+		CMesh* Mesh = m_Template->Mesh();
+		TUInt32 numNodes = Mesh->GetNumNodes();
+		end = node + 1;
+		while (end < numNodes && Mesh->GetNode( end ).parent >= node)
+		{
+			++end;
+		}
+	}
+
+	// Dirty range covers all dirty subtrees and any clean nodes between them
+	SDirtyNodes& dirty = m_Archetype->DirtyNodes( m_Row );
+	if (dirty.begin == dirty.end)
+	{
+		dirty.begin = node;
+		dirty.end = end;
+	}
+	else
+	{
+		if (node < dirty.begin)
+		{
+			dirty.begin = node;
+		}
+		if (end > dirty.end)
+		{
+			dirty.end = end;
+		}
+	}
 }
 
 
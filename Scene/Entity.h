@@ -7,13 +7,20 @@
 #pragma once
 
 #include <string>
+#include <vector>
 using namespace std;
 
 #include "Defines.h"
 #include "CVector3.h"
 #include "CMatrix4x4.h"
 #include "Camera.h"
-#include "Mesh.h"
+#include "MeshCache.h"
+#include "EntityArchetype.h"
+#include "EntityIndex.h"
+#include "SpatialGrid.h"
+#include "StringAtoms.h"
+#include "MatrixKernels.h"
+#include "RenderCommands.h"
 
 namespace gen
 {
@@ -21,9 +28,33 @@ namespace gen
 /////////////////////////////////////
 //	Public types
 
-// An entity UID is just a 32 bit value
-typedef TUInt32 TEntityUID;
-const TEntityUID SystemUID = 0xffffffff;
+// An entity UID is a 64 bit handle made up of a slot index (low 32 bits) and a generation
+// (high 32 bits) - see CEntitySlotMap. UIDs should be treated as opaque values outside the
+// entity manager. The system UID is never a valid entity handle
+typedef TUInt64 TEntityUID;
+const TEntityUID SystemUID = 0xffffffffffffffffull;
+
+// Build an entity UID from a slot index and generation
+inline TEntityUID MakeEntityUID( TUInt32 index, TUInt32 generation )
+{
+	return (static_cast<TEntityUID>(generation) << 32) | index;
+}
+
+// Extract the slot index from an entity UID
+inline TUInt32 EntityUIDIndex( TEntityUID UID )
+{
+	return static_cast<TUInt32>(UID);
+}
+
+// Extract the slot generation from an entity UID
+inline TUInt32 EntityUIDGeneration( TEntityUID UID )
+{
+	return static_cast<TUInt32>(UID >> 32);
+}
+
+// The mesh interface gives no access to geometry, so default bounding spheres assume the
+// geometry lies within this distance of the mesh's nodes (see CEntityTemplate)
+const TFloat32 kDefaultNodeRadius = 10.0f;
 
 
 /*-----------------------------------------------------------------------------------------
@@ -41,26 +72,40 @@ class CEntityTemplate
 //	Constructors/Destructors
 public:
 	// Base entity template constructor needs template type (e.g. "Car"), name (e.g. "Fiat Panda")
-	// and the associated mesh (e.g. "panda.x")
-	CEntityTemplate( const string& type, const string& name, const string& meshFilename )
+	// and the associated mesh (e.g. "panda.x"). The type and name are interned as atoms. The
+	// mesh is shared, through the given cache, with any other templates using the same file
+	CEntityTemplate( const string& type, const string& name, const string& meshFilename,
+	                 CMeshCache* meshCache )
 	{
-		m_Type = type;
-		m_Name = name;
-
-		// Load mesh
-		m_Mesh = new CMesh();
-		if (!m_Mesh->Load( meshFilename ))
+		m_TypeAtom = InternAtom( type );
+		m_NameAtom = InternAtom( name );
+		m_UpdateInterval = 1;
+
+		// Get mesh, only loaded if no other template is using it
+		m_MeshCache = meshCache;
+		m_Mesh = m_MeshCache->Acquire( meshFilename );
+		m_MeshAtom = InternAtom( CMeshCache::CanonicalPath( meshFilename ) );
+		if (!m_Mesh)
 		{
 			string errorMsg = "Error loading mesh " + meshFilename;
 			SystemMessageBox( errorMsg.c_str(), "Mesh Error" );
-			throw; // failure in constructor can only be signalled with exception 
+			throw CMeshLoadError( meshFilename ); // failure in constructor can only be signalled with exception
 		}
+
+		// Parent of each node kept together, for calculating absolute matrices in one pass
+		TUInt32 numNodes = m_Mesh->GetNumNodes();
+		m_NodeParents.resize( numNodes );
+		for (TUInt32 node = 0; node < numNodes; ++node)
+		{
+			m_NodeParents[node] = m_Mesh->GetNode( node ).parent;
+		}
+		CalculateBoundingSphere();
 	}
 
 	// Destructor - base class destructors should always be virtual
 	virtual ~CEntityTemplate()
 	{
-		delete m_Mesh;
+		m_MeshCache->Release( m_Mesh );
 	}
 
 private:
@@ -78,12 +123,22 @@ public:
 
 	const string& GetType()
 	{
-		return m_Type;
+		return AtomString( m_TypeAtom );
 	}
 
 	const string& GetName()
 	{
-		return m_Name;
+		return AtomString( m_NameAtom );
+	}
+
+	TAtom GetTypeAtom()
+	{
+		return m_TypeAtom;
+	}
+
+	TAtom GetNameAtom()
+	{
+		return m_NameAtom;
 	}
 
 	CMesh* const Mesh()
@@ -91,20 +146,123 @@ public:
 		return m_Mesh;
 	}
 
+	// Atom of the mesh's canonical file path - the same for all templates sharing the mesh.
+	// Identifies the mesh in render sort keys
+	TAtom GetMeshAtom()
+	{
+		return m_MeshAtom;
+	}
+
+	// Parent of each node in the mesh (see MatrixMultiplyHierarchy)
+	const TUInt32* NodeParents()
+	{
+		return &m_NodeParents[0];
+	}
+
+	// Number of frames between updates for entities created from this template
+	TUInt32 GetUpdateInterval()
+	{
+		return m_UpdateInterval;
+	}
+
+	// Sphere enclosing the mesh in model space, used to cull entities that are off screen
+	const SBoundingSphere& GetBoundingSphere()
+	{
+		return m_BoundingSphere;
+	}
+
+
+	/////////////////////////////////////
+	//	Setters
+
+	// Set the number of frames between updates for entities created from this template from
+	// now on: 1 to update every frame (the default), 0 to never update them. Individual
+	// entities can change their own interval with CEntity::SetUpdateInterval
+	void SetUpdateInterval( TUInt32 frames )
+	{
+		m_UpdateInterval = frames;
+	}
+
+	// Set the sphere enclosing the mesh in model space. By default the sphere encloses the
+	// mesh's nodes with a margin of kDefaultNodeRadius around each. Set a sphere for meshes
+	// with geometry further from their nodes, or whose nodes move far from their defaults,
+	// otherwise their entities may be culled while still partly on screen. Entities already
+	// created from this template only pick up the new sphere when they next move
+	void SetBoundingSphere( const CVector3& centre, TFloat32 radius )
+	{
+		m_BoundingSphere.centre = centre;
+		m_BoundingSphere.radius = radius;
+	}
+
 
 /////////////////////////////////////
 //	Private interface
 private:
 
+	// Set the default bounding sphere from the mesh's node hierarchy
+	void CalculateBoundingSphere();
+
 	// Type and name of the template
-	string m_Type;
-	string m_Name;
+	TAtom m_TypeAtom;
+	TAtom m_NameAtom;
+
+	// Initial update interval for entities using this template
+	TUInt32 m_UpdateInterval;
 
-	// The mesh representing this entity
-	CMesh* m_Mesh;
+	// The mesh representing this entity, the atom of its path and the cache it is shared through
+	CMesh*      m_Mesh;
+	TAtom       m_MeshAtom;
+	CMeshCache* m_MeshCache;
+
+	// Copy of the parent of each node in the mesh
+	vector<TUInt32> m_NodeParents;
+
+	// Sphere enclosing the mesh in model space
+	SBoundingSphere m_BoundingSphere;
 };
 
 
+// A template handle is a template that has been looked up and checked once, ready to be used
+// to create entities of one kind without any further lookup. The template class and entity
+// kind are part of the handle's type, so a handle can only be passed to the matching Create
+// function (e.g. a tank template handle to CreateTank). Get handles from the entity manager's
+// Resolve functions. A handle is invalid (IsValid returns false) if the template did not
+// exist or was the wrong class, and remains usable only until its template is destroyed
+template <class TTemplate, EEntityKind Kind>
+class CTemplateHandle
+{
+public:
+	typedef TTemplate TTemplateClass;
+
+	// Default handle is invalid
+	CTemplateHandle()
+	{
+		m_Template = 0;
+	}
+
+	explicit CTemplateHandle( TTemplate* entityTemplate )
+	{
+		m_Template = entityTemplate;
+	}
+
+	bool IsValid() const
+	{
+		return m_Template != 0;
+	}
+
+	TTemplate* Get() const
+	{
+		return m_Template;
+	}
+
+private:
+	TTemplate* m_Template;
+};
+
+// Handle for templates used to create base class entities
+typedef CTemplateHandle<CEntityTemplate, Kind_Base> TEntityTemplateHandle;
+
+
 
 /*-----------------------------------------------------------------------------------------
 -------------------------------------------------------------------------------------------
@@ -115,28 +273,44 @@ private:
 // Base entity holds a pointer to its template data and the current position as a set of
 // matrices. The entity can be rendered but its update function does nothing - base class
 // entities are assumed to be static scene elements
+// Each entity occupies a row in the archetype for its class. The root matrix (and any hot
+// data added by derived classes) is held in the archetype's columns, not in the entity
 class CEntity
 {
+	// The archetype, index lists and spatial grid update the entity's row, list and bucket
+	// positions when they move entities around. The manager marks entities whose destruction
+	// is deferred
+	friend class CEntityArchetype;
+	friend class CEntityList;
+	friend class CSpatialGrid;
+	friend class CEntityManager;
+
 /////////////////////////////////////
 //	Constructors/Destructors
 public:
-	// Base entity constructor, needs pointer to common template data and UID, may also pass 
-	// name, initial position, rotation and scaling. Set up positional matrices for the entity
+	// Base entity constructor, needs pointer to common template data, UID and the archetype
+	// to store the entity in, may also pass name (as an atom), initial position, rotation and
+	// scaling. Set up positional matrices for the entity
 	CEntity
 	(
-		CEntityTemplate* entityTemplate,
-		TEntityUID       UID,
-		const string&    name = "",
-		const CVector3&  position = CVector3::kOrigin, 
-		const CVector3&  rotation = CVector3( 0.0f, 0.0f, 0.0f ),
-		const CVector3&  scale = CVector3( 1.0f, 1.0f, 1.0f )
+		CEntityTemplate*  entityTemplate,
+		TEntityUID        UID,
+		CEntityArchetype* archetype,
+		TAtom             name = kNoAtom,
+		const CVector3&   position = CVector3::kOrigin, 
+		const CVector3&   rotation = CVector3( 0.0f, 0.0f, 0.0f ),
+		const CVector3&   scale = CVector3( 1.0f, 1.0f, 1.0f )
 	);
 
 	// Destructor - base class destructors should always be virtual
 	virtual ~CEntity()
 	{
-		delete[] m_Matrices;
-		delete[] m_RelMatrices;
+		if (m_Row != kNoRow) // Row may already have been removed in a batch
+		{
+			m_Archetype->RemoveRow( m_Row );
+		}
+		TUInt32 numNodes = m_Template->Mesh()->GetNumNodes();
+		m_Archetype->GetMatrixArena()->Free( m_RelMatrices, numNodes * 2 );
 	}
 
 private:
@@ -162,23 +336,117 @@ public:
 		return m_Template;
 	}
 
+	// Unnamed entities have an empty name
 	const string& GetName()
 	{
-		return m_Name;
+		return AtomString( m_NameAtom );
+	}
+
+	TAtom GetNameAtom()
+	{
+		return m_NameAtom;
+	}
+
+	CEntityArchetype* GetArchetype()
+	{
+		return m_Archetype;
+	}
+
+	EEntityKind GetKind()
+	{
+		return m_Archetype->GetKind();
+	}
+
+	// Returns true if the entity has been destroyed but not yet deleted - this happens if it
+	// is destroyed while entity queries are alive. Such an entity has no valid UID
+	bool IsDestroyed()
+	{
+		return m_IsDestroyed;
+	}
+
+	// Number of frames between updates of this entity
+	TUInt32 GetUpdateInterval()
+	{
+		return m_Archetype->UpdateSchedule( m_Row ).interval;
+	}
+
+	// Set the number of frames between updates of this entity: 1 to update every frame, 0 to
+	// stop updating it. Low priority entities (e.g. those far from the camera) can be updated
+	// less often, they are passed the total time since their last update when they are
+	void SetUpdateInterval( TUInt32 frames )
+	{
+		m_Archetype->UpdateSchedule( m_Row ).interval = frames;
+	}
+
+	// Returns true if the entity is asleep - it is not updated until it is woken (see
+	// CEntityManager::SleepEntity). Entities whose class has no update are always asleep
+	bool IsAsleep()
+	{
+		return m_Indices[Index_Awake].list == 0;
+	}
+
+	// Return the list this entity is in for the given index, or 0 if it is not indexed
+	CEntityList* GetIndexList( EEntityIndex index )
+	{
+		return m_Indices[index].list;
 	}
 
 
 	/////////////////////////////////////
 	// Matrix access
 
-	// Direct access to position and matrix
+	// Direct access to position and matrix. The root matrix lives in the archetype
+	// The node and the nodes below it are assumed to be changed through the returned
+	// reference, so their absolute matrices are recalculated before the next render. Use
+	// GetPosition / GetMatrix when only reading, so unmoved entities cost nothing to render
 	CVector3& Position( TUInt32 node = 0 )
 	{
-		return m_RelMatrices[node].Position();
+		return Matrix( node ).Position();
 	}
 	CMatrix4x4& Matrix( TUInt32 node = 0 )
 	{
-		return m_RelMatrices[node];
+		// Nothing to do if every node from this one onwards is already dirty
+		SDirtyNodes& dirty = m_Archetype->DirtyNodes( m_Row );
+		if (dirty.end != kAllNodes || dirty.begin > node)
+		{
+			MarkDirty( node );
+		}
+
+		// Only awake entities are visited by every spatial grid update and transform pass, so
+		// list sleeping ones
+		if (IsAsleep())
+		{
+			if (!m_Indices[Index_Dirty].list)
+			{
+				m_Archetype->DirtyEntities().Add( this );
+			}
+			if (node == 0 && !m_Indices[Index_Moved].list)
+			{
+				m_Archetype->MovedEntities().Add( this );
+			}
+		}
+		return GetNodeMatrix( node );
+	}
+
+	// Read only access to position and matrix
+	const CVector3& GetPosition( TUInt32 node = 0 )
+	{
+		return GetMatrix( node ).Position();
+	}
+	const CMatrix4x4& GetMatrix( TUInt32 node = 0 )
+	{
+		return GetNodeMatrix( node );
+	}
+
+	// Root matrix and position as they were at the start of the current update. Read other
+	// entities through these during an update - their current matrices may be changing
+	CVector3& FrameStartPosition()
+	{
+		return FrameStartMatrix().Position();
+	}
+	CMatrix4x4& FrameStartMatrix()
+	{
+		return m_Archetype->FrameStartMatrix( m_Row );
 	}
 
 
@@ -190,23 +458,84 @@ public:
 	// Virtual function, base version does nothing
 	virtual bool Update( TFloat32 updateTime ) { return true; }
 	
+	// Recalculate the absolute matrices of any nodes that have changed since they were last
+	// calculated. Called for awake and dirty entities by CEntityManager::UpdateTransforms before
+	// rendering
+	void CalculateMatrices();
+
 	// Render the entity
 	void Render();
 
+	// Add commands to render the entity, one for each node of its mesh, to the given list. The
+	// depth (0 to kMaxSortKeyDepth) orders the commands front to back within each mesh node
+	void AddRenderCommands( CRenderCommandList* commands, TUInt32 depth );
+
+
+/////////////////////////////////////
+//	Protected interface
+protected:
+
+	// Row of this entity in its archetype - derived classes use this to access their own
+	// columns. Only valid until the next row removal in the archetype, so don't store it
+	TUInt32 GetRow()
+	{
+		return m_Row;
+	}
+
 
 /////////////////////////////////////
 //	Private interface
 private:
 
+	// Relative matrix for the given node, the root matrix for node 0
+	CMatrix4x4& GetNodeMatrix( TUInt32 node )
+	{
+		if (node == 0)
+		{
+			return m_Archetype->RootMatrix( m_Row );
+		}
+		return m_RelMatrices[node];
+	}
+
+	// Add the given node and all the nodes below it to the nodes whose absolute matrices need
+	// recalculating
+	void MarkDirty( TUInt32 node );
+
 	// The template used by this entity - the common data for all entities of this type
 	CEntityTemplate* m_Template;
 
-	// Unique identifier and name for the entity
+	// Unique identifier and name for the entity, unnamed entities have kNoAtom
 	TEntityUID  m_UID;
-	string      m_Name;
+	TAtom       m_NameAtom;
+
+	// Set when destruction of the entity has been deferred
+	bool        m_IsDestroyed;
 
-	// Relative and absolute world matrices for each node in the template's mesh
-	CMatrix4x4* m_RelMatrices; // Dynamically allocated arrays
+	// Archetype storing this entity's hot data, and the row used within it
+	CEntityArchetype* m_Archetype;
+	TUInt32           m_Row;
+
+	// The list this entity is in for each index and its position in that list
+	struct SIndexEntry
+	{
+		CEntityList* list;
+		TUInt32      position;
+	};
+	SIndexEntry m_Indices[NumEntityIndices];
+
+	// The bucket this entity is in within the manager's spatial grid (kNoGridBucket if none)
+	// and its position in that bucket
+	struct SGridEntry
+	{
+		TUInt32 bucket;
+		TUInt32 position;
+	};
+	SGridEntry m_GridEntry;
+
+	// Relative and absolute world matrices for each node in the template's mesh. The relative
+	// matrix for the root (node 0) is unused - it is held in the archetype. Absolute matrices
+	// are only recalculated for the nodes in the archetype's dirty node column
+	CMatrix4x4* m_RelMatrices; // One array from the matrix arena, holding both sets
 	CMatrix4x4* m_Matrices;
 };
 
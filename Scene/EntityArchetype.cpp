@@ -0,0 +1,179 @@
+/*******************************************
+	EntityArchetype.cpp
+
+	Packed structure-of-arrays storage for
+	entities of one concrete class
+********************************************/
+
+#include <algorithm>
+using namespace std;
+
+#include "EntityArchetype.h"
+#include "Entity.h"
+
+namespace gen
+{
+
+/////////////////////////////////////
+// Row management
+
+// Reserve space in all columns for the given number of rows
+void CEntityArchetype::Reserve( TUInt32 numRows )
+{
+	m_Entities.reserve( numRows );
+	m_RootMatrices.reserve( numRows );
+	m_FrameStartMatrices.reserve( numRows );
+	m_UpdateSchedules.reserve( numRows );
+	m_DirtyNodes.reserve( numRows );
+	m_WorldBounds.reserve( numRows );
+	ReserveColumns( numRows );
+}
+
+// Ensure there is space for the given number of rows to be added without reallocating the
+// columns again. Grows geometrically, so repeated small batches do not each reallocate
+void CEntityArchetype::ReserveExtra( TUInt32 numNewRows )
+{
+	TUInt32 numRows = static_cast<TUInt32>(m_Entities.size()) + numNewRows;
+	TUInt32 capacity = static_cast<TUInt32>(m_Entities.capacity());
+	if (numRows > capacity)
+	{
+		Reserve( numRows > capacity * 2 ? numRows : capacity * 2 );
+	}
+}
+
+// Add a row for the given entity, returns the new row index. Called from the CEntity
+// constructor, before any derived class has been constructed
+TUInt32 CEntityArchetype::AddRow( CEntity* entity )
+{
+	TUInt32 row = static_cast<TUInt32>(m_Entities.size());
+	m_Entities.push_back( entity );
+	m_RootMatrices.push_back( CMatrix4x4() );
+	m_FrameStartMatrices.push_back( CMatrix4x4() );
+
+	// Updated every frame until told otherwise
+	SUpdateSchedule schedule;
+	schedule.interval = 1;
+	schedule.phase = m_NextUpdatePhase++;
+	schedule.lastUpdateTime = 0.0;
+	schedule.wakeTime = 0.0;
+	m_UpdateSchedules.push_back( schedule );
+
+	// New entity has no absolute matrices yet
+	SDirtyNodes dirty = { 0, kAllNodes };
+	m_DirtyNodes.push_back( dirty );
+	SBoundingSphere bounds = { CVector3::kOrigin, 0.0f };
+	m_WorldBounds.push_back( bounds );
+	AddColumns();
+	return row;
+}
+
+// Remove the given row, moving the last row into its place. Called from the CEntity
+// destructor
+void CEntityArchetype::RemoveRow( TUInt32 row )
+{
+	TUInt32 lastRow = static_cast<TUInt32>(m_Entities.size()) - 1;
+
+	// If not removing last row...
+	if (row != lastRow)
+	{
+		// ...move the last row into the empty row and tell the moved entity
+		m_Entities[row] = m_Entities[lastRow];
+		m_RootMatrices[row] = m_RootMatrices[lastRow];
+		m_FrameStartMatrices[row] = m_FrameStartMatrices[lastRow];
+		m_UpdateSchedules[row] = m_UpdateSchedules[lastRow];
+		m_DirtyNodes[row] = m_DirtyNodes[lastRow];
+		m_WorldBounds[row] = m_WorldBounds[lastRow];
+		MoveColumns( lastRow, row );
+		m_Entities[row]->m_Row = row;
+	}
+	m_Entities.pop_back();
+	m_RootMatrices.pop_back();
+	m_FrameStartMatrices.pop_back();
+	m_UpdateSchedules.pop_back();
+	m_DirtyNodes.pop_back();
+	m_WorldBounds.pop_back();
+	TruncateColumns( lastRow );
+}
+
+// Remove the rows of all the given entities in a single pass. Each surviving entity is
+// moved at most once. The entities are detached from the archetype, so their destructors
+// will not try to remove their rows again
+void CEntityArchetype::RemoveRows( CEntity* const* entities, TUInt32 numEntities )
+{
+	if (numEntities == 0)
+	{
+		return;
+	}
+
+	// Get sorted list of rows to remove and detach the entities
+	m_RemovedRows.clear();
+	for (TUInt32 entity = 0; entity < numEntities; ++entity)
+	{
+		m_RemovedRows.push_back( entities[entity]->m_Row );
+		entities[entity]->m_Row = kNoRow;
+	}
+	sort( m_RemovedRows.begin(), m_RemovedRows.end() );
+
+	// The removed rows below the new size are holes. There are exactly as many surviving
+	// rows at or above the new size, move each of those down into a hole
+	TUInt32 oldNumRows = static_cast<TUInt32>(m_Entities.size());
+	TUInt32 newNumRows = oldNumRows - numEntities;
+	TUInt32 hole = 0;
+	TUInt32 removed = static_cast<TUInt32>(lower_bound( m_RemovedRows.begin(), m_RemovedRows.end(),
+	                                                     newNumRows ) - m_RemovedRows.begin());
+	for (TUInt32 row = newNumRows; row < oldNumRows; ++row)
+	{
+		if (removed < numEntities && m_RemovedRows[removed] == row)
+		{
+			// Removed row, nothing to keep
+			++removed;
+		}
+		else
+		{
+			// Surviving row, move it into the next hole and tell the moved entity
+			TUInt32 newRow = m_RemovedRows[hole++];
+			m_Entities[newRow] = m_Entities[row];
+			m_RootMatrices[newRow] = m_RootMatrices[row];
+			m_FrameStartMatrices[newRow] = m_FrameStartMatrices[row];
+			m_UpdateSchedules[newRow] = m_UpdateSchedules[row];
+			m_DirtyNodes[newRow] = m_DirtyNodes[row];
+			m_WorldBounds[newRow] = m_WorldBounds[row];
+			MoveColumns( row, newRow );
+			m_Entities[newRow]->m_Row = newRow;
+		}
+	}
+
+	m_Entities.resize( newNumRows );
+	m_RootMatrices.resize( newNumRows );
+	m_FrameStartMatrices.resize( newNumRows );
+	m_UpdateSchedules.resize( newNumRows );
+	m_DirtyNodes.resize( newNumRows );
+	m_WorldBounds.resize( newNumRows );
+	TruncateColumns( newNumRows );
+}
+
+
+/////////////////////////////////////
+// Frame start state
+
+// Copy the current state of the rows that may have changed into the frame start columns
+void CEntityArchetype::SaveFrameStart( CEntityList* awakeList )
+{
+	SaveFrameStartRows( awakeList );
+	SaveFrameStartRows( &m_MovedEntities );
+}
+
+// Copy the current state of the rows of the entities in the given list into the frame start
+// columns
+void CEntityArchetype::SaveFrameStartRows( CEntityList* list )
+{
+	for (TUInt32 position = 0; position < list->Size(); ++position)
+	{
+		TUInt32 row = list->GetEntity( position )->m_Row;
+		m_FrameStartMatrices[row] = m_RootMatrices[row];
+		SaveFrameStartColumns( row );
+	}
+}
+
+
+} // namespace gen
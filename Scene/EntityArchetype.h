@@ -0,0 +1,284 @@
+/*******************************************
+	EntityArchetype.h
+
+	Packed structure-of-arrays storage for
+	entities of one concrete class
+********************************************/
+
+#pragma once
+
+#include <vector>
+using namespace std;
+
+#include "Defines.h"
+#include "CMatrix4x4.h"
+#include "PoolAllocator.h"
+#include "MatrixKernels.h"
+#include "EntityIndex.h"
+
+namespace gen
+{
+
+class CEntity;
+
+/////////////////////////////////////
+//	Public types
+
+// Row index of an entity that has been detached from its archetype
+const TUInt32 kNoRow = 0xffffffff;
+
+// When an entity is updated. An entity with an interval of N frames is updated on the frames
+// where (frame number + phase) is a multiple of N, and is passed the time since its last
+// update. An interval of 0 means the entity is never updated
+struct SUpdateSchedule
+{
+	TUInt32  interval;
+	TUInt32  phase;
+	TFloat64 lastUpdateTime; // Update clock at the last update (see CEntityManager)
+	TFloat64 wakeTime;       // Update clock time a sleeping entity wakes, 0 if only woken
+	                         // by messages (see CEntityManager::SleepEntity)
+};
+
+// The mesh nodes of an entity whose absolute matrices are out of date, from begin up to (not
+// including) end. Nodes are stored depth first, so the subtree below a node is a contiguous
+// range of nodes. Empty (begin == end) when all absolute matrices are up to date
+struct SDirtyNodes
+{
+	TUInt32 begin;
+	TUInt32 end;
+};
+
+// Dirty range end covering all nodes after begin, whatever the number of nodes
+const TUInt32 kAllNodes = 0xffffffff;
+
+// The concrete entity classes known to the entity manager. Each kind has its own archetype
+// so entities of the same class are stored (and updated) together
+enum EEntityKind
+{
+	Kind_Base,  // CEntity - static scenery
+	Kind_Tank,  // CTankEntity
+	Kind_Shell, // CShellEntity
+	Kind_Ammo,  // CAmmoEntity
+	NumEntityKinds
+};
+
+
+/*-----------------------------------------------------------------------------------------
+-------------------------------------------------------------------------------------------
+	Entity Archetype Base Class
+-------------------------------------------------------------------------------------------
+-----------------------------------------------------------------------------------------*/
+
+// An archetype holds all the entities of a single concrete class. The hot data for those
+// entities is stored in parallel arrays (columns) indexed by row rather than inside each
+// entity object, so passes over one field touch contiguous memory. The base archetype has
+// columns for the entity pointer, the root matrix, a copy of the root matrix taken at the
+// start of each update (see SaveFrameStart), the update schedule, the range of node matrices
+// needing recalculation and the world bounding sphere. Derived archetypes add columns for the data specific to
+// their entity class (see CTankArchetype for example)
+// The rows are kept packed - if a row is removed from the middle, the last row is moved
+// down to fill its space and the moved entity is told its new row
+class CEntityArchetype
+{
+/////////////////////////////////////
+//	Constructors/Destructors
+public:
+	// Constructor needs the kind of entity held in this archetype and the arena its entities
+	// take their node matrices from. Pass false for isUpdated if the entity class does not
+	// override Update, then its entities are skipped entirely by the update
+	CEntityArchetype( EEntityKind kind, CMatrixArena* matrixArena, bool isUpdated = true )
+		: m_MovedEntities( Index_Moved ), m_DirtyEntities( Index_Dirty )
+	{
+		m_Kind = kind;
+		m_MatrixArena = matrixArena;
+		m_IsUpdated = isUpdated;
+		m_NextUpdatePhase = 0;
+	}
+
+	// Destructor - base class destructors should always be virtual
+	virtual ~CEntityArchetype() {}
+
+private:
+	// Prevent use of copy constructor and assignment operator (private and not defined)
+	CEntityArchetype( const CEntityArchetype& );
+	CEntityArchetype& operator=( const CEntityArchetype& );
+
+
+/////////////////////////////////////
+//	Public interface
+public:
+
+	/////////////////////////////////////
+	// Getters
+
+	EEntityKind GetKind()
+	{
+		return m_Kind;
+	}
+
+	TUInt32 NumRows()
+	{
+		return static_cast<TUInt32>(m_Entities.size());
+	}
+
+	CEntity* GetEntity( TUInt32 row )
+	{
+		return m_Entities[row];
+	}
+
+	CMatrixArena* GetMatrixArena()
+	{
+		return m_MatrixArena;
+	}
+
+	// Returns false if the entities in this archetype have no update to call
+	bool IsUpdated()
+	{
+		return m_IsUpdated;
+	}
+
+	// Direct access to the root matrix column
+	CMatrix4x4& RootMatrix( TUInt32 row )
+	{
+		return m_RootMatrices[row];
+	}
+
+	// Direct access to the frame start matrix column
+	CMatrix4x4& FrameStartMatrix( TUInt32 row )
+	{
+		return m_FrameStartMatrices[row];
+	}
+
+	// Direct access to the update schedule column
+	SUpdateSchedule& UpdateSchedule( TUInt32 row )
+	{
+		return m_UpdateSchedules[row];
+	}
+
+	// Direct access to the dirty node column
+	SDirtyNodes& DirtyNodes( TUInt32 row )
+	{
+		return m_DirtyNodes[row];
+	}
+
+	// Direct access to the world bounding sphere column. Updated along with the absolute
+	// matrices (see CEntity::CalculateMatrices)
+	SBoundingSphere& WorldBounds( TUInt32 row )
+	{
+		return m_WorldBounds[row];
+	}
+
+	// The whole world bounding sphere column, for culling
+	const SBoundingSphere* WorldBoundsColumn()
+	{
+		return m_WorldBounds.empty() ? 0 : &m_WorldBounds[0];
+	}
+
+	// The entities that have been moved while asleep (or were created or went to sleep) since
+	// the spatial grid was last updated. Awake entities are not listed, the grid and the frame
+	// start copy visit all of them (see CEntityManager::UpdateSpatialGrid and SaveFrameStart)
+	CEntityList& MovedEntities()
+	{
+		return m_MovedEntities;
+	}
+
+	// The entities that have had matrices changed while asleep (or were created or went to
+	// sleep with matrices to recalculate) since the last transform pass. Awake entities are
+	// not listed, the transform pass visits all of them (see CEntityManager::UpdateTransforms)
+	CEntityList& DirtyEntities()
+	{
+		return m_DirtyEntities;
+	}
+
+
+	/////////////////////////////////////
+	// Row management
+
+	// Reserve space in all columns for the given number of rows
+	void Reserve( TUInt32 numRows );
+
+	// Ensure there is space for the given number of rows to be added without reallocating the
+	// columns again. Grows geometrically, so repeated small batches do not each reallocate
+	void ReserveExtra( TUInt32 numNewRows );
+
+	// Add a row for the given entity, returns the new row index. Called from the CEntity
+	// constructor, before any derived class has been constructed
+	TUInt32 AddRow( CEntity* entity );
+
+	// Remove the given row, moving the last row into its place. Called from the CEntity
+	// destructor
+	void RemoveRow( TUInt32 row );
+
+	// Remove the rows of all the given entities in a single pass. Each surviving entity is
+	// moved at most once. The entities are detached from the archetype, so their destructors
+	// will not try to remove their rows again
+	void RemoveRows( CEntity* const* entities, TUInt32 numEntities );
+
+
+	/////////////////////////////////////
+	// Frame start state
+
+	// Copy the current state of the rows that may have changed into the frame start columns -
+	// those of the entities in the given awake list and of the entities listed as moved (see
+	// MovedEntities). Sleeping entities cannot change, so their frame start state is already
+	// current. Called at the start of each update, before the moved list is emptied, so
+	// entities can read the state other entities had at the start of the update while those
+	// entities are being updated (possibly on other threads)
+	void SaveFrameStart( CEntityList* awakeList );
+
+
+/////////////////////////////////////
+//	Protected interface
+protected:
+
+	/////////////////////////////////////
+	// Column management
+
+	// Derived archetypes override these to maintain their additional columns alongside the
+	// base columns. Base versions do nothing
+	virtual void ReserveColumns( TUInt32 /*numRows*/ ) {}
+	virtual void AddColumns() {}
+	virtual void MoveColumns( TUInt32 /*from*/, TUInt32 /*to*/ ) {}
+	virtual void TruncateColumns( TUInt32 /*numRows*/ ) {}
+	virtual void SaveFrameStartColumns( TUInt32 /*row*/ ) {}
+
+
+/////////////////////////////////////
+//	Private interface
+private:
+
+	// The kind of entity held in this archetype
+	EEntityKind m_Kind;
+
+	// Node matrices for the entities come from here, owned by the entity manager
+	CMatrixArena* m_MatrixArena;
+
+	// False if the entity class has no update
+	bool m_IsUpdated;
+
+	// Phase given to the next row added. Rows are given phases in turn so entities with the
+	// same update interval are spread evenly over the frames
+	TUInt32 m_NextUpdatePhase;
+
+	// Base columns
+	vector<CEntity*>   m_Entities;
+	vector<CMatrix4x4> m_RootMatrices;
+	vector<CMatrix4x4> m_FrameStartMatrices;
+	vector<SUpdateSchedule> m_UpdateSchedules;
+	vector<SDirtyNodes>     m_DirtyNodes;
+	vector<SBoundingSphere> m_WorldBounds;
+
+	// Sleeping entities to move in the spatial grid, and to recalculate matrices for
+	CEntityList m_MovedEntities;
+	CEntityList m_DirtyEntities;
+
+	// Copy the current state of the rows of the entities in the given list into the frame
+	// start columns
+	void SaveFrameStartRows( CEntityList* list );
+
+	// Working space for RemoveRows, kept to avoid reallocation
+	vector<TUInt32> m_RemovedRows;
+};
+
+
+} // namespace gen
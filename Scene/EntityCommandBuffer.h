@@ -0,0 +1,136 @@
+/*******************************************
+	EntityCommandBuffer.h
+
+	Records entity creation and destruction
+	for later execution by the entity manager
+********************************************/
+
+#pragma once
+
+#include <vector>
+using namespace std;
+
+#include "Defines.h"
+#include "CVector3.h"
+#include "Entity.h"
+
+namespace gen
+{
+
+/////////////////////////////////////
+//	Public types
+
+// All the parameters needed to create an entity of any kind. The UID is allocated when the
+// command is recorded so it can be returned to the caller straight away
+struct SCreateCommand
+{
+	EEntityKind      kind;
+	CEntityTemplate* entityTemplate;
+	TEntityUID       UID;
+	TAtom            name;
+	CVector3         position;
+	CVector3         rotation;
+	CVector3         scale;
+
+	// Kind-specific parameters
+	TUInt32          team;    // Tanks
+	TEntityUID       shooter; // Shells
+};
+
+
+// A command buffer holds entity creations and destructions requested while the entity
+// storage must not change (e.g. during UpdateAllEntities). The entity manager executes the
+// commands as one batch later - destroyed entities are grouped by archetype so each
+// archetype can be compacted in a single pass
+class CEntityCommandBuffer
+{
+/////////////////////////////////////
+//	Constructors/Destructors
+public:
+	CEntityCommandBuffer() {}
+
+	// No destructor needed
+
+private:
+	// Prevent use of copy constructor and assignment operator (private and not defined)
+	CEntityCommandBuffer( const CEntityCommandBuffer& );
+	CEntityCommandBuffer& operator=( const CEntityCommandBuffer& );
+
+
+/////////////////////////////////////
+//	Public interface
+public:
+
+	/////////////////////////////////////
+	// Recording
+
+	// Record the creation of an entity
+	void Create( const SCreateCommand& command )
+	{
+		m_Creates.push_back( command );
+	}
+
+	// Ensure the given number of further creations can be recorded without reallocating
+	void ReserveCreates( TUInt32 numCreates )
+	{
+		m_Creates.reserve( m_Creates.size() + numCreates );
+	}
+
+	// Record the destruction of an entity
+	void Destroy( CEntity* entity )
+	{
+		m_Destroys[entity->GetKind()].push_back( entity );
+	}
+
+
+	/////////////////////////////////////
+	// Playback
+
+	bool IsEmpty()
+	{
+		if (!m_Creates.empty())
+		{
+			return false;
+		}
+		for (TUInt32 kind = 0; kind < NumEntityKinds; ++kind)
+		{
+			if (!m_Destroys[kind].empty())
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// Recorded creations in the order they were made
+	vector<SCreateCommand>& Creates()
+	{
+		return m_Creates;
+	}
+
+	// Recorded destructions of the given kind of entity
+	vector<CEntity*>& Destroys( EEntityKind kind )
+	{
+		return m_Destroys[kind];
+	}
+
+	// Remove all commands, keeps the memory used for reuse
+	void Clear()
+	{
+		m_Creates.clear();
+		for (TUInt32 kind = 0; kind < NumEntityKinds; ++kind)
+		{
+			m_Destroys[kind].clear();
+		}
+	}
+
+
+/////////////////////////////////////
+//	Private interface
+private:
+	vector<SCreateCommand> m_Creates;
+	vector<CEntity*>       m_Destroys[NumEntityKinds];
+};
+
+
+} // namespace gen
@@ -0,0 +1,45 @@
+/*******************************************
+	EntityIndex.cpp
+
+	Entity membership lists used by the entity
+	manager to index entities by type, team
+	and name
+********************************************/
+
+#include "EntityIndex.h"
+#include "Entity.h"
+
+namespace gen
+{
+
+// Add an entity to the list, it must not already be in a list for this index
+void CEntityList::Add( CEntity* entity )
+{
+	CEntity::SIndexEntry& entry = entity->m_Indices[m_Index];
+	entry.list = this;
+	entry.position = static_cast<TUInt32>(m_Entities.size());
+	m_Entities.push_back( entity );
+}
+
+// Remove an entity from the list
+void CEntityList::Remove( CEntity* entity )
+{
+	CEntity::SIndexEntry& entry = entity->m_Indices[m_Index];
+	TUInt32 lastPosition = static_cast<TUInt32>(m_Entities.size()) - 1;
+
+	// If not removing last entity...
+	if (entry.position != lastPosition)
+	{
+		// ...move the last entity into the gap and tell it its new position
+		CEntity* movedEntity = m_Entities[lastPosition];
+		m_Entities[entry.position] = movedEntity;
+		movedEntity->m_Indices[m_Index].position = entry.position;
+	}
+	m_Entities.pop_back();
+
+	entry.list = 0;
+	entry.position = 0;
+}
+
+
+} // namespace gen
@@ -0,0 +1,161 @@
+/*******************************************
+	EntityIndex.h
+
+	Entity membership lists used by the entity
+	manager to index entities by type, team
+	and name
+********************************************/
+
+#pragma once
+
+#include <vector>
+#include <unordered_map>
+using namespace std;
+
+#include "Defines.h"
+#include "StringAtoms.h"
+
+namespace gen
+{
+
+class CEntity;
+
+/////////////////////////////////////
+//	Public types
+
+// The indices an entity can be a member of. An entity is in at most one list of each index
+enum EEntityIndex
+{
+	Index_Type, // Entities with the same template type
+	Index_Team, // Tanks on the same team
+	Index_Name, // Entities with the same name (named entities only)
+	Index_Awake, // Entities that are awake, one list for each archetype
+	Index_Moved, // Sleeping entities moved since the spatial grid was updated, one list for each archetype
+	Index_Dirty, // Sleeping entities with matrices to recalculate, one list for each archetype
+	NumEntityIndices
+};
+
+
+// A span is a lightweight view of a range of entity pointers. Use begin/end (including range
+// for loops) or size and [] to iterate. A span is invalidated by any entity creation or
+// destruction, so don't keep it across these calls
+class CEntitySpan
+{
+public:
+	CEntitySpan()
+	{
+		m_Begin = m_End = 0;
+	}
+
+	CEntitySpan( CEntity* const* begin, CEntity* const* end )
+	{
+		m_Begin = begin;
+		m_End = end;
+	}
+
+	CEntity* const* begin() const
+	{
+		return m_Begin;
+	}
+
+	CEntity* const* end() const
+	{
+		return m_End;
+	}
+
+	TUInt32 size() const
+	{
+		return static_cast<TUInt32>(m_End - m_Begin);
+	}
+
+	bool empty() const
+	{
+		return m_Begin == m_End;
+	}
+
+	CEntity* operator[]( TUInt32 index ) const
+	{
+		return m_Begin[index];
+	}
+
+private:
+	CEntity* const* m_Begin;
+	CEntity* const* m_End;
+};
+
+
+// An entity list holds the members of one entry in an index (e.g. all entities of type
+// "Tank"). Entities are held in no particular order. Each entity records which list it is in
+// for each index and its position in that list, so both adding and removing are O(1) - the
+// last entity is moved into the gap left by a removed one
+class CEntityList
+{
+/////////////////////////////////////
+//	Constructors/Destructors
+public:
+	// Constructor needs the index this list belongs to
+	CEntityList( EEntityIndex index )
+	{
+		m_Index = index;
+	}
+
+	// No destructor needed, the list does not own the entities
+
+private:
+	// Prevent use of copy constructor and assignment operator (private and not defined)
+	CEntityList( const CEntityList& );
+	CEntityList& operator=( const CEntityList& );
+
+
+/////////////////////////////////////
+//	Public interface
+public:
+
+	// Return a span of all the entities in the list
+	CEntitySpan Entities()
+	{
+		if (m_Entities.empty())
+		{
+			return CEntitySpan();
+		}
+		return CEntitySpan( &m_Entities[0], &m_Entities[0] + m_Entities.size() );
+	}
+
+	TUInt32 Size()
+	{
+		return static_cast<TUInt32>(m_Entities.size());
+	}
+
+	CEntity* GetEntity( TUInt32 position )
+	{
+		return m_Entities[position];
+	}
+
+	// Add an entity to the list, it must not already be in a list for this index
+	void Add( CEntity* entity );
+
+	// Remove an entity from the list
+	void Remove( CEntity* entity );
+
+	// Empty the list without updating the entities - only for use when all entities are
+	// being destroyed
+	void Clear()
+	{
+		m_Entities.clear();
+	}
+
+
+/////////////////////////////////////
+//	Private interface
+private:
+	EEntityIndex     m_Index;
+	vector<CEntity*> m_Entities;
+};
+
+
+// Index of entity lists by name atom - used by the entity manager and walked by queries
+typedef unordered_map<TAtom, CEntityList*> TNameIndex;
+typedef TNameIndex::iterator TNameIndexIter;
+
+
+} // namespace gen
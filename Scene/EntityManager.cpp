@@ -5,23 +5,81 @@
 	destruction
 ********************************************/
 
+#include <new>
+#include <cstdio>
+#include <cstring>
+using namespace std;
+
 #include "EntityManager.h"
+#include "MappedFile.h"
+#include "Messenger.h"
 
 namespace gen
 {
 
+// Messages sent during a parallel update are buffered by the messenger
+extern CMessenger Messenger;
+
+// Number of entities updated together in each job of a parallel update
+static const TUInt32 kUpdateGrainSize = 64;
+
+// Number of rows given to a worker at a time in a parallel transform pass. Most rows are
+// skipped quickly, so chunks are larger than for updates
+static const TUInt32 kTransformGrainSize = 256;
+
+// Number of visible entities given to a worker at a time when recording render commands
+static const TUInt32 kRenderGrainSize = 64;
+
+// Snapshot index meaning no snapshot, for pipelined rendering
+static const TUInt32 kNoSnapshot = 0xffffffff;
+
 /////////////////////////////////////
 // Constructors/Destructors
 
-// Constructor reserves space for entities and UID hash map, also sets first UID
-CEntityManager::CEntityManager()
+// Constructor creates the entity archetypes and pools, and reserves space for entities and UIDs
+CEntityManager::CEntityManager() : m_MatrixArena( 256 ), m_RenderThread( 1 )
 {
-	// Initialise list of entities and UID hash map
-	m_Entities.reserve( 1024 );
-	m_EntityUIDMap = new CHashTable<TEntityUID, TUInt32>( 2048, JOneAtATimeHash ); 
-
-	// Set first entity UID that will be used
-	m_NextUID = 0;
+	// Create an archetype for each kind of entity
+	m_Archetypes[Kind_Base] = new CEntityArchetype( Kind_Base, &m_MatrixArena, false ); // No update
+	m_Archetypes[Kind_Tank] = new CTankArchetype( &m_MatrixArena );
+	m_Archetypes[Kind_Shell] = new CShellArchetype( &m_MatrixArena );
+	m_Archetypes[Kind_Ammo] = new CEntityArchetype( Kind_Ammo, &m_MatrixArena );
+
+	// Create a pool for the entity objects of each kind
+	m_EntityPools[Kind_Base] = new CPoolAllocator( sizeof(CEntity), 256 );
+	m_EntityPools[Kind_Tank] = new CPoolAllocator( sizeof(CTankEntity), 64 );
+	m_EntityPools[Kind_Shell] = new CPoolAllocator( sizeof(CShellEntity), 1024 );
+	m_EntityPools[Kind_Ammo] = new CPoolAllocator( sizeof(CAmmoEntity), 256 );
+
+	// Initialise entity storage and UID slots
+	m_Archetypes[Kind_Base]->Reserve( 256 );
+	m_Archetypes[Kind_Tank]->Reserve( 256 );
+	m_Archetypes[Kind_Shell]->Reserve( 1024 );
+	m_Archetypes[Kind_Ammo]->Reserve( 256 );
+	m_EntitySlots.Reserve( 2048 );
+
+	m_NumLiveQueries = 0;
+	m_IsUpdating = false;
+	m_ParallelUpdate = false;
+	m_InParallelUpdate = false;
+	m_UpdateFrame = 0;
+	m_UpdateClock = 0.0;
+	m_WakeClock = 0.0;
+	for (TUInt32 kind = 0; kind < NumEntityKinds; ++kind)
+	{
+		m_AwakeLists[kind] = new CEntityList( Index_Awake );
+	}
+	m_NumRenderedEntities = 0;
+	m_RenderBackend = 0;
+	for (TUInt32 worker = 0; worker < m_Jobs.NumWorkers(); ++worker)
+	{
+		m_WorkerCommands.push_back( new CRenderCommandList );
+	}
+	m_PipelinedRender = false;
+	m_PublishedSnapshot = kNoSnapshot;
+	m_RenderingSnapshot = kNoSnapshot;
+	RefillSnapshots();
+	m_WorkerSnapshotChanges.resize( m_Jobs.NumWorkers() );
 
 	m_IsEnumerating = false;
 }
@@ -30,7 +88,30 @@ CEntityManager::CEntityManager()
 CEntityManager::~CEntityManager()
 {
 	DestroyAllEntities();
-	delete m_EntityUIDMap;
+	for (TUInt32 kind = 0; kind < NumEntityKinds; ++kind)
+	{
+		delete m_Archetypes[kind];
+		delete m_EntityPools[kind];
+		delete m_AwakeLists[kind];
+	}
+	for (TUInt32 worker = 0; worker < m_WorkerCommands.size(); ++worker)
+	{
+		delete m_WorkerCommands[worker];
+	}
+
+	// Delete index lists
+	for (TUInt32 type = 0; type < m_TypeIndex.size(); ++type)
+	{
+		delete m_TypeIndex[type];
+	}
+	for (TUInt32 team = 0; team < m_TeamIndex.size(); ++team)
+	{
+		delete m_TeamIndex[team];
+	}
+	for (TNameIndexIter nameList = m_NameIndex.begin(); nameList != m_NameIndex.end(); ++nameList)
+	{
+		delete nameList->second;
+	}
 }
 
 
@@ -42,10 +123,10 @@ CEntityManager::~CEntityManager()
 CEntityTemplate* CEntityManager::CreateTemplate( const string& type, const string& name, const string& mesh )
 {
 	// Create new entity template
-	CEntityTemplate* newTemplate = new CEntityTemplate( type, name, mesh );
+	CEntityTemplate* newTemplate = new CEntityTemplate( type, name, mesh, &m_MeshCache );
 
-	// Add the template name / template pointer pair to the map
-    m_Templates[name] = newTemplate;
+	// Add the template pointer to the list entry for its name
+	AddTemplate( newTemplate );
 
 	return newTemplate;
 }
@@ -58,257 +139,1863 @@ CTankTemplate* CEntityManager::CreateTankTemplate(const string& type, const stri
 	float turretTurnSpeed, int maxHP, int startAmmo, int shellDamage)
 {
 	// Create new tank template
-	CTankTemplate* newTemplate = new CTankTemplate(type, name, mesh, maxSpeed, acceleration,
+	CTankTemplate* newTemplate = new CTankTemplate(type, name, mesh, &m_MeshCache, maxSpeed, acceleration,
 		turnSpeed, turretTurnSpeed, maxHP, startAmmo ,shellDamage);
 
-	// Add the template name / template pointer pair to the map
-	m_Templates[name] = newTemplate;
+	// Add the template pointer to the list entry for its name
+	AddTemplate(newTemplate);
 
 	return newTemplate;
 }
 
+// Start creating a base entity template with the given type, name and mesh. The mesh is loaded
+// on a worker thread and the template is added to the manager by UpdateTemplateLoads once it
+// has loaded. Returns an object to check the progress of the load
+TTemplateLoad CEntityManager::CreateTemplateAsync( const string& type, const string& name,
+                                                   const string& mesh )
+{
+	TTemplateLoadsIter existing = m_TemplateLoads.find( FindAtom( name ) );
+	if (existing != m_TemplateLoads.end())
+	{
+		return existing->second;
+	}
+
+	TTemplateLoad load( new CTemplateLoad( Kind_Base, type, name, mesh ) );
+	StartTemplateLoad( load );
+	return load;
+}
+
+// Start creating a tank template with the given type, name, mesh and stats. As above
+TTemplateLoad CEntityManager::CreateTankTemplateAsync( const string& type, const string& name,
+                                                       const string& mesh, float maxSpeed,
+                                                       float acceleration, float turnSpeed,
+                                                       float turretTurnSpeed, int maxHP,
+                                                       int startAmmo, int shellDamage )
+{
+	TTemplateLoadsIter existing = m_TemplateLoads.find( FindAtom( name ) );
+	if (existing != m_TemplateLoads.end())
+	{
+		return existing->second;
+	}
+
+	TTemplateLoad load( new CTemplateLoad( Kind_Tank, type, name, mesh ) );
+	load->m_MaxSpeed = maxSpeed;
+	load->m_Acceleration = acceleration;
+	load->m_TurnSpeed = turnSpeed;
+	load->m_TurretTurnSpeed = turretTurnSpeed;
+	load->m_MaxHP = maxHP;
+	load->m_StartAmmo = startAmmo;
+	load->m_ShellDamage = shellDamage;
+	StartTemplateLoad( load );
+	return load;
+}
+
+// Record a new asynchronous template load and start loading its mesh, unless the mesh is
+// already loaded or being loaded by another template
+void CEntityManager::StartTemplateLoad( const TTemplateLoad& load )
+{
+	m_TemplateLoads[InternAtom( load->m_Name )] = load;
+
+	if (m_MeshCache.IsCached( load->m_MeshFilename ))
+	{
+		// Nothing to load, the template is created on the next UpdateTemplateLoads
+		load->m_State = TemplateLoad_Loaded;
+		return;
+	}
+
+	// If another template is loading the same mesh file, this load waits for that one rather
+	// than loading a second copy (see FinishTemplateLoad)
+	string meshPath = CMeshCache::CanonicalPath( load->m_MeshFilename );
+	for (TTemplateLoadsIter other = m_TemplateLoads.begin(); other != m_TemplateLoads.end(); ++other)
+	{
+		CTemplateLoad* otherLoad = other->second.get();
+		if (otherLoad != load.get() && otherLoad->m_MeshLoad == 0 &&
+		    CMeshCache::CanonicalPath( otherLoad->m_MeshFilename ) == meshPath)
+		{
+			load->m_MeshLoad = other->second;
+			return;
+		}
+	}
+
+	// The worker's copy of the shared pointer keeps the load alive until the mesh has loaded
+	m_Workers.Submit( bind( &CTemplateLoad::LoadMesh, load ) );
+}
+
+
+// Add templates whose meshes have finished loading to the manager and create any entities
+// waiting for them
+void CEntityManager::UpdateTemplateLoads()
+{
+	TTemplateLoadsIter load = m_TemplateLoads.begin();
+	while (load != m_TemplateLoads.end())
+	{
+		if (FinishTemplateLoad( load->second.get() ))
+		{
+			load = m_TemplateLoads.erase( load );
+		}
+		else
+		{
+			++load;
+		}
+	}
+}
+
+// Wait for all template loads to finish, then add the templates as UpdateTemplateLoads
+void CEntityManager::WaitForTemplateLoads()
+{
+	m_Workers.WaitIdle();
+	UpdateTemplateLoads();
+}
+
+// Create the template for a load whose mesh is available (or fail it), then create or cancel
+// the entities queued for it. Returns false if the load must wait
+bool CEntityManager::FinishTemplateLoad( CTemplateLoad* load )
+{
+	// Wait for the mesh, which may be loaded by another load using the same file. The state is
+	// read once as the worker thread may change it
+	CTemplateLoad* meshLoad = load->m_MeshLoad ? load->m_MeshLoad.get() : load;
+	ETemplateLoadState meshState = meshLoad->m_State;
+	if (meshState == TemplateLoad_Pending)
+	{
+		return false;
+	}
+
+	// Give a newly loaded mesh to the mesh cache, where the template constructor (and any other
+	// template using the same file) will find it
+	if (meshState == TemplateLoad_Loaded && meshLoad->m_Mesh)
+	{
+		m_MeshCache.AddLoaded( meshLoad->m_MeshFilename, meshLoad->m_Mesh );
+		meshLoad->m_Mesh = 0;
+	}
+
+	if (load->m_MeshLoad)
+	{
+		// Take the result of the load that loaded the mesh
+		if (meshState == TemplateLoad_Failed)
+		{
+			load->m_Error = meshLoad->m_Error;
+			load->m_State = TemplateLoad_Failed;
+		}
+		else
+		{
+			load->m_State = TemplateLoad_Loaded;
+		}
+		load->m_MeshLoad.reset();
+	}
+
+	if (load->m_State == TemplateLoad_Loaded)
+	{
+		// The mesh is in the cache now so the template constructor will not load it. It could
+		// still fail if the mesh has been evicted since, in which case it is loaded again here
+		try
+		{
+			CEntityTemplate* newTemplate;
+			if (load->m_Kind == Kind_Tank)
+			{
+				newTemplate = new CTankTemplate( load->m_Type, load->m_Name, load->m_MeshFilename,
+				                                 &m_MeshCache, load->m_MaxSpeed, load->m_Acceleration,
+				                                 load->m_TurnSpeed, load->m_TurretTurnSpeed,
+				                                 load->m_MaxHP, load->m_StartAmmo, load->m_ShellDamage );
+			}
+			else
+			{
+				newTemplate = new CEntityTemplate( load->m_Type, load->m_Name, load->m_MeshFilename,
+				                                   &m_MeshCache );
+			}
+			AddTemplate( newTemplate );
+			load->m_Template = newTemplate;
+			load->m_State = TemplateLoad_Ready;
+		}
+		catch (const CMeshLoadError& error)
+		{
+			load->m_Error = error.what();
+			load->m_State = TemplateLoad_Failed;
+		}
+	}
+
+	// Create the entities waiting for this template, unless they have been destroyed since.
+	// If the template failed their reserved UIDs are freed
+	for (TUInt32 create = 0; create < load->m_QueuedCreates.size(); ++create)
+	{
+		SCreateCommand& command = load->m_QueuedCreates[create];
+		if (!m_EntitySlots.IsReserved( command.UID ))
+		{
+			continue;
+		}
+		if (load->m_State == TemplateLoad_Failed)
+		{
+			m_EntitySlots.FreeUID( command.UID );
+			continue;
+		}
+
+		command.entityTemplate = load->m_Template;
+		if (IsDeferring())
+		{
+			m_Commands.Create( command );
+		}
+		else
+		{
+			ConstructEntity( command );
+		}
+	}
+	load->m_QueuedCreates.clear();
+	return true;
+}
+
+
+// Add a new template to the template list, in the entry for its name atom
+void CEntityManager::AddTemplate( CEntityTemplate* newTemplate )
+{
+	TAtom name = newTemplate->GetNameAtom();
+	if (name >= m_Templates.size())
+	{
+		m_Templates.resize( name + 1, 0 );
+	}
+	m_Templates[name] = newTemplate;
+}
+
 // Destroy the given template (name) - returns true if the template existed and was destroyed
 bool CEntityManager::DestroyTemplate( const string& name )
 {
-	// Find the template name in the template map
-	TTemplateIter entityTemplate = m_Templates.find( name );
-	if (entityTemplate == m_Templates.end())
+	// Find the template name in the template list
+	CEntityTemplate* entityTemplate = GetTemplate( name );
+	if (!entityTemplate)
 	{
 		// Not found
 		return false;
 	}
 
-	// Delete the template and remove the map entry
-	delete entityTemplate->second;
-	m_Templates.erase( entityTemplate );
+	// Delete the template and clear the list entry. Its mesh may be in a render snapshot
+	DiscardSnapshots();
+	m_Templates[entityTemplate->GetNameAtom()] = 0;
+	delete entityTemplate;
 	return true;
 }
 
 // Destroy all templates held by the manager
 void CEntityManager::DestroyAllTemplates()
 {
-	while (m_Templates.size())
+	DiscardSnapshots();
+	for (TUInt32 name = 0; name < m_Templates.size(); ++name)
 	{
-		TTemplateIter entityTemplate = m_Templates.begin();
-		while (entityTemplate != m_Templates.end())
-		{
-			delete entityTemplate->second;
-			++entityTemplate;
-		};
-		m_Templates.clear();
+		delete m_Templates[name];
 	}
+	m_Templates.clear();
 }
 
 
 /////////////////////////////////////
 // Entity creation / destruction
 
-// Create a base class entity - requires a template name, may supply entity name and position
-// Returns the UID of the new entity
+// Create a base class entity from a resolved template, may supply entity name and position
+// Returns the UID of the new entity, or SystemUID if the template handle is invalid
 TEntityUID CEntityManager::CreateEntity
 (
-	const string&    templateName,
-	const string&    name /*= ""*/,
+	const TEntityTemplateHandle& entityTemplate,
+	TAtom            name /*= kNoAtom*/,
 	const CVector3&  position /*= CVector3::kOrigin*/, 
 	const CVector3&  rotation /*= CVector3( 0.0f, 0.0f, 0.0f )*/,
 	const CVector3&  scale /*= CVector3( 1.0f, 1.0f, 1.0f )*/
 )
 {
-	// Get template associated with the template name
-	CEntityTemplate* entityTemplate = GetTemplate( templateName );
-
-	// Create new entity with next UID
-	CEntity* newEntity = new CEntity( entityTemplate, m_NextUID, name, position, rotation, scale );
-
-	// Get vector index for new entity and add it to vector
-	TUInt32 entityIndex = static_cast<TUInt32>(m_Entities.size());
-	m_Entities.push_back( newEntity );
-
-	// Add mapping from UID to entity index into hash map
-	m_EntityUIDMap->SetKeyValue( m_NextUID, entityIndex );
-	
-	m_IsEnumerating = false; // Cancel any entity enumeration (entity list has changed)
+	if (!entityTemplate.IsValid())
+	{
+		return SystemUID;
+	}
 
-	// Return UID of new entity then increase it ready for next entity
-	return m_NextUID++;
+	SCreateCommand command;
+	command.kind = Kind_Base;
+	command.entityTemplate = entityTemplate.Get();
+	command.name = name;
+	command.position = position;
+	command.rotation = rotation;
+	command.scale = scale;
+	command.team = 0;
+	command.shooter = SystemUID;
+
+	// Create new entity (or defer its creation) and return its UID
+	return SubmitCreate( command );
 }
 
 
-// Create a tank, requires a tank template name and team number, may supply entity name and
-// position. Returns the UID of the new entity
+// Create a tank from a resolved tank template, requires a team number, may supply entity name
+// and position. Returns the UID of the new entity, or SystemUID if the template handle is invalid
 TEntityUID CEntityManager::CreateTank
 (
-	const string&   templateName,
+	const TTankTemplateHandle& tankTemplate,
 	TUInt32         team,
-	const string&   name /*= ""*/,
+	TAtom           name /*= kNoAtom*/,
 	const CVector3& position /*= CVector3::kOrigin*/,
 	const CVector3& rotation /*= CVector3( 0.0f, 0.0f, 0.0f )*/,
 	const CVector3& scale /*= CVector3( 1.0f, 1.0f, 1.0f )*/
 	)
 {
-	// Get tank template associated with the template name
-	// This will cause an error if the template is not a tank type
-	CTankTemplate* tankTemplate = static_cast<CTankTemplate*>(GetTemplate(templateName));
-
-	// Create new tank entity with next UID
-	CEntity* newEntity = new CTankEntity(tankTemplate, m_NextUID, team, name, position, rotation, scale);
-
-	// Get vector index for new entity and add it to vector
-	TUInt32 entityIndex = static_cast<int>(m_Entities.size());
-	m_Entities.push_back(newEntity);
-
-	// Add mapping from UID to entity index into hash map
-	m_EntityUIDMap->SetKeyValue(m_NextUID, entityIndex);
-
-	m_IsEnumerating = false; // Cancel any entity enumeration (entity list has changed)
+	// The handle has already checked that the template is a tank template
+	if (!tankTemplate.IsValid())
+	{
+		return SystemUID;
+	}
 
-							 // Return UID of new entity then increase it ready for next entity
-	return m_NextUID++;
+	SCreateCommand command;
+	command.kind = Kind_Tank;
+	command.entityTemplate = tankTemplate.Get();
+	command.name = name;
+	command.position = position;
+	command.rotation = rotation;
+	command.scale = scale;
+	command.team = team;
+	command.shooter = SystemUID;
+
+	// Create new tank entity (or defer its creation) and return its UID
+	return SubmitCreate(command);
 }
 
 
-// Create a shell, requires a shell template name, may supply entity name and position
-// Returns the UID of the new entity
+// Create a shell from a resolved template, may supply entity name and position
+// Returns the UID of the new entity, or SystemUID if the template handle is invalid
 TEntityUID CEntityManager::CreateShell
 (
-	const string&   templateName,
-	TEntityUID       ShooterUID,
-	const string&   name /*= ""*/,
+	const TShellTemplateHandle& shellTemplate,
+	TEntityUID      ShooterUID,
+	TAtom           name /*= kNoAtom*/,
 	const CVector3& position /*= CVector3::kOrigin*/,
 	const CVector3& rotation /*= CVector3( 0.0f, 0.0f, 0.0f )*/,
 	const CVector3& scale /*= CVector3( 1.0f, 1.0f, 1.0f )*/
 	)
 {
-	// Get template associated with the template name
-	CEntityTemplate* entityTemplate = GetTemplate(templateName);
-
-	// Create new tank entity with next UID
-	CEntity* newEntity = new CShellEntity(entityTemplate, m_NextUID, ShooterUID, 
-		name, position, rotation, scale);
-
-	// Get vector index for new entity and add it to vector
-	TUInt32 entityIndex = static_cast<int>(m_Entities.size());
-	m_Entities.push_back(newEntity);
-
-	// Add mapping from UID to entity index into hash map
-	m_EntityUIDMap->SetKeyValue(m_NextUID, entityIndex);
-
-	m_IsEnumerating = false; // Cancel any entity enumeration (entity list has changed)
+	if (!shellTemplate.IsValid())
+	{
+		return SystemUID;
+	}
 
-							 // Return UID of new entity then increase it ready for next entity
-	return m_NextUID++;
+	SCreateCommand command;
+	command.kind = Kind_Shell;
+	command.entityTemplate = shellTemplate.Get();
+	command.name = name;
+	command.position = position;
+	command.rotation = rotation;
+	command.scale = scale;
+	command.team = 0;
+	command.shooter = ShooterUID;
+
+	// Create new shell entity (or defer its creation) and return its UID
+	return SubmitCreate(command);
 }
 
 
 
-// Create a shell, requires a shell template name, may supply entity name and position
-// Returns the UID of the new entity
+// Create an ammo box from a resolved template, may supply entity name and position
+// Returns the UID of the new entity, or SystemUID if the template handle is invalid
 TEntityUID CEntityManager::CreateAmmo
 (
-	const string& templateName,
+	const TAmmoTemplateHandle& ammoTemplate,
 	TEntityUID    ShooterUID,
-	const string& name /*= ""*/,
+	TAtom         name /*= kNoAtom*/,
 	const CVector3& position /*= CVector3::kOrigin*/,
 	const CVector3& rotation /*= CVector3( 0.0f, 0.0f, 0.0f )*/,
 	const CVector3& scale /*= CVector3( 1.0f, 1.0f, 1.0f )*/
 )
 {
-	// Get template associated with the template name
-	CEntityTemplate* entityTemplate = GetTemplate(templateName);
+	if (!ammoTemplate.IsValid())
+	{
+		return SystemUID;
+	}
+
+	SCreateCommand command;
+	command.kind = Kind_Ammo;
+	command.entityTemplate = ammoTemplate.Get();
+	command.name = name;
+	command.position = position;
+	command.rotation = rotation;
+	command.scale = scale;
+	command.team = 0;
+	command.shooter = ShooterUID;
+
+	// Create new ammo entity (or defer its creation) and return its UID
+	return SubmitCreate(command);
+}
+
+
+// Create a number of tanks from one tank template in a single operation. The position, rotation
+// and team of each tank are taken from the given arrays (rotations may be 0 for no rotation).
+// The UIDs of the new tanks are written to the UIDs array if one is given. Returns the number
+// of tanks created, 0 if the handle is invalid or there are not enough UIDs left
+TUInt32 CEntityManager::CreateTanks
+(
+	const TTankTemplateHandle& tankTemplate,
+	TUInt32         numTanks,
+	const CVector3* positions,
+	const CVector3* rotations,
+	const TUInt32*  teams,
+	TEntityUID*     UIDs /*= 0*/
+)
+{
+	if (!tankTemplate.IsValid() || numTanks == 0)
+	{
+		return 0;
+	}
+
+	SCreateCommand command;
+	command.kind = Kind_Tank;
+	command.entityTemplate = tankTemplate.Get();
+	command.name = kNoAtom;
+	command.rotation = CVector3( 0.0f, 0.0f, 0.0f );
+	command.scale = CVector3( 1.0f, 1.0f, 1.0f );
+	command.team = 0;
+	command.shooter = SystemUID;
+	return SubmitCreates( command, numTanks, positions, rotations, teams, UIDs ) ? numTanks : 0;
+}
+
+
+// Create a number of shells from one template in a single operation, all fired by the same
+// entity. Other parameters are as for CreateTanks
+TUInt32 CEntityManager::CreateShells
+(
+	const TShellTemplateHandle& shellTemplate,
+	TUInt32         numShells,
+	TEntityUID      ShooterUID,
+	const CVector3* positions,
+	const CVector3* rotations,
+	TEntityUID*     UIDs /*= 0*/
+)
+{
+	if (!shellTemplate.IsValid() || numShells == 0)
+	{
+		return 0;
+	}
 
-	// Create new tank entity with next UID
-	CEntity* newEntity = new CAmmoEntity(entityTemplate, m_NextUID,
-		name, position, rotation, scale);
+	SCreateCommand command;
+	command.kind = Kind_Shell;
+	command.entityTemplate = shellTemplate.Get();
+	command.name = kNoAtom;
+	command.rotation = CVector3( 0.0f, 0.0f, 0.0f );
+	command.scale = CVector3( 1.0f, 1.0f, 1.0f );
+	command.team = 0;
+	command.shooter = ShooterUID;
+	return SubmitCreates( command, numShells, positions, rotations, 0, UIDs ) ? numShells : 0;
+}
 
-	// Get vector index for new entity and add it to vector
-	TUInt32 entityIndex = static_cast<int>(m_Entities.size());
-	m_Entities.push_back(newEntity);
 
-	// Add mapping from UID to entity index into hash map
-	m_EntityUIDMap->SetKeyValue(m_NextUID, entityIndex);
+// Queue the creation of an entity using the given template name if that template is being
+// loaded, returning the entity's reserved UID. Returns SystemUID if the template is not loading
+// (or is the wrong class for the entity kind)
+TEntityUID CEntityManager::QueueCreate( EEntityKind kind, TAtom templateName, TAtom name,
+                                        const CVector3& position, const CVector3& rotation,
+                                        const CVector3& scale, TUInt32 team, TEntityUID shooter )
+{
+	unique_lock<mutex> lock( m_ParallelMutex, defer_lock );
+	if (m_InParallelUpdate)
+	{
+		lock.lock();
+	}
 
-	m_IsEnumerating = false; // Cancel any entity enumeration (entity list has changed)
+	TTemplateLoadsIter load = m_TemplateLoads.find( templateName );
+	if (load == m_TemplateLoads.end() || (kind != Kind_Base && (kind == Kind_Tank) != (load->second->m_Kind == Kind_Tank)))
+	{
+		return SystemUID;
+	}
 
-							 // Return UID of new entity then increase it ready for next entity
-	return m_NextUID++;
+	SCreateCommand command;
+	command.kind = kind;
+	command.entityTemplate = 0; // Set when the template is ready
+	command.UID = m_EntitySlots.AllocateUID();
+	if (command.UID == SystemUID)
+	{
+		return SystemUID;
+	}
+	command.name = name;
+	command.position = position;
+	command.rotation = rotation;
+	command.scale = scale;
+	command.team = team;
+	command.shooter = shooter;
+	load->second->m_QueuedCreates.push_back( command );
+	return command.UID;
 }
 
 
+// Allocate a UID for the entity described by the given command (UID is filled in) and
+// create it, or record the command if creation must be deferred. Returns the new UID, or
+// SystemUID if no UID is left
+TEntityUID CEntityManager::SubmitCreate( SCreateCommand& command )
+{
+	unique_lock<mutex> lock( m_ParallelMutex, defer_lock );
+	if (m_InParallelUpdate)
+	{
+		lock.lock();
+	}
 
+	command.UID = m_EntitySlots.AllocateUID();
+	if (command.UID == SystemUID)
+	{
+		return SystemUID;
+	}
+	if (IsDeferring())
+	{
+		// The UID stays reserved, with no entity, until the command is carried out
+		m_Commands.Create( command );
+	}
+	else
+	{
+		ConstructEntity( command );
+	}
+	return command.UID;
+}
 
-// Destroy the given entity - returns true if the entity existed and was destroyed
-bool CEntityManager::DestroyEntity( TEntityUID UID )
+// Create a batch of entities described by the given command, which has the parameters shared
+// by the batch. Positions and any rotations and teams are given per entity. UIDs are allocated
+// for the whole batch at once and storage is grown once before the entities are created, or
+// the creations are recorded if they must be deferred. Returns false, creating nothing, if
+// there are not enough UIDs left for the batch
+bool CEntityManager::SubmitCreates( SCreateCommand& command, TUInt32 numEntities,
+                                    const CVector3* positions, const CVector3* rotations,
+                                    const TUInt32* teams, TEntityUID* UIDs )
 {
-	// Find the vector index of the given UID
-	TUInt32 entityIndex;
-	if (!m_EntityUIDMap->LookUpKey( UID, &entityIndex ))
+	unique_lock<mutex> lock( m_ParallelMutex, defer_lock );
+	if (m_InParallelUpdate)
+	{
+		lock.lock();
+	}
+
+	if (!UIDs)
+	{
+		m_BatchUIDs.resize( numEntities );
+		UIDs = &m_BatchUIDs[0];
+	}
+	if (!m_EntitySlots.AllocateUIDs( numEntities, UIDs ))
 	{
-		// Quit if not found
 		return false;
 	}
 
-	// Delete the given entity and remove from UID map
-	delete m_Entities[entityIndex];
-	m_EntityUIDMap->RemoveKey( UID );
+	bool deferring = IsDeferring();
+	if (deferring)
+	{
+		m_Commands.ReserveCreates( numEntities );
+	}
+	else
+	{
+		// Grow the archetype columns and the entity pool once for the whole batch
+		CEntityArchetype* archetype = m_Archetypes[command.kind];
+		archetype->ReserveExtra( numEntities );
+		m_EntityPools[command.kind]->Reserve( archetype->NumRows() + numEntities );
+	}
+
+	for (TUInt32 entity = 0; entity < numEntities; ++entity)
+	{
+		command.UID = UIDs[entity];
+		command.position = positions[entity];
+		if (rotations)
+		{
+			command.rotation = rotations[entity];
+		}
+		if (teams)
+		{
+			command.team = teams[entity];
+		}
+
+		if (deferring)
+		{
+			m_Commands.Create( command );
+		}
+		else
+		{
+			ConstructEntity( command );
+		}
+	}
+	return true;
+}
+
+// Create the entity described by the given command, its UID has already been allocated
+void CEntityManager::ConstructEntity( const SCreateCommand& command )
+{
+	// Create the entity of the correct class in the pool for its kind, it adds itself to the
+	// archetype for its kind
+	void* memory = m_EntityPools[command.kind]->Allocate();
+	CEntity* newEntity;
+	switch (command.kind)
+	{
+		case Kind_Tank:
+		{
+			CTankArchetype* tankArchetype = static_cast<CTankArchetype*>(m_Archetypes[Kind_Tank]);
+			newEntity = new (memory) CTankEntity( static_cast<CTankTemplate*>(command.entityTemplate),
+			                                      command.UID, tankArchetype, command.team, command.name,
+			                                      command.position, command.rotation, command.scale );
+			AddToTeamIndex( newEntity, command.team );
+			break;
+		}
+		case Kind_Shell:
+		{
+			CShellArchetype* shellArchetype = static_cast<CShellArchetype*>(m_Archetypes[Kind_Shell]);
+			newEntity = new (memory) CShellEntity( command.entityTemplate, command.UID, shellArchetype,
+			                                       command.shooter, command.name,
+			                                       command.position, command.rotation, command.scale );
+			break;
+		}
+		case Kind_Ammo:
+		{
+			newEntity = new (memory) CAmmoEntity( command.entityTemplate, command.UID, m_Archetypes[Kind_Ammo],
+			                                      command.name, command.position, command.rotation, command.scale );
+			break;
+		}
+		default:
+		{
+			newEntity = new (memory) CEntity( command.entityTemplate, command.UID, m_Archetypes[Kind_Base],
+			                                  command.name, command.position, command.rotation, command.scale );
+			break;
+		}
+	}
 
-	// If not removing last entity...
-	if (entityIndex != m_Entities.size() - 1)
+	// First update will be passed the time from now. New entities are awake
+	m_Archetypes[command.kind]->UpdateSchedule( newEntity->m_Row ).lastUpdateTime = m_UpdateClock;
+	if (m_Archetypes[command.kind]->IsUpdated())
 	{
-		// ...put the last entity into the empty entity slot and update UID map
-		m_Entities[entityIndex] = m_Entities.back();
-		m_EntityUIDMap->SetKeyValue( m_Entities.back()->GetUID(), entityIndex );
+		m_AwakeLists[command.kind]->Add( newEntity );
 	}
-	m_Entities.pop_back(); // Remove last entity
+
+	// Store the new entity in its UID slot and index it
+	m_EntitySlots.SetEntity( command.UID, newEntity );
+	AddToTypeIndex( newEntity );
+	AddToNameIndex( newEntity );
 
 	m_IsEnumerating = false; // Cancel any entity enumeration (entity list has changed)
-	return true;
 }
 
 
-// Destroy all entities held by the manager
-void CEntityManager::DestroyAllEntities()
+
+
+// Destroy the given entity - returns true if the entity existed and was destroyed
+// During update or while any entity queries are alive, the entity is marked as destroyed and
+// its UID freed, but it is not deleted until the deferred commands are carried out. Destroying
+// an entity whose creation has been deferred cancels the creation
+bool CEntityManager::DestroyEntity( TEntityUID UID )
 {
-	m_EntityUIDMap->RemoveAllKeys();
-	while (m_Entities.size())
+	if (m_InParallelUpdate)
+	{
+		// Other threads are updating entities, so only record the destruction for now. It is
+		// made when the threads have finished
+		lock_guard<mutex> lock( m_ParallelMutex );
+		if (!m_EntitySlots.GetEntity( UID ) && !m_EntitySlots.IsReserved( UID ))
+		{
+			return false;
+		}
+		m_ParallelDestroys.push_back( UID );
+		return true;
+	}
+
+	// Find the entity with the given UID
+	CEntity* entity = m_EntitySlots.GetEntity( UID );
+	if (!entity)
 	{
-		delete m_Entities.back();
-		m_Entities.pop_back();
+		// Freeing the UID of a deferred creation cancels it, otherwise quit if not found (or
+		// a stale UID)
+		return m_EntitySlots.IsReserved( UID ) && m_EntitySlots.FreeUID( UID );
+	}
+
+	// Free the entity's UID slot - the entity can no longer be looked up
+	m_EntitySlots.FreeUID( UID );
+
+	if (IsDeferring())
+	{
+		// Updates or queries may be walking the archetype and index lists so they must not
+		// change yet. Both skip destroyed entities
+		entity->m_IsDestroyed = true;
+		m_Commands.Destroy( entity );
+	}
+	else
+	{
+		// Safe to delete now, also catch up with any earlier deferred commands
+		FlushCommands();
+
+		// Delete the given entity. The entity removes itself from its archetype, the last
+		// entity in that archetype is moved into the empty row
+		RemoveFromIndices( entity );
+		DeleteEntity( entity );
 	}
 
 	m_IsEnumerating = false; // Cancel any entity enumeration (entity list has changed)
+	return true;
 }
 
 
-/////////////////////////////////////
-// Update / Rendering
-
-// Call all entity update functions. Pass the time since last update
-void CEntityManager::UpdateAllEntities( float updateTime )
+// Destroy all entities held by the manager. Must not be called while queries are alive
+void CEntityManager::DestroyAllEntities()
 {
-	TUInt32 entity = 0;
-	while (entity < m_Entities.size())
+	m_Commands.Clear(); // Destroyed entities are deleted with the rest below
+	m_EntitySlots.FreeAllUIDs();
+	for (TUInt32 type = 0; type < m_TypeIndex.size(); ++type)
 	{
-		// Update entity, if it returns false, then destroy it
-		if (!m_Entities[entity]->Update( updateTime ))
+		if (m_TypeIndex[type])
 		{
-			DestroyEntity(m_Entities[entity]->GetUID());
+			m_TypeIndex[type]->Clear();
 		}
-		else
+	}
+	for (TUInt32 team = 0; team < m_TeamIndex.size(); ++team)
+	{
+		m_TeamIndex[team]->Clear();
+	}
+	for (TNameIndexIter nameList = m_NameIndex.begin(); nameList != m_NameIndex.end(); ++nameList)
+	{
+		delete nameList->second;
+	}
+	m_NameIndex.clear();
+	m_SpatialGrid.Clear();
+	m_SleepChanges.clear();
+	m_WakeTimers = TWakeTimers();
+	RefillSnapshots();
+	for (TUInt32 kind = 0; kind < NumEntityKinds; ++kind)
+	{
+		m_AwakeLists[kind]->Clear();
+		m_Archetypes[kind]->MovedEntities().Clear();
+		m_Archetypes[kind]->DirtyEntities().Clear();
+
+		// Delete from the end of each archetype so no rows need to be moved
+		CEntityArchetype* archetype = m_Archetypes[kind];
+		while (archetype->NumRows())
 		{
-			++entity;
+			DeleteEntity( archetype->GetEntity( archetype->NumRows() - 1 ) );
 		}
 	}
+
+	m_IsEnumerating = false; // Cancel any entity enumeration (entity list has changed)
 }
 
-// Render all entities
-void CEntityManager::RenderAllEntities()
+
+// Destruct the given entity and return its memory to the pool for its kind
+void CEntityManager::DeleteEntity( CEntity* entity )
+{
+	CPoolAllocator* entityPool = m_EntityPools[entity->GetKind()];
+	entity->~CEntity();
+	entityPool->Free( entity );
+}
+
+
+/////////////////////////////////////
+// Snapshots
+
+// Round a snapshot file offset up to the section alignment
+static TUInt32 AlignSnapshotOffset( TUInt32 offset )
+{
+	return (offset + kSnapshotAlignment - 1) & ~(kSnapshotAlignment - 1);
+}
+
+// Set the position of a snapshot section following the given offset, returns the offset after it
+static TUInt32 PlaceSnapshotSection( SSnapshotSection& section, TUInt32 offset, TUInt32 size )
+{
+	section.offset = AlignSnapshotOffset( offset );
+	section.size = size;
+	return section.offset + size;
+}
+
+// Write a snapshot section at its position in the file, padding up to it from the current position
+static bool WriteSnapshotSection( FILE* file, const SSnapshotSection& section, const void* data )
 {
-	TEntityIter entity = m_Entities.begin();
-	while (entity != m_Entities.end())
+	static const TUInt8 padding[kSnapshotAlignment] = { 0 };
+	long position = ftell( file );
+	if (position < 0 || static_cast<TUInt32>(position) > section.offset)
 	{
-		(*entity)->Render();
-		++entity;
+		return false;
 	}
+	size_t paddingSize = section.offset - static_cast<TUInt32>(position);
+	if (fwrite( padding, 1, paddingSize, file ) != paddingSize)
+	{
+		return false;
+	}
+	return section.size == 0 || fwrite( data, 1, section.size, file ) == section.size;
+}
+
+// Returns true if a snapshot section lies within a file of the given size, and holds the given
+// number of records of the given size
+static bool IsSnapshotSectionValid( const SSnapshotSection& section, TUInt32 fileSize,
+                                    TUInt32 numRecords, TUInt32 recordSize )
+{
+	return section.offset % kSnapshotAlignment == 0 && section.offset <= fileSize &&
+	       section.size <= fileSize - section.offset &&
+	       static_cast<TUInt64>(numRecords) * recordSize == section.size;
+}
+
+
+// Save all entities to a binary snapshot file. Returns false if the file cannot be written, or
+// if called during update or while queries are alive
+bool CEntityManager::SaveSnapshot( const string& fileName )
+{
+	FlushCommands();
+	if (IsDeferring())
+	{
+		return false;
+	}
+
+	// Gather the records for each section. Strings and templates are shared between entities
+	vector<char>                        strings;
+	unordered_map<TAtom, TUInt32>       stringOffsets;
+	vector<SSnapshotTemplate>           templates;
+	unordered_map<CEntityTemplate*, TUInt32> templateIndices;
+	vector<SSnapshotEntity>             entities;
+	vector<CTankEntity::SSnapshotState>  tankStates;
+	vector<CShellEntity::SSnapshotState> shellStates;
+	vector<CAmmoEntity::SSnapshotState>  ammoStates;
+	vector<CMatrix4x4>                  matrices;
+
+	SSnapshotHeader header;
+	memset( &header, 0, sizeof(header) );
+	for (TUInt32 kind = 0; kind < NumEntityKinds; ++kind)
+	{
+		CEntityArchetype* archetype = m_Archetypes[kind];
+		header.numEntities[kind] = archetype->NumRows();
+		for (TUInt32 row = 0; row < archetype->NumRows(); ++row)
+		{
+			CEntity* entity = archetype->GetEntity( row );
+			CEntityTemplate* entityTemplate = entity->Template();
+			TUInt32 numNodes = entityTemplate->Mesh()->GetNumNodes();
+
+			// Add the names of templates and entities not seen before
+			TAtom names[2] = { entityTemplate->GetNameAtom(), entity->GetNameAtom() };
+			for (TUInt32 name = 0; name < 2; ++name)
+			{
+				if (names[name] != kNoAtom && stringOffsets.find( names[name] ) == stringOffsets.end())
+				{
+					const string& text = AtomString( names[name] );
+					stringOffsets[names[name]] = static_cast<TUInt32>(strings.size());
+					strings.insert( strings.end(), text.c_str(), text.c_str() + text.length() + 1 );
+				}
+			}
+			if (templateIndices.find( entityTemplate ) == templateIndices.end())
+			{
+				SSnapshotTemplate templateRecord = { stringOffsets[names[0]], numNodes };
+				templateIndices[entityTemplate] = static_cast<TUInt32>(templates.size());
+				templates.push_back( templateRecord );
+			}
+
+			// Records are cleared as raw bytes so their padding is written as zeros. They hold
+			// maths types with constructors, so the pointers are passed to memset as void*
+			SSnapshotEntity record;
+			memset( static_cast<void*>(&record), 0, sizeof(record) );
+			record.UID = entity->GetUID();
+			record.templateIndex = templateIndices[entityTemplate];
+			record.name = (names[1] != kNoAtom) ? stringOffsets[names[1]] : kNoSnapshotString;
+			record.firstMatrix = static_cast<TUInt32>(matrices.size());
+			record.rootMatrix = entity->GetMatrix();
+
+			// Update schedule, relative to the current clock and frame number
+			const SUpdateSchedule& schedule = archetype->UpdateSchedule( row );
+			if (archetype->IsUpdated() && entity->IsAsleep())
+			{
+				record.flags |= kSnapshotAsleep;
+				if (schedule.wakeTime > 0.0)
+				{
+					record.wakeAfter = schedule.wakeTime - m_UpdateClock;
+				}
+			}
+			record.updateInterval = schedule.interval;
+			if (schedule.interval > 1)
+			{
+				record.updatePhase = schedule.interval - (m_UpdateFrame + schedule.phase) % schedule.interval;
+			}
+			record.sinceLastUpdate = m_UpdateClock - schedule.lastUpdateTime;
+			entities.push_back( record );
+			matrices.insert( matrices.end(), entity->m_RelMatrices + 1, entity->m_RelMatrices + numNodes );
+
+			if (kind == Kind_Tank)
+			{
+				tankStates.push_back( CTankEntity::SSnapshotState() );
+				memset( static_cast<void*>(&tankStates.back()), 0, sizeof(CTankEntity::SSnapshotState) );
+				static_cast<CTankEntity*>(entity)->SaveState( tankStates.back() );
+			}
+			else if (kind == Kind_Shell)
+			{
+				shellStates.push_back( CShellEntity::SSnapshotState() );
+				memset( static_cast<void*>(&shellStates.back()), 0, sizeof(CShellEntity::SSnapshotState) );
+				static_cast<CShellEntity*>(entity)->SaveState( shellStates.back() );
+			}
+			else if (kind == Kind_Ammo)
+			{
+				ammoStates.push_back( CAmmoEntity::SSnapshotState() );
+				memset( static_cast<void*>(&ammoStates.back()), 0, sizeof(CAmmoEntity::SSnapshotState) );
+				static_cast<CAmmoEntity*>(entity)->SaveState( ammoStates.back() );
+			}
+		}
+	}
+
+	// Lay out the file
+	header.magic = kSnapshotMagic;
+	header.version = kSnapshotVersion;
+	header.entityRecordSize = sizeof(SSnapshotEntity);
+	header.tankRecordSize = sizeof(CTankEntity::SSnapshotState);
+	header.shellRecordSize = sizeof(CShellEntity::SSnapshotState);
+	header.ammoRecordSize = sizeof(CAmmoEntity::SSnapshotState);
+	header.matrixSize = sizeof(CMatrix4x4);
+	header.numTemplates = static_cast<TUInt32>(templates.size());
+	header.numSlots = m_EntitySlots.NumSlots();
+	header.numMatrices = static_cast<TUInt32>(matrices.size());
+
+	vector<TUInt32> generations( header.numSlots );
+	for (TUInt32 slot = 0; slot < header.numSlots; ++slot)
+	{
+		generations[slot] = m_EntitySlots.GetGeneration( slot );
+	}
+
+	TUInt32 offset = sizeof(SSnapshotHeader);
+	offset = PlaceSnapshotSection( header.strings, offset, static_cast<TUInt32>(strings.size()) );
+	offset = PlaceSnapshotSection( header.templates, offset, header.numTemplates * sizeof(SSnapshotTemplate) );
+	offset = PlaceSnapshotSection( header.slots, offset, header.numSlots * sizeof(TUInt32) );
+	offset = PlaceSnapshotSection( header.entities, offset,
+	                               static_cast<TUInt32>(entities.size()) * sizeof(SSnapshotEntity) );
+	offset = PlaceSnapshotSection( header.tankStates, offset,
+	                               static_cast<TUInt32>(tankStates.size()) * sizeof(CTankEntity::SSnapshotState) );
+	offset = PlaceSnapshotSection( header.shellStates, offset,
+	                               static_cast<TUInt32>(shellStates.size()) * sizeof(CShellEntity::SSnapshotState) );
+	offset = PlaceSnapshotSection( header.ammoStates, offset,
+	                               static_cast<TUInt32>(ammoStates.size()) * sizeof(CAmmoEntity::SSnapshotState) );
+	offset = PlaceSnapshotSection( header.matrices, offset, header.numMatrices * sizeof(CMatrix4x4) );
+
+	// Write the sections in order
+	FILE* file = fopen( fileName.c_str(), "wb" );
+	if (!file)
+	{
+		return false;
+	}
+	bool written = fwrite( &header, sizeof(header), 1, file ) == 1 &&
+	               WriteSnapshotSection( file, header.strings, strings.empty() ? 0 : &strings[0] ) &&
+	               WriteSnapshotSection( file, header.templates, templates.empty() ? 0 : &templates[0] ) &&
+	               WriteSnapshotSection( file, header.slots, generations.empty() ? 0 : &generations[0] ) &&
+	               WriteSnapshotSection( file, header.entities, entities.empty() ? 0 : &entities[0] ) &&
+	               WriteSnapshotSection( file, header.tankStates, tankStates.empty() ? 0 : &tankStates[0] ) &&
+	               WriteSnapshotSection( file, header.shellStates, shellStates.empty() ? 0 : &shellStates[0] ) &&
+	               WriteSnapshotSection( file, header.ammoStates, ammoStates.empty() ? 0 : &ammoStates[0] ) &&
+	               WriteSnapshotSection( file, header.matrices, matrices.empty() ? 0 : &matrices[0] );
+	return (fclose( file ) == 0) && written;
+}
+
+
+// Replace all entities with those in a snapshot file. Returns false, leaving the current
+// entities in place, if the file is missing, from an incompatible build, or does not match
+// the templates
+bool CEntityManager::LoadSnapshot( const string& fileName )
+{
+	FlushCommands();
+	if (IsDeferring() || !m_TemplateLoads.empty())
+	{
+		return false;
+	}
+
+	CMappedFile file;
+	if (!file.Open( fileName ) || file.GetSize() < sizeof(SSnapshotHeader))
+	{
+		return false;
+	}
+	const TUInt8* data = file.GetData();
+	TUInt32 fileSize = file.GetSize();
+
+	// Check the header describes a file from this build that fits in the file
+	const SSnapshotHeader& header = *reinterpret_cast<const SSnapshotHeader*>(data);
+	TUInt32 numEntities = 0;
+	for (TUInt32 kind = 0; kind < NumEntityKinds; ++kind)
+	{
+		if (header.numEntities[kind] > 0xffffffff - numEntities)
+		{
+			return false;
+		}
+		numEntities += header.numEntities[kind];
+	}
+	if (header.magic != kSnapshotMagic || header.version != kSnapshotVersion ||
+	    header.entityRecordSize != sizeof(SSnapshotEntity) ||
+	    header.tankRecordSize != sizeof(CTankEntity::SSnapshotState) ||
+	    header.shellRecordSize != sizeof(CShellEntity::SSnapshotState) ||
+	    header.ammoRecordSize != sizeof(CAmmoEntity::SSnapshotState) ||
+	    header.matrixSize != sizeof(CMatrix4x4) ||
+	    !IsSnapshotSectionValid( header.strings, fileSize, header.strings.size, 1 ) ||
+	    !IsSnapshotSectionValid( header.templates, fileSize, header.numTemplates, sizeof(SSnapshotTemplate) ) ||
+	    header.numSlots > CEntitySlotMap::kMaxSlots ||
+	    !IsSnapshotSectionValid( header.slots, fileSize, header.numSlots, sizeof(TUInt32) ) ||
+	    !IsSnapshotSectionValid( header.entities, fileSize, numEntities, sizeof(SSnapshotEntity) ) ||
+	    !IsSnapshotSectionValid( header.tankStates, fileSize, header.numEntities[Kind_Tank],
+	                             sizeof(CTankEntity::SSnapshotState) ) ||
+	    !IsSnapshotSectionValid( header.shellStates, fileSize, header.numEntities[Kind_Shell],
+	                             sizeof(CShellEntity::SSnapshotState) ) ||
+	    !IsSnapshotSectionValid( header.ammoStates, fileSize, header.numEntities[Kind_Ammo],
+	                             sizeof(CAmmoEntity::SSnapshotState) ) ||
+	    !IsSnapshotSectionValid( header.matrices, fileSize, header.numMatrices, sizeof(CMatrix4x4) ) ||
+	    (header.strings.size > 0 && data[header.strings.offset + header.strings.size - 1] != 0))
+	{
+		return false;
+	}
+
+	// The records are used in place
+	const char* strings = reinterpret_cast<const char*>(data + header.strings.offset);
+	const SSnapshotTemplate* templates = reinterpret_cast<const SSnapshotTemplate*>(data + header.templates.offset);
+	const TUInt32* generations = reinterpret_cast<const TUInt32*>(data + header.slots.offset);
+	const SSnapshotEntity* entities = reinterpret_cast<const SSnapshotEntity*>(data + header.entities.offset);
+	const CTankEntity::SSnapshotState* tankStates =
+		reinterpret_cast<const CTankEntity::SSnapshotState*>(data + header.tankStates.offset);
+	const CShellEntity::SSnapshotState* shellStates =
+		reinterpret_cast<const CShellEntity::SSnapshotState*>(data + header.shellStates.offset);
+	const CAmmoEntity::SSnapshotState* ammoStates =
+		reinterpret_cast<const CAmmoEntity::SSnapshotState*>(data + header.ammoStates.offset);
+	const CMatrix4x4* matrices = reinterpret_cast<const CMatrix4x4*>(data + header.matrices.offset);
+
+	// Find the templates, which must have the same number of mesh nodes as when saved
+	vector<CEntityTemplate*> entityTemplates( header.numTemplates );
+	for (TUInt32 templateIndex = 0; templateIndex < header.numTemplates; ++templateIndex)
+	{
+		const SSnapshotTemplate& templateRecord = templates[templateIndex];
+		if (templateRecord.name >= header.strings.size)
+		{
+			return false;
+		}
+		CEntityTemplate* entityTemplate = GetTemplate( FindAtom( strings + templateRecord.name ) );
+		if (!entityTemplate || entityTemplate->Mesh()->GetNumNodes() != templateRecord.numNodes)
+		{
+			return false;
+		}
+		entityTemplates[templateIndex] = entityTemplate;
+	}
+
+	// Check every entity record before changing anything
+	const SSnapshotEntity* record = entities;
+	for (TUInt32 kind = 0; kind < NumEntityKinds; ++kind)
+	{
+		for (TUInt32 entity = 0; entity < header.numEntities[kind]; ++entity, ++record)
+		{
+			if (record->templateIndex >= header.numTemplates ||
+			    (record->name != kNoSnapshotString && record->name >= header.strings.size) ||
+			    (kind == Kind_Tank && !dynamic_cast<CTankTemplate*>(entityTemplates[record->templateIndex])) ||
+			    record->firstMatrix > header.numMatrices ||
+			    templates[record->templateIndex].numNodes - 1 > header.numMatrices - record->firstMatrix)
+			{
+				return false;
+			}
+		}
+	}
+
+	// Replace the current entities and UID slots
+	DestroyAllEntities();
+	m_EntitySlots.BeginRestore( generations, header.numSlots );
+
+	// Create the entities kind by kind, growing storage once for each kind. Each entity is
+	// created as normal, then its saved matrices and data are copied over the defaults
+	record = entities;
+	for (TUInt32 kind = 0; kind < NumEntityKinds; ++kind)
+	{
+		TUInt32 numOfKind = header.numEntities[kind];
+		m_Archetypes[kind]->ReserveExtra( numOfKind );
+		m_EntityPools[kind]->Reserve( m_Archetypes[kind]->NumRows() + numOfKind );
+
+		SCreateCommand command;
+		command.kind = static_cast<EEntityKind>(kind);
+		command.position = CVector3::kOrigin;
+		command.rotation = CVector3( 0.0f, 0.0f, 0.0f );
+		command.scale = CVector3( 1.0f, 1.0f, 1.0f );
+		command.team = 0;
+		command.shooter = SystemUID;
+		for (TUInt32 entity = 0; entity < numOfKind; ++entity, ++record)
+		{
+			if (!m_EntitySlots.RestoreUID( record->UID ))
+			{
+				continue; // Corrupt UID, skip the entity rather than have two share a slot
+			}
+
+			command.entityTemplate = entityTemplates[record->templateIndex];
+			command.UID = record->UID;
+			command.name = (record->name != kNoSnapshotString) ? InternAtom( strings + record->name ) : kNoAtom;
+			if (kind == Kind_Tank)
+			{
+				command.team = tankStates[entity].team; // Tank is indexed by team on creation
+			}
+			ConstructEntity( command );
+
+			CEntity* newEntity = m_EntitySlots.GetEntity( record->UID );
+			TUInt32 numNodes = templates[record->templateIndex].numNodes;
+			newEntity->Matrix() = record->rootMatrix;
+			if (numNodes > 1)
+			{
+				memcpy( newEntity->m_RelMatrices + 1, matrices + record->firstMatrix,
+				        (numNodes - 1) * sizeof(CMatrix4x4) );
+			}
+			if (kind == Kind_Tank)
+			{
+				static_cast<CTankEntity*>(newEntity)->LoadState( tankStates[entity] );
+			}
+			else if (kind == Kind_Shell)
+			{
+				static_cast<CShellEntity*>(newEntity)->LoadState( shellStates[entity] );
+			}
+			else if (kind == Kind_Ammo)
+			{
+				static_cast<CAmmoEntity*>(newEntity)->LoadState( ammoStates[entity] );
+			}
+
+			// Restore the update schedule relative to the current clock and frame number
+			SUpdateSchedule& schedule = m_Archetypes[kind]->UpdateSchedule( newEntity->m_Row );
+			schedule.interval = record->updateInterval;
+			if (schedule.interval > 1)
+			{
+				schedule.phase = (schedule.interval - (m_UpdateFrame + record->updatePhase) % schedule.interval) %
+				                 schedule.interval;
+			}
+			schedule.lastUpdateTime = m_UpdateClock - record->sinceLastUpdate;
+			if (record->flags & kSnapshotAsleep)
+			{
+				SetAsleep( newEntity, true, (record->wakeAfter > 0.0) ? m_UpdateClock + record->wakeAfter : 0.0 );
+			}
+		}
+	}
+	m_EntitySlots.EndRestore();
+	return true;
+}
+
+
+/////////////////////////////////////
+// Index maintenance
+
+// Add a new entity to the index for its template type
+void CEntityManager::AddToTypeIndex( CEntity* entity )
+{
+	TAtom templateType = entity->Template()->GetTypeAtom();
+	if (templateType >= m_TypeIndex.size())
+	{
+		m_TypeIndex.resize( templateType + 1, 0 );
+	}
+	if (!m_TypeIndex[templateType])
+	{
+		// First entity of this type, create the list
+		m_TypeIndex[templateType] = new CEntityList( Index_Type );
+	}
+	m_TypeIndex[templateType]->Add( entity );
+}
+
+// Add a new tank to the index for its team
+void CEntityManager::AddToTeamIndex( CEntity* entity, TUInt32 team )
+{
+	// Create lists for any team numbers not seen before
+	while (m_TeamIndex.size() <= team)
+	{
+		m_TeamIndex.push_back( new CEntityList( Index_Team ) );
+	}
+	m_TeamIndex[team]->Add( entity );
+}
+
+// Add a new named entity to the index for its name
+void CEntityManager::AddToNameIndex( CEntity* entity )
+{
+	TAtom name = entity->GetNameAtom();
+	if (name == kNoAtom)
+	{
+		return;
+	}
+
+	CEntityList*& nameList = m_NameIndex[name];
+	if (!nameList)
+	{
+		// First entity with this name, create the list
+		nameList = new CEntityList( Index_Name );
+	}
+	nameList->Add( entity );
+}
+
+// Remove an entity from all indices it is in, and from the spatial grid
+void CEntityManager::RemoveFromIndices( CEntity* entity )
+{
+	m_SpatialGrid.Remove( entity );
+	if (IsSnapshotting())
+	{
+		NoteSnapshotChange( EntityUIDIndex( entity->GetUID() ) );
+	}
+
+	CEntityList* nameList = entity->GetIndexList( Index_Name );
+	for (TUInt32 index = 0; index < NumEntityIndices; ++index)
+	{
+		CEntityList* list = entity->GetIndexList( static_cast<EEntityIndex>(index) );
+		if (list)
+		{
+			list->Remove( entity );
+		}
+	}
+
+	// Delete the list for a name once it has no entities
+	if (nameList && nameList->Size() == 0)
+	{
+		m_NameIndex.erase( entity->GetNameAtom() );
+		delete nameList;
+	}
+}
+
+
+/////////////////////////////////////
+// Spatial queries
+
+// Find the entities whose frame start position is within the given radius of a point, optionally
+// only those of a template type and/or tanks on a team
+TUInt32 CEntityManager::FindEntitiesInRadius( const CVector3& centre, TFloat32 radius,
+                                              vector<CEntity*>* found,
+                                              TAtom templateType /*= kNoAtom*/,
+                                              TUInt32 team /*= kAnyTeam*/ )
+{
+	CEntityList* teamList = 0;
+	if (team != kAnyTeam)
+	{
+		if (team >= m_TeamIndex.size())
+		{
+			found->clear();
+			return 0;
+		}
+		teamList = m_TeamIndex[team];
+	}
+	return m_SpatialGrid.FindInRadius( centre, radius, templateType, teamList, found );
+}
+
+// Find the entities whose frame start position is inside the box between the given minimum and
+// maximum points, optionally only those of a template type and/or tanks on a team
+TUInt32 CEntityManager::FindEntitiesInBox( const CVector3& minPoint, const CVector3& maxPoint,
+                                           vector<CEntity*>* found,
+                                           TAtom templateType /*= kNoAtom*/,
+                                           TUInt32 team /*= kAnyTeam*/ )
+{
+	CEntityList* teamList = 0;
+	if (team != kAnyTeam)
+	{
+		if (team >= m_TeamIndex.size())
+		{
+			found->clear();
+			return 0;
+		}
+		teamList = m_TeamIndex[team];
+	}
+	return m_SpatialGrid.FindInBox( minPoint, maxPoint, templateType, teamList, found );
+}
+
+// Find any one entity whose frame start position is within the given radius of a point, other
+// than the excluded one, optionally only of a template type and/or on a team
+CEntity* CEntityManager::FindEntityInRadius( const CVector3& centre, TFloat32 radius,
+                                             TAtom templateType /*= kNoAtom*/,
+                                             TUInt32 team /*= kAnyTeam*/,
+                                             TEntityUID exclude /*= SystemUID*/ )
+{
+	CEntityList* teamList = 0;
+	if (team != kAnyTeam)
+	{
+		if (team >= m_TeamIndex.size())
+		{
+			return 0;
+		}
+		teamList = m_TeamIndex[team];
+	}
+	CEntity* excludeEntity = (exclude != SystemUID) ? GetEntity( exclude ) : 0;
+	return m_SpatialGrid.FindAnyInRadius( centre, radius, templateType, teamList, excludeEntity );
+}
+
+
+/////////////////////////////////////
+// Structural changes
+
+// Carry out all deferred creations and destructions. Does nothing if still deferring
+void CEntityManager::FlushCommands()
+{
+	if (IsDeferring() || m_Commands.IsEmpty())
+	{
+		return;
+	}
+
+	// Destructions first, so the rows they free can be reused by the creations. Each archetype
+	// is compacted in one pass over all its destroyed entities
+	for (TUInt32 kind = 0; kind < NumEntityKinds; ++kind)
+	{
+		vector<CEntity*>& destroys = m_Commands.Destroys( static_cast<EEntityKind>(kind) );
+		if (destroys.empty())
+		{
+			continue;
+		}
+		m_Archetypes[kind]->RemoveRows( &destroys[0], static_cast<TUInt32>(destroys.size()) );
+		for (TUInt32 entity = 0; entity < destroys.size(); ++entity)
+		{
+			RemoveFromIndices( destroys[entity] );
+			DeleteEntity( destroys[entity] );
+		}
+	}
+
+	// Then creations in the order they were made. Skip those that were cancelled by destroying
+	// their UID before they were carried out
+	vector<SCreateCommand>& creates = m_Commands.Creates();
+	for (TUInt32 command = 0; command < creates.size(); ++command)
+	{
+		if (m_EntitySlots.IsReserved( creates[command].UID ))
+		{
+			ConstructEntity( creates[command] );
+		}
+	}
+
+	m_Commands.Clear();
+	m_IsEnumerating = false; // Cancel any entity enumeration (entity list has changed)
+}
+
+
+/////////////////////////////////////
+// Sleeping
+
+// Put the entity with the given UID to sleep - it is not updated until a message is sent to
+// it or it is woken with WakeEntity, or until the given time has passed if that is more than 0
+// During an update the entity falls asleep when the update ends. Returns false if the UID is
+// not found
+bool CEntityManager::SleepEntity( TEntityUID UID, TFloat32 wakeAfter /*= 0.0f*/ )
+{
+	CEntity* entity = m_EntitySlots.GetEntity( UID );
+	if (!entity)
+	{
+		return false;
+	}
+
+	TFloat64 wakeTime = (wakeAfter > 0.0f) ? m_UpdateClock + wakeAfter : 0.0;
+	if (m_IsUpdating)
+	{
+		// The awake lists are being walked, change them afterwards
+		unique_lock<mutex> lock( m_ParallelMutex, defer_lock );
+		if (m_InParallelUpdate)
+		{
+			lock.lock();
+		}
+		SSleepChange change = { UID, true, wakeTime };
+		m_SleepChanges.push_back( change );
+	}
+	else
+	{
+		SetAsleep( entity, true, wakeTime );
+	}
+	return true;
+}
+
+// Wake the entity with the given UID so it is updated again. During an update the entity is
+// woken when the update ends. Returns false if the UID is not found
+bool CEntityManager::WakeEntity( TEntityUID UID )
+{
+	CEntity* entity = m_EntitySlots.GetEntity( UID );
+	if (!entity)
+	{
+		return false;
+	}
+
+	if (m_IsUpdating)
+	{
+		unique_lock<mutex> lock( m_ParallelMutex, defer_lock );
+		if (m_InParallelUpdate)
+		{
+			lock.lock();
+		}
+		SSleepChange change = { UID, false, 0.0 };
+		m_SleepChanges.push_back( change );
+	}
+	else
+	{
+		SetAsleep( entity, false, 0.0 );
+	}
+	return true;
+}
+
+
+// Put an entity to sleep, with the given wake time (0 for none), or wake it. Not during update
+// Does nothing for entities whose class has no update, they are always asleep
+void CEntityManager::SetAsleep( CEntity* entity, bool asleep, TFloat64 wakeTime )
+{
+	CEntityArchetype* archetype = entity->GetArchetype();
+	if (!archetype->IsUpdated())
+	{
+		return;
+	}
+
+	CEntityList* awakeList = m_AwakeLists[archetype->GetKind()];
+	SUpdateSchedule& schedule = archetype->UpdateSchedule( entity->m_Row );
+	if (asleep)
+	{
+		// Entities only sleep until their next message, so stay awake if there is one already
+		if (Messenger.HasMessage( entity->GetUID() ))
+		{
+			return;
+		}
+		if (!entity->IsAsleep())
+		{
+			awakeList->Remove( entity );
+
+			// It may have moved in its last update, so the spatial grid must visit it once more,
+			// and the transform pass too if its matrices have not been recalculated since
+			if (!entity->GetIndexList( Index_Moved ))
+			{
+				archetype->MovedEntities().Add( entity );
+			}
+			SDirtyNodes& dirty = archetype->DirtyNodes( entity->m_Row );
+			if (dirty.begin != dirty.end && !entity->GetIndexList( Index_Dirty ))
+			{
+				archetype->DirtyEntities().Add( entity );
+			}
+		}
+		schedule.wakeTime = wakeTime;
+		if (wakeTime > 0.0)
+		{
+			SWakeTimer timer = { wakeTime, entity->GetUID() };
+			m_WakeTimers.push( timer );
+		}
+	}
+	else
+	{
+		if (entity->IsAsleep())
+		{
+			awakeList->Add( entity );
+			schedule.lastUpdateTime = m_WakeClock;
+		}
+		schedule.wakeTime = 0.0;
+	}
+}
+
+// Wake the sleeping entities whose wake time has come or that have been sent messages
+void CEntityManager::WakeEntities()
+{
+	while (!m_WakeTimers.empty() && m_WakeTimers.top().time <= m_UpdateClock)
+	{
+		SWakeTimer timer = m_WakeTimers.top();
+		m_WakeTimers.pop();
+
+		// Skip timers for entities that have gone, been woken, or gone back to sleep since
+		CEntity* entity = m_EntitySlots.GetEntity( timer.UID );
+		if (entity && entity->IsAsleep() &&
+		    entity->GetArchetype()->UpdateSchedule( entity->m_Row ).wakeTime == timer.time)
+		{
+			SetAsleep( entity, false, 0.0 );
+		}
+	}
+
+	Messenger.TakeRecipients( m_MessageRecipients );
+	for (TUInt32 recipient = 0; recipient < m_MessageRecipients.size(); ++recipient)
+	{
+		CEntity* entity = m_EntitySlots.GetEntity( m_MessageRecipients[recipient] );
+		if (entity && entity->IsAsleep())
+		{
+			SetAsleep( entity, false, 0.0 );
+		}
+	}
+	m_MessageRecipients.clear();
+}
+
+// Make the sleep and wake changes requested during the update, in the order requested
+void CEntityManager::ApplySleepChanges()
+{
+	for (TUInt32 change = 0; change < m_SleepChanges.size(); ++change)
+	{
+		// Skip entities destroyed during the update
+		CEntity* entity = m_EntitySlots.GetEntity( m_SleepChanges[change].UID );
+		if (entity)
+		{
+			SetAsleep( entity, m_SleepChanges[change].asleep, m_SleepChanges[change].wakeTime );
+		}
+	}
+	m_SleepChanges.clear();
+}
+
+
+/////////////////////////////////////
+// Update / Rendering
+
+// Call all entity update functions. Pass the time since last update
+// Entities are updated one archetype at a time, so all calls to the same Update function
+// are made together. Creations and destructions made during the update are deferred, so
+// archetypes don't change while they are walked. They are carried out together at the end
+// Only awake entities are visited. They are updated on the frames given by their update
+// schedule, and are passed the time since their last update. Sleeping entities are woken
+// first if their wake time has come or they have been sent messages
+// In a parallel update the rows of each archetype are split between the job system's
+// workers. Messages are buffered and destructions recorded until all workers have finished
+void CEntityManager::UpdateAllEntities( float updateTime )
+{
+	UpdateTemplateLoads();
+	FlushCommands();
+
+	++m_UpdateFrame;
+	m_UpdateClock += updateTime;
+	WakeEntities();
+
+	// Save the state other entities may read during the update
+	for (TUInt32 kind = 0; kind < NumEntityKinds; ++kind)
+	{
+		m_Archetypes[kind]->SaveFrameStart( m_AwakeLists[kind] );
+	}
+	UpdateSpatialGrid();
+
+	m_IsUpdating = true;
+	if (m_ParallelUpdate)
+	{
+		m_InParallelUpdate = true;
+		Messenger.BeginBuffering( m_Jobs.NumWorkers() );
+		for (TUInt32 kind = 0; kind < NumEntityKinds; ++kind)
+		{
+			CEntityList* awakeList = m_AwakeLists[kind];
+			m_Jobs.ParallelFor( awakeList->Size(), kUpdateGrainSize,
+			                    bind( &CEntityManager::UpdateEntities, this, awakeList,
+			                          placeholders::_1, placeholders::_2 ) );
+		}
+		Messenger.EndBuffering();
+		m_InParallelUpdate = false;
+
+		// Make the destructions recorded during the update, still deferred until it ends
+		for (TUInt32 destroy = 0; destroy < m_ParallelDestroys.size(); ++destroy)
+		{
+			DestroyEntity( m_ParallelDestroys[destroy] );
+		}
+		m_ParallelDestroys.clear();
+	}
+	else
+	{
+		for (TUInt32 kind = 0; kind < NumEntityKinds; ++kind)
+		{
+			UpdateEntities( m_AwakeLists[kind], 0, m_AwakeLists[kind]->Size() );
+		}
+	}
+	m_IsUpdating = false;
+	m_WakeClock = m_UpdateClock;
+
+	ApplySleepChanges();
+
+	FlushCommands();
+
+	if (m_PipelinedRender && m_RenderBackend)
+	{
+		PublishSnapshot();
+	}
+}
+
+// Update the entities in the given range of positions in an awake list that are due an
+// update this frame. Used by both serial and parallel updates
+void CEntityManager::UpdateEntities( CEntityList* awakeList, TUInt32 begin, TUInt32 end )
+{
+	for (TUInt32 position = begin; position < end; ++position)
+	{
+		CEntity* entity = awakeList->GetEntity( position );
+
+		// Skip entities not due this frame - those with an interval of 1 always are
+		SUpdateSchedule& schedule = entity->GetArchetype()->UpdateSchedule( entity->m_Row );
+		if (entity->IsDestroyed() || (schedule.interval != 1 &&
+		    (schedule.interval == 0 || (m_UpdateFrame + schedule.phase) % schedule.interval != 0)))
+		{
+			continue;
+		}
+
+		// Update entity with the time since its last update, if it returns false, then destroy it
+		TFloat32 updateTime = static_cast<TFloat32>(m_UpdateClock - schedule.lastUpdateTime);
+		schedule.lastUpdateTime = m_UpdateClock;
+		if (!entity->Update( updateTime ))
+		{
+			DestroyEntity( entity->GetUID() );
+		}
+	}
+}
+
+// Move the entities in the spatial grid to their frame start positions, adding any new entities.
+// Only entities that may have moved are visited - those that are awake, and the sleeping
+// entities listed as moved in their archetype (which includes new entities). Static and
+// sleeping entities that have not moved cost nothing. Only entities that have changed cell
+// move between buckets, the rest just have their position updated in place
+void CEntityManager::UpdateSpatialGrid()
+{
+	for (TUInt32 kind = 0; kind < NumEntityKinds; ++kind)
+	{
+		CEntityArchetype* archetype = m_Archetypes[kind];
+		CEntityList* awakeList = m_AwakeLists[kind];
+		for (TUInt32 position = 0; position < awakeList->Size(); ++position)
+		{
+			CEntity* entity = awakeList->GetEntity( position );
+			if (!entity->IsDestroyed())
+			{
+				m_SpatialGrid.Update( entity, archetype->FrameStartMatrix( entity->m_Row ).Position() );
+			}
+		}
+
+		// Empty the moved list from the end, so no entities are moved within it
+		CEntityList& movedList = archetype->MovedEntities();
+		while (movedList.Size())
+		{
+			CEntity* entity = movedList.GetEntity( movedList.Size() - 1 );
+			movedList.Remove( entity );
+			if (!entity->IsDestroyed())
+			{
+				m_SpatialGrid.Update( entity, archetype->FrameStartMatrix( entity->m_Row ).Position() );
+			}
+		}
+	}
+}
+
+// Recalculate the absolute node matrices of all entities that have moved since the last call.
+// Only awake entities and those in each archetype's dirty list are visited, the dirty lists are
+// emptied afterwards
+void CEntityManager::UpdateTransforms()
+{
+	for (TUInt32 kind = 0; kind < NumEntityKinds; ++kind)
+	{
+		CEntityList* lists[2] = { m_AwakeLists[kind], &m_Archetypes[kind]->DirtyEntities() };
+		for (TUInt32 list = 0; list < 2; ++list)
+		{
+			if (m_ParallelUpdate)
+			{
+				m_Jobs.ParallelFor( lists[list]->Size(), kTransformGrainSize,
+				                    bind( &CEntityManager::CalculateTransforms, this, lists[list],
+				                          placeholders::_1, placeholders::_2 ) );
+			}
+			else
+			{
+				CalculateTransforms( lists[list], 0, lists[list]->Size() );
+			}
+		}
+
+		// Empty the dirty list from the end, so no entities are moved within it
+		CEntityList& dirtyList = m_Archetypes[kind]->DirtyEntities();
+		while (dirtyList.Size())
+		{
+			dirtyList.Remove( dirtyList.GetEntity( dirtyList.Size() - 1 ) );
+		}
+	}
+
+	// Entities recalculated must be copied into the snapshots again
+	for (TUInt32 worker = 0; worker < m_WorkerSnapshotChanges.size(); ++worker)
+	{
+		vector<TUInt32>& changes = m_WorkerSnapshotChanges[worker];
+		for (TUInt32 change = 0; change < changes.size(); ++change)
+		{
+			NoteSnapshotChange( changes[change] );
+		}
+		changes.clear();
+	}
+}
+
+// Recalculate the absolute matrices of the entities in the given range of positions in a list.
+// Only the dirty node column is read for entities that have not moved. Entities recalculated
+// are recorded for the snapshots if rendering is pipelined
+void CEntityManager::CalculateTransforms( CEntityList* list, TUInt32 begin, TUInt32 end )
+{
+	vector<TUInt32>* snapshotChanges = 0;
+	if (IsSnapshotting())
+	{
+		snapshotChanges = &m_WorkerSnapshotChanges[CJobSystem::CurrentWorker()];
+	}
+	for (TUInt32 position = begin; position < end; ++position)
+	{
+		CEntity* entity = list->GetEntity( position );
+		SDirtyNodes& dirty = entity->GetArchetype()->DirtyNodes( entity->m_Row );
+		if (dirty.begin != dirty.end)
+		{
+			entity->CalculateMatrices();
+			if (snapshotChanges)
+			{
+				snapshotChanges->push_back( EntityUIDIndex( entity->GetUID() ) );
+			}
+		}
+	}
+}
+
+// Render all entities. If a camera is given, only entities whose bounding spheres are at least
+// partly inside the camera's view frustum are rendered. Each archetype's world bounds column is
+// culled in one pass, then only the visible rows are visited. With a render backend the visible
+// entities record commands instead of rendering, and the commands are executed together. When
+// rendering is pipelined, the latest snapshot is passed to the render thread instead
+void CEntityManager::RenderAllEntities( CCamera* camera /*= 0*/ )
+{
+	SRenderView view = MakeRenderView( camera );
+	if (m_PipelinedRender && m_RenderBackend)
+	{
+		// Wait for the previous frame, so there is at most one frame in flight
+		WaitForRender();
+		if (m_PublishedSnapshot != kNoSnapshot)
+		{
+			m_RenderingSnapshot = m_PublishedSnapshot;
+			m_RenderThread.Submit( bind( &CEntityManager::RenderSnapshot, this,
+			                             m_RenderingSnapshot, view ) );
+		}
+		return;
+	}
+
+	FlushCommands();
+	UpdateTransforms();
+
+	m_NumRenderedEntities = 0;
+	for (TUInt32 kind = 0; kind < NumEntityKinds; ++kind)
+	{
+		CEntityArchetype* archetype = m_Archetypes[kind];
+		TUInt32 numRows = archetype->NumRows();
+		TUInt32 numVisible = numRows;
+		const TUInt32* rows = 0;
+		if (camera)
+		{
+			m_VisibleRows.resize( numRows );
+			numVisible = MatrixCullSpheres( archetype->WorldBoundsColumn(), numRows, view.planes,
+			                                view.numPlanes, numRows ? &m_VisibleRows[0] : 0 );
+			rows = numVisible ? &m_VisibleRows[0] : 0;
+		}
+
+		if (m_RenderBackend)
+		{
+			if (m_ParallelUpdate)
+			{
+				m_Jobs.ParallelFor( numVisible, kRenderGrainSize,
+				                    bind( &CEntityManager::RecordRenderCommands, this, archetype,
+				                          rows, &view, placeholders::_1, placeholders::_2 ) );
+			}
+			else
+			{
+				RecordRenderCommands( archetype, rows, &view, 0, numVisible );
+			}
+			continue;
+		}
+
+		for (TUInt32 visible = 0; visible < numVisible; ++visible)
+		{
+			CEntity* entity = archetype->GetEntity( rows ? rows[visible] : visible );
+			if (!entity->IsDestroyed())
+			{
+				entity->Render();
+				++m_NumRenderedEntities;
+			}
+		}
+	}
+
+	if (m_RenderBackend)
+	{
+		ExecuteRenderCommands();
+	}
+}
+
+// Record render commands for the entities in the given range of visible rows of an archetype
+// into the current worker's command list, sorted by the depth of their bounds in the view
+void CEntityManager::RecordRenderCommands( CEntityArchetype* archetype, const TUInt32* rows,
+                                           const SRenderView* view, TUInt32 begin, TUInt32 end )
+{
+	CRenderCommandList* commands = m_WorkerCommands[CJobSystem::CurrentWorker()];
+	TUInt32 numRendered = 0;
+	for (TUInt32 visible = begin; visible < end; ++visible)
+	{
+		TUInt32 row = rows ? rows[visible] : visible;
+		CEntity* entity = archetype->GetEntity( row );
+		if (entity->IsDestroyed())
+		{
+			continue;
+		}
+
+		TUInt32 depth = RenderViewDepth( *view, archetype->WorldBounds( row ).centre );
+		entity->AddRenderCommands( commands, depth );
+		++numRendered;
+	}
+	m_NumRenderedEntities += numRendered;
+}
+
+// Merge the workers' command lists, sort the commands and pass them to the render backend
+void CEntityManager::ExecuteRenderCommands()
+{
+	m_RenderCommands.Clear();
+	for (TUInt32 worker = 0; worker < m_WorkerCommands.size(); ++worker)
+	{
+		m_RenderCommands.Append( *m_WorkerCommands[worker] );
+		m_WorkerCommands[worker]->Clear();
+	}
+	m_RenderCommands.Sort();
+
+	m_RenderBackend->BeginFrame();
+	m_RenderBackend->ExecuteCommands( m_RenderCommands.Commands(),
+	                                  m_RenderCommands.NumCommands() );
+	m_RenderBackend->EndFrame();
+}
+
+
+/////////////////////////////////////
+// Pipelined rendering
+
+// Choose whether rendering is pipelined with updates
+void CEntityManager::SetPipelinedRender( bool pipelined )
+{
+	WaitForRender();
+	m_PipelinedRender = pipelined;
+	m_PublishedSnapshot = kNoSnapshot;
+	RefillSnapshots();
+}
+
+// Wait until the render thread has finished any frame it is rendering
+void CEntityManager::WaitForRender()
+{
+	m_RenderThread.WaitIdle();
+	m_RenderingSnapshot = kNoSnapshot;
+}
+
+// Bring the snapshot not being rendered up to date and make it the latest. Absolute matrices
+// are brought up to date first (on all cores if parallel update is on), recording the entities
+// recalculated. Then only the entities that have changed or gone since the snapshot was last
+// filled are copied into it - two updates' worth of changes, as the snapshots are filled in
+// turn. The render thread reads only the snapshot, never the entities
+void CEntityManager::PublishSnapshot()
+{
+	UpdateTransforms();
+
+	// Fill the snapshot that is not the latest. Only wait if the render thread is still on it,
+	// which happens when there are several updates between renders
+	TUInt32 snapshot = (m_PublishedSnapshot == 0) ? 1 : 0;
+	if (snapshot == m_RenderingSnapshot)
+	{
+		WaitForRender();
+	}
+
+	CRenderSnapshot& renderSnapshot = m_Snapshots[snapshot];
+	if (m_RefillSnapshot[snapshot])
+	{
+		renderSnapshot.Clear();
+		for (TUInt32 kind = 0; kind < NumEntityKinds; ++kind)
+		{
+			CEntityArchetype* archetype = m_Archetypes[kind];
+			for (TUInt32 row = 0; row < archetype->NumRows(); ++row)
+			{
+				CEntity* entity = archetype->GetEntity( row );
+				if (!entity->IsDestroyed())
+				{
+					CopyToSnapshot( renderSnapshot, entity );
+				}
+			}
+		}
+		m_RefillSnapshot[snapshot] = false;
+	}
+	else
+	{
+		// A slot may have been changed more than once, or emptied and reused, so copy the
+		// entity now in each slot
+		vector<TUInt32>& changes = m_SnapshotChanges[snapshot];
+		for (TUInt32 change = 0; change < changes.size(); ++change)
+		{
+			CEntity* entity = m_EntitySlots.GetSlotEntity( changes[change] );
+			if (entity && !entity->IsDestroyed())
+			{
+				CopyToSnapshot( renderSnapshot, entity );
+			}
+			else
+			{
+				renderSnapshot.RemoveEntity( changes[change] );
+			}
+		}
+	}
+	m_SnapshotChanges[snapshot].clear();
+	m_PublishedSnapshot = snapshot;
+}
+
+// Copy an entity's mesh, world bounds and absolute matrices into its slot in a snapshot
+void CEntityManager::CopyToSnapshot( CRenderSnapshot& snapshot, CEntity* entity )
+{
+	CEntityTemplate* entityTemplate = entity->Template();
+	snapshot.SetEntity( EntityUIDIndex( entity->GetUID() ), entityTemplate->Mesh(),
+	                    entityTemplate->GetMeshAtom(),
+	                    entity->GetArchetype()->WorldBounds( entity->m_Row ), entity->m_Matrices,
+	                    entityTemplate->Mesh()->GetNumNodes() );
+}
+
+// Render a snapshot with the given view. Runs on the render thread
+void CEntityManager::RenderSnapshot( TUInt32 snapshot, SRenderView view )
+{
+	m_NumRenderedEntities = m_Snapshots[snapshot].Render( view, m_RenderBackend );
+}
+
+// Wait for the render thread and empty both snapshots, so no mesh is used by them
+void CEntityManager::DiscardSnapshots()
+{
+	WaitForRender();
+	m_Snapshots[0].Clear();
+	m_Snapshots[1].Clear();
+	m_PublishedSnapshot = kNoSnapshot;
+	RefillSnapshots();
 }
 
 
@@ -7,12 +7,29 @@
 
 #pragma once
 
-#include <map>
+#include <vector>
+#include <queue>
+#include <functional>
+#include <atomic>
+#include <mutex>
 using namespace std;
 
 #include "Defines.h"
-#include "CHashTable.h"
 #include "Entity.h"
+#include "EntitySlotMap.h"
+#include "PoolAllocator.h"
+#include "MeshCache.h"
+#include "TemplateLoad.h"
+#include "WorkerPool.h"
+#include "JobSystem.h"
+#include "EntitySnapshot.h"
+#include "StringAtoms.h"
+#include "GlobPattern.h"
+#include "EntityQuery.h"
+#include "EntityCommandBuffer.h"
+#include "RenderBackend.h"
+#include "RenderSnapshot.h"
+#include "SpatialGrid.h"
 #include "TankEntity.h"
 #include "ShellEntity.h"
 #include "AmmoEntity.h"
@@ -21,10 +38,22 @@ using namespace std;
 namespace gen
 {
 
+// Team to pass to the spatial queries to find entities on any team (see FindEntitiesInRadius)
+const TUInt32 kAnyTeam = 0xffffffff;
+
 // The entity manager is responsible for creation, update, rendering and deletion of
-// entities. It also manages UIDs for entities using a hash table
+// entities. Entities are stored in archetypes, one for each concrete entity class, which
+// keep the hot entity data in packed columns. It also manages UIDs for entities using a
+// generational slot map
+// Entities created or destroyed during UpdateAllEntities (or while queries are alive) are
+// recorded in a command buffer and the changes are made together afterwards. UIDs for
+// deferred creations are returned immediately, but GetEntity returns 0 for them until the
+// entity is actually created
 class CEntityManager
 {
+	// Queries read the entity storage directly and defer entity destruction while alive
+	friend class CEntityQuery;
+
 /////////////////////////////////////
 //	Constructors/Destructors
 public:
@@ -50,14 +79,37 @@ public:
 
 	// Create a base entity template with the given type, name and mesh. Returns the new entity
 	// template pointer
-	CEntityTemplate* CEntityManager::CreateTemplate( const string& type, const string& name, const string& mesh	);
+	CEntityTemplate* CreateTemplate( const string& type, const string& name, const string& mesh	);
 
 	// Create a tank template with the given type, name, mesh and stats. Returns the new entity
 	// template pointer
-	CTankTemplate* CEntityManager::CreateTankTemplate( const string& type, const string& name,
-	                                                   const string& mesh, float maxSpeed,
-	                                                   float acceleration, float turnSpeed,
-	                                                   float turretTurnSpeed, int maxHP, int startAmmo,int shellDamage );
+	CTankTemplate* CreateTankTemplate( const string& type, const string& name,
+	                                   const string& mesh, float maxSpeed,
+	                                   float acceleration, float turnSpeed,
+	                                   float turretTurnSpeed, int maxHP, int startAmmo,int shellDamage );
+
+
+	// Start creating a base entity template with the given type, name and mesh. The mesh is
+	// loaded on a worker thread and the template is added to the manager by UpdateTemplateLoads
+	// once it has loaded. Entities created using the template name (not a handle) before then
+	// are given UIDs straight away and are created when the template is ready, or cancelled if
+	// it fails. Returns an object to check the progress of the load. If a template of the same
+	// name is already loading then that load is returned instead
+	TTemplateLoad CreateTemplateAsync( const string& type, const string& name, const string& mesh );
+
+	// Start creating a tank template with the given type, name, mesh and stats. As above
+	TTemplateLoad CreateTankTemplateAsync( const string& type, const string& name,
+	                                       const string& mesh, float maxSpeed,
+	                                       float acceleration, float turnSpeed,
+	                                       float turretTurnSpeed, int maxHP, int startAmmo, int shellDamage );
+
+	// Add templates whose meshes have finished loading to the manager and create any entities
+	// waiting for them. Called at the start of UpdateAllEntities, may be called at other times
+	// to make templates available sooner
+	void UpdateTemplateLoads();
+
+	// Wait for all template loads to finish, then add the templates as UpdateTemplateLoads
+	void WaitForTemplateLoads();
 
 
 	// Destroy the given template (name) - returns true if the template existed and was destroyed
@@ -67,6 +119,50 @@ public:
 	void DestroyAllTemplates();
 
 
+	/////////////////////////////////////
+	// Template resolution
+
+	// Look up a template once and return a handle to create entities of one kind with it. The
+	// handle is invalid if there is no template with the given name, or for tanks if it is not
+	// a tank template. Atom versions avoid hashing the name. A handle is not updated if its
+	// template is destroyed, so do not keep handles across calls to DestroyTemplate
+	TEntityTemplateHandle ResolveEntityTemplate( const string& name )
+	{
+		return ResolveEntityTemplate( FindAtom( name ) );
+	}
+	TEntityTemplateHandle ResolveEntityTemplate( TAtom name )
+	{
+		return TEntityTemplateHandle( GetTemplate( name ) );
+	}
+
+	TTankTemplateHandle ResolveTankTemplate( const string& name )
+	{
+		return ResolveTankTemplate( FindAtom( name ) );
+	}
+	TTankTemplateHandle ResolveTankTemplate( TAtom name )
+	{
+		return TTankTemplateHandle( dynamic_cast<CTankTemplate*>(GetTemplate( name )) );
+	}
+
+	TShellTemplateHandle ResolveShellTemplate( const string& name )
+	{
+		return ResolveShellTemplate( FindAtom( name ) );
+	}
+	TShellTemplateHandle ResolveShellTemplate( TAtom name )
+	{
+		return TShellTemplateHandle( GetPlainTemplate( name ) );
+	}
+
+	TAmmoTemplateHandle ResolveAmmoTemplate( const string& name )
+	{
+		return ResolveAmmoTemplate( FindAtom( name ) );
+	}
+	TAmmoTemplateHandle ResolveAmmoTemplate( TAtom name )
+	{
+		return TAmmoTemplateHandle( GetPlainTemplate( name ) );
+	}
+
+
 	/////////////////////////////////////
 	// Entity creation / destruction
 
@@ -79,7 +175,10 @@ public:
 		const CVector3&  position = CVector3::kOrigin, 
 		const CVector3&  rotation = CVector3( 0.0f, 0.0f, 0.0f ),
 		const CVector3&  scale = CVector3( 1.0f, 1.0f, 1.0f )
-	);
+	)
+	{
+		return CreateEntity( FindAtom( templateName ), InternAtom( name ), position, rotation, scale );
+	}
 
 	// Create a tank, requires a tank template name and team number, may supply entity name and
 	// position. Returns the UID of the new entity
@@ -91,7 +190,10 @@ public:
 		const CVector3& position = CVector3::kOrigin,
 		const CVector3& rotation = CVector3(0.0f, 0.0f, 0.0f),
 		const CVector3& scale = CVector3(1.0f, 1.0f, 1.0f)
-	);
+	)
+	{
+		return CreateTank( FindAtom( templateName ), team, InternAtom( name ), position, rotation, scale );
+	}
 
 	// Create a shell, requires a shell template name, may supply entity name and position
 	// Returns the UID of the new entity
@@ -103,7 +205,10 @@ public:
 		const CVector3& position = CVector3::kOrigin,
 		const CVector3& rotation = CVector3(0.0f, 0.0f, 0.0f),
 		const CVector3& scale = CVector3(1.0f, 1.0f, 1.0f)
-	);
+	)
+	{
+		return CreateShell( FindAtom( templateName ), ShooterUID, InternAtom( name ), position, rotation, scale );
+	}
 
 
 	// Create an ammo box, requires an ammo template name, may supply entity name and position
@@ -116,88 +221,413 @@ public:
 		const CVector3& position = CVector3::kOrigin,
 		const CVector3& rotation = CVector3(0.0f, 0.0f, 0.0f),
 		const CVector3& scale = CVector3(1.0f, 1.0f, 1.0f)
+	)
+	{
+		return CreateAmmo( FindAtom( templateName ), ShooterUID, InternAtom( name ), position, rotation, scale );
+	}
+
+
+	// Versions of the functions above taking the template name and entity name as atoms (see
+	// StringAtoms.h), which avoid any string hashing. Use these when creating entities often
+	TEntityUID CreateEntity
+	(
+		TAtom            templateName,
+		TAtom            name = kNoAtom,
+		const CVector3&  position = CVector3::kOrigin, 
+		const CVector3&  rotation = CVector3( 0.0f, 0.0f, 0.0f ),
+		const CVector3&  scale = CVector3( 1.0f, 1.0f, 1.0f )
+	)
+	{
+		TEntityTemplateHandle entityTemplate = ResolveEntityTemplate( templateName );
+		if (!entityTemplate.IsValid())
+		{
+			// The template may still be loading, if so the creation waits for it
+			return QueueCreate( Kind_Base, templateName, name, position, rotation, scale, 0, SystemUID );
+		}
+		return CreateEntity( entityTemplate, name, position, rotation, scale );
+	}
+	TEntityUID CreateTank
+	(
+		TAtom           templateName,
+		TUInt32         team,
+		TAtom           name = kNoAtom,
+		const CVector3& position = CVector3::kOrigin,
+		const CVector3& rotation = CVector3(0.0f, 0.0f, 0.0f),
+		const CVector3& scale = CVector3(1.0f, 1.0f, 1.0f)
+	)
+	{
+		TTankTemplateHandle tankTemplate = ResolveTankTemplate( templateName );
+		if (!tankTemplate.IsValid())
+		{
+			// The template may still be loading, if so the creation waits for it
+			return QueueCreate( Kind_Tank, templateName, name, position, rotation, scale, team, SystemUID );
+		}
+		return CreateTank( tankTemplate, team, name, position, rotation, scale );
+	}
+	TEntityUID CreateShell
+	(
+		TAtom           templateName,
+		TEntityUID      ShooterUID,
+		TAtom           name = kNoAtom,
+		const CVector3& position = CVector3::kOrigin,
+		const CVector3& rotation = CVector3(0.0f, 0.0f, 0.0f),
+		const CVector3& scale = CVector3(1.0f, 1.0f, 1.0f)
+	)
+	{
+		TShellTemplateHandle shellTemplate = ResolveShellTemplate( templateName );
+		if (!shellTemplate.IsValid())
+		{
+			// The template may still be loading, if so the creation waits for it
+			return QueueCreate( Kind_Shell, templateName, name, position, rotation, scale, 0, ShooterUID );
+		}
+		return CreateShell( shellTemplate, ShooterUID, name, position, rotation, scale );
+	}
+	TEntityUID CreateAmmo
+	(
+		TAtom           templateName,
+		TEntityUID      ShooterUID,
+		TAtom           name = kNoAtom,
+		const CVector3& position = CVector3::kOrigin,
+		const CVector3& rotation = CVector3(0.0f, 0.0f, 0.0f),
+		const CVector3& scale = CVector3(1.0f, 1.0f, 1.0f)
+	)
+	{
+		TAmmoTemplateHandle ammoTemplate = ResolveAmmoTemplate( templateName );
+		if (!ammoTemplate.IsValid())
+		{
+			// The template may still be loading, if so the creation waits for it
+			return QueueCreate( Kind_Ammo, templateName, name, position, rotation, scale, 0, ShooterUID );
+		}
+		return CreateAmmo( ammoTemplate, ShooterUID, name, position, rotation, scale );
+	}
+
+
+	// Versions of the functions above taking a template handle from one of the Resolve functions
+	// above. These do no template lookup at all, use them for entities created repeatedly (e.g.
+	// shells). If the handle is invalid, or there are already as many entities as there can be
+	// UIDs (CEntitySlotMap::kMaxSlots), no entity is created and SystemUID is returned
+	TEntityUID CreateEntity
+	(
+		const TEntityTemplateHandle& entityTemplate,
+		TAtom            name = kNoAtom,
+		const CVector3&  position = CVector3::kOrigin, 
+		const CVector3&  rotation = CVector3( 0.0f, 0.0f, 0.0f ),
+		const CVector3&  scale = CVector3( 1.0f, 1.0f, 1.0f )
+	);
+	TEntityUID CreateTank
+	(
+		const TTankTemplateHandle& tankTemplate,
+		TUInt32         team,
+		TAtom           name = kNoAtom,
+		const CVector3& position = CVector3::kOrigin,
+		const CVector3& rotation = CVector3(0.0f, 0.0f, 0.0f),
+		const CVector3& scale = CVector3(1.0f, 1.0f, 1.0f)
+	);
+	TEntityUID CreateShell
+	(
+		const TShellTemplateHandle& shellTemplate,
+		TEntityUID      ShooterUID,
+		TAtom           name = kNoAtom,
+		const CVector3& position = CVector3::kOrigin,
+		const CVector3& rotation = CVector3(0.0f, 0.0f, 0.0f),
+		const CVector3& scale = CVector3(1.0f, 1.0f, 1.0f)
+	);
+	TEntityUID CreateAmmo
+	(
+		const TAmmoTemplateHandle& ammoTemplate,
+		TEntityUID      ShooterUID,
+		TAtom           name = kNoAtom,
+		const CVector3& position = CVector3::kOrigin,
+		const CVector3& rotation = CVector3(0.0f, 0.0f, 0.0f),
+		const CVector3& scale = CVector3(1.0f, 1.0f, 1.0f)
 	);
 
 
 
-	// Destroy the given entity - returns true if the entity existed and was destroyed
+	// Create a number of tanks from one tank template in a single operation, e.g. a wave of
+	// tanks at level load. The position, rotation and team of each tank are taken from the
+	// given arrays (rotations may be 0 for no rotation). The UIDs of the new tanks are written
+	// to the UIDs array if one is given. Storage for all the tanks is grown once up front
+	// rather than tank by tank. Returns the number of tanks created, 0 if the handle is invalid
+	// or there are not enough UIDs left for them all (then no tanks are created)
+	TUInt32 CreateTanks
+	(
+		const TTankTemplateHandle& tankTemplate,
+		TUInt32         numTanks,
+		const CVector3* positions,
+		const CVector3* rotations,
+		const TUInt32*  teams,
+		TEntityUID*     UIDs = 0
+	);
+
+	// Create a number of shells from one template in a single operation, e.g. a barrage, all
+	// fired by the same entity. Other parameters are as for CreateTanks
+	TUInt32 CreateShells
+	(
+		const TShellTemplateHandle& shellTemplate,
+		TUInt32         numShells,
+		TEntityUID      ShooterUID,
+		const CVector3* positions,
+		const CVector3* rotations,
+		TEntityUID*     UIDs = 0
+	);
+
+
+	// Destroy the given entity - returns true if the entity existed and was destroyed. Can also
+	// cancel a deferred creation
 	bool DestroyEntity( TEntityUID UID );
 
 	// Destroy all entities held by the manager
 	void DestroyAllEntities();
 
 
+	/////////////////////////////////////
+	// Snapshots
+
+	// Save all entities to a binary snapshot file (see EntitySnapshot.h): their UIDs, names,
+	// templates (by name), matrices, update schedules, sleep state and kind-specific data.
+	// Returns false if the file cannot be written, or if called during update or while queries
+	// are alive
+	bool SaveSnapshot( const string& fileName );
+
+	// Replace all entities with those in a snapshot file. The file is mapped into memory and
+	// the entities are created directly from its records, with the same UIDs as when saved.
+	// All templates used must exist and have the same meshes. Returns false, leaving the
+	// current entities in place, if the file is missing, from an incompatible build, or does
+	// not match the templates. Also fails during update, while queries are alive or while
+	// templates are loading
+	bool LoadSnapshot( const string& fileName );
+
+
 	/////////////////////////////////////
 	// Template / Entity access
 
 	// Return the template with the given name
 	CEntityTemplate* GetTemplate( const string& name )
 	{
-		// Find the template name in the template map
-		TTemplateIter entityTemplate = m_Templates.find( name );
-		if (entityTemplate == m_Templates.end())
+		return GetTemplate( FindAtom( name ) );
+	}
+
+	// Return the template with the given name atom
+	CEntityTemplate* GetTemplate( TAtom name )
+	{
+		if (name >= m_Templates.size())
 		{
 			// Template name not found
 			return 0;
 		}
-		return (*entityTemplate).second;
+		return m_Templates[name];
+	}
+
+	// Return the template with the given name atom if it is a plain template, or 0 if it
+	// does not exist or is a template for a specific kind of entity (e.g. a tank template).
+	// Shells and ammo are created from plain templates only
+	CEntityTemplate* GetPlainTemplate( TAtom name )
+	{
+		CEntityTemplate* entityTemplate = GetTemplate( name );
+		if (dynamic_cast<CTankTemplate*>(entityTemplate))
+		{
+			return 0;
+		}
+		return entityTemplate;
 	}
 
 
 	// Return the number of entities
 	TUInt32 NumEntities() 
 	{
-		return static_cast<TUInt32>(m_Entities.size());
+		TUInt32 numEntities = 0;
+		for (TUInt32 kind = 0; kind < NumEntityKinds; ++kind)
+		{
+			numEntities += m_Archetypes[kind]->NumRows();
+		}
+		return numEntities;
 	}
 
-	// Return the entities at the given array index
+	// Return the entities at the given index. Indexes run through each archetype in turn
 	CEntity* GetEntityAtIndex( TUInt32 index )
 	{
-		return m_Entities[index];
+		TUInt32 kind = 0;
+		while (index >= m_Archetypes[kind]->NumRows())
+		{
+			index -= m_Archetypes[kind]->NumRows();
+			++kind;
+		}
+		return m_Archetypes[kind]->GetEntity( index );
 	}
 
-	// Return the entity with the given UID
+	// Return the archetype holding all entities of the given kind
+	CEntityArchetype* GetArchetype( EEntityKind kind )
+	{
+		return m_Archetypes[kind];
+	}
+
+	// Return the entity with the given UID, or 0 if the entity no longer exists
 	CEntity* GetEntity( TEntityUID UID )
 	{
-		// Find the entity UID in the entity hash map
-		TUInt32 entityIndex;
-		if (!m_EntityUIDMap->LookUpKey( UID, &entityIndex ))
-		{
-			return 0;
-		}
-		return m_Entities[entityIndex];
+		return m_EntitySlots.GetEntity( UID );
 	}
 
 	// Return the entity with the given name & optionally the given template name & type
+	// If a name is given then only entities with that name are searched (using the name index),
+	// otherwise if a type is given then only entities of that type are searched. If several
+	// entities match, any one of them may be returned
 	CEntity* GetEntity( const string& name, const string& templateName = "",
 	                    const string& templateType = "" )
 	{
-		TEntityIter entity = m_Entities.begin();
-		while (entity != m_Entities.end())
+		CEntityQuery query( *this, name, templateName, templateType );
+		return query.Next();
+	}
+
+
+	/////////////////////////////////////
+	// Entity indices
+
+	// Return the list of entities whose template has the given type, or 0 if there have never
+	// been any entities of that type
+	CEntityList* GetTypeList( const string& templateType )
+	{
+		return GetTypeList( FindAtom( templateType ) );
+	}
+	CEntityList* GetTypeList( TAtom templateType )
+	{
+		if (templateType >= m_TypeIndex.size())
 		{
-			if ((*entity)->GetName() == name && 
-				(templateName.length() == 0 || (*entity)->Template()->GetName() == templateName) &&
-				(templateType.length() == 0 || (*entity)->Template()->GetType() == templateType))
-			{
-				return (*entity);
-			}
-			++entity;
+			return 0;
 		}
-		return 0;
+		return m_TypeIndex[templateType];
+	}
+
+	// Return all entities whose template has the given type. The span is invalidated by any
+	// entity creation or destruction. During update or while entity queries are alive the
+	// span may include destroyed entities (see CEntity::IsDestroyed)
+	CEntitySpan GetEntitiesOfType( const string& templateType )
+	{
+		return GetEntitiesOfType( FindAtom( templateType ) );
+	}
+	CEntitySpan GetEntitiesOfType( TAtom templateType )
+	{
+		CEntityList* typeList = GetTypeList( templateType );
+		if (!typeList)
+		{
+			return CEntitySpan();
+		}
+		return typeList->Entities();
+	}
+
+	// Return the list of entities with the given name, or 0 if there are no entities with that
+	// name. Unnamed entities are not indexed by name
+	CEntityList* GetNameList( const string& name )
+	{
+		return GetNameList( FindAtom( name ) );
+	}
+	CEntityList* GetNameList( TAtom name )
+	{
+		TNameIndexIter nameList = m_NameIndex.find( name );
+		if (nameList == m_NameIndex.end())
+		{
+			return 0;
+		}
+		return nameList->second;
+	}
+
+	// Return all entities with the given name - there may be several entities with the same
+	// name. The span is invalidated by any entity creation or destruction. During update or
+	// while entity queries are alive the span may include destroyed entities
+	CEntitySpan GetEntitiesWithName( const string& name )
+	{
+		return GetEntitiesWithName( FindAtom( name ) );
+	}
+	CEntitySpan GetEntitiesWithName( TAtom name )
+	{
+		CEntityList* nameList = GetNameList( name );
+		if (!nameList)
+		{
+			return CEntitySpan();
+		}
+		return nameList->Entities();
+	}
+
+	// Return the number of team lists - one more than the highest team number used by a tank
+	TUInt32 NumTeams()
+	{
+		return static_cast<TUInt32>(m_TeamIndex.size());
+	}
+
+	// Return all tanks on the given team. The span is invalidated by any entity creation or
+	// destruction
+	CEntitySpan GetTeamEntities( TUInt32 team )
+	{
+		if (team >= m_TeamIndex.size())
+		{
+			return CEntitySpan();
+		}
+		return m_TeamIndex[team]->Entities();
+	}
+
+
+	/////////////////////////////////////
+	// Spatial queries
+
+	// Find the entities whose position at the start of the last update (see
+	// CEntity::FrameStartPosition) is within the given radius of a point, or inside the box
+	// between the given minimum and maximum points. Pass a template type atom to find only
+	// entities of that type, and a team to find only tanks on that team. The entities found
+	// replace the contents of the given vector and their number is returned. Uses a spatial
+	// grid brought up to date at the start of each update, so entities created since then are
+	// not found. Safe to call from entity updates, including parallel updates
+	TUInt32 FindEntitiesInRadius( const CVector3& centre, TFloat32 radius,
+	                              vector<CEntity*>* found, TAtom templateType = kNoAtom,
+	                              TUInt32 team = kAnyTeam );
+	TUInt32 FindEntitiesInBox( const CVector3& minPoint, const CVector3& maxPoint,
+	                           vector<CEntity*>* found, TAtom templateType = kNoAtom,
+	                           TUInt32 team = kAnyTeam );
+
+	// Find any one entity within the given radius of a point, other than the entity with the
+	// given UID, with the same filters and limitations as FindEntitiesInRadius. Returns 0 if
+	// there is none. Allocates no memory, so suits checks made by many entities every update
+	CEntity* FindEntityInRadius( const CVector3& centre, TFloat32 radius,
+	                             TAtom templateType = kNoAtom, TUInt32 team = kAnyTeam,
+	                             TEntityUID exclude = SystemUID );
+
+	// Set the size of the spatial grid's cells - best around the radius of the most frequent
+	// queries (kDefaultGridCellSize by default)
+	void SetSpatialCellSize( TFloat32 cellSize )
+	{
+		m_SpatialGrid.SetCellSize( cellSize );
 	}
 
 
 	// Begin an enumeration of entities matching given name, template name and type
-	// An empty string indicates to match anything in this field (would be nice to support
-	// wildcards, e.g. match name of "Ship*")
+	// An empty string indicates to match anything in this field. Each field may be a glob
+	// pattern, e.g. match name of "Ship*" (see CGlobPattern)
+	// There is only one enumeration for the whole manager and it is cancelled by any entity
+	// creation or destruction. Prefer CEntityQuery, which doesn't have these limitations
+	// If an exact type is given, only the entities of that type are visited, otherwise if an
+	// exact name is given only the entities with that name are visited
 	void BeginEnumEntities( const string& name, const string& templateName,
 	                        const string& templateType = "" )
 	{
 		m_IsEnumerating = true;
-		m_EnumEntity = m_Entities.begin();
-		m_EnumName = name;
-		m_EnumTemplateName = templateName;
-		m_EnumTemplateType = templateType;
+		m_EnumKind = 0;
+		m_EnumRow = 0;
+		m_EnumName.Compile( name );
+		m_EnumTemplateName.Compile( templateName );
+		m_EnumType.Compile( templateType );
+		if (m_EnumType.IsLiteral())
+		{
+			m_EnumListEntities = GetEntitiesOfType( m_EnumType.GetLiteral() );
+			m_EnumByList = true;
+		}
+		else if (m_EnumName.IsLiteral())
+		{
+			m_EnumListEntities = GetEntitiesWithName( m_EnumName.GetLiteral() );
+			m_EnumByList = true;
+		}
+		else
+		{
+			m_EnumByList = false;
+		}
 	}
 
 	// Finish enumerating entities (see above)
@@ -215,19 +645,37 @@ public:
 			return 0;
 		}
 
-		while (m_EnumEntity != m_Entities.end())
+		// Visit only the entities of the given type or name. Any creation or destruction cancels
+		// the enumeration so the span stays valid
+		if (m_EnumByList)
 		{
-			if ((m_EnumName.length() == 0 || (*m_EnumEntity)->GetName() == m_EnumName) && 
-				(m_EnumTemplateName.length() == 0 ||
-				 (*m_EnumEntity)->Template()->GetName() == m_EnumTemplateName) &&
-				(m_EnumTemplateType.length() == 0 ||
-				 (*m_EnumEntity)->Template()->GetType() == m_EnumTemplateType))
+			while (m_EnumRow < m_EnumListEntities.size())
 			{
-				CEntity* foundEntity = *m_EnumEntity;
-				++m_EnumEntity;
-				return foundEntity;
+				CEntity* entity = m_EnumListEntities[m_EnumRow];
+				++m_EnumRow;
+				if (EnumMatches( entity ))
+				{
+					return entity;
+				}
 			}
-			++m_EnumEntity;
+			m_IsEnumerating = false;
+			return 0;
+		}
+
+		while (m_EnumKind < NumEntityKinds)
+		{
+			CEntityArchetype* archetype = m_Archetypes[m_EnumKind];
+			while (m_EnumRow < archetype->NumRows())
+			{
+				CEntity* entity = archetype->GetEntity( m_EnumRow );
+				++m_EnumRow;
+				if (EnumMatches( entity ))
+				{
+					return entity;
+				}
+			}
+			++m_EnumKind;
+			m_EnumRow = 0;
 		}
 		
 		m_IsEnumerating = false;
@@ -235,15 +683,104 @@ public:
 	}
 
 
+	/////////////////////////////////////
+	// Sleeping
+
+	// Put the entity with the given UID to sleep - it is not updated until a message is sent to
+	// it or it is woken with WakeEntity, or until the given time has passed if that is more
+	// than 0. Sleeping entities cost nothing in the update. An entity with messages waiting
+	// stays awake. During an update the entity falls asleep when the update ends. Returns
+	// false if the UID is not found
+	bool SleepEntity( TEntityUID UID, TFloat32 wakeAfter = 0.0f );
+
+	// Wake the entity with the given UID so it is updated again. During an update the entity
+	// is woken when the update ends. Returns false if the UID is not found
+	bool WakeEntity( TEntityUID UID );
+
+	// Number of entities that are awake, i.e. the number the update visits
+	TUInt32 NumAwakeEntities()
+	{
+		TUInt32 numAwake = 0;
+		for (TUInt32 kind = 0; kind < NumEntityKinds; ++kind)
+		{
+			numAwake += m_AwakeLists[kind]->Size();
+		}
+		return numAwake;
+	}
+
+
 	/////////////////////////////////////
 	// Update / Rendering
 
 	// Call all entity update functions - not the ideal method, OK for this example
-	// Pass the time since last update
+	// Pass the time since last update. Entities created during the update are not updated
+	// until the next call. Templates that have finished loading are added first
+	// Entities with an update interval above 1 (see CEntity::SetUpdateInterval) are spread
+	// over the frames and passed the total time since their previous update
 	void UpdateAllEntities( float updateTime );
 
+	// Choose whether UpdateAllEntities updates entities on all cores. In a parallel update
+	// entities must only change their own data, and read other entities through their frame
+	// start state (e.g. FrameStartPosition), which is the state at the start of the update.
+	// Messages sent during a parallel update are delivered when it ends. Off by default
+	void SetParallelUpdate( bool parallel )
+	{
+		m_ParallelUpdate = parallel;
+	}
+	bool IsParallelUpdate()
+	{
+		return m_ParallelUpdate;
+	}
+
+	// Recalculate the absolute node matrices of all entities that have moved since the last
+	// call. Only awake entities and sleeping entities that have been moved are visited, and
+	// only their changed nodes are recalculated, so static scenery costs nothing. Split between all cores if parallel update is on. Called by RenderAllEntities
+	void UpdateTransforms();
+
 	// Render all entities - not the ideal method, OK for this example
-	void RenderAllEntities();
+	// If a camera is given, only entities whose bounding spheres are at least partly inside
+	// the camera's view frustum are rendered. If a render backend is set, visible entities
+	// record render commands, which are sorted and executed by the backend - on the render
+	// thread if rendering is pipelined (see SetPipelinedRender)
+	void RenderAllEntities( CCamera* camera = 0 );
+
+	// Set the backend used to execute render commands, or 0 to render each entity with its own
+	// mesh render call (the default). With a backend, commands are recorded on all cores if
+	// parallel update is on, then sorted by mesh, node and depth so the backend can draw each
+	// mesh node once for all visible entities. The manager does not own the backend
+	void SetRenderBackend( CRenderBackend* backend )
+	{
+		WaitForRender();
+		m_RenderBackend = backend;
+		RefillSnapshots();
+	}
+	CRenderBackend* GetRenderBackend()
+	{
+		return m_RenderBackend;
+	}
+
+	// Choose whether rendering is pipelined with updates (needs a render backend). When it is,
+	// each UpdateAllEntities ends by publishing a snapshot of the entity transforms, and
+	// RenderAllEntities passes the latest snapshot to a render thread and returns at once - so
+	// the next update runs while the render thread culls, sorts and executes the previous
+	// frame. The backend is then only called from the render thread. What is rendered is the
+	// state at the end of the last update, entities changed since then appear next frame. Off
+	// by default
+	void SetPipelinedRender( bool pipelined );
+	bool IsPipelinedRender()
+	{
+		return m_PipelinedRender;
+	}
+
+	// Wait until the render thread has finished any frame it is rendering. Does nothing if
+	// rendering is not pipelined
+	void WaitForRender();
+
+	// Number of entities rendered by the last call to RenderAllEntities
+	TUInt32 NumRenderedEntities()
+	{
+		return m_NumRenderedEntities;
+	}
 
 		
 /////////////////////////////////////
@@ -253,13 +790,194 @@ private:
 	/////////////////////////////////////
 	// Types
 
-	// Entity templates are held in a map, define some types for convenience
-	typedef map<string, CEntityTemplate*> TTemplates;
-	typedef TTemplates::iterator TTemplateIter;
+	// Entity templates are held in a list indexed by the atom of the template name. Entries
+	// are 0 for atoms that are not template names
+	typedef vector<CEntityTemplate*> TTemplates;
+
+	// Index of entity lists by template type atom, entries are 0 for atoms that are not types
+	typedef vector<CEntityList*> TTypeIndex;
+
+	// Index of tank lists by team number
+	typedef vector<CEntityList*> TTeamIndex;
+
+	// The index of entity lists by name atom (TNameIndex) is in EntityIndex.h, as queries
+	// also walk it
+
+
+	/////////////////////////////////////
+	// Template maintenance
+
+	// Add a new template to the template list, in the entry for its name atom
+	void AddTemplate( CEntityTemplate* newTemplate );
+
+	// Record a new asynchronous template load and start loading its mesh, unless the mesh is
+	// already loaded or being loaded by another template
+	void StartTemplateLoad( const TTemplateLoad& load );
+
+	// Create the template for a load whose mesh is available (or fail it), then create or
+	// cancel the entities queued for it. Returns false if the load must wait for another
+	// template load loading the same mesh
+	bool FinishTemplateLoad( CTemplateLoad* load );
+
+	// Queue the creation of an entity using the given template name if that template is being
+	// loaded, returning the entity's reserved UID. Returns SystemUID if the template is not
+	// loading (or is the wrong class for the entity kind)
+	TEntityUID QueueCreate( EEntityKind kind, TAtom templateName, TAtom name, const CVector3& position,
+	                        const CVector3& rotation, const CVector3& scale, TUInt32 team,
+	                        TEntityUID shooter );
+
+
+	/////////////////////////////////////
+	// Index maintenance
+
+	// Add a new entity to the index for its template type
+	void AddToTypeIndex( CEntity* entity );
+
+	// Add a new tank to the index for its team
+	void AddToTeamIndex( CEntity* entity, TUInt32 team );
+
+	// Add a new named entity to the index for its name
+	void AddToNameIndex( CEntity* entity );
+
+	// Remove an entity from all indices it is in, and from the spatial grid
+	void RemoveFromIndices( CEntity* entity );
+
+
+	/////////////////////////////////////
+	// Structural changes
+
+	// Returns true if entity creation and destruction must be deferred - i.e. during update
+	// or while any queries are alive
+	bool IsDeferring()
+	{
+		return m_IsUpdating || m_NumLiveQueries > 0;
+	}
+
+	// Allocate a UID for the entity described by the given command (UID is filled in) and
+	// create it, or record the command if creation must be deferred. Returns the new UID, or
+	// SystemUID if no UID is left
+	TEntityUID SubmitCreate( SCreateCommand& command );
+
+	// Create the entity described by the given command, its UID has already been allocated
+	void ConstructEntity( const SCreateCommand& command );
+
+	// Create a batch of entities described by the given command, which has the parameters
+	// shared by the batch. Positions and any rotations and teams are given per entity. UIDs
+	// are allocated for the whole batch at once and storage is grown once before the entities
+	// are created, or the creations are recorded if they must be deferred. The UIDs are
+	// written to the given array if there is one. Returns false, creating nothing, if there
+	// are not enough UIDs left for the batch
+	bool SubmitCreates( SCreateCommand& command, TUInt32 numEntities, const CVector3* positions,
+	                    const CVector3* rotations, const TUInt32* teams, TEntityUID* UIDs );
+
+	// Destruct the given entity and return its memory to the pool for its kind
+	void DeleteEntity( CEntity* entity );
+
+	// Carry out all deferred creations and destructions. Does nothing if still deferring
+	void FlushCommands();
+
+
+	/////////////////////////////////////
+	// Update support
+
+	// Update the entities in the given range of positions in an awake list that are due an
+	// update this frame. Used by both serial and parallel updates
+	void UpdateEntities( CEntityList* awakeList, TUInt32 begin, TUInt32 end );
+
+	// Move the entities in the spatial grid to their frame start positions, adding any new
+	// entities. Called at the start of each update
+	void UpdateSpatialGrid();
+
+	// Recalculate the absolute matrices of the entities in the given range of positions in a
+	// list (an awake or dirty list). Used by both serial and parallel transform passes
+	void CalculateTransforms( CEntityList* list, TUInt32 begin, TUInt32 end );
+
+
+	/////////////////////////////////////
+	// Render support
+
+	// Record render commands for the entities in the given range of visible rows of an
+	// archetype into the current worker's command list. Rows are given by the list of rows, or
+	// are the positions in the range if there is no list. Depths are from the given view.
+	// Used by both serial and parallel recording
+	void RecordRenderCommands( CEntityArchetype* archetype, const TUInt32* rows,
+	                           const SRenderView* view, TUInt32 begin, TUInt32 end );
+
+	// Merge the workers' command lists, sort the commands and pass them to the render backend
+	void ExecuteRenderCommands();
+
+	// Bring the snapshot not being rendered up to date and make it the latest. Called at the
+	// end of each update when rendering is pipelined
+	void PublishSnapshot();
+
+	// Returns true if snapshots are being kept up to date, i.e. rendering is pipelined
+	bool IsSnapshotting()
+	{
+		return m_PipelinedRender && m_RenderBackend;
+	}
+
+	// Record that the entity in the given snapshot slot (UID index) has changed or gone, for
+	// each snapshot that is not going to be refilled anyway
+	void NoteSnapshotChange( TUInt32 slot )
+	{
+		for (TUInt32 snapshot = 0; snapshot < 2; ++snapshot)
+		{
+			if (!m_RefillSnapshot[snapshot])
+			{
+				m_SnapshotChanges[snapshot].push_back( slot );
+			}
+		}
+	}
 
-	// Entity instances are held in a vector, define some types for convenience
-	typedef vector<CEntity*> TEntities;
-	typedef TEntities::iterator TEntityIter;
+	// Make the next publish of each snapshot refill it from all entities. Used when changes
+	// have not been recorded, e.g. before rendering was pipelined
+	void RefillSnapshots()
+	{
+		for (TUInt32 snapshot = 0; snapshot < 2; ++snapshot)
+		{
+			m_RefillSnapshot[snapshot] = true;
+			m_SnapshotChanges[snapshot].clear();
+		}
+	}
+
+	// Copy an entity's mesh, world bounds and absolute matrices into its slot (UID index) in
+	// the given snapshot
+	void CopyToSnapshot( CRenderSnapshot& snapshot, CEntity* entity );
+
+	// Render a snapshot with the given view. Runs on the render thread
+	void RenderSnapshot( TUInt32 snapshot, SRenderView view );
+
+	// Wait for the render thread and empty both snapshots, so no mesh is used by them. Called
+	// before templates (and their meshes) are destroyed
+	void DiscardSnapshots();
+
+
+	/////////////////////////////////////
+	// Sleep support
+
+	// Put an entity to sleep, with the given wake time (0 for none), or wake it. Not during
+	// update. Does nothing for entities whose class has no update, they are always asleep
+	void SetAsleep( CEntity* entity, bool asleep, TFloat64 wakeTime );
+
+	// Wake the sleeping entities whose wake time has come or that have been sent messages
+	void WakeEntities();
+
+	// Make the sleep and wake changes requested during the update
+	void ApplySleepChanges();
+
+
+	/////////////////////////////////////
+	// Query support
+
+	// Called by CEntityQuery as queries start and end - may be called from any thread
+	void BeginQuery()
+	{
+		++m_NumLiveQueries;
+	}
+	void EndQuery()
+	{
+		--m_NumLiveQueries;
+	}
 
 
 	/////////////////////////////////////
@@ -268,30 +986,174 @@ private:
 	// The map of template names / templates
 	TTemplates m_Templates;
 
+	// Meshes used by the templates, templates using the same mesh file share one mesh
+	CMeshCache m_MeshCache;
+
+	// Templates being created asynchronously, by template name atom. Loads are removed when
+	// their template is added to the manager or they fail
+	typedef unordered_map<TAtom, TTemplateLoad> TTemplateLoads;
+	typedef TTemplateLoads::iterator TTemplateLoadsIter;
+	TTemplateLoads m_TemplateLoads;
+
 
 	/////////////////////////////////////
 	// Entity Data
 
-	// The main list of entities. This vector is kept packed - i.e. with no gaps. If an
-	// entity is removed from the middle of the list, the last entity is moved down to
-	// fill its space
-	TEntities m_Entities;
+	// The entities, stored in one archetype per entity kind. Each archetype is kept packed
+	// - i.e. with no gaps. If an entity is removed from the middle of an archetype, the last
+	// entity is moved down to fill its space
+	CEntityArchetype* m_Archetypes[NumEntityKinds];
+
+	// The memory for entity objects comes from a pool for each kind, and the memory for their
+	// node matrices from an arena shared by all kinds. Both keep freed memory for reuse, so
+	// steady creation and destruction of entities makes no global allocator calls
+	CPoolAllocator* m_EntityPools[NumEntityKinds];
+	CMatrixArena    m_MatrixArena;
+
+	// A mapping from UIDs to entities, also provides the UIDs. Entity objects never move, so
+	// this mapping is not affected when archetype rows are moved around
+	CEntitySlotMap m_EntitySlots;
 
-	// A mapping from UIDs to indexes into the above array
-	CHashTable<TEntityUID, TUInt32>* m_EntityUIDMap;
+	// Lists of entities for each template type and tanks for each team, kept up to date on
+	// entity creation and destruction. Lists are created on demand and never deleted until
+	// the manager is destroyed
+	TTypeIndex m_TypeIndex;
+	TTeamIndex m_TeamIndex;
 
-	// Entity IDs are provided using a single increasing integer
-	TEntityUID m_NextUID;
+	// Lists of entities for each name, hashed by name atom. Names are often unique, so a
+	// name's list is deleted when its last entity is removed
+	TNameIndex m_NameIndex;
+
+	// Entities by frame start position, for spatial queries. Moved entities change cells at
+	// the start of each update, destroyed entities are removed with their indices
+	CSpatialGrid m_SpatialGrid;
+
+	// Number of entity queries currently alive
+	atomic<TUInt32> m_NumLiveQueries;
+
+	// Set during UpdateAllEntities
+	bool m_IsUpdating;
+
+	// Number of updates so far and total time passed to them. Entities' update schedules are
+	// based on these. The clock is double precision so time differences stay accurate
+	TUInt32  m_UpdateFrame;
+	TFloat64 m_UpdateClock;
+
+	// Update clock that entities being woken count their next update time from - the start of
+	// the current update, or the end of the last one. An entity's first update after waking is
+	// passed the time since then, not the whole time it was asleep
+	TFloat64 m_WakeClock;
+
+	// Awake entities of each kind - the update walks these lists, not the archetypes
+	CEntityList* m_AwakeLists[NumEntityKinds];
+
+	// Sleep and wake changes requested during the update, made when it ends
+	struct SSleepChange
+	{
+		TEntityUID UID;
+		bool       asleep;
+		TFloat64   wakeTime;
+	};
+	vector<SSleepChange> m_SleepChanges;
+
+	// Wake times of sleeping entities, earliest first. An entity woken early or put back to
+	// sleep leaves its old entry behind, entries are checked against the entity's current
+	// wake time when they come up
+	struct SWakeTimer
+	{
+		TFloat64   time;
+		TEntityUID UID;
+
+		bool operator>( const SWakeTimer& other ) const
+		{
+			return time > other.time;
+		}
+	};
+	typedef priority_queue<SWakeTimer, vector<SWakeTimer>, greater<SWakeTimer> > TWakeTimers;
+	TWakeTimers m_WakeTimers;
+
+	// Working space for the UIDs sent messages, kept to avoid reallocation
+	vector<TEntityUID> m_MessageRecipients;
+
+	// Parallel updates - set while entities are being updated on several threads. Creations
+	// and destructions in that time take the mutex. Destructions are only recorded and are
+	// made (deferred as usual) once the threads have finished
+	bool               m_ParallelUpdate;
+	bool               m_InParallelUpdate;
+	mutex              m_ParallelMutex;
+	vector<TEntityUID> m_ParallelDestroys;
+
+	// Creations and destructions deferred while updating or while queries are alive
+	CEntityCommandBuffer m_Commands;
+
+	// UIDs for a batch creation when the caller does not want them, kept to avoid reallocation
+	vector<TEntityUID> m_BatchUIDs;
+
+	// Rendering - rows of an archetype that passed culling (working space, kept to avoid
+	// reallocation) and the number of entities rendered by the last RenderAllEntities
+	vector<TUInt32> m_VisibleRows;
+	atomic<TUInt32> m_NumRenderedEntities;
+
+	// Render commands - the backend that executes them, a command list for each worker to
+	// record into and the merged list of all commands for the frame
+	CRenderBackend*             m_RenderBackend;
+	vector<CRenderCommandList*> m_WorkerCommands;
+	CRenderCommandList          m_RenderCommands;
+
+	// Pipelined rendering - two snapshots, so one can be filled while the other is rendered,
+	// the latest one published and the one last passed to the render thread (kNoSnapshot if
+	// none). The render thread itself is declared with the other threads below
+	bool            m_PipelinedRender;
+	CRenderSnapshot m_Snapshots[2];
+	TUInt32         m_PublishedSnapshot;
+	TUInt32         m_RenderingSnapshot;
+
+	// The slots of each snapshot to copy again since it was last filled (entities whose
+	// matrices have been recalculated or that have been destroyed), or whether it is to be
+	// refilled from all entities. Transform passes record recalculated entities in a list for
+	// each worker, which are then added to both snapshots' lists
+	vector<TUInt32>          m_SnapshotChanges[2];
+	bool                     m_RefillSnapshot[2];
+	vector< vector<TUInt32> > m_WorkerSnapshotChanges;
 
 
 	/////////////////////////////////////
 	// Data for Entity Enumeration
 
-	bool        m_IsEnumerating;
-	TEntityIter m_EnumEntity;
-	string      m_EnumName;
-	string      m_EnumTemplateName;
-	string      m_EnumTemplateType;
+	// Return true if the given entity matches the current enumeration's patterns
+	bool EnumMatches( CEntity* entity )
+	{
+		return !entity->IsDestroyed() &&
+		       (m_EnumName.IsAny() || m_EnumName.MatchAtom( entity->GetNameAtom() )) &&
+		       (m_EnumTemplateName.IsAny() ||
+		        m_EnumTemplateName.MatchAtom( entity->Template()->GetNameAtom() )) &&
+		       (m_EnumType.IsAny() || m_EnumType.MatchAtom( entity->Template()->GetTypeAtom() ));
+	}
+
+	bool         m_IsEnumerating;
+	TUInt32      m_EnumKind;
+	TUInt32      m_EnumRow;
+	CGlobPattern m_EnumName;
+	CGlobPattern m_EnumTemplateName;
+	CGlobPattern m_EnumType;
+	bool         m_EnumByList;
+	CEntitySpan  m_EnumListEntities;
+
+
+	/////////////////////////////////////
+	// Background Work
+
+	// Threads for loading template meshes. Declared after the templates, loads and mesh cache
+	// so it is destroyed before them - any loads still running finish first. Only the job
+	// system and render thread follow it, and loads do not use them
+	CWorkerPool m_Workers;
+
+	// Threads for parallel entity updates
+	CJobSystem m_Jobs;
+
+	// A single thread rendering snapshots when rendering is pipelined. Declared after the
+	// snapshots so it is destroyed (finishing any frame) before them
+	CWorkerPool m_RenderThread;
 };
 
 
@@ -0,0 +1,226 @@
+/*******************************************
+	EntityQuery.cpp
+
+	Independent, re-entrant queries over the
+	entities held by the entity manager
+********************************************/
+
+#include "EntityQuery.h"
+#include "EntityManager.h"
+
+namespace gen
+{
+
+// Start a query over the given manager's entities for the given name, template name and
+// type. The template name and type are resolved immediately. If a name is given then only
+// entities with that name are examined, otherwise if a type is given only entities of that
+// type
+CEntityQuery::CEntityQuery( CEntityManager& manager, const string& name /*= ""*/,
+                            const string& templateName /*= ""*/, const string& templateType /*= ""*/ )
+	: CEntityQuery( manager, FindAtom( name ), FindAtom( templateName ), FindAtom( templateType ) )
+{
+}
+
+// As above, but the filters are given as atoms, with kNoAtom matching anything. Avoids
+// all string hashing
+CEntityQuery::CEntityQuery( CEntityManager& manager, TAtom name, TAtom templateName,
+                            TAtom templateType )
+{
+	m_Manager = &manager;
+	Start( name, templateName, templateType, 0, 0, 0 );
+}
+
+// As above, but the filters are given as compiled glob patterns, with 0 matching anything.
+// The patterns must stay alive until the query ends and must not be used by other threads
+// at the same time (they cache match results)
+CEntityQuery::CEntityQuery( CEntityManager& manager, CGlobPattern* name, CGlobPattern* templateName,
+                            CGlobPattern* templateType )
+{
+	m_Manager = &manager;
+
+	// Patterns without wildcards become atoms and patterns matching anything are dropped, so
+	// only true wildcard patterns need to be matched
+	CGlobPattern* patterns[3] = { name, templateName, templateType };
+	TAtom atoms[3] = { kNoAtom, kNoAtom, kNoAtom };
+	for (TUInt32 filter = 0; filter < 3; ++filter)
+	{
+		if (patterns[filter] && patterns[filter]->IsAny())
+		{
+			patterns[filter] = 0;
+		}
+		else if (patterns[filter] && patterns[filter]->IsLiteral())
+		{
+			atoms[filter] = patterns[filter]->GetLiteral();
+			patterns[filter] = 0;
+		}
+	}
+	Start( atoms[0], atoms[1], atoms[2], patterns[0], patterns[1], patterns[2] );
+}
+
+
+// Set up the query, shared by the constructors. Filters given as atoms are used in
+// preference to patterns, any pattern given should be a true wildcard pattern
+void CEntityQuery::Start( TAtom name, TAtom templateName, TAtom templateType,
+                          CGlobPattern* namePattern, CGlobPattern* templatePattern,
+                          CGlobPattern* typePattern )
+{
+	m_Name = name;
+	m_NamePattern = namePattern;
+	m_TemplatePattern = templatePattern;
+	m_TypePattern = typePattern;
+	m_IsEmpty = (name == kUnknownAtom); // No entity has a name that was never interned
+
+	// Resolve template name, a template that doesn't exist can't match anything
+	m_Template = 0;
+	if (templateName != kNoAtom)
+	{
+		m_Template = m_Manager->GetTemplate( templateName );
+		m_IsEmpty = m_IsEmpty || (m_Template == 0);
+	}
+
+	// Choose the entity lists to walk. Entities with the given name (or matching names) are
+	// found through the name index, otherwise entities of the given type (or matching types)
+	// through the type index. A name or type with no list can't match anything
+	m_Walk = Walk_Archetypes;
+	m_List = 0;
+	m_Type = kNoAtom;
+	m_ListPosition = m_ListSize = 0;
+	if (name != kNoAtom || namePattern)
+	{
+		if (namePattern)
+		{
+			m_Walk = Walk_NameIndex;
+			m_NameIndexPosition = m_Manager->m_NameIndex.begin();
+		}
+		else
+		{
+			m_Walk = Walk_List;
+			m_List = m_Manager->GetNameList( name );
+			m_IsEmpty = m_IsEmpty || (m_List == 0);
+		}
+
+		// The type must be checked for each entity in the name lists
+		if (templateType != kNoAtom)
+		{
+			m_Type = templateType;
+			m_IsEmpty = m_IsEmpty || (m_Manager->GetTypeList( templateType ) == 0);
+		}
+	}
+	else if (templateType != kNoAtom)
+	{
+		m_Walk = Walk_List;
+		m_List = m_Manager->GetTypeList( templateType );
+		m_IsEmpty = m_IsEmpty || (m_List == 0);
+	}
+	else if (typePattern)
+	{
+		m_Walk = Walk_TypeIndex;
+		m_TypeIndexPosition = 0;
+	}
+	if (m_List)
+	{
+		m_ListSize = m_List->Size();
+	}
+
+	// Take archetype sizes now so entities created during the query are not visited
+	m_Kind = m_Row = 0;
+	for (TUInt32 kind = 0; kind < NumEntityKinds; ++kind)
+	{
+		m_NumRows[kind] = m_Manager->GetArchetype( static_cast<EEntityKind>(kind) )->NumRows();
+	}
+
+	// Entity destruction is deferred while any query is alive
+	m_Manager->BeginQuery();
+}
+
+// Destructor ends the query
+CEntityQuery::~CEntityQuery()
+{
+	m_Manager->EndQuery();
+}
+
+
+// Return the next matching entity or 0 if there are no more
+CEntity* CEntityQuery::Next()
+{
+	if (m_IsEmpty)
+	{
+		return 0;
+	}
+
+	// Walk the name or type lists if there are any
+	if (m_Walk != Walk_Archetypes)
+	{
+		do
+		{
+			while (m_ListPosition < m_ListSize)
+			{
+				CEntity* entity = m_List->GetEntity( m_ListPosition );
+				++m_ListPosition;
+				if (Matches( entity ))
+				{
+					return entity;
+				}
+			}
+		} while (NextList());
+		return 0;
+	}
+
+	// Otherwise walk each archetype
+	while (m_Kind < NumEntityKinds)
+	{
+		CEntityArchetype* archetype = m_Manager->GetArchetype( static_cast<EEntityKind>(m_Kind) );
+		while (m_Row < m_NumRows[m_Kind])
+		{
+			CEntity* entity = archetype->GetEntity( m_Row );
+			++m_Row;
+			if (Matches( entity ))
+			{
+				return entity;
+			}
+		}
+		++m_Kind;
+		m_Row = 0;
+	}
+	return 0;
+}
+
+
+// Move on to the next entity list to walk, returns false if there are no more
+bool CEntityQuery::NextList()
+{
+	m_List = 0;
+	if (m_Walk == Walk_NameIndex)
+	{
+		// Each pattern match is cached, so this only matches each distinct name once
+		TNameIndex& nameIndex = m_Manager->m_NameIndex;
+		while (!m_List && m_NameIndexPosition != nameIndex.end())
+		{
+			if (m_NamePattern->MatchAtom( m_NameIndexPosition->first ))
+			{
+				m_List = m_NameIndexPosition->second;
+			}
+			++m_NameIndexPosition;
+		}
+	}
+	else if (m_Walk == Walk_TypeIndex)
+	{
+		// Type index is indexed by type atom, with no list for atoms that are not types
+		CEntityManager::TTypeIndex& typeIndex = m_Manager->m_TypeIndex;
+		while (!m_List && m_TypeIndexPosition < typeIndex.size())
+		{
+			if (typeIndex[m_TypeIndexPosition] && m_TypePattern->MatchAtom( m_TypeIndexPosition ))
+			{
+				m_List = typeIndex[m_TypeIndexPosition];
+			}
+			++m_TypeIndexPosition;
+		}
+	}
+
+	m_ListPosition = 0;
+	m_ListSize = m_List ? m_List->Size() : 0;
+	return m_List != 0;
+}
+
+
+} // namespace gen
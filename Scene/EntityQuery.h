@@ -0,0 +1,193 @@
+/*******************************************
+	EntityQuery.h
+
+	Independent, re-entrant queries over the
+	entities held by the entity manager
+********************************************/
+
+#pragma once
+
+#include <string>
+using namespace std;
+
+#include "Defines.h"
+#include "Entity.h"
+#include "StringAtoms.h"
+#include "GlobPattern.h"
+
+namespace gen
+{
+
+class CEntityManager;
+
+// A query visits the entities matching a given name, template name and type. An empty
+// string matches anything in that field. Filters may also be given as compiled glob patterns
+// (see CGlobPattern), e.g. all entities named "Team1_*". A name pattern is matched against
+// the names in the name index rather than every entity, and a type pattern against the types
+// in the type index. Queries are meant to be created on the stack and
+// are independent of each other, so they can be nested and run at the same time on different
+// threads. A query makes no heap allocations of its own
+// Iterate with a range for loop:
+//     for (CEntity* entity : CEntityQuery( EntityManager, "", "", "Tank" )) ...
+// or by calling Next until it returns 0
+//
+// Behaviour under structural change while a query is alive:
+// - Entities created while any query is alive are not created until no queries are alive (their
+//   UIDs are returned straight away), so are not visited
+// - Entities destroyed while any query is alive are removed from lookups (GetEntity returns 0)
+//   immediately, but stay in storage until no queries are alive. Queries skip them
+// Structural changes (creation/destruction) must still only be made from one thread
+class CEntityQuery
+{
+/////////////////////////////////////
+//	Constructors/Destructors
+public:
+	// Start a query over the given manager's entities for the given name, template name and
+	// type. The template name and type are resolved immediately. If a name is given then only
+	// entities with that name are examined, otherwise if a type is given only entities of that
+	// type
+	CEntityQuery( CEntityManager& manager, const string& name = "",
+	              const string& templateName = "", const string& templateType = "" );
+
+	// As above, but the filters are given as atoms, with kNoAtom matching anything. Avoids
+	// all string hashing
+	CEntityQuery( CEntityManager& manager, TAtom name, TAtom templateName, TAtom templateType );
+
+	// As above, but the filters are given as compiled glob patterns, with 0 matching anything.
+	// The patterns must stay alive until the query ends and must not be used by other threads
+	// at the same time (they cache match results)
+	CEntityQuery( CEntityManager& manager, CGlobPattern* name, CGlobPattern* templateName,
+	              CGlobPattern* templateType );
+
+	// Destructor ends the query
+	~CEntityQuery();
+
+private:
+	// Prevent use of copy constructor and assignment operator (private and not defined)
+	CEntityQuery( const CEntityQuery& );
+	CEntityQuery& operator=( const CEntityQuery& );
+
+
+/////////////////////////////////////
+//	Public interface
+public:
+
+	// Return the next matching entity or 0 if there are no more
+	CEntity* Next();
+
+
+	/////////////////////////////////////
+	// Range for support
+
+	// Iterator for range for loops. A query is a single pass - begin continues from the
+	// current position of the query
+	class CIterator
+	{
+	public:
+		CEntity* operator*() const
+		{
+			return m_Entity;
+		}
+
+		CIterator& operator++()
+		{
+			m_Entity = m_Query->Next();
+			return *this;
+		}
+
+		bool operator!=( const CIterator& other ) const
+		{
+			return m_Entity != other.m_Entity;
+		}
+
+	private:
+		friend class CEntityQuery;
+		CIterator( CEntityQuery* query, CEntity* entity )
+		{
+			m_Query = query;
+			m_Entity = entity;
+		}
+
+		CEntityQuery* m_Query;
+		CEntity*      m_Entity;
+	};
+
+	CIterator begin()
+	{
+		return CIterator( this, Next() );
+	}
+
+	CIterator end()
+	{
+		return CIterator( this, 0 );
+	}
+
+
+/////////////////////////////////////
+//	Private interface
+private:
+
+	// Set up the query, shared by the constructors. Filters given as atoms are used in
+	// preference to patterns, any pattern given should be a true wildcard pattern
+	void Start( TAtom name, TAtom templateName, TAtom templateType, CGlobPattern* namePattern,
+	            CGlobPattern* templatePattern, CGlobPattern* typePattern );
+
+	// Move on to the next entity list to walk, returns false if there are no more
+	bool NextList();
+
+	// Return true if the given entity matches the query filters
+	bool Matches( CEntity* entity )
+	{
+		return !entity->IsDestroyed() &&
+		       (m_Name == kNoAtom || entity->GetNameAtom() == m_Name) &&
+		       (m_Template == 0 || entity->Template() == m_Template) &&
+		       (m_Type == kNoAtom || entity->Template()->GetTypeAtom() == m_Type) &&
+		       (m_NamePattern == 0 || m_NamePattern->MatchAtom( entity->GetNameAtom() )) &&
+		       (m_TemplatePattern == 0 ||
+		        m_TemplatePattern->MatchAtom( entity->Template()->GetNameAtom() )) &&
+		       (m_TypePattern == 0 || m_TypePattern->MatchAtom( entity->Template()->GetTypeAtom() ));
+	}
+
+	// How the query finds entities to examine
+	enum EWalk
+	{
+		Walk_Archetypes, // Every entity in each archetype
+		Walk_List,       // A single name or type list
+		Walk_NameIndex,  // Each name list whose name matches the name pattern
+		Walk_TypeIndex,  // Each type list whose type matches the type pattern
+	};
+
+	CEntityManager* m_Manager;
+
+	// Filters - template name is resolved to the template itself. The type is only checked
+	// here when walking the name list, otherwise it has been used to choose the list
+	TAtom            m_Name;
+	CEntityTemplate* m_Template;
+	TAtom            m_Type;
+
+	// Pattern filters, 0 if not used
+	CGlobPattern* m_NamePattern;
+	CGlobPattern* m_TemplatePattern;
+	CGlobPattern* m_TypePattern;
+
+	// Set if the query can't match anything (e.g. unknown template or type)
+	bool m_IsEmpty;
+
+	EWalk m_Walk;
+
+	// When a name or type is given the query walks the list for that name or type, or the lists
+	// for the names or types matching a pattern...
+	CEntityList*   m_List;
+	TUInt32        m_ListPosition;
+	TUInt32        m_ListSize;
+	TNameIndexIter m_NameIndexPosition;
+	TAtom          m_TypeIndexPosition;
+
+	// ...otherwise it walks each archetype in turn. Sizes are taken when the query starts
+	TUInt32 m_Kind;
+	TUInt32 m_Row;
+	TUInt32 m_NumRows[NumEntityKinds];
+};
+
+
+} // namespace gen
@@ -0,0 +1,254 @@
+/*******************************************
+	EntitySlotMap.cpp
+
+	Maps entity UIDs to entities using
+	generational slots
+********************************************/
+
+#include "EntitySlotMap.h"
+
+namespace gen
+{
+
+// Constructor - no slots yet
+CEntitySlotMap::CEntitySlotMap() : m_NumSlots( 0 )
+{
+	m_NumChunks = 0;
+	m_FreeHead = kNoSlot;
+	m_FreeTail = kNoSlot;
+}
+
+// Destructor frees the slot storage
+CEntitySlotMap::~CEntitySlotMap()
+{
+	for (TUInt32 chunk = 0; chunk < m_NumChunks; ++chunk)
+	{
+		delete[] m_Chunks[chunk];
+	}
+}
+
+
+// Reserve space for the given number of slots, returns false if it is more than kMaxSlots
+bool CEntitySlotMap::Reserve( TUInt32 numSlots )
+{
+	if (numSlots > kMaxSlots)
+	{
+		return false;
+	}
+	while ((m_NumChunks << kChunkShift) < numSlots)
+	{
+		m_Chunks[m_NumChunks++] = new SSlot[1u << kChunkShift];
+	}
+	return true;
+}
+
+
+// Allocate a slot and return its UID. The slot holds no entity until SetEntity is called.
+// Returns SystemUID if the slot map is full
+TEntityUID CEntitySlotMap::AllocateUID()
+{
+	TUInt32 index;
+	if (m_FreeHead != kNoSlot)
+	{
+		// Reuse the oldest free slot
+		index = m_FreeHead;
+		m_FreeHead = Slot( index ).nextFree;
+		if (m_FreeHead == kNoSlot)
+		{
+			m_FreeTail = kNoSlot;
+		}
+	}
+	else
+	{
+		// No free slots, add a new one
+		index = AddSlots( 1 );
+		if (index == kNoSlot)
+		{
+			return SystemUID;
+		}
+	}
+
+	// Free slots never hold an entity, so only the free list link changes here. Other threads
+	// may be looking up stale UIDs for this slot
+	SSlot& slot = Slot( index );
+	slot.nextFree = kSlotInUse;
+	return MakeEntityUID( index, slot.generation );
+}
+
+
+// Allocate the given number of slots, writing their UIDs to the given array. Free slots
+// are reused first, any further slots needed are added as one contiguous block. Returns false,
+// allocating nothing, if the slot map would be too large
+bool CEntitySlotMap::AllocateUIDs( TUInt32 numUIDs, TEntityUID* UIDs )
+{
+	TUInt32 numAllocated = 0;
+	while (numAllocated < numUIDs && m_FreeHead != kNoSlot)
+	{
+		UIDs[numAllocated++] = AllocateUID();
+	}
+	if (numAllocated == numUIDs)
+	{
+		return true;
+	}
+
+	// Remaining slots are new and consecutive, all starting at generation 1
+	TUInt32 index = AddSlots( numUIDs - numAllocated );
+	if (index == kNoSlot)
+	{
+		// Return the reused slots (their UIDs become stale) so the failed call has no effect
+		for (TUInt32 UID = 0; UID < numAllocated; ++UID)
+		{
+			FreeUID( UIDs[UID] );
+		}
+		for (TUInt32 UID = 0; UID < numUIDs; ++UID)
+		{
+			UIDs[UID] = SystemUID;
+		}
+		return false;
+	}
+	while (numAllocated < numUIDs)
+	{
+		Slot( index ).nextFree = kSlotInUse;
+		UIDs[numAllocated++] = MakeEntityUID( index++, 1 );
+	}
+	return true;
+}
+
+
+// Free the slot for the given UID so it can be reused, returns false if the UID is stale
+bool CEntitySlotMap::FreeUID( TEntityUID UID )
+{
+	TUInt32 index = EntityUIDIndex( UID );
+	if (index >= NumSlots())
+	{
+		return false;
+	}
+	SSlot& slot = Slot( index );
+	if (slot.generation != EntityUIDGeneration( UID ) || slot.nextFree != kSlotInUse)
+	{
+		return false;
+	}
+
+	// Move the slot on a generation so all existing UIDs for it become stale
+	slot.entity = 0;
+	slot.nextFree = kNoSlot;
+	++slot.generation;
+
+	// A slot whose generation has wrapped is retired rather than reused, otherwise a very old
+	// UID could become valid again
+	if (slot.generation != 0)
+	{
+		PushFreeSlot( index );
+	}
+	return true;
+}
+
+
+// Free all slots
+void CEntitySlotMap::FreeAllUIDs()
+{
+	m_FreeHead = kNoSlot;
+	m_FreeTail = kNoSlot;
+	TUInt32 numSlots = NumSlots();
+	for (TUInt32 index = 0; index < numSlots; ++index)
+	{
+		SSlot& slot = Slot( index );
+		if (slot.nextFree == kSlotInUse)
+		{
+			slot.entity = 0;
+			++slot.generation;
+		}
+		slot.nextFree = kNoSlot;
+		if (slot.generation != 0)
+		{
+			PushFreeSlot( index );
+		}
+	}
+}
+
+
+// Restore slots from a snapshot - replace all slots with the given generations. No slots are
+// free or allocated until RestoreUID and EndRestore are called
+void CEntitySlotMap::BeginRestore( const TUInt32* generations, TUInt32 numSlots )
+{
+	m_NumSlots.store( 0, memory_order_relaxed );
+	AddSlots( numSlots );
+	for (TUInt32 index = 0; index < numSlots; ++index)
+	{
+		Slot( index ).generation = generations[index];
+	}
+	m_FreeHead = kNoSlot;
+	m_FreeTail = kNoSlot;
+}
+
+// Mark the slot for a saved UID as allocated, returns false if the UID does not match its
+// slot or has already been restored
+bool CEntitySlotMap::RestoreUID( TEntityUID UID )
+{
+	TUInt32 index = EntityUIDIndex( UID );
+	if (index >= NumSlots())
+	{
+		return false;
+	}
+	SSlot& slot = Slot( index );
+	if (slot.generation != EntityUIDGeneration( UID ) || slot.nextFree == kSlotInUse)
+	{
+		return false;
+	}
+	slot.nextFree = kSlotInUse;
+	return true;
+}
+
+// Free all slots not restored with RestoreUID, in index order
+void CEntitySlotMap::EndRestore()
+{
+	TUInt32 numSlots = NumSlots();
+	for (TUInt32 index = 0; index < numSlots; ++index)
+	{
+		if (Slot( index ).nextFree != kSlotInUse && Slot( index ).generation != 0)
+		{
+			PushFreeSlot( index );
+		}
+	}
+}
+
+
+// Add the given number of slots to the end of the slot map, all free, not in the free list
+// and at generation 1. Returns the index of the first new slot, or kNoSlot if there is no room
+TUInt32 CEntitySlotMap::AddSlots( TUInt32 numSlots )
+{
+	TUInt32 firstIndex = NumSlots();
+	if (numSlots > kMaxSlots - firstIndex || !Reserve( firstIndex + numSlots ))
+	{
+		return kNoSlot;
+	}
+
+	// Generations start at 1 so a zeroed UID is never valid
+	for (TUInt32 index = firstIndex; index < firstIndex + numSlots; ++index)
+	{
+		SSlot& slot = Slot( index );
+		slot.entity = 0;
+		slot.generation = 1;
+		slot.nextFree = kNoSlot;
+	}
+	m_NumSlots.store( firstIndex + numSlots, memory_order_release );
+	return firstIndex;
+}
+
+// Add a slot to the end of the free list
+void CEntitySlotMap::PushFreeSlot( TUInt32 index )
+{
+	Slot( index ).nextFree = kNoSlot;
+	if (m_FreeTail == kNoSlot)
+	{
+		m_FreeHead = index;
+	}
+	else
+	{
+		Slot( m_FreeTail ).nextFree = index;
+	}
+	m_FreeTail = index;
+}
+
+
+} // namespace gen
@@ -0,0 +1,188 @@
+/*******************************************
+	EntitySlotMap.h
+
+	Maps entity UIDs to entities using
+	generational slots
+********************************************/
+
+#pragma once
+
+#include <atomic>
+using namespace std;
+
+#include "Defines.h"
+#include "Entity.h"
+
+namespace gen
+{
+
+// The slot map owns the UID space for entities. Each UID names a slot in an array (the low
+// 32 bits) and the generation of that slot when the UID was issued (the high 32 bits). A
+// slot's generation is increased whenever its entity is freed, so old UIDs for the slot
+// no longer match and are detected as stale with a single comparison. Freed slots are
+// reused in the order they were freed, which spreads reuse over all the free slots
+// Slots are stored in fixed size chunks that never move once allocated, so entities can be
+// looked up by UID on one thread while another thread (holding a lock) allocates new slots
+class CEntitySlotMap
+{
+/////////////////////////////////////
+//	Constructors/Destructors
+public:
+
+	// Constructor
+	CEntitySlotMap();
+
+	// Destructor frees the slot storage, the slot map does not own the entities
+	~CEntitySlotMap();
+
+private:
+	// Prevent use of copy constructor and assignment operator (private and not defined)
+	CEntitySlotMap( const CEntitySlotMap& );
+	CEntitySlotMap& operator=( const CEntitySlotMap& );
+
+
+/////////////////////////////////////
+//	Public interface
+public:
+
+	// Maximum number of slots in a slot map
+	static const TUInt32 kMaxSlots = 1u << 26;
+
+	// Reserve space for the given number of slots. Returns false, reserving nothing, if it is
+	// more than kMaxSlots
+	bool Reserve( TUInt32 numSlots );
+
+	// Allocate a slot and return its UID. The slot holds no entity until SetEntity is called.
+	// Returns SystemUID if there are no free slots and the slot map is at kMaxSlots
+	TEntityUID AllocateUID();
+
+	// Allocate the given number of slots, writing their UIDs to the given array. Free slots
+	// are reused first, any further slots needed are added as one contiguous block with a
+	// single resize. Returns false if that would take the slot map past kMaxSlots, in which
+	// case no slots are allocated and every UID is set to SystemUID
+	bool AllocateUIDs( TUInt32 numUIDs, TEntityUID* UIDs );
+
+	// Set the entity for a UID returned from AllocateUID
+	void SetEntity( TEntityUID UID, CEntity* entity )
+	{
+		Slot( EntityUIDIndex( UID ) ).entity = entity;
+	}
+
+	// Return the entity with the given UID, or 0 if the UID is stale or has no entity
+	CEntity* GetEntity( TEntityUID UID )
+	{
+		TUInt32 index = EntityUIDIndex( UID );
+		if (index >= m_NumSlots.load( memory_order_acquire ))
+		{
+			return 0;
+		}
+		SSlot& slot = Slot( index );
+		return slot.generation == EntityUIDGeneration( UID ) ? slot.entity : 0;
+	}
+
+	// Return the entity in the slot with the given index, or 0 if the slot is free, beyond the
+	// end of the slot map or its entity's creation has been deferred
+	CEntity* GetSlotEntity( TUInt32 index )
+	{
+		if (index >= m_NumSlots.load( memory_order_acquire ))
+		{
+			return 0;
+		}
+		return Slot( index ).entity;
+	}
+
+	// Returns true if the given UID has been allocated but has no entity yet - i.e. the
+	// creation of its entity has been deferred
+	bool IsReserved( TEntityUID UID )
+	{
+		TUInt32 index = EntityUIDIndex( UID );
+		if (index >= m_NumSlots.load( memory_order_acquire ))
+		{
+			return false;
+		}
+		SSlot& slot = Slot( index );
+		return slot.generation == EntityUIDGeneration( UID ) && slot.nextFree == kSlotInUse &&
+		       slot.entity == 0;
+	}
+
+	// Free the slot for the given UID so it can be reused, returns false if the UID is stale
+	bool FreeUID( TEntityUID UID );
+
+	// Free all slots
+	void FreeAllUIDs();
+
+
+	/////////////////////////////////////
+	// Snapshots
+
+	// Number of slots and the current generation of a slot, saved in entity snapshots so the
+	// exact UIDs can be restored
+	TUInt32 NumSlots()
+	{
+		return m_NumSlots.load( memory_order_relaxed );
+	}
+	TUInt32 GetGeneration( TUInt32 index )
+	{
+		return Slot( index ).generation;
+	}
+
+	// Restore slots from a snapshot - only when no UIDs are allocated. BeginRestore replaces
+	// all slots with the given generations (the number must not be more than kMaxSlots), then RestoreUID marks the slot for each saved UID
+	// as allocated (returning false if the UID does not match its slot or is already restored)
+	// and EndRestore frees all the other slots. UIDs from before the restore must not be used
+	// afterwards, they may match restored UIDs
+	void BeginRestore( const TUInt32* generations, TUInt32 numSlots );
+	bool RestoreUID( TEntityUID UID );
+	void EndRestore();
+
+
+/////////////////////////////////////
+//	Private interface
+private:
+
+	// A slot holds an entity pointer and the current generation for the slot. Free slots
+	// are linked through their next free index, slots in use are marked as such
+	struct SSlot
+	{
+		CEntity* entity;
+		TUInt32  generation;
+		TUInt32  nextFree;
+	};
+
+	// Marks the end of the free list, and slots that are not in the free list
+	static const TUInt32 kNoSlot = 0xffffffff;
+	static const TUInt32 kSlotInUse = 0xfffffffe;
+
+	// Slots are allocated in chunks of 2^kChunkShift. The table of chunk pointers has a fixed
+	// size, which is what limits the slot map to kMaxSlots
+	static const TUInt32 kChunkShift = 14;
+	static const TUInt32 kChunkMask = (1u << kChunkShift) - 1;
+	static const TUInt32 kMaxChunks = kMaxSlots >> kChunkShift;
+
+	SSlot& Slot( TUInt32 index )
+	{
+		return m_Chunks[index >> kChunkShift][index & kChunkMask];
+	}
+
+	// Add the given number of slots to the end of the slot map, all free, not in the free list
+	// and at generation 1. Returns the index of the first new slot, or kNoSlot (adding none)
+	// if the slot map would go past kMaxSlots
+	TUInt32 AddSlots( TUInt32 numSlots );
+
+	// Add a slot to the end of the free list
+	void PushFreeSlot( TUInt32 index );
+
+	SSlot*  m_Chunks[kMaxChunks];
+	TUInt32 m_NumChunks;
+
+	// Number of slots in use, published after the slots are initialised so lookups from other
+	// threads never see a slot before its chunk exists
+	atomic<TUInt32> m_NumSlots;
+
+	// Free list of slots, taken from the head and returned to the tail
+	TUInt32 m_FreeHead;
+	TUInt32 m_FreeTail;
+};
+
+
+} // namespace gen
@@ -0,0 +1,109 @@
+/*******************************************
+	EntitySnapshot.h
+
+	Binary file format for snapshots of all
+	the entities in an entity manager
+********************************************/
+
+#pragma once
+
+#include "Defines.h"
+#include "CMatrix4x4.h"
+#include "Entity.h"
+
+namespace gen
+{
+
+// A snapshot file holds everything needed to restore the entities of an entity manager,
+// written by CEntityManager::SaveSnapshot and read by LoadSnapshot. The file is loaded by
+// mapping it into memory and reading the records in place, so it is not portable - it uses
+// the native byte order and structure layout, and the header records the sizes of the record
+// structures so a file from an incompatible build is rejected rather than misread
+// Layout - each section starts on a kSnapshotAlignment boundary:
+//     SSnapshotHeader
+//     Strings            - null-terminated template and entity names, referred to by offset
+//     Templates          - SSnapshotTemplate for each template used by the entities
+//     Slots              - TUInt32 generation for each UID slot, so UIDs can be restored exactly
+//     Entities           - SSnapshotEntity for each entity, grouped by kind
+//     Tank states        - CTankEntity::SSnapshotState for each tank, in the same order
+//     Shell states       - CShellEntity::SSnapshotState for each shell, in the same order
+//     Ammo states        - CAmmoEntity::SSnapshotState for each ammo entity, in the same order
+//     Matrices           - relative node matrices for nodes 1 and up of each entity in turn
+// Templates are saved by name only, they must exist (with the same meshes) when loading
+// Times and update phases are saved relative to the entity manager's clock and frame number,
+// so a loaded entity is next updated, and wakes, after the same time as when it was saved
+
+// Identifies a snapshot file, and the version of the format written by this code
+const TUInt32 kSnapshotMagic = 0x534e4547; // "GENS"
+const TUInt32 kSnapshotVersion = 2;
+
+// Sections are aligned to this many bytes
+const TUInt32 kSnapshotAlignment = 16;
+
+// Offset used for no string (e.g. unnamed entities)
+const TUInt32 kNoSnapshotString = 0xffffffff;
+
+
+// Section positions, as byte offsets from the start of the file
+struct SSnapshotSection
+{
+	TUInt32 offset;
+	TUInt32 size;
+};
+
+struct SSnapshotHeader
+{
+	TUInt32 magic;
+	TUInt32 version;
+
+	// Sizes of the record structures written (see above)
+	TUInt32 entityRecordSize;
+	TUInt32 tankRecordSize;
+	TUInt32 shellRecordSize;
+	TUInt32 ammoRecordSize;
+	TUInt32 matrixSize;
+
+	// Counts
+	TUInt32 numTemplates;
+	TUInt32 numSlots;
+	TUInt32 numEntities[NumEntityKinds];
+	TUInt32 numMatrices;
+
+	SSnapshotSection strings;
+	SSnapshotSection templates;
+	SSnapshotSection slots;
+	SSnapshotSection entities;
+	SSnapshotSection tankStates;
+	SSnapshotSection shellStates;
+	SSnapshotSection ammoStates;
+	SSnapshotSection matrices;
+};
+
+// A template used by the saved entities
+struct SSnapshotTemplate
+{
+	TUInt32 name;     // String offset
+	TUInt32 numNodes; // Number of mesh nodes, checked against the template's mesh when loading
+};
+
+// Flags for an entity record
+const TUInt32 kSnapshotAsleep = 1; // Entity is asleep (see CEntityManager::SleepEntity)
+
+// Data common to all entities
+struct SSnapshotEntity
+{
+	TEntityUID UID;
+	TUInt32    templateIndex;
+	TUInt32    name;            // String offset, kNoSnapshotString if unnamed
+	TUInt32    firstMatrix;     // Index of its first relative matrix (node 1) in the matrix section
+	TUInt32    flags;           // kSnapshot... flags above
+	TUInt32    updateInterval;  // See SUpdateSchedule
+	TUInt32    updatePhase;     // Frames until the entity's next update, if its interval is above 1
+	TUInt32    padding;
+	TFloat64   sinceLastUpdate; // Time since the entity's last update
+	TFloat64   wakeAfter;       // Time until a sleeping entity wakes, 0 if only woken by messages
+	CMatrix4x4 rootMatrix;
+};
+
+
+} // namespace gen
@@ -0,0 +1,222 @@
+/*******************************************
+	GlobPattern.cpp
+
+	Compiled wildcard patterns for matching
+	entity names, template names and types
+********************************************/
+
+#include "GlobPattern.h"
+
+namespace gen
+{
+
+// Replace the pattern with a new one
+void CGlobPattern::Compile( const string& pattern )
+{
+	m_Tokens.clear();
+	m_Literals.clear();
+	m_Classes.clear();
+	m_AtomResults.clear();
+	m_MinLength = 0;
+
+	TUInt32 pos = 0;
+	while (pos < pattern.length())
+	{
+		char c = pattern[pos];
+		if (c == '*')
+		{
+			// Runs of * are the same as a single *
+			if (m_Tokens.empty() || m_Tokens.back().type != Token_AnyString)
+			{
+				SToken token = { Token_AnyString, 0, 0 };
+				m_Tokens.push_back( token );
+			}
+			++pos;
+		}
+		else if (c == '?')
+		{
+			SToken token = { Token_AnyChar, 0, 0 };
+			m_Tokens.push_back( token );
+			++m_MinLength;
+			++pos;
+		}
+		else if (c == '[')
+		{
+			TUInt32 classEnd = CompileClass( pattern, pos + 1 );
+			if (classEnd)
+			{
+				++m_MinLength;
+				pos = classEnd;
+			}
+			else
+			{
+				// No closing bracket, treat the [ as an ordinary character
+				AddLiteral( c );
+				++pos;
+			}
+		}
+		else if (c == '\\' && pos + 1 < pattern.length())
+		{
+			AddLiteral( pattern[pos + 1] );
+			pos += 2;
+		}
+		else
+		{
+			AddLiteral( c );
+			++pos;
+		}
+	}
+
+	// Recognise the simple cases so callers can use faster methods than matching
+	m_IsAny = m_Tokens.empty() || (m_Tokens.size() == 1 && m_Tokens[0].type == Token_AnyString);
+	m_IsLiteral = !m_IsAny && m_Tokens.size() == 1 && m_Tokens[0].type == Token_Literal;
+	m_Literal = m_IsLiteral ? FindAtom( m_Literals ) : kUnknownAtom;
+}
+
+
+// Returns true if the given string matches the pattern
+bool CGlobPattern::Match( const string& text )
+{
+	if (m_IsAny)
+	{
+		return true;
+	}
+	if (text.length() < m_MinLength)
+	{
+		return false;
+	}
+
+	// Match tokens in order. On a mismatch go back to the most recent *, make it consume one
+	// more character and try again from there. Every other token matches a fixed number of
+	// characters, so this never needs to go back further than the last *
+	TUInt32 numTokens = static_cast<TUInt32>(m_Tokens.size());
+	TUInt32 textLength = static_cast<TUInt32>(text.length());
+	TUInt32 token = 0;
+	TUInt32 pos = 0;
+	TUInt32 starToken = numTokens; // None yet
+	TUInt32 starPos = 0;
+	while (pos < textLength || token < numTokens)
+	{
+		if (token < numTokens)
+		{
+			const SToken& current = m_Tokens[token];
+			if (current.type == Token_AnyString)
+			{
+				// Initially match no characters
+				starToken = token;
+				starPos = pos;
+				++token;
+				continue;
+			}
+
+			TUInt32 length = (current.type == Token_Literal) ? current.length : 1;
+			if (pos + length <= textLength && MatchToken( current, text, pos ))
+			{
+				++token;
+				pos += length;
+				continue;
+			}
+		}
+
+		// Mismatch - retry from the last * with one more character, if there is one to take
+		if (starToken == numTokens || starPos >= textLength)
+		{
+			return false;
+		}
+		++starPos;
+		token = starToken + 1;
+		pos = starPos;
+	}
+	return true;
+}
+
+
+// Add a literal character to the pattern, merging with any preceding literal token
+void CGlobPattern::AddLiteral( char c )
+{
+	if (m_Tokens.empty() || m_Tokens.back().type != Token_Literal)
+	{
+		SToken token = { Token_Literal, static_cast<TUInt32>(m_Literals.length()), 0 };
+		m_Tokens.push_back( token );
+	}
+	m_Literals += c;
+	++m_Tokens.back().length;
+	++m_MinLength;
+}
+
+// Compile the character class starting after the '[' at the given position in the pattern.
+// Returns the position after the closing ']', or 0 if the class is not closed
+TUInt32 CGlobPattern::CompileClass( const string& pattern, TUInt32 pos )
+{
+	SCharClass charClass = { { 0, 0, 0, 0, 0, 0, 0, 0 } };
+
+	bool negate = false;
+	if (pos < pattern.length() && (pattern[pos] == '!' || pattern[pos] == '^'))
+	{
+		negate = true;
+		++pos;
+	}
+
+	// A ] straight after the [ (or [!) is part of the class rather than closing it
+	bool first = true;
+	while (pos < pattern.length() && (first || pattern[pos] != ']'))
+	{
+		first = false;
+		TUInt8 low = static_cast<TUInt8>(pattern[pos]);
+		if (low == '\\' && pos + 1 < pattern.length())
+		{
+			low = static_cast<TUInt8>(pattern[++pos]);
+		}
+		++pos;
+
+		// Range
+		TUInt8 high = low;
+		if (pos + 1 < pattern.length() && pattern[pos] == '-' && pattern[pos + 1] != ']')
+		{
+			high = static_cast<TUInt8>(pattern[pos + 1]);
+			pos += 2;
+		}
+		for (TUInt32 c = low; c <= high; ++c)
+		{
+			charClass.Add( static_cast<TUInt8>(c) );
+		}
+	}
+	if (pos >= pattern.length())
+	{
+		return 0; // Not closed
+	}
+
+	if (negate)
+	{
+		for (TUInt32 word = 0; word < 8; ++word)
+		{
+			charClass.bits[word] = ~charClass.bits[word];
+		}
+	}
+
+	SToken token = { Token_Class, 0, static_cast<TUInt32>(m_Classes.size()) };
+	m_Tokens.push_back( token );
+	m_Classes.push_back( charClass );
+	return pos + 1;
+}
+
+
+// Returns true if the given non-* token matches the text at the given position. The text
+// must have enough characters left for the token
+bool CGlobPattern::MatchToken( const SToken& token, const string& text, TUInt32 pos )
+{
+	switch (token.type)
+	{
+		case Token_Literal:
+			return text.compare( pos, token.length, m_Literals, token.start, token.length ) == 0;
+		case Token_AnyChar:
+			return true;
+		case Token_Class:
+			return m_Classes[token.length].Contains( static_cast<TUInt8>(text[pos]) );
+		default:
+			return false;
+	}
+}
+
+
+} // namespace gen
@@ -0,0 +1,175 @@
+/*******************************************
+	GlobPattern.h
+
+	Compiled wildcard patterns for matching
+	entity names, template names and types
+********************************************/
+
+#pragma once
+
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "Defines.h"
+#include "StringAtoms.h"
+
+namespace gen
+{
+
+// A glob pattern matches strings using wildcards:
+//     *      any sequence of characters, including none
+//     ?      any single character
+//     [abc]  any one of the characters listed, ranges such as [a-z] may be used
+//     [!abc] any one character not listed ([^abc] is also accepted)
+//     \x     the character x, even if it is one of the special characters above
+// e.g. "Team1_*", "*Scout", "Tank?", "[AB]-[0-9]*". The empty pattern matches anything
+// A pattern is compiled once when it is constructed. Results of matching atoms are cached in
+// the pattern, as the string for an atom never changes - so repeatedly matching the same
+// names (e.g. in a query every frame) only examines each distinct name once. Because of this
+// cache a pattern must only be used from one thread at a time
+class CGlobPattern
+{
+/////////////////////////////////////
+//	Constructors/Destructors
+public:
+	// Constructor compiles the given pattern
+	CGlobPattern( const string& pattern = "" )
+	{
+		Compile( pattern );
+	}
+
+	// No destructor needed
+
+private:
+	// Prevent use of copy constructor and assignment operator (private and not defined)
+	CGlobPattern( const CGlobPattern& );
+	CGlobPattern& operator=( const CGlobPattern& );
+
+
+/////////////////////////////////////
+//	Public interface
+public:
+
+	// Replace the pattern with a new one
+	void Compile( const string& pattern );
+
+	// Returns true if the pattern matches any string (e.g. "" or "*")
+	bool IsAny()
+	{
+		return m_IsAny;
+	}
+
+	// Returns true if the pattern contains no wildcards, i.e. it only matches one string. The
+	// atom for that string is given by GetLiteral, which is kUnknownAtom (matches nothing) if
+	// the string has not been interned. The string is not interned by the pattern, so patterns
+	// can be compiled on any thread and do not add to the atom table
+	bool IsLiteral()
+	{
+		return m_IsLiteral;
+	}
+	TAtom GetLiteral()
+	{
+		// The string may have been interned since the pattern was compiled
+		if (m_Literal == kUnknownAtom && m_IsLiteral)
+		{
+			m_Literal = FindAtom( m_Literals );
+		}
+		return m_Literal;
+	}
+
+	// Returns true if the given string matches the pattern
+	bool Match( const string& text );
+
+	// Returns true if the string for the given atom matches the pattern. Cached
+	bool MatchAtom( TAtom atom )
+	{
+		if (m_IsLiteral)
+		{
+			return atom != kUnknownAtom && atom == GetLiteral();
+		}
+		if (atom >= m_AtomResults.size())
+		{
+			if (atom == kUnknownAtom)
+			{
+				return false;
+			}
+			m_AtomResults.resize( atom + 1, Result_Unknown );
+		}
+		if (m_AtomResults[atom] == Result_Unknown)
+		{
+			m_AtomResults[atom] = Match( AtomString( atom ) ) ? Result_Match : Result_NoMatch;
+		}
+		return m_AtomResults[atom] == Result_Match;
+	}
+
+
+/////////////////////////////////////
+//	Private interface
+private:
+
+	// The compiled pattern is a sequence of tokens
+	enum ETokenType
+	{
+		Token_Literal,   // Characters that must match exactly
+		Token_AnyChar,   // ?
+		Token_AnyString, // *
+		Token_Class,     // [...]
+	};
+	struct SToken
+	{
+		ETokenType type;
+		TUInt32    start;  // Literal - position of the characters in m_Literals
+		TUInt32    length; // Literal - number of characters. Class - index of the class set
+	};
+
+	// A character class is a set of 256 bits, one for each character
+	struct SCharClass
+	{
+		TUInt32 bits[8];
+
+		void Add( TUInt8 c )
+		{
+			bits[c >> 5] |= 1u << (c & 31);
+		}
+		bool Contains( TUInt8 c ) const
+		{
+			return (bits[c >> 5] & (1u << (c & 31))) != 0;
+		}
+	};
+
+	// Add a literal character to the pattern, merging with any preceding literal token
+	void AddLiteral( char c );
+
+	// Compile the character class starting after the '[' at the given position in the pattern.
+	// Returns the position after the closing ']', or 0 if the class is not closed
+	TUInt32 CompileClass( const string& pattern, TUInt32 pos );
+
+	// Returns true if the given non-* token matches the text at the given position. The text
+	// must have enough characters left for the token
+	bool MatchToken( const SToken& token, const string& text, TUInt32 pos );
+
+	// Cached results for atoms
+	enum EMatchResult
+	{
+		Result_Unknown,
+		Result_NoMatch,
+		Result_Match,
+	};
+
+	vector<SToken>     m_Tokens;
+	string             m_Literals;
+	vector<SCharClass> m_Classes;
+
+	// Minimum length of string that can match (total length of non-* tokens)
+	TUInt32 m_MinLength;
+
+	bool  m_IsAny;
+	bool  m_IsLiteral;
+	TAtom m_Literal;
+
+	vector<TUInt8> m_AtomResults;
+};
+
+
+} // namespace gen
@@ -0,0 +1,207 @@
+/*******************************************
+	JobSystem.cpp
+
+	Work-stealing threads for splitting a
+	loop over several cores
+********************************************/
+
+#include "JobSystem.h"
+
+namespace gen
+{
+
+// Index of the worker running on each thread, threads that are not workers are worker 0
+static thread_local TUInt32 CurrentWorkerIndex = 0;
+
+
+// Constructor takes the number of threads to use in addition to the calling thread, 0 for
+// one less than the number of hardware threads
+CJobSystem::CJobSystem( TUInt32 numThreads /*= 0*/ )
+{
+	if (numThreads == 0)
+	{
+		// The calling thread is also a worker
+		numThreads = thread::hardware_concurrency();
+		numThreads = (numThreads > 1) ? numThreads - 1 : 0;
+	}
+	m_NumThreads = numThreads;
+	m_Queues = new SWorkerQueue[numThreads + 1];
+	m_Job = 0;
+	m_LoopNumber = 0;
+	m_NumBusyThreads = 0;
+	m_Stopping = false;
+}
+
+// Destructor stops the threads
+CJobSystem::~CJobSystem()
+{
+	{
+		lock_guard<mutex> lock( m_Mutex );
+		m_Stopping = true;
+	}
+	m_LoopStarted.notify_all();
+	for (TUInt32 worker = 0; worker < m_Threads.size(); ++worker)
+	{
+		m_Threads[worker].join();
+	}
+	delete[] m_Queues;
+}
+
+
+// Index of the worker running on the current thread
+TUInt32 CJobSystem::CurrentWorker()
+{
+	return CurrentWorkerIndex;
+}
+
+
+// Call the job for all items from 0 to numItems - 1, in chunks of up to grainSize items,
+// using all the workers. Returns when all items have been processed
+void CJobSystem::ParallelFor( TUInt32 numItems, TUInt32 grainSize, const TRangeJob& job )
+{
+	if (grainSize == 0)
+	{
+		grainSize = 1;
+	}
+	TUInt32 numChunks = (numItems + grainSize - 1) / grainSize;
+
+	// Not worth waking the threads for a single chunk
+	if (numChunks <= 1 || m_NumThreads == 0)
+	{
+		if (numItems > 0)
+		{
+			job( 0, numItems );
+		}
+		return;
+	}
+
+	if (m_Threads.empty())
+	{
+		Start();
+	}
+
+	// Deal consecutive chunks to each worker so each works on neighbouring items. They are
+	// queued in reverse so the owner (taking from the back) works through them in order and
+	// thieves (taking from the front) take the chunks the owner would reach last
+	TUInt32 numWorkers = NumWorkers();
+	for (TUInt32 worker = 0; worker < numWorkers; ++worker)
+	{
+		TUInt32 firstChunk = static_cast<TUInt32>((static_cast<TUInt64>(numChunks) * worker) / numWorkers);
+		TUInt32 lastChunk = static_cast<TUInt32>((static_cast<TUInt64>(numChunks) * (worker + 1)) / numWorkers);
+		lock_guard<mutex> lock( m_Queues[worker].lock );
+		for (TUInt32 chunk = lastChunk; chunk > firstChunk; --chunk)
+		{
+			SRange range;
+			range.begin = (chunk - 1) * grainSize;
+			range.end = (chunk * grainSize < numItems) ? chunk * grainSize : numItems;
+			m_Queues[worker].ranges.push_back( range );
+		}
+	}
+
+	// Start the loop on the threads and work on it here too
+	{
+		lock_guard<mutex> lock( m_Mutex );
+		m_Job = &job;
+		++m_LoopNumber;
+		m_NumBusyThreads = m_NumThreads;
+	}
+	m_LoopStarted.notify_all();
+	RunJobs( 0 );
+
+	// No chunks are left to take, wait for the threads to finish the ones they have taken
+	unique_lock<mutex> lock( m_Mutex );
+	while (m_NumBusyThreads > 0)
+	{
+		m_LoopFinished.wait( lock );
+	}
+	m_Job = 0;
+}
+
+
+// Start the worker threads
+void CJobSystem::Start()
+{
+	for (TUInt32 worker = 1; worker <= m_NumThreads; ++worker)
+	{
+		m_Threads.push_back( thread( &CJobSystem::WorkerMain, this, worker ) );
+	}
+}
+
+// Thread function for each worker - runs the chunks of each loop until stopped
+void CJobSystem::WorkerMain( TUInt32 worker )
+{
+	CurrentWorkerIndex = worker;
+
+	TUInt32 loopNumber = 0;
+	unique_lock<mutex> lock( m_Mutex );
+	while (true)
+	{
+		while (m_LoopNumber == loopNumber && !m_Stopping)
+		{
+			m_LoopStarted.wait( lock );
+		}
+		if (m_Stopping)
+		{
+			return;
+		}
+		loopNumber = m_LoopNumber;
+
+		// Work on the loop without holding the lock
+		lock.unlock();
+		RunJobs( worker );
+		lock.lock();
+
+		if (--m_NumBusyThreads == 0)
+		{
+			m_LoopFinished.notify_all();
+		}
+	}
+}
+
+// Process chunks for the current loop until there are none left to take. Chunks are only
+// added before a loop starts, so once every queue is empty there is no more work to find
+void CJobSystem::RunJobs( TUInt32 worker )
+{
+	SRange range;
+	while (PopRange( worker, &range ) || StealRange( worker, &range ))
+	{
+		(*m_Job)( range.begin, range.end );
+	}
+}
+
+
+// Take a chunk from the back of the given worker's own queue. Return false if it is empty
+bool CJobSystem::PopRange( TUInt32 worker, SRange* range )
+{
+	SWorkerQueue& queue = m_Queues[worker];
+	lock_guard<mutex> lock( queue.lock );
+	if (queue.ranges.empty())
+	{
+		return false;
+	}
+	*range = queue.ranges.back();
+	queue.ranges.pop_back();
+	return true;
+}
+
+// Steal a chunk from the front of another worker's queue, trying each in turn starting with
+// the next worker. Return false if all are empty
+bool CJobSystem::StealRange( TUInt32 worker, SRange* range )
+{
+	TUInt32 numWorkers = NumWorkers();
+	for (TUInt32 offset = 1; offset < numWorkers; ++offset)
+	{
+		SWorkerQueue& queue = m_Queues[(worker + offset) % numWorkers];
+		lock_guard<mutex> lock( queue.lock );
+		if (!queue.ranges.empty())
+		{
+			*range = queue.ranges.front();
+			queue.ranges.pop_front();
+			return true;
+		}
+	}
+	return false;
+}
+
+
+} // namespace gen
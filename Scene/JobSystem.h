@@ -0,0 +1,121 @@
+/*******************************************
+	JobSystem.h
+
+	Work-stealing threads for splitting a
+	loop over several cores
+********************************************/
+
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+using namespace std;
+
+#include "Defines.h"
+
+namespace gen
+{
+
+// The job system runs a loop over a range of items on all cores. The range is split into
+// chunks which are dealt out evenly, in order, to a queue for each worker. The calling thread
+// is worker 0 and takes part in the work, the other workers are threads owned by the job
+// system. Each worker takes chunks from the back of its own queue, and when its queue is
+// empty it steals from the front of the other queues - so a worker whose chunks are slow to
+// process is helped by the others rather than holding up the whole loop
+// The threads are started on the first loop that needs them. ParallelFor must be called
+// from one thread (the owner) and must not be called from inside a job
+class CJobSystem
+{
+/////////////////////////////////////
+//	Constructors/Destructors
+public:
+	// Constructor takes the number of threads to use in addition to the calling thread, 0 for
+	// one less than the number of hardware threads
+	CJobSystem( TUInt32 numThreads = 0 );
+
+	// Destructor stops the threads
+	~CJobSystem();
+
+private:
+	// Prevent use of copy constructor and assignment operator (private and not defined)
+	CJobSystem( const CJobSystem& );
+	CJobSystem& operator=( const CJobSystem& );
+
+
+/////////////////////////////////////
+//	Public interface
+public:
+
+	// A range job processes the items from begin up to (not including) end
+	typedef function<void( TUInt32 begin, TUInt32 end )> TRangeJob;
+
+	// Number of workers, including the calling thread
+	TUInt32 NumWorkers()
+	{
+		return m_NumThreads + 1;
+	}
+
+	// Index of the worker running on the current thread, from 0 to NumWorkers() - 1. Threads
+	// that are not workers (e.g. the main thread) are worker 0
+	static TUInt32 CurrentWorker();
+
+	// Call the job for all items from 0 to numItems - 1, in chunks of up to grainSize items,
+	// using all the workers. Returns when all items have been processed. Chunks are processed
+	// in no particular order and several at once, so the job must be safe to call like that
+	void ParallelFor( TUInt32 numItems, TUInt32 grainSize, const TRangeJob& job );
+
+
+/////////////////////////////////////
+//	Private interface
+private:
+
+	// A chunk of items to be processed
+	struct SRange
+	{
+		TUInt32 begin;
+		TUInt32 end;
+	};
+
+	// Queue of chunks for one worker. Its own worker takes from the back, others steal from
+	// the front
+	struct SWorkerQueue
+	{
+		mutex         lock;
+		deque<SRange> ranges;
+	};
+
+	// Start the worker threads
+	void Start();
+
+	// Thread function for each worker - runs the chunks of each loop until stopped
+	void WorkerMain( TUInt32 worker );
+
+	// Process chunks for the current loop until there are none left to take
+	void RunJobs( TUInt32 worker );
+
+	// Take a chunk from the given worker's own queue, or steal one from another queue.
+	// Return false if there are none
+	bool PopRange( TUInt32 worker, SRange* range );
+	bool StealRange( TUInt32 worker, SRange* range );
+
+	TUInt32        m_NumThreads;
+	vector<thread> m_Threads;
+	SWorkerQueue*  m_Queues; // One for each worker
+
+	// The current loop. Workers wait for the loop number to change, then work on the loop
+	// until it runs out of chunks. Guarded by the mutex
+	mutex              m_Mutex;
+	condition_variable m_LoopStarted;
+	condition_variable m_LoopFinished;
+	const TRangeJob*   m_Job;
+	TUInt32            m_LoopNumber;
+	TUInt32            m_NumBusyThreads;
+	bool               m_Stopping;
+};
+
+
+} // namespace gen
@@ -0,0 +1,114 @@
+/*******************************************
+	MappedFile.cpp
+
+	Read-only memory mapped files
+********************************************/
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "MappedFile.h"
+
+namespace gen
+{
+
+// Constructor - no file open
+CMappedFile::CMappedFile()
+{
+	m_Data = 0;
+	m_Size = 0;
+	m_File = 0;
+	m_Mapping = 0;
+}
+
+
+// Map the given file, closing any file already mapped. Returns false on failure
+bool CMappedFile::Open( const string& fileName )
+{
+	Close();
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA( fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING,
+	                           FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, 0 );
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx( file, &size ) || size.QuadPart == 0 || size.HighPart != 0)
+	{
+		CloseHandle( file );
+		return false;
+	}
+	HANDLE mapping = CreateFileMappingA( file, 0, PAGE_READONLY, 0, 0, 0 );
+	if (!mapping)
+	{
+		CloseHandle( file );
+		return false;
+	}
+	void* data = MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, 0 );
+	if (!data)
+	{
+		CloseHandle( mapping );
+		CloseHandle( file );
+		return false;
+	}
+	m_File = file;
+	m_Mapping = mapping;
+	m_Size = size.LowPart;
+#else
+	int file = open( fileName.c_str(), O_RDONLY );
+	if (file < 0)
+	{
+		return false;
+	}
+	struct stat status;
+	if (fstat( file, &status ) != 0 || status.st_size == 0 || status.st_size > 0xffffffffll)
+	{
+		close( file );
+		return false;
+	}
+	void* data = mmap( 0, status.st_size, PROT_READ, MAP_PRIVATE, file, 0 );
+	close( file ); // The mapping keeps its own reference to the file
+	if (data == MAP_FAILED)
+	{
+		return false;
+	}
+	m_Size = static_cast<TUInt32>(status.st_size);
+#endif
+
+	m_Data = static_cast<const TUInt8*>(data);
+	return true;
+}
+
+
+// Unmap the file
+void CMappedFile::Close()
+{
+	if (!m_Data)
+	{
+		return;
+	}
+
+#ifdef _WIN32
+	UnmapViewOfFile( m_Data );
+	CloseHandle( m_Mapping );
+	CloseHandle( m_File );
+#else
+	munmap( const_cast<TUInt8*>(m_Data), m_Size );
+#endif
+
+	m_Data = 0;
+	m_Size = 0;
+	m_File = 0;
+	m_Mapping = 0;
+}
+
+
+} // namespace gen
@@ -0,0 +1,72 @@
+/*******************************************
+	MappedFile.h
+
+	Read-only memory mapped files
+********************************************/
+
+#pragma once
+
+#include <string>
+using namespace std;
+
+#include "Defines.h"
+
+namespace gen
+{
+
+// A mapped file makes the whole contents of a file readable in memory without copying it,
+// pages are read from disk by the OS as they are first touched. Read-only
+class CMappedFile
+{
+/////////////////////////////////////
+//	Constructors/Destructors
+public:
+	// Constructor - no file open
+	CMappedFile();
+
+	// Destructor unmaps the file
+	~CMappedFile()
+	{
+		Close();
+	}
+
+private:
+	// Prevent use of copy constructor and assignment operator (private and not defined)
+	CMappedFile( const CMappedFile& );
+	CMappedFile& operator=( const CMappedFile& );
+
+
+/////////////////////////////////////
+//	Public interface
+public:
+
+	// Map the given file, closing any file already mapped. Returns false on failure
+	bool Open( const string& fileName );
+
+	// Unmap the file
+	void Close();
+
+	// The file contents and size, 0 if no file is mapped
+	const TUInt8* GetData()
+	{
+		return m_Data;
+	}
+	TUInt32 GetSize()
+	{
+		return m_Size;
+	}
+
+
+/////////////////////////////////////
+//	Private interface
+private:
+	const TUInt8* m_Data;
+	TUInt32       m_Size;
+
+	// OS handles for the file and the mapping (Windows only)
+	void* m_File;
+	void* m_Mapping;
+};
+
+
+} // namespace gen
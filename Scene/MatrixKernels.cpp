@@ -0,0 +1,671 @@
+/*******************************************
+	MatrixKernels.cpp
+
+	SIMD matrix multiply, inverse and point
+	transform, single and batched, and bounding
+	sphere culling
+********************************************/
+
+// SIMD kernels are only built for x86/x64. Functions using an instruction set above the
+// compiler's default are marked for GCC/Clang, Visual C++ allows any intrinsics anywhere
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define GEN_MATRIX_SIMD
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define GEN_TARGET_SSE
+#define GEN_TARGET_AVX2
+#else
+#include <cpuid.h>
+#define GEN_TARGET_SSE  __attribute__((target("sse2")))
+#define GEN_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#endif
+#endif
+
+#include <cstring>
+
+#include "MatrixKernels.h"
+
+namespace gen
+{
+
+// Matrices are used as 16 floats, row by row (e00, e01, e02, e03, e10...), and points as 3
+// floats. Rows are row vectors, so row 3 holds the translation and a point p is transformed
+// to p.x * row0 + p.y * row1 + p.z * row2 + row3
+
+
+/*-----------------------------------------------------------------------------------------
+	Scalar kernels
+-----------------------------------------------------------------------------------------*/
+
+static void MultiplyScalar( CMatrix4x4* out, const CMatrix4x4& a, const CMatrix4x4& b )
+{
+	const TFloat32* A = &a.e00;
+	const TFloat32* B = &b.e00;
+	TFloat32 result[16];
+	for (TUInt32 row = 0; row < 4; ++row)
+	{
+		for (TUInt32 col = 0; col < 4; ++col)
+		{
+			result[row * 4 + col] = A[row * 4 + 0] * B[col]     + A[row * 4 + 1] * B[4 + col] +
+			                        A[row * 4 + 2] * B[8 + col] + A[row * 4 + 3] * B[12 + col];
+		}
+	}
+	memcpy( &out->e00, result, sizeof(result) );
+}
+
+static void MultiplyBatchScalar( CMatrix4x4* out, const CMatrix4x4* a, const CMatrix4x4* b,
+                                 TUInt32 num )
+{
+	for (TUInt32 i = 0; i < num; ++i)
+	{
+		MultiplyScalar( &out[i], a[i], b[i] );
+	}
+}
+
+static void MultiplyHierarchyScalar( CMatrix4x4* matrices, const CMatrix4x4* relMatrices,
+                                     const TUInt32* parents, TUInt32 begin, TUInt32 end )
+{
+	for (TUInt32 node = begin; node < end; ++node)
+	{
+		MultiplyScalar( &matrices[node], relMatrices[node], matrices[parents[node]] );
+	}
+}
+
+// Inverse of the upper 3x3 from the cross products of its rows divided by the determinant,
+// then the translation is negated and transformed by that
+static void InverseAffineScalar( CMatrix4x4* out, const CMatrix4x4& m )
+{
+	const TFloat32* M = &m.e00;
+	TFloat32 c[3][3]; // Cross products of rows 1&2, 2&0, 0&1
+	for (TUInt32 i = 0; i < 3; ++i)
+	{
+		const TFloat32* r1 = M + ((i + 1) % 3) * 4;
+		const TFloat32* r2 = M + ((i + 2) % 3) * 4;
+		c[i][0] = r1[1] * r2[2] - r1[2] * r2[1];
+		c[i][1] = r1[2] * r2[0] - r1[0] * r2[2];
+		c[i][2] = r1[0] * r2[1] - r1[1] * r2[0];
+	}
+	TFloat32 invDet = 1.0f / (M[0] * c[0][0] + M[1] * c[0][1] + M[2] * c[0][2]);
+
+	TFloat32 result[16];
+	for (TUInt32 row = 0; row < 3; ++row)
+	{
+		for (TUInt32 col = 0; col < 3; ++col)
+		{
+			result[row * 4 + col] = c[col][row] * invDet;
+		}
+		result[row * 4 + 3] = 0.0f;
+	}
+	for (TUInt32 col = 0; col < 3; ++col)
+	{
+		result[12 + col] = -(M[12] * result[col] + M[13] * result[4 + col] + M[14] * result[8 + col]);
+	}
+	result[15] = 1.0f;
+	memcpy( &out->e00, result, sizeof(result) );
+}
+
+static void TransformPointsScalar( CVector3* out, const CMatrix4x4& m, const CVector3* points,
+                                   TUInt32 num )
+{
+	const TFloat32* M = &m.e00;
+	for (TUInt32 i = 0; i < num; ++i)
+	{
+		TFloat32 x = points[i].x, y = points[i].y, z = points[i].z;
+		out[i].x = x * M[0] + y * M[4] + z * M[8]  + M[12];
+		out[i].y = x * M[1] + y * M[5] + z * M[9]  + M[13];
+		out[i].z = x * M[2] + y * M[6] + z * M[10] + M[14];
+	}
+}
+
+static TUInt32 CullSpheresScalar( const SBoundingSphere* spheres, TUInt32 num, const SPlane* planes,
+                                  TUInt32 numPlanes, TUInt32* visible )
+{
+	TUInt32 numVisible = 0;
+	for (TUInt32 i = 0; i < num; ++i)
+	{
+		const SBoundingSphere& sphere = spheres[i];
+		TUInt32 plane = 0;
+		while (plane < numPlanes &&
+		       planes[plane].normal.x * sphere.centre.x + planes[plane].normal.y * sphere.centre.y +
+		       planes[plane].normal.z * sphere.centre.z + planes[plane].distance <= sphere.radius)
+		{
+			++plane;
+		}
+		if (plane == numPlanes)
+		{
+			visible[numVisible++] = i;
+		}
+	}
+	return numVisible;
+}
+
+
+#ifdef GEN_MATRIX_SIMD
+
+/*-----------------------------------------------------------------------------------------
+	SSE kernels
+-----------------------------------------------------------------------------------------*/
+
+// One row of a matrix product: the given row of a times the rows of b
+GEN_TARGET_SSE static inline __m128 MultiplyRowSSE( const TFloat32* aRow,
+                                                     __m128 b0, __m128 b1, __m128 b2, __m128 b3 )
+{
+	__m128 row = _mm_mul_ps( _mm_set1_ps( aRow[0] ), b0 );
+	row = _mm_add_ps( row, _mm_mul_ps( _mm_set1_ps( aRow[1] ), b1 ) );
+	row = _mm_add_ps( row, _mm_mul_ps( _mm_set1_ps( aRow[2] ), b2 ) );
+	return _mm_add_ps( row, _mm_mul_ps( _mm_set1_ps( aRow[3] ), b3 ) );
+}
+
+GEN_TARGET_SSE static void MultiplySSE( CMatrix4x4* out, const CMatrix4x4& a, const CMatrix4x4& b )
+{
+	const TFloat32* A = &a.e00;
+	const TFloat32* B = &b.e00;
+	__m128 b0 = _mm_loadu_ps( B );
+	__m128 b1 = _mm_loadu_ps( B + 4 );
+	__m128 b2 = _mm_loadu_ps( B + 8 );
+	__m128 b3 = _mm_loadu_ps( B + 12 );
+
+	// All rows calculated before storing any, the output may be an input
+	__m128 r0 = MultiplyRowSSE( A,      b0, b1, b2, b3 );
+	__m128 r1 = MultiplyRowSSE( A + 4,  b0, b1, b2, b3 );
+	__m128 r2 = MultiplyRowSSE( A + 8,  b0, b1, b2, b3 );
+	__m128 r3 = MultiplyRowSSE( A + 12, b0, b1, b2, b3 );
+	TFloat32* O = &out->e00;
+	_mm_storeu_ps( O,      r0 );
+	_mm_storeu_ps( O + 4,  r1 );
+	_mm_storeu_ps( O + 8,  r2 );
+	_mm_storeu_ps( O + 12, r3 );
+}
+
+GEN_TARGET_SSE static void MultiplyBatchSSE( CMatrix4x4* out, const CMatrix4x4* a,
+                                             const CMatrix4x4* b, TUInt32 num )
+{
+	for (TUInt32 i = 0; i < num; ++i)
+	{
+		MultiplySSE( &out[i], a[i], b[i] );
+	}
+}
+
+GEN_TARGET_SSE static void MultiplyHierarchySSE( CMatrix4x4* matrices, const CMatrix4x4* relMatrices,
+                                                 const TUInt32* parents, TUInt32 begin, TUInt32 end )
+{
+	for (TUInt32 node = begin; node < end; ++node)
+	{
+		MultiplySSE( &matrices[node], relMatrices[node], matrices[parents[node]] );
+	}
+}
+
+// Cross product of the xyz parts of two vectors, w is 0 if both inputs' w are 0
+GEN_TARGET_SSE static inline __m128 CrossSSE( __m128 a, __m128 b )
+{
+	__m128 aYZX = _mm_shuffle_ps( a, a, _MM_SHUFFLE(3, 0, 2, 1) );
+	__m128 bYZX = _mm_shuffle_ps( b, b, _MM_SHUFFLE(3, 0, 2, 1) );
+	__m128 c = _mm_sub_ps( _mm_mul_ps( a, bYZX ), _mm_mul_ps( aYZX, b ) );
+	return _mm_shuffle_ps( c, c, _MM_SHUFFLE(3, 0, 2, 1) );
+}
+
+GEN_TARGET_SSE static void InverseAffineSSE( CMatrix4x4* out, const CMatrix4x4& m )
+{
+	const TFloat32* M = &m.e00;
+	__m128 r0 = _mm_loadu_ps( M );
+	__m128 r1 = _mm_loadu_ps( M + 4 );
+	__m128 r2 = _mm_loadu_ps( M + 8 );
+	__m128 t  = _mm_loadu_ps( M + 12 );
+
+	// Cross products of the rows are the columns of the inverse 3x3 times the determinant
+	__m128 zero = _mm_setzero_ps();
+	__m128 c0 = CrossSSE( r1, r2 );
+	__m128 c1 = CrossSSE( r2, r0 );
+	__m128 c2 = CrossSSE( r0, r1 );
+	__m128 det = _mm_mul_ps( r0, c0 );
+	det = _mm_add_ss( _mm_add_ss( det, _mm_shuffle_ps( det, det, _MM_SHUFFLE(1, 1, 1, 1) ) ),
+	                  _mm_shuffle_ps( det, det, _MM_SHUFFLE(2, 2, 2, 2) ) );
+	__m128 invDet = _mm_div_ps( _mm_set1_ps( 1.0f ), _mm_shuffle_ps( det, det, 0 ) );
+	c0 = _mm_mul_ps( c0, invDet );
+	c1 = _mm_mul_ps( c1, invDet );
+	c2 = _mm_mul_ps( c2, invDet );
+	__m128 c3 = zero;
+	_MM_TRANSPOSE4_PS( c0, c1, c2, c3 ); // Now rows of the inverse, w is 0
+
+	// Translation is -t times the inverse 3x3, with w of 1
+	__m128 inverseT = _mm_mul_ps( _mm_shuffle_ps( t, t, _MM_SHUFFLE(0, 0, 0, 0) ), c0 );
+	inverseT = _mm_add_ps( inverseT, _mm_mul_ps( _mm_shuffle_ps( t, t, _MM_SHUFFLE(1, 1, 1, 1) ), c1 ) );
+	inverseT = _mm_add_ps( inverseT, _mm_mul_ps( _mm_shuffle_ps( t, t, _MM_SHUFFLE(2, 2, 2, 2) ), c2 ) );
+	inverseT = _mm_sub_ps( zero, inverseT );
+	inverseT = _mm_add_ps( inverseT, _mm_set_ps( 1.0f, 0.0f, 0.0f, 0.0f ) );
+
+	TFloat32* O = &out->e00;
+	_mm_storeu_ps( O,      c0 );
+	_mm_storeu_ps( O + 4,  c1 );
+	_mm_storeu_ps( O + 8,  c2 );
+	_mm_storeu_ps( O + 12, inverseT );
+}
+
+GEN_TARGET_SSE static void TransformPointsSSE( CVector3* out, const CMatrix4x4& m,
+                                               const CVector3* points, TUInt32 num )
+{
+	const TFloat32* M = &m.e00;
+	__m128 m0 = _mm_loadu_ps( M );
+	__m128 m1 = _mm_loadu_ps( M + 4 );
+	__m128 m2 = _mm_loadu_ps( M + 8 );
+	__m128 m3 = _mm_loadu_ps( M + 12 );
+	for (TUInt32 i = 0; i < num; ++i)
+	{
+		__m128 p = _mm_mul_ps( _mm_set1_ps( points[i].x ), m0 );
+		p = _mm_add_ps( p, _mm_mul_ps( _mm_set1_ps( points[i].y ), m1 ) );
+		p = _mm_add_ps( p, _mm_mul_ps( _mm_set1_ps( points[i].z ), m2 ) );
+		p = _mm_add_ps( p, m3 );
+
+		// Only 3 floats to store
+		TFloat32 result[4];
+		_mm_storeu_ps( result, p );
+		out[i].x = result[0];
+		out[i].y = result[1];
+		out[i].z = result[2];
+	}
+}
+
+// Spheres are transposed so each register holds one component of 4 spheres, then all 4 are
+// tested against each plane at once
+GEN_TARGET_SSE static TUInt32 CullSpheresSSE( const SBoundingSphere* spheres, TUInt32 num,
+                                              const SPlane* planes, TUInt32 numPlanes,
+                                              TUInt32* visible )
+{
+	TUInt32 numVisible = 0;
+	TUInt32 first = 0;
+	for (; first + 4 <= num; first += 4)
+	{
+		const TFloat32* S = &spheres[first].centre.x;
+		__m128 x = _mm_loadu_ps( S );
+		__m128 y = _mm_loadu_ps( S + 4 );
+		__m128 z = _mm_loadu_ps( S + 8 );
+		__m128 r = _mm_loadu_ps( S + 12 );
+		_MM_TRANSPOSE4_PS( x, y, z, r );
+
+		__m128 inside = _mm_castsi128_ps( _mm_set1_epi32( -1 ) );
+		for (TUInt32 plane = 0; plane < numPlanes; ++plane)
+		{
+			__m128 dist = _mm_add_ps( _mm_mul_ps( x, _mm_set1_ps( planes[plane].normal.x ) ),
+			                          _mm_set1_ps( planes[plane].distance ) );
+			dist = _mm_add_ps( dist, _mm_mul_ps( y, _mm_set1_ps( planes[plane].normal.y ) ) );
+			dist = _mm_add_ps( dist, _mm_mul_ps( z, _mm_set1_ps( planes[plane].normal.z ) ) );
+			inside = _mm_and_ps( inside, _mm_cmple_ps( dist, r ) );
+		}
+
+		TUInt32 mask = static_cast<TUInt32>(_mm_movemask_ps( inside ));
+		for (TUInt32 i = 0; mask != 0; ++i, mask >>= 1)
+		{
+			if (mask & 1)
+			{
+				visible[numVisible++] = first + i;
+			}
+		}
+	}
+
+	// Remaining spheres one at a time
+	TUInt32 numLeft = CullSpheresScalar( spheres + first, num - first, planes, numPlanes,
+	                                     visible + numVisible );
+	for (TUInt32 i = 0; i < numLeft; ++i)
+	{
+		visible[numVisible++] += first;
+	}
+	return numVisible;
+}
+
+
+/*-----------------------------------------------------------------------------------------
+	AVX2 kernels
+-----------------------------------------------------------------------------------------*/
+
+// Two rows of a matrix product: the two rows of a in the given register (one in each half)
+// times the rows of b (each held in both halves)
+GEN_TARGET_AVX2 static inline __m256 MultiplyRowsAVX2( __m256 aRows,
+                                                        __m256 b0, __m256 b1, __m256 b2, __m256 b3 )
+{
+	__m256 rows = _mm256_mul_ps( _mm256_permute_ps( aRows, _MM_SHUFFLE(0, 0, 0, 0) ), b0 );
+	rows = _mm256_fmadd_ps( _mm256_permute_ps( aRows, _MM_SHUFFLE(1, 1, 1, 1) ), b1, rows );
+	rows = _mm256_fmadd_ps( _mm256_permute_ps( aRows, _MM_SHUFFLE(2, 2, 2, 2) ), b2, rows );
+	return _mm256_fmadd_ps( _mm256_permute_ps( aRows, _MM_SHUFFLE(3, 3, 3, 3) ), b3, rows );
+}
+
+GEN_TARGET_AVX2 static inline void MultiplyAVX2( TFloat32* O, const TFloat32* A, const TFloat32* B )
+{
+	__m256 b0 = _mm256_broadcast_ps( reinterpret_cast<const __m128*>(B) );
+	__m256 b1 = _mm256_broadcast_ps( reinterpret_cast<const __m128*>(B + 4) );
+	__m256 b2 = _mm256_broadcast_ps( reinterpret_cast<const __m128*>(B + 8) );
+	__m256 b3 = _mm256_broadcast_ps( reinterpret_cast<const __m128*>(B + 12) );
+
+	// Both halves calculated before storing either, the output may be an input
+	__m256 r01 = MultiplyRowsAVX2( _mm256_loadu_ps( A ),     b0, b1, b2, b3 );
+	__m256 r23 = MultiplyRowsAVX2( _mm256_loadu_ps( A + 8 ), b0, b1, b2, b3 );
+	_mm256_storeu_ps( O,     r01 );
+	_mm256_storeu_ps( O + 8, r23 );
+}
+
+GEN_TARGET_AVX2 static void MultiplySingleAVX2( CMatrix4x4* out, const CMatrix4x4& a,
+                                                const CMatrix4x4& b )
+{
+	MultiplyAVX2( &out->e00, &a.e00, &b.e00 );
+}
+
+GEN_TARGET_AVX2 static void MultiplyBatchAVX2( CMatrix4x4* out, const CMatrix4x4* a,
+                                               const CMatrix4x4* b, TUInt32 num )
+{
+	for (TUInt32 i = 0; i < num; ++i)
+	{
+		MultiplyAVX2( &out[i].e00, &a[i].e00, &b[i].e00 );
+	}
+}
+
+GEN_TARGET_AVX2 static void MultiplyHierarchyAVX2( CMatrix4x4* matrices, const CMatrix4x4* relMatrices,
+                                                   const TUInt32* parents, TUInt32 begin, TUInt32 end )
+{
+	for (TUInt32 node = begin; node < end; ++node)
+	{
+		MultiplyAVX2( &matrices[node].e00, &relMatrices[node].e00, &matrices[parents[node]].e00 );
+	}
+}
+
+// Two points at a time, one in each half
+GEN_TARGET_AVX2 static void TransformPointsAVX2( CVector3* out, const CMatrix4x4& m,
+                                                 const CVector3* points, TUInt32 num )
+{
+	const TFloat32* M = &m.e00;
+	__m256 m0 = _mm256_broadcast_ps( reinterpret_cast<const __m128*>(M) );
+	__m256 m1 = _mm256_broadcast_ps( reinterpret_cast<const __m128*>(M + 4) );
+	__m256 m2 = _mm256_broadcast_ps( reinterpret_cast<const __m128*>(M + 8) );
+	__m256 m3 = _mm256_broadcast_ps( reinterpret_cast<const __m128*>(M + 12) );
+	TUInt32 i = 0;
+	for (; i + 1 < num; i += 2)
+	{
+		const CVector3& p0 = points[i];
+		const CVector3& p1 = points[i + 1];
+		__m256 p = _mm256_fmadd_ps( _mm256_setr_ps( p0.x, p0.x, p0.x, p0.x, p1.x, p1.x, p1.x, p1.x ), m0, m3 );
+		p = _mm256_fmadd_ps( _mm256_setr_ps( p0.y, p0.y, p0.y, p0.y, p1.y, p1.y, p1.y, p1.y ), m1, p );
+		p = _mm256_fmadd_ps( _mm256_setr_ps( p0.z, p0.z, p0.z, p0.z, p1.z, p1.z, p1.z, p1.z ), m2, p );
+
+		TFloat32 result[8];
+		_mm256_storeu_ps( result, p );
+		out[i].x = result[0];
+		out[i].y = result[1];
+		out[i].z = result[2];
+		out[i + 1].x = result[4];
+		out[i + 1].y = result[5];
+		out[i + 1].z = result[6];
+	}
+	if (i < num)
+	{
+		TransformPointsSSE( out + i, m, points + i, 1 );
+	}
+}
+
+// As the SSE version, with 8 spheres at a time. Spheres 0-3 go in the low halves of the
+// registers and 4-7 in the high halves, so the mask bits are in sphere order
+GEN_TARGET_AVX2 static TUInt32 CullSpheresAVX2( const SBoundingSphere* spheres, TUInt32 num,
+                                                const SPlane* planes, TUInt32 numPlanes,
+                                                TUInt32* visible )
+{
+	TUInt32 numVisible = 0;
+	TUInt32 first = 0;
+	for (; first + 8 <= num; first += 8)
+	{
+		const TFloat32* S = &spheres[first].centre.x;
+		__m256 s04 = _mm256_insertf128_ps( _mm256_castps128_ps256( _mm_loadu_ps( S ) ),      _mm_loadu_ps( S + 16 ), 1 );
+		__m256 s15 = _mm256_insertf128_ps( _mm256_castps128_ps256( _mm_loadu_ps( S + 4 ) ),  _mm_loadu_ps( S + 20 ), 1 );
+		__m256 s26 = _mm256_insertf128_ps( _mm256_castps128_ps256( _mm_loadu_ps( S + 8 ) ),  _mm_loadu_ps( S + 24 ), 1 );
+		__m256 s37 = _mm256_insertf128_ps( _mm256_castps128_ps256( _mm_loadu_ps( S + 12 ) ), _mm_loadu_ps( S + 28 ), 1 );
+
+		// Transpose each half
+		__m256 t0 = _mm256_unpacklo_ps( s04, s15 );
+		__m256 t1 = _mm256_unpackhi_ps( s04, s15 );
+		__m256 t2 = _mm256_unpacklo_ps( s26, s37 );
+		__m256 t3 = _mm256_unpackhi_ps( s26, s37 );
+		__m256 x = _mm256_shuffle_ps( t0, t2, _MM_SHUFFLE(1, 0, 1, 0) );
+		__m256 y = _mm256_shuffle_ps( t0, t2, _MM_SHUFFLE(3, 2, 3, 2) );
+		__m256 z = _mm256_shuffle_ps( t1, t3, _MM_SHUFFLE(1, 0, 1, 0) );
+		__m256 r = _mm256_shuffle_ps( t1, t3, _MM_SHUFFLE(3, 2, 3, 2) );
+
+		__m256 inside = _mm256_castsi256_ps( _mm256_set1_epi32( -1 ) );
+		for (TUInt32 plane = 0; plane < numPlanes; ++plane)
+		{
+			__m256 dist = _mm256_fmadd_ps( x, _mm256_set1_ps( planes[plane].normal.x ),
+			                               _mm256_set1_ps( planes[plane].distance ) );
+			dist = _mm256_fmadd_ps( y, _mm256_set1_ps( planes[plane].normal.y ), dist );
+			dist = _mm256_fmadd_ps( z, _mm256_set1_ps( planes[plane].normal.z ), dist );
+			inside = _mm256_and_ps( inside, _mm256_cmp_ps( dist, r, _CMP_LE_OQ ) );
+		}
+
+		TUInt32 mask = static_cast<TUInt32>(_mm256_movemask_ps( inside ));
+		for (TUInt32 i = 0; mask != 0; ++i, mask >>= 1)
+		{
+			if (mask & 1)
+			{
+				visible[numVisible++] = first + i;
+			}
+		}
+	}
+
+	// Remaining spheres four then one at a time
+	TUInt32 numLeft = CullSpheresSSE( spheres + first, num - first, planes, numPlanes,
+	                                  visible + numVisible );
+	for (TUInt32 i = 0; i < numLeft; ++i)
+	{
+		visible[numVisible++] += first;
+	}
+	return numVisible;
+}
+
+
+/*-----------------------------------------------------------------------------------------
+	CPU feature detection
+-----------------------------------------------------------------------------------------*/
+
+// Get the registers (eax, ebx, ecx, edx) returned by the cpuid instruction
+static void CpuId( TUInt32 leaf, TUInt32 subLeaf, TUInt32 regs[4] )
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuidex( info, leaf, subLeaf );
+	for (TUInt32 reg = 0; reg < 4; ++reg)
+	{
+		regs[reg] = static_cast<TUInt32>(info[reg]);
+	}
+#else
+	__cpuid_count( leaf, subLeaf, regs[0], regs[1], regs[2], regs[3] );
+#endif
+}
+
+// Get the operating system's enabled register state (XCR0), only call if OSXSAVE is set
+static TUInt64 GetXCR0()
+{
+#ifdef _MSC_VER
+	return _xgetbv( 0 );
+#else
+	TUInt32 low, high;
+	__asm__ __volatile__( "xgetbv" : "=a"(low), "=d"(high) : "c"(0) );
+	return (static_cast<TUInt64>(high) << 32) | low;
+#endif
+}
+
+#endif // GEN_MATRIX_SIMD
+
+
+// Return the fastest set of kernels supported by this CPU
+EMatrixKernels SupportedMatrixKernels()
+{
+#ifdef GEN_MATRIX_SIMD
+	TUInt32 regs[4];
+	CpuId( 0, 0, regs );
+	TUInt32 maxLeaf = regs[0];
+	if (maxLeaf < 1)
+	{
+		return MatrixKernels_Scalar;
+	}
+
+	CpuId( 1, 0, regs );
+	bool hasSSE2 = (regs[3] & (1u << 26)) != 0;
+	bool hasFMA = (regs[2] & (1u << 12)) != 0;
+	bool hasOSXSave = (regs[2] & (1u << 27)) != 0;
+	bool hasAVX = (regs[2] & (1u << 28)) != 0;
+	if (!hasSSE2)
+	{
+		return MatrixKernels_Scalar;
+	}
+
+	// AVX registers must be saved by the operating system (XMM and YMM state enabled)
+	bool hasAVX2 = false;
+	if (maxLeaf >= 7 && hasFMA && hasAVX && hasOSXSave && (GetXCR0() & 6) == 6)
+	{
+		CpuId( 7, 0, regs );
+		hasAVX2 = (regs[1] & (1u << 5)) != 0;
+	}
+	return hasAVX2 ? MatrixKernels_AVX2 : MatrixKernels_SSE;
+#else
+	return MatrixKernels_Scalar;
+#endif
+}
+
+
+/*-----------------------------------------------------------------------------------------
+	Kernel dispatch
+-----------------------------------------------------------------------------------------*/
+
+// A set of kernels
+struct SMatrixKernels
+{
+	EMatrixKernels kernels;
+	void (*multiply)( CMatrix4x4* out, const CMatrix4x4& a, const CMatrix4x4& b );
+	void (*inverseAffine)( CMatrix4x4* out, const CMatrix4x4& m );
+	void (*transformPoints)( CVector3* out, const CMatrix4x4& m, const CVector3* points, TUInt32 num );
+	void (*multiplyBatch)( CMatrix4x4* out, const CMatrix4x4* a, const CMatrix4x4* b, TUInt32 num );
+	void (*multiplyHierarchy)( CMatrix4x4* matrices, const CMatrix4x4* relMatrices,
+	                           const TUInt32* parents, TUInt32 begin, TUInt32 end );
+	TUInt32 (*cullSpheres)( const SBoundingSphere* spheres, TUInt32 num, const SPlane* planes,
+	                        TUInt32 numPlanes, TUInt32* visible );
+};
+
+// Fill in the given set of kernels, the set must be supported
+static void SelectKernels( SMatrixKernels* selected, EMatrixKernels kernels )
+{
+	selected->kernels = kernels;
+	switch (kernels)
+	{
+#ifdef GEN_MATRIX_SIMD
+		case MatrixKernels_AVX2:
+			selected->multiply = MultiplySingleAVX2;
+			selected->inverseAffine = InverseAffineSSE;
+			selected->transformPoints = TransformPointsAVX2;
+			selected->multiplyBatch = MultiplyBatchAVX2;
+			selected->multiplyHierarchy = MultiplyHierarchyAVX2;
+			selected->cullSpheres = CullSpheresAVX2;
+			break;
+		case MatrixKernels_SSE:
+			selected->multiply = MultiplySSE;
+			selected->inverseAffine = InverseAffineSSE;
+			selected->transformPoints = TransformPointsSSE;
+			selected->multiplyBatch = MultiplyBatchSSE;
+			selected->multiplyHierarchy = MultiplyHierarchySSE;
+			selected->cullSpheres = CullSpheresSSE;
+			break;
+#endif
+		default:
+			selected->kernels = MatrixKernels_Scalar;
+			selected->multiply = MultiplyScalar;
+			selected->inverseAffine = InverseAffineScalar;
+			selected->transformPoints = TransformPointsScalar;
+			selected->multiplyBatch = MultiplyBatchScalar;
+			selected->multiplyHierarchy = MultiplyHierarchyScalar;
+			selected->cullSpheres = CullSpheresScalar;
+			break;
+	}
+}
+
+// Return the fastest supported set of kernels
+static SMatrixKernels InitialKernels()
+{
+	SMatrixKernels kernels;
+	SelectKernels( &kernels, SupportedMatrixKernels() );
+	return kernels;
+}
+
+// Return the kernels in use. Chosen on first use, so kernels may be used during static
+// initialisation
+static SMatrixKernels& Kernels()
+{
+	static SMatrixKernels kernels = InitialKernels();
+	return kernels;
+}
+
+
+// Return the set of kernels in use
+EMatrixKernels GetMatrixKernels()
+{
+	return Kernels().kernels;
+}
+
+// Use the given set of kernels, or the fastest supported set if it is not supported
+void SetMatrixKernels( EMatrixKernels kernels )
+{
+	EMatrixKernels supported = SupportedMatrixKernels();
+	SelectKernels( &Kernels(), (kernels <= supported) ? kernels : supported );
+}
+
+
+/////////////////////////////////////
+//	Single matrix kernels
+
+// Calculate a * b, the result may be one of the inputs
+void MatrixMultiply( CMatrix4x4* out, const CMatrix4x4& a, const CMatrix4x4& b )
+{
+	Kernels().multiply( out, a, b );
+}
+
+// Calculate the inverse of an affine matrix, the result may be the input
+void MatrixInverseAffine( CMatrix4x4* out, const CMatrix4x4& m )
+{
+	Kernels().inverseAffine( out, m );
+}
+
+// Transform a point by a matrix, the result may be the input
+void MatrixTransformPoint( CVector3* out, const CMatrix4x4& m, const CVector3& point )
+{
+	Kernels().transformPoints( out, m, &point, 1 );
+}
+
+
+/////////////////////////////////////
+//	Batched kernels
+
+// Calculate out[i] = a[i] * b[i] for num matrices
+void MatrixMultiplyBatch( CMatrix4x4* out, const CMatrix4x4* a, const CMatrix4x4* b,
+                          TUInt32 num )
+{
+	Kernels().multiplyBatch( out, a, b, num );
+}
+
+// Transform num points by the same matrix
+void MatrixTransformPoints( CVector3* out, const CMatrix4x4& m, const CVector3* points,
+                            TUInt32 num )
+{
+	Kernels().transformPoints( out, m, points, num );
+}
+
+// Test num spheres against the given planes and write the indices of those that are not
+// entirely outside any of the planes to visible. Returns the number of indices written
+TUInt32 MatrixCullSpheres( const SBoundingSphere* spheres, TUInt32 num, const SPlane* planes,
+                           TUInt32 numPlanes, TUInt32* visible )
+{
+	return Kernels().cullSpheres( spheres, num, planes, numPlanes, visible );
+}
+
+// Calculate absolute matrices for the nodes from begin up to (not including) end of a node
+// hierarchy
+void MatrixMultiplyHierarchy( CMatrix4x4* matrices, const CMatrix4x4* relMatrices,
+                              const TUInt32* parents, TUInt32 begin, TUInt32 end )
+{
+	Kernels().multiplyHierarchy( matrices, relMatrices, parents, begin, end );
+}
+
+
+} // namespace gen
@@ -0,0 +1,102 @@
+/*******************************************
+	MatrixKernels.h
+
+	SIMD matrix multiply, inverse and point
+	transform, single and batched, and bounding
+	sphere culling
+********************************************/
+
+#pragma once
+
+#include "Defines.h"
+#include "CVector3.h"
+#include "CMatrix4x4.h"
+
+namespace gen
+{
+
+/////////////////////////////////////
+//	Public types
+
+// Sets of matrix kernels, from slowest to fastest. The fastest set the CPU supports is chosen
+// on first use. SSE needs SSE2, AVX2 also needs FMA and operating system support for AVX.
+// Only scalar kernels are available on processors other than x86/x64
+enum EMatrixKernels
+{
+	MatrixKernels_Scalar,
+	MatrixKernels_SSE,
+	MatrixKernels_AVX2,
+};
+
+// A bounding sphere. Four floats, so a sphere can be loaded as one SIMD register
+struct SBoundingSphere
+{
+	CVector3 centre;
+	TFloat32 radius;
+};
+
+// A plane given by a unit normal and distance. Points p with Dot( normal, p ) + distance > 0
+// are outside the plane (on the side the normal points to)
+struct SPlane
+{
+	CVector3 normal;
+	TFloat32 distance;
+};
+
+
+/////////////////////////////////////
+//	Kernel selection
+
+// Return the fastest set of kernels supported by this CPU
+EMatrixKernels SupportedMatrixKernels();
+
+// Return the set of kernels in use
+EMatrixKernels GetMatrixKernels();
+
+// Use the given set of kernels, or the fastest supported set if it is not supported. Allows
+// the kernels to be compared, not thread-safe - don't call while other threads use kernels
+void SetMatrixKernels( EMatrixKernels kernels );
+
+
+/////////////////////////////////////
+//	Single matrix kernels
+
+// Calculate a * b, the result may be one of the inputs. Results can differ from CMatrix4x4's
+// operator* in the last bit as the AVX2 kernels use fused multiply-add
+void MatrixMultiply( CMatrix4x4* out, const CMatrix4x4& a, const CMatrix4x4& b );
+
+// Calculate the inverse of an affine matrix (one whose last column is 0,0,0,1), the result
+// may be the input. The upper 3x3 may contain scaling but must not be singular
+void MatrixInverseAffine( CMatrix4x4* out, const CMatrix4x4& m );
+
+// Transform a point by a matrix (as CMatrix4x4::TransformPoint), the result may be the input
+void MatrixTransformPoint( CVector3* out, const CMatrix4x4& m, const CVector3& point );
+
+
+/////////////////////////////////////
+//	Batched kernels
+
+// Calculate out[i] = a[i] * b[i] for num matrices. Each result may be one of its inputs
+void MatrixMultiplyBatch( CMatrix4x4* out, const CMatrix4x4* a, const CMatrix4x4* b,
+                          TUInt32 num );
+
+// Transform num points by the same matrix. Each result may be its input
+void MatrixTransformPoints( CVector3* out, const CMatrix4x4& m, const CVector3* points,
+                            TUInt32 num );
+
+// Test num spheres against the given planes and write the indices of those that are not
+// entirely outside any of the planes to visible (which must have space for num indices), in
+// order. Returns the number of indices written. With the six planes of a camera's frustum
+// this gives the spheres that may be on screen. Tests 4 (SSE) or 8 (AVX2) spheres at a time
+TUInt32 MatrixCullSpheres( const SBoundingSphere* spheres, TUInt32 num, const SPlane* planes,
+                           TUInt32 numPlanes, TUInt32* visible );
+
+// Calculate absolute matrices for the nodes from begin up to (not including) end of a node
+// hierarchy: matrices[node] = relMatrices[node] * matrices[parents[node]]. Each parent must
+// come before its children and begin must be at least 1 - node 0 is the root, which has no
+// parent
+void MatrixMultiplyHierarchy( CMatrix4x4* matrices, const CMatrix4x4* relMatrices,
+                              const TUInt32* parents, TUInt32 begin, TUInt32 end );
+
+
+} // namespace gen
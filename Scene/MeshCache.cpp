@@ -0,0 +1,143 @@
+/*******************************************
+	MeshCache.cpp
+
+	Shared, reference counted meshes for
+	entity templates
+********************************************/
+
+#include <vector>
+
+#include "MeshCache.h"
+
+namespace gen
+{
+
+// Destructor deletes any meshes still held
+CMeshCache::~CMeshCache()
+{
+	for (TMeshesIter cached = m_Meshes.begin(); cached != m_Meshes.end(); ++cached)
+	{
+		delete cached->second.mesh;
+	}
+}
+
+
+// Return the mesh loaded from the given file, loading it if it is not already cached, and
+// add a reference to it. Returns 0 if the mesh could not be loaded
+CMesh* CMeshCache::Acquire( const string& fileName )
+{
+	TAtom path = InternAtom( CanonicalPath( fileName ) );
+	TMeshesIter cached = m_Meshes.find( path );
+	if (cached != m_Meshes.end())
+	{
+		++cached->second.refCount;
+		return cached->second.mesh;
+	}
+
+	// Not cached, load the mesh using the file name as given
+	CMesh* mesh = new CMesh();
+	if (!mesh->Load( fileName ))
+	{
+		delete mesh;
+		return 0;
+	}
+
+	SCachedMesh newMesh = { mesh, 1 };
+	m_Meshes[path] = newMesh;
+	m_MeshPaths[mesh] = path;
+	return mesh;
+}
+
+
+// Add a mesh loaded elsewhere (e.g. on a worker thread) for the given file, without adding a
+// reference - the next Acquire for the file will use it. If the file is already cached the
+// given mesh is not needed and is deleted
+void CMeshCache::AddLoaded( const string& fileName, CMesh* mesh )
+{
+	TAtom path = InternAtom( CanonicalPath( fileName ) );
+	if (m_Meshes.find( path ) != m_Meshes.end())
+	{
+		delete mesh;
+		return;
+	}
+
+	SCachedMesh newMesh = { mesh, 0 };
+	m_Meshes[path] = newMesh;
+	m_MeshPaths[mesh] = path;
+}
+
+
+// Remove a reference to a mesh returned from Acquire, the mesh is deleted when its last
+// reference is removed
+void CMeshCache::Release( CMesh* mesh )
+{
+	TMeshPathsIter meshPath = m_MeshPaths.find( mesh );
+	if (meshPath == m_MeshPaths.end())
+	{
+		return;
+	}
+
+	TMeshesIter cached = m_Meshes.find( meshPath->second );
+	if (--cached->second.refCount == 0)
+	{
+		delete mesh;
+		m_Meshes.erase( cached );
+		m_MeshPaths.erase( meshPath );
+	}
+}
+
+
+// Return the canonical form of a mesh file path: separators are all '/', letters are lower
+// case, and empty, "." and ".." components are removed where possible
+string CMeshCache::CanonicalPath( const string& fileName )
+{
+	// Split into components, dropping empty and "." components and resolving ".." against
+	// the previous component. Leading ".." components cannot be resolved and are kept
+	vector<string> components;
+	string component;
+	for (TUInt32 pos = 0; pos <= fileName.length(); ++pos)
+	{
+		char c = (pos < fileName.length()) ? fileName[pos] : '/';
+		if (c != '/' && c != '\\')
+		{
+			component += (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;
+			continue;
+		}
+
+		if (component == "..")
+		{
+			if (!components.empty() && components.back() != "..")
+			{
+				components.pop_back();
+			}
+			else
+			{
+				components.push_back( component );
+			}
+		}
+		else if (!component.empty() && component != ".")
+		{
+			components.push_back( component );
+		}
+		component.clear();
+	}
+
+	// Keep a leading separator (absolute path)
+	string path;
+	if (!fileName.empty() && (fileName[0] == '/' || fileName[0] == '\\'))
+	{
+		path = "/";
+	}
+	for (TUInt32 i = 0; i < components.size(); ++i)
+	{
+		if (i > 0)
+		{
+			path += '/';
+		}
+		path += components[i];
+	}
+	return path;
+}
+
+
+} // namespace gen
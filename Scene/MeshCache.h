@@ -0,0 +1,114 @@
+/*******************************************
+	MeshCache.h
+
+	Shared, reference counted meshes for
+	entity templates
+********************************************/
+
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <stdexcept>
+using namespace std;
+
+#include "Defines.h"
+#ifdef GEN_HEADLESS
+#include "NullMesh.h"
+#else
+#include "Mesh.h"
+#endif
+#include "StringAtoms.h"
+
+namespace gen
+{
+
+// Exception thrown when a mesh file cannot be loaded, e.g. by a template constructor
+class CMeshLoadError : public runtime_error
+{
+public:
+	CMeshLoadError( const string& fileName ) : runtime_error( "Error loading mesh " + fileName ) {}
+};
+
+
+// The mesh cache loads each mesh file once and shares the loaded mesh between all the entity
+// templates that use it. Files are identified by their canonical path (see CanonicalPath), so
+// "Tank.x", ".\tank.x" and "Models/../Tank.x" all share one mesh. Each template acquires its
+// mesh when it is created and releases it when it is destroyed - a mesh is deleted as soon as
+// no template uses it. Not thread-safe
+class CMeshCache
+{
+/////////////////////////////////////
+//	Constructors/Destructors
+public:
+	// Constructor - empty cache
+	CMeshCache() {}
+
+	// Destructor deletes any meshes still held
+	~CMeshCache();
+
+private:
+	// Prevent use of copy constructor and assignment operator (private and not defined)
+	CMeshCache( const CMeshCache& );
+	CMeshCache& operator=( const CMeshCache& );
+
+
+/////////////////////////////////////
+//	Public interface
+public:
+
+	// Return the mesh loaded from the given file, loading it if it is not already cached, and
+	// add a reference to it. Returns 0 if the mesh could not be loaded
+	CMesh* Acquire( const string& fileName );
+
+	// Remove a reference to a mesh returned from Acquire, the mesh is deleted when its last
+	// reference is removed
+	void Release( CMesh* mesh );
+
+	// Returns true if the mesh for the given file is already loaded
+	bool IsCached( const string& fileName )
+	{
+		return m_Meshes.find( FindAtom( CanonicalPath( fileName ) ) ) != m_Meshes.end();
+	}
+
+	// Add a mesh loaded elsewhere (e.g. on a worker thread) for the given file, without adding
+	// a reference - the next Acquire for the file will use it. If the file is already cached
+	// the given mesh is not needed and is deleted
+	void AddLoaded( const string& fileName, CMesh* mesh );
+
+	// Return the number of distinct meshes currently loaded
+	TUInt32 NumMeshes()
+	{
+		return static_cast<TUInt32>(m_Meshes.size());
+	}
+
+	// Return the canonical form of a mesh file path: separators are all '/', letters are lower
+	// case (file names are not case sensitive on our platforms), and empty, "." and ".."
+	// components are removed where possible. Does not touch the file system
+	static string CanonicalPath( const string& fileName );
+
+
+/////////////////////////////////////
+//	Private interface
+private:
+
+	// A loaded mesh and the number of templates using it
+	struct SCachedMesh
+	{
+		CMesh*  mesh;
+		TUInt32 refCount;
+	};
+
+	// Cached meshes by atom of their canonical path, and the path atom of each mesh so meshes
+	// can be released by pointer
+	typedef unordered_map<TAtom, SCachedMesh> TMeshes;
+	typedef TMeshes::iterator TMeshesIter;
+	typedef unordered_map<CMesh*, TAtom> TMeshPaths;
+	typedef TMeshPaths::iterator TMeshPathsIter;
+
+	TMeshes    m_Meshes;
+	TMeshPaths m_MeshPaths;
+};
+
+
+} // namespace gen
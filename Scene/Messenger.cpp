@@ -5,6 +5,7 @@
 ********************************************/
 
 #include "Messenger.h"
+#include "JobSystem.h"
 
 namespace gen
 {
@@ -22,9 +23,16 @@ CMessenger Messenger;
 // Send the given message to a particular UID, does not check if the UID exists
 void CMessenger::SendMessage( TEntityUID to, const SMessage& msg )
 {
+	if (m_IsBuffering)
+	{
+		m_Outboxes[CJobSystem::CurrentWorker()].push_back( UIDMsgPair( to, msg ) );
+		return;
+	}
+
 	// Simply insert the UID/message pair into the message map. It will be inserted next
-	// to any other pairs with the same UID
-	m_Messages.insert( UIDMsgPair( to, msg ) );
+	// to any other pairs with the same UID. Record the recipient so it can be woken if asleep
+	m_Messages.insert( TMessages::value_type( to, msg ) );
+	m_Recipients.push_back( to );
 }
 
 
@@ -35,6 +43,26 @@ bool CMessenger::FetchMessage( TEntityUID to, SMessage* msg )
 	// Find the first message for this UID in the message map
 	TMessageIter itMessage = m_Messages.find( to );
 
+	// While buffering the map is shared between threads, so is not changed. Skip the messages
+	// already fetched, then mark the message returned as fetched and leave it to EndBuffering
+	// to delete. Each UID's messages are only fetched by one thread, so no lock is needed
+	if (m_IsBuffering)
+	{
+		while (itMessage != m_Messages.end() && itMessage->first == to && itMessage->second.fetched)
+		{
+			++itMessage;
+		}
+		if (itMessage == m_Messages.end() || itMessage->first != to)
+		{
+			return false;
+		}
+
+		*msg = itMessage->second.message;
+		itMessage->second.fetched = true;
+		m_Fetched[CJobSystem::CurrentWorker()].push_back( itMessage );
+		return true;
+	}
+
 	// See if no messages for this UID
 	if (itMessage == m_Messages.end())
 	{
@@ -42,12 +70,52 @@ bool CMessenger::FetchMessage( TEntityUID to, SMessage* msg )
 	}
 
 	// Return message, then delete it
-	*msg = itMessage->second;
+	*msg = itMessage->second.message;
 	m_Messages.erase( itMessage );
 
 	return true;
 }
 
 
+/////////////////////////////////////
+// Buffering
+
+// Start holding sent messages in an outbox for each worker thread
+void CMessenger::BeginBuffering( TUInt32 numOutboxes )
+{
+	if (m_Outboxes.size() < numOutboxes)
+	{
+		m_Outboxes.resize( numOutboxes );
+		m_Fetched.resize( numOutboxes );
+	}
+	m_IsBuffering = true;
+}
+
+// Stop buffering, delete the messages fetched while buffering and deliver the messages held in
+// the outboxes, in outbox order
+void CMessenger::EndBuffering()
+{
+	m_IsBuffering = false;
+	for (TUInt32 worker = 0; worker < m_Fetched.size(); ++worker)
+	{
+		for (TUInt32 message = 0; message < m_Fetched[worker].size(); ++message)
+		{
+			m_Messages.erase( m_Fetched[worker][message] );
+		}
+		m_Fetched[worker].clear();
+	}
+
+	for (TUInt32 outbox = 0; outbox < m_Outboxes.size(); ++outbox)
+	{
+		m_Messages.insert( m_Outboxes[outbox].begin(), m_Outboxes[outbox].end() );
+		for (TUInt32 message = 0; message < m_Outboxes[outbox].size(); ++message)
+		{
+			m_Recipients.push_back( m_Outboxes[outbox][message].first );
+		}
+		m_Outboxes[outbox].clear();
+	}
+}
+
+
 
 } // namespace gen
@@ -7,6 +7,7 @@
 #pragma once
 
 #include <map>
+#include <vector>
 using namespace std;
 
 #include "Defines.h"
@@ -26,9 +27,11 @@ enum EMessageType
 	Msg_Hit,  // Tells tank its been Hit
 	Msg_Help, // Calls for help from fellow tanks
 	Msg_Ammo, // Tells Tanks Ammo is available 
+	Msg_Restock, // Tells tank it has picked up ammo
 };
 
-// A message contains a type and the UID that sent it.
+// A message contains a type, the UID that sent it and the UID of the entity it is about (e.g.
+// the attacker for Msg_Help).
 // The message types for this exercise don't currently require extra data, but it is possible
 // to use a union to add additional data for new message types (see the space game code)
 struct SMessage
@@ -51,6 +54,7 @@ struct SMessage
 	//*** Message data
 	EMessageType type;
 	TEntityUID   from;
+	TEntityUID   subject;
 };
 
 
@@ -61,7 +65,10 @@ class CMessenger
 //	Constructors/Destructors
 public:
 	// Default constructor
-	CMessenger() {}
+	CMessenger()
+	{
+		m_IsBuffering = false;
+	}
 
 	// No destructor needed
 
@@ -85,6 +92,33 @@ public:
 	// pointer. Returns false if there are no messages for this UID
 	bool FetchMessage( TEntityUID to, SMessage* msg );
 
+	// Returns true if there are any messages waiting for the given UID. Not while buffering
+	bool HasMessage( TEntityUID to )
+	{
+		return m_Messages.find( to ) != m_Messages.end();
+	}
+
+	// Return the UIDs messages have been sent to since the last call, in the given vector,
+	// which should be empty (UIDs may be repeated). The entity manager uses this to wake
+	// sleeping entities when messages arrive for them
+	void TakeRecipients( vector<TEntityUID>& recipients )
+	{
+		recipients.swap( m_Recipients );
+	}
+
+
+	/////////////////////////////////////
+	// Buffering
+
+	// While buffering, messages sent are held in an outbox for the sending thread rather than
+	// delivered, so several threads can send and fetch messages at once. They are delivered
+	// together by EndBuffering, so messages sent while buffering can't be fetched until after
+	// it. Messages fetched while buffering are only marked as fetched, and are erased by
+	// EndBuffering, so fetching takes no lock - but the messages for each UID must only be
+	// fetched by one thread. The given number of outboxes is indexed by CJobSystem::CurrentWorker
+	void BeginBuffering( TUInt32 numOutboxes );
+	void EndBuffering();
+
 
 /////////////////////////////////////
 //	Private interface
@@ -95,11 +129,30 @@ private:
 	// key/value pairs in a multimap are sorted by key, which means all the messages for a
 	// particular UID are together. Key look-up is somewhat slower than for a hash map though
 	// Define some types to make usage easier
-	typedef multimap<TEntityUID, SMessage> TMessages;
+	// Each message is stored with a flag set when it is fetched while buffering
+	struct SStoredMessage
+	{
+		SStoredMessage( const SMessage& msg ) : message( msg ), fetched( false ) {}
+
+		SMessage message;
+		bool     fetched;
+	};
+	typedef multimap<TEntityUID, SStoredMessage> TMessages;
 	typedef TMessages::iterator TMessageIter;
-    typedef pair<TEntityUID, SMessage> UIDMsgPair; // The type stored by the multimap
+    typedef pair<TEntityUID, SMessage> UIDMsgPair; // A message and its recipient
 
 	TMessages m_Messages;
+
+	// UIDs sent messages since the last TakeRecipients
+	vector<TEntityUID> m_Recipients;
+
+	// Outboxes for each worker thread while buffering, and the messages each worker thread
+	// has fetched, to be erased when buffering ends
+	typedef vector<UIDMsgPair> TOutbox;
+	typedef vector<TMessageIter> TFetchedList;
+	bool                 m_IsBuffering;
+	vector<TOutbox>      m_Outboxes;
+	vector<TFetchedList> m_Fetched;
 };
 
 
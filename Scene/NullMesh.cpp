@@ -0,0 +1,235 @@
+/*******************************************
+	NullMesh.cpp
+
+	Mesh with a node hierarchy but no geometry,
+	used in headless builds
+********************************************/
+
+#include <cstdio>
+#include <cstdlib>
+
+#include "NullMesh.h"
+
+namespace gen
+{
+
+// Load the node hierarchy from the given text .x file. Returns false on failure. Each Frame
+// in the file becomes a node, with its FrameTransformMatrix as the node's matrix. Top level
+// frames are children of node 0, which stands for the whole file. Everything else in the file
+// (meshes, materials, animation etc.) is skipped
+bool CMesh::Load( const string& fileName )
+{
+	m_Nodes.clear();
+
+	// Read whole file
+	FILE* file = fopen( fileName.c_str(), "rb" );
+	if (!file)
+	{
+		return false;
+	}
+	string text;
+	char buffer[4096];
+	size_t numRead;
+	while ((numRead = fread( buffer, 1, sizeof(buffer), file )) > 0)
+	{
+		text.append( buffer, numRead );
+	}
+	fclose( file );
+
+	// Header is "xof " followed by version, then format "txt " (binary is "bin ", compressed
+	// formats are "tzip" and "bzip")
+	if (text.length() < 16 || text.compare( 0, 4, "xof " ) != 0 || text.compare( 8, 4, "txt " ) != 0)
+	{
+		return false;
+	}
+
+	AddNode( "", 0 );
+
+	// Stack of open blocks, holding the node for frame blocks or ~0 for other blocks
+	const TUInt32 kNotFrame = ~0u;
+	vector<TUInt32> blocks;
+	TUInt32 currentFrame = 0; // Innermost open frame, 0 when not in a frame
+
+	TUInt32 pos = 16;
+	string token;
+	ETokenType type = NextToken( text, pos, token );
+	while (type != Token_None)
+	{
+		if (type == Token_Name)
+		{
+			// Block type, may be followed by block name, then the block itself
+			string blockType = token;
+			string blockName;
+			type = NextToken( text, pos, token );
+			if (type == Token_Name)
+			{
+				blockName = token;
+				type = NextToken( text, pos, token );
+			}
+			if (type != Token_OpenBrace)
+			{
+				continue; // Not a block (e.g. an enum value in a data list), token not used yet
+			}
+
+			if (blockType == "template")
+			{
+				// Template definitions contain nothing we need - skip to end of block
+				TUInt32 depth = 1;
+				while (depth > 0 && (type = NextToken( text, pos, token )) != Token_None)
+				{
+					if (type == Token_OpenBrace)
+					{
+						++depth;
+					}
+					else if (type == Token_CloseBrace)
+					{
+						--depth;
+					}
+				}
+			}
+			else if (blockType == "Frame")
+			{
+				currentFrame = AddNode( blockName, currentFrame );
+				blocks.push_back( currentFrame );
+			}
+			else if (blockType == "FrameTransformMatrix" && currentFrame != 0)
+			{
+				// 16 elements, row by row, same layout as CMatrix4x4
+				TFloat32* element = &m_Nodes[currentFrame].positionMatrix.e00;
+				for (TUInt32 n = 0; n < 16; ++n)
+				{
+					if (NextToken( text, pos, token ) != Token_Number)
+					{
+						m_Nodes.clear();
+						return false;
+					}
+					element[n] = static_cast<TFloat32>(atof( token.c_str() ));
+				}
+				blocks.push_back( kNotFrame );
+			}
+			else
+			{
+				blocks.push_back( kNotFrame );
+			}
+		}
+		else if (type == Token_OpenBrace)
+		{
+			// Unnamed block, e.g. a reference to another data object
+			blocks.push_back( kNotFrame );
+		}
+		else if (type == Token_CloseBrace)
+		{
+			if (blocks.empty())
+			{
+				m_Nodes.clear();
+				return false;
+			}
+			if (blocks.back() != kNotFrame)
+			{
+				currentFrame = m_Nodes[blocks.back()].parent;
+			}
+			blocks.pop_back();
+		}
+		type = NextToken( text, pos, token );
+	}
+
+	if (!blocks.empty())
+	{
+		m_Nodes.clear();
+		return false;
+	}
+	return true;
+}
+
+
+// Read the next token from the given text starting at the given position, which is moved
+// past the token. Separators, comments, strings and GUIDs are skipped. The text of name and
+// number tokens is returned in the given string
+CMesh::ETokenType CMesh::NextToken( const string& text, TUInt32& pos, string& token )
+{
+	TUInt32 length = static_cast<TUInt32>(text.length());
+	while (pos < length)
+	{
+		char c = text[pos];
+		if ((c == '/' && pos + 1 < length && text[pos + 1] == '/') || c == '#')
+		{
+			// Comment to end of line
+			while (pos < length && text[pos] != '\n')
+			{
+				++pos;
+			}
+		}
+		else if (c == '"' || c == '<')
+		{
+			// String or GUID
+			char close = (c == '"') ? '"' : '>';
+			++pos;
+			while (pos < length && text[pos] != close)
+			{
+				++pos;
+			}
+			++pos;
+		}
+		else if (c == '{')
+		{
+			++pos;
+			return Token_OpenBrace;
+		}
+		else if (c == '}')
+		{
+			++pos;
+			return Token_CloseBrace;
+		}
+		else if (c == '-' || c == '+' || c == '.' || (c >= '0' && c <= '9'))
+		{
+			TUInt32 start = pos;
+			while (pos < length && (text[pos] == '-' || text[pos] == '+' || text[pos] == '.' ||
+			       text[pos] == 'e' || text[pos] == 'E' || (text[pos] >= '0' && text[pos] <= '9')))
+			{
+				++pos;
+			}
+			token.assign( text, start, pos - start );
+			return Token_Number;
+		}
+		else if (c == '_' || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'))
+		{
+			TUInt32 start = pos;
+			while (pos < length && (text[pos] == '_' || text[pos] == '-' ||
+			       (text[pos] >= 'a' && text[pos] <= 'z') || (text[pos] >= 'A' && text[pos] <= 'Z') ||
+			       (text[pos] >= '0' && text[pos] <= '9')))
+			{
+				++pos;
+			}
+			token.assign( text, start, pos - start );
+			return Token_Name;
+		}
+		else
+		{
+			// White space, separators (, ;) and anything else
+			++pos;
+		}
+	}
+	return Token_None;
+}
+
+
+// Add a node with the given name and parent, returns its index
+TUInt32 CMesh::AddNode( const string& name, TUInt32 parent )
+{
+	TUInt32 index = static_cast<TUInt32>(m_Nodes.size());
+	SMeshNode node;
+	node.name = name;
+	node.depth = (index == 0) ? 0 : m_Nodes[parent].depth + 1;
+	node.parent = parent;
+	node.numChildren = 0;
+	node.positionMatrix = CMatrix4x4::kIdentity;
+	m_Nodes.push_back( node );
+	if (index != 0)
+	{
+		++m_Nodes[parent].numChildren;
+	}
+	return index;
+}
+
+
+} // namespace gen
@@ -0,0 +1,104 @@
+/*******************************************
+	NullMesh.h
+
+	Mesh with a node hierarchy but no geometry,
+	used in headless builds
+********************************************/
+
+#pragma once
+
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "Defines.h"
+#include "CMatrix4x4.h"
+
+namespace gen
+{
+
+// Headless builds (GEN_HEADLESS defined) run the entity simulation without Direct3D, e.g. on
+// dedicated servers or for benchmarks. They use this mesh class in place of the one from
+// Mesh.h. It has the same interface as far as the scene code is concerned, but only loads
+// the node hierarchy from the mesh file - which entities need for their node matrices - and
+// renders nothing. CMakeLists.txt in this directory builds the headless library, with
+// GEN_HEADLESS defined, from the scene files and the gen maths library (CVector3, CMatrix4x4,
+// etc.)
+// Only text .x files can be read, binary or compressed .x files fail to load
+
+// A node in the mesh hierarchy. Nodes are stored depth first, so a node's parent always
+// comes before it. Node 0 is the root for the whole file
+struct SMeshNode
+{
+	string     name;
+	TUInt32    depth;
+	TUInt32    parent;
+	TUInt32    numChildren;
+	CMatrix4x4 positionMatrix; // Relative to parent
+};
+
+
+class CMesh
+{
+/////////////////////////////////////
+//	Constructors/Destructors
+public:
+	// Constructor creates an empty mesh
+	CMesh() {}
+
+	// No destructor needed
+
+private:
+	// Prevent use of copy constructor and assignment operator (private and not defined)
+	CMesh( const CMesh& );
+	CMesh& operator=( const CMesh& );
+
+
+/////////////////////////////////////
+//	Public interface
+public:
+
+	// Load the node hierarchy from the given text .x file. Returns false on failure
+	bool Load( const string& fileName );
+
+	TUInt32 GetNumNodes()
+	{
+		return static_cast<TUInt32>(m_Nodes.size());
+	}
+
+	SMeshNode& GetNode( TUInt32 node )
+	{
+		return m_Nodes[node];
+	}
+
+	// Nothing to render in a headless build
+	void Render( CMatrix4x4* /*matrices*/ ) {}
+
+
+/////////////////////////////////////
+//	Private interface
+private:
+
+	// Kinds of token in a text .x file
+	enum ETokenType
+	{
+		Token_None, // End of file
+		Token_Name,
+		Token_Number,
+		Token_OpenBrace,
+		Token_CloseBrace,
+	};
+
+	// Read the next token from the given text starting at the given position, which is moved
+	// past the token. Separators, comments, strings and GUIDs are skipped. The text of name
+	// and number tokens is returned in the given string
+	static ETokenType NextToken( const string& text, TUInt32& pos, string& token );
+
+	// Add a node with the given name and parent, returns its index
+	TUInt32 AddNode( const string& name, TUInt32 parent );
+
+	vector<SMeshNode> m_Nodes;
+};
+
+
+} // namespace gen
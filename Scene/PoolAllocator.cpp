@@ -0,0 +1,111 @@
+/*******************************************
+	PoolAllocator.cpp
+
+	Fixed size free-list pools used for entity
+	objects and entity matrices
+********************************************/
+
+#include <new>
+using namespace std;
+
+#include "PoolAllocator.h"
+
+namespace gen
+{
+
+/*-----------------------------------------------------------------------------------------
+-------------------------------------------------------------------------------------------
+	Pool Allocator Class
+-------------------------------------------------------------------------------------------
+-----------------------------------------------------------------------------------------*/
+
+// Alignment given to every object in a pool - enough for any entity or matrix type
+const TUInt32 kPoolAlignment = 16;
+
+// Constructor needs the size of each object and the number of objects in each block of
+// memory taken from the global allocator
+CPoolAllocator::CPoolAllocator( TUInt32 objectSize, TUInt32 objectsPerBlock )
+{
+	// Objects must be able to hold a free list link, and are rounded up to keep them aligned
+	if (objectSize < sizeof(SFreeObject))
+	{
+		objectSize = sizeof(SFreeObject);
+	}
+	m_ObjectSize = (objectSize + kPoolAlignment - 1) & ~(kPoolAlignment - 1);
+	m_ObjectsPerBlock = objectsPerBlock;
+	m_FreeList = 0;
+}
+
+// Destructor releases all blocks. Any objects still allocated are not destructed
+CPoolAllocator::~CPoolAllocator()
+{
+	for (TUInt32 block = 0; block < m_Blocks.size(); ++block)
+	{
+		::operator delete( m_Blocks[block] );
+	}
+}
+
+
+// Ensure there is memory for at least the given number of objects without further blocks
+void CPoolAllocator::Reserve( TUInt32 numObjects )
+{
+	while (m_Blocks.size() * m_ObjectsPerBlock < numObjects)
+	{
+		AddBlock();
+	}
+}
+
+
+// Take another block from the global allocator and add its objects to the free list
+void CPoolAllocator::AddBlock()
+{
+	// Global operator new returns memory suitably aligned for any fundamental type
+	char* block = static_cast<char*>(::operator new( m_ObjectSize * m_ObjectsPerBlock ));
+	m_Blocks.push_back( block );
+
+	// Link in reverse so objects are handed out in address order
+	for (TUInt32 object = m_ObjectsPerBlock; object > 0; --object)
+	{
+		Free( block + (object - 1) * m_ObjectSize );
+	}
+}
+
+
+/*-----------------------------------------------------------------------------------------
+-------------------------------------------------------------------------------------------
+	Matrix Arena Class
+-------------------------------------------------------------------------------------------
+-----------------------------------------------------------------------------------------*/
+
+// Destructor releases all pools
+CMatrixArena::~CMatrixArena()
+{
+	for (TUInt32 pool = 0; pool < m_Pools.size(); ++pool)
+	{
+		delete m_Pools[pool];
+	}
+}
+
+// Return an array of the given number of default constructed matrices
+CMatrix4x4* CMatrixArena::Allocate( TUInt32 numMatrices )
+{
+	// Create the pool for this array size if it is the first of its size
+	if (numMatrices >= m_Pools.size())
+	{
+		m_Pools.resize( numMatrices + 1, 0 );
+	}
+	if (!m_Pools[numMatrices])
+	{
+		m_Pools[numMatrices] = new CPoolAllocator( numMatrices * sizeof(CMatrix4x4), m_ArraysPerBlock );
+	}
+
+	CMatrix4x4* matrices = static_cast<CMatrix4x4*>(m_Pools[numMatrices]->Allocate());
+	for (TUInt32 matrix = 0; matrix < numMatrices; ++matrix)
+	{
+		new (&matrices[matrix]) CMatrix4x4;
+	}
+	return matrices;
+}
+
+
+} // namespace gen
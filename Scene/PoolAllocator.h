@@ -0,0 +1,154 @@
+/*******************************************
+	PoolAllocator.h
+
+	Fixed size free-list pools used for entity
+	objects and entity matrices
+********************************************/
+
+#pragma once
+
+#include <vector>
+using namespace std;
+
+#include "Defines.h"
+#include "CMatrix4x4.h"
+
+namespace gen
+{
+
+/*-----------------------------------------------------------------------------------------
+-------------------------------------------------------------------------------------------
+	Pool Allocator Class
+-------------------------------------------------------------------------------------------
+-----------------------------------------------------------------------------------------*/
+
+// A pool hands out memory for objects of one fixed size. Memory is taken from the global
+// allocator in large blocks of many objects and is never returned to it until the pool is
+// destroyed. Freed objects are kept in a free list and reused - most recently freed first, as
+// that memory is most likely to still be in the cache. So once a pool has grown to the peak
+// number of objects, allocating and freeing make no global allocator calls, and the objects
+// from one pool sit close together in memory
+// The pool only provides memory - use placement new and call destructors explicitly
+// Not thread-safe
+class CPoolAllocator
+{
+/////////////////////////////////////
+//	Constructors/Destructors
+public:
+	// Constructor needs the size of each object and the number of objects in each block of
+	// memory taken from the global allocator
+	CPoolAllocator( TUInt32 objectSize, TUInt32 objectsPerBlock );
+
+	// Destructor releases all blocks. Any objects still allocated are not destructed
+	~CPoolAllocator();
+
+private:
+	// Prevent use of copy constructor and assignment operator (private and not defined)
+	CPoolAllocator( const CPoolAllocator& );
+	CPoolAllocator& operator=( const CPoolAllocator& );
+
+
+/////////////////////////////////////
+//	Public interface
+public:
+
+	// Ensure there is memory for at least the given number of objects without further blocks
+	void Reserve( TUInt32 numObjects );
+
+	// Return memory for one object
+	void* Allocate()
+	{
+		if (!m_FreeList)
+		{
+			AddBlock();
+		}
+		SFreeObject* object = m_FreeList;
+		m_FreeList = object->next;
+		return object;
+	}
+
+	// Return memory from Allocate to the pool
+	void Free( void* object )
+	{
+		SFreeObject* freeObject = static_cast<SFreeObject*>(object);
+		freeObject->next = m_FreeList;
+		m_FreeList = freeObject;
+	}
+
+
+/////////////////////////////////////
+//	Private interface
+private:
+
+	// Free objects are linked through their own memory
+	struct SFreeObject
+	{
+		SFreeObject* next;
+	};
+
+	// Take another block from the global allocator and add its objects to the free list
+	void AddBlock();
+
+	TUInt32 m_ObjectSize;      // Rounded up to keep every object aligned
+	TUInt32 m_ObjectsPerBlock;
+
+	vector<char*> m_Blocks;
+	SFreeObject*  m_FreeList;
+};
+
+
+/*-----------------------------------------------------------------------------------------
+-------------------------------------------------------------------------------------------
+	Matrix Arena Class
+-------------------------------------------------------------------------------------------
+-----------------------------------------------------------------------------------------*/
+
+// The matrix arena provides the per-node matrix arrays for entities. Entities with the same
+// number of nodes share a pool, so arrays are always reused at exactly the right size
+class CMatrixArena
+{
+/////////////////////////////////////
+//	Constructors/Destructors
+public:
+	// Constructor needs the number of arrays in each block of memory taken from the global
+	// allocator, for each node count
+	CMatrixArena( TUInt32 arraysPerBlock )
+	{
+		m_ArraysPerBlock = arraysPerBlock;
+	}
+
+	// Destructor releases all pools
+	~CMatrixArena();
+
+private:
+	// Prevent use of copy constructor and assignment operator (private and not defined)
+	CMatrixArena( const CMatrixArena& );
+	CMatrixArena& operator=( const CMatrixArena& );
+
+
+/////////////////////////////////////
+//	Public interface
+public:
+
+	// Return an array of the given number of default constructed matrices
+	CMatrix4x4* Allocate( TUInt32 numMatrices );
+
+	// Return an array from Allocate to the arena, must pass the same number of matrices
+	void Free( CMatrix4x4* matrices, TUInt32 numMatrices )
+	{
+		m_Pools[numMatrices]->Free( matrices );
+	}
+
+
+/////////////////////////////////////
+//	Private interface
+private:
+
+	TUInt32 m_ArraysPerBlock;
+
+	// One pool for each array size, indexed by number of matrices. Created on demand
+	vector<CPoolAllocator*> m_Pools;
+};
+
+
+} // namespace gen
@@ -0,0 +1,78 @@
+/*******************************************
+	RenderBackend.cpp
+
+	Interface for executing render commands
+	and rendering instanced batches of mesh
+	nodes, with null and recording backends
+********************************************/
+
+#include "RenderBackend.h"
+
+namespace gen
+{
+
+/*-----------------------------------------------------------------------------------------
+-------------------------------------------------------------------------------------------
+	Render Backend Interface
+-------------------------------------------------------------------------------------------
+-----------------------------------------------------------------------------------------*/
+
+// Execute the given sorted commands. Each run of commands with the same mesh and node becomes
+// one call to RenderInstances, with the matrices gathered in command order
+void CRenderBackend::ExecuteCommands( const SRenderCommand* commands, TUInt32 numCommands )
+{
+	TUInt32 runStart = 0;
+	while (runStart < numCommands)
+	{
+		CMesh* mesh = commands[runStart].mesh;
+		TUInt32 node = commands[runStart].node;
+		m_InstanceMatrices.clear();
+		TUInt32 runEnd = runStart;
+		while (runEnd < numCommands && commands[runEnd].mesh == mesh &&
+		       commands[runEnd].node == node)
+		{
+			m_InstanceMatrices.push_back( *commands[runEnd].matrix );
+			++runEnd;
+		}
+
+		RenderInstances( mesh, node, &m_InstanceMatrices[0], runEnd - runStart );
+		runStart = runEnd;
+	}
+}
+
+
+
+/*-----------------------------------------------------------------------------------------
+-------------------------------------------------------------------------------------------
+	Recording Render Backend Class
+-------------------------------------------------------------------------------------------
+-----------------------------------------------------------------------------------------*/
+
+// Forget the calls made in the previous frame
+void CRecordingRenderBackend::BeginFrame()
+{
+	m_Calls.clear();
+	m_Matrices.clear();
+	m_NumInstances = 0;
+}
+
+// Record the call
+void CRecordingRenderBackend::RenderInstances( CMesh* mesh, TUInt32 node,
+                                               const CMatrix4x4* matrices, TUInt32 numInstances )
+{
+	SCall call;
+	call.mesh = mesh;
+	call.node = node;
+	call.numInstances = numInstances;
+	call.firstMatrix = static_cast<TUInt32>(m_Matrices.size());
+	m_Calls.push_back( call );
+	m_NumInstances += numInstances;
+
+	if (m_KeepMatrices)
+	{
+		m_Matrices.insert( m_Matrices.end(), matrices, matrices + numInstances );
+	}
+}
+
+
+} // namespace gen
@@ -0,0 +1,178 @@
+/*******************************************
+	RenderBackend.h
+
+	Interface for executing render commands
+	and rendering instanced batches of mesh
+	nodes, with null and recording backends
+********************************************/
+
+#pragma once
+
+#include <vector>
+using namespace std;
+
+#include "Defines.h"
+#include "CMatrix4x4.h"
+#include "RenderCommands.h"
+
+namespace gen
+{
+
+/*-----------------------------------------------------------------------------------------
+-------------------------------------------------------------------------------------------
+	Render Backend Interface
+-------------------------------------------------------------------------------------------
+-----------------------------------------------------------------------------------------*/
+
+// A render backend executes sorted lists of render commands. The base version of
+// ExecuteCommands draws each run of commands for the same mesh node as many copies (instances)
+// of the node in a single call to RenderInstances, which is all most backends need to provide.
+// The entity manager renders through a backend, if given one, so all visible entities sharing
+// a mesh cost one call per node of the mesh, rather than one call per entity (see
+// CEntityManager::SetRenderBackend)
+class CRenderBackend
+{
+/////////////////////////////////////
+//	Constructors/Destructors
+public:
+	CRenderBackend() {}
+
+	// Destructor - base class destructors should always be virtual
+	virtual ~CRenderBackend() {}
+
+private:
+	// Prevent use of copy constructor and assignment operator (private and not defined)
+	CRenderBackend( const CRenderBackend& );
+	CRenderBackend& operator=( const CRenderBackend& );
+
+
+/////////////////////////////////////
+//	Public interface
+public:
+
+	// Called before the first batch of each frame and after the last. Base versions do nothing
+	virtual void BeginFrame() {}
+	virtual void EndFrame() {}
+
+	// Execute the given commands, which should be sorted by key (see CRenderCommandList::Sort).
+	// Gathers the matrices of each run of commands with the same mesh and node into an instance
+	// buffer and passes them to RenderInstances
+	virtual void ExecuteCommands( const SRenderCommand* commands, TUInt32 numCommands );
+
+	// Render the given node of a mesh once for each of the given world matrices. The matrices
+	// are contiguous and only valid during the call
+	virtual void RenderInstances( CMesh* /*mesh*/, TUInt32 /*node*/, const CMatrix4x4* /*matrices*/,
+	                              TUInt32 numInstances ) = 0;
+
+
+/////////////////////////////////////
+//	Private interface
+private:
+
+	// Instance matrices of the run of commands being executed, kept to avoid reallocation
+	vector<CMatrix4x4> m_InstanceMatrices;
+};
+
+
+
+/*-----------------------------------------------------------------------------------------
+-------------------------------------------------------------------------------------------
+	Null Render Backend Class
+-------------------------------------------------------------------------------------------
+-----------------------------------------------------------------------------------------*/
+
+// A backend that draws nothing. Used to measure the CPU cost of rendering (culling, recording,
+// sorting and gathering commands) without a graphics device, e.g. in headless builds
+class CNullRenderBackend : public CRenderBackend
+{
+public:
+	void RenderInstances( CMesh* /*mesh*/, TUInt32 /*node*/, const CMatrix4x4* /*matrices*/,
+	                      TUInt32 /*numInstances*/ ) {}
+};
+
+
+
+/*-----------------------------------------------------------------------------------------
+-------------------------------------------------------------------------------------------
+	Recording Render Backend Class
+-------------------------------------------------------------------------------------------
+-----------------------------------------------------------------------------------------*/
+
+// A backend that draws nothing but records the calls made to it in the last frame. Used for
+// testing and in headless builds. Matrices are only kept if asked for
+class CRecordingRenderBackend : public CRenderBackend
+{
+/////////////////////////////////////
+//	Constructors/Destructors
+public:
+	// Constructor, pass true to keep a copy of the matrices passed for each call
+	CRecordingRenderBackend( bool keepMatrices = false )
+	{
+		m_KeepMatrices = keepMatrices;
+		m_NumInstances = 0;
+	}
+
+
+/////////////////////////////////////
+//	Public interface
+public:
+
+	// A call to RenderInstances
+	struct SCall
+	{
+		CMesh*  mesh;
+		TUInt32 node;
+		TUInt32 numInstances;
+		TUInt32 firstMatrix; // Index into the kept matrices, if they are kept
+	};
+
+	/////////////////////////////////////
+	// CRenderBackend interface
+
+	// Forget the calls made in the previous frame
+	void BeginFrame();
+
+	// Record the call
+	void RenderInstances( CMesh* /*mesh*/, TUInt32 /*node*/, const CMatrix4x4* /*matrices*/,
+	                      TUInt32 numInstances );
+
+
+	/////////////////////////////////////
+	// Recorded calls
+
+	// Number of calls (draw calls) made in the last frame
+	TUInt32 NumCalls()
+	{
+		return static_cast<TUInt32>(m_Calls.size());
+	}
+
+	const SCall& GetCall( TUInt32 call )
+	{
+		return m_Calls[call];
+	}
+
+	// Total number of instances over all calls in the last frame
+	TUInt32 NumInstances()
+	{
+		return m_NumInstances;
+	}
+
+	// Matrices kept for the given call, one for each instance. Only if keeping matrices
+	const CMatrix4x4* GetMatrices( TUInt32 call )
+	{
+		return &m_Matrices[m_Calls[call].firstMatrix];
+	}
+
+
+/////////////////////////////////////
+//	Private interface
+private:
+
+	bool               m_KeepMatrices;
+	vector<SCall>      m_Calls;
+	vector<CMatrix4x4> m_Matrices;
+	TUInt32            m_NumInstances;
+};
+
+
+} // namespace gen
@@ -0,0 +1,72 @@
+/*******************************************
+	RenderCommands.cpp
+
+	Render commands with sort keys, recorded
+	into lists and sorted before execution
+********************************************/
+
+#include "RenderCommands.h"
+
+namespace gen
+{
+
+/*-----------------------------------------------------------------------------------------
+-------------------------------------------------------------------------------------------
+	Render Command List Class
+-------------------------------------------------------------------------------------------
+-----------------------------------------------------------------------------------------*/
+
+// Sort the commands by key, keeping the order of commands with equal keys. Least significant
+// byte first radix sort - the counts for all eight bytes are made in a single read of the keys,
+// then each byte that differs between commands takes one pass moving the commands between the
+// list and the working space. Typical keys share their top bytes (few meshes), so most frames
+// need only a few passes
+void CRenderCommandList::Sort()
+{
+	TUInt32 numCommands = NumCommands();
+	if (numCommands < 2)
+	{
+		return;
+	}
+
+	const TUInt32 kNumBytes = sizeof(TUInt64);
+	TUInt32 counts[kNumBytes][256] = {};
+	for (TUInt32 command = 0; command < numCommands; ++command)
+	{
+		TUInt64 key = m_Commands[command].sortKey;
+		for (TUInt32 byte = 0; byte < kNumBytes; ++byte)
+		{
+			++counts[byte][(key >> (byte * 8)) & 0xff];
+		}
+	}
+
+	m_SortCommands.resize( numCommands );
+	for (TUInt32 byte = 0; byte < kNumBytes; ++byte)
+	{
+		// Skip bytes that are the same in every key
+		TUInt32* byteCounts = counts[byte];
+		if (byteCounts[(m_Commands[0].sortKey >> (byte * 8)) & 0xff] == numCommands)
+		{
+			continue;
+		}
+
+		// Convert counts to the position of the first command with each byte value
+		TUInt32 position = 0;
+		for (TUInt32 value = 0; value < 256; ++value)
+		{
+			TUInt32 count = byteCounts[value];
+			byteCounts[value] = position;
+			position += count;
+		}
+
+		for (TUInt32 command = 0; command < numCommands; ++command)
+		{
+			const SRenderCommand& from = m_Commands[command];
+			m_SortCommands[byteCounts[(from.sortKey >> (byte * 8)) & 0xff]++] = from;
+		}
+		m_Commands.swap( m_SortCommands );
+	}
+}
+
+
+} // namespace gen
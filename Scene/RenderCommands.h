@@ -0,0 +1,130 @@
+/*******************************************
+	RenderCommands.h
+
+	Render commands with sort keys, recorded
+	into lists and sorted before execution
+********************************************/
+
+#pragma once
+
+#include <vector>
+using namespace std;
+
+#include "Defines.h"
+#include "CMatrix4x4.h"
+
+namespace gen
+{
+
+class CMesh;
+
+/////////////////////////////////////
+//	Render commands
+
+// A request to render one node of a mesh with the given world matrix. The matrix is not
+// copied, it must stay valid until the command has been executed
+struct SRenderCommand
+{
+	TUInt64           sortKey;
+	CMesh*            mesh;
+	const CMatrix4x4* matrix;
+	TUInt32           node;
+};
+
+// Sizes of the fields of a sort key. Most significant first: mesh, node, then depth - so
+// sorted commands are grouped by mesh, then by node within a mesh (each group is one state
+// change and one instanced draw), then front to back within a group
+const TUInt32 kSortKeyMeshBits = 24;
+const TUInt32 kSortKeyNodeBits = 16;
+const TUInt32 kSortKeyDepthBits = 24;
+const TUInt32 kMaxSortKeyDepth = (1 << kSortKeyDepthBits) - 1;
+
+// Return the sort key for a command. The mesh is a small integer identifying the mesh (e.g.
+// CEntityTemplate::GetMeshAtom) and depth is a distance from the camera scaled to the range
+// 0 to kMaxSortKeyDepth. Each field is truncated to its size
+inline TUInt64 RenderSortKey( TUInt32 mesh, TUInt32 node, TUInt32 depth )
+{
+	const TUInt64 meshMask = (1 << kSortKeyMeshBits) - 1;
+	const TUInt64 nodeMask = (1 << kSortKeyNodeBits) - 1;
+	return ((mesh & meshMask) << (kSortKeyNodeBits + kSortKeyDepthBits)) |
+	       ((node & nodeMask) << kSortKeyDepthBits) | (depth & kMaxSortKeyDepth);
+}
+
+
+/*-----------------------------------------------------------------------------------------
+-------------------------------------------------------------------------------------------
+	Render Command List Class
+-------------------------------------------------------------------------------------------
+-----------------------------------------------------------------------------------------*/
+
+// A list of render commands. Lists are not thread-safe, so when commands are recorded on
+// several threads each thread records into its own list, and the lists are appended together
+// once recording has finished. The list is then sorted and passed to a render backend
+// (see CRenderBackend::ExecuteCommands). Memory is kept when a list is cleared
+class CRenderCommandList
+{
+/////////////////////////////////////
+//	Constructors/Destructors
+public:
+	// Constructor - empty list
+	CRenderCommandList() {}
+
+private:
+	// Prevent use of copy constructor and assignment operator (private and not defined)
+	CRenderCommandList( const CRenderCommandList& );
+	CRenderCommandList& operator=( const CRenderCommandList& );
+
+
+/////////////////////////////////////
+//	Public interface
+public:
+
+	// Add a command to the list
+	void Add( TUInt64 sortKey, CMesh* mesh, TUInt32 node, const CMatrix4x4* matrix )
+	{
+		SRenderCommand command;
+		command.sortKey = sortKey;
+		command.mesh = mesh;
+		command.matrix = matrix;
+		command.node = node;
+		m_Commands.push_back( command );
+	}
+
+	// Add all the commands of another list to the end of this one
+	void Append( const CRenderCommandList& other )
+	{
+		m_Commands.insert( m_Commands.end(), other.m_Commands.begin(), other.m_Commands.end() );
+	}
+
+	// Remove all commands
+	void Clear()
+	{
+		m_Commands.clear();
+	}
+
+	// Sort the commands by key, keeping the order of commands with equal keys. Radix sort, one
+	// pass for each byte of the keys that is not the same in every command
+	void Sort();
+
+	TUInt32 NumCommands() const
+	{
+		return static_cast<TUInt32>(m_Commands.size());
+	}
+
+	const SRenderCommand* Commands() const
+	{
+		return m_Commands.empty() ? 0 : &m_Commands[0];
+	}
+
+
+/////////////////////////////////////
+//	Private interface
+private:
+
+	// The commands, and working space for the sort
+	vector<SRenderCommand> m_Commands;
+	vector<SRenderCommand> m_SortCommands;
+};
+
+
+} // namespace gen
@@ -0,0 +1,165 @@
+/*******************************************
+	RenderSnapshot.cpp
+
+	Copy of the entity transforms needed to
+	render a frame, rendered on another thread
+********************************************/
+
+#include <algorithm>
+using namespace std;
+
+#include "RenderSnapshot.h"
+
+namespace gen
+{
+
+/////////////////////////////////////
+//	Render views
+
+// Return the view of the given camera, or a view that culls nothing if there is no camera
+SRenderView MakeRenderView( CCamera* camera )
+{
+	SRenderView view;
+	view.numPlanes = 0;
+	view.depthScale = 0.0f;
+	if (camera)
+	{
+		// Frustum planes as normal and distance, normals point out of the frustum
+		CVector3 points[6];
+		CVector3 vectors[6];
+		camera->CalculateFrustrumPlanes( points, vectors );
+		for (TUInt32 plane = 0; plane < 6; ++plane)
+		{
+			view.planes[plane].normal = vectors[plane];
+			view.planes[plane].distance = -Dot( vectors[plane], points[plane] );
+		}
+		view.numPlanes = 6;
+
+		view.position = camera->Position();
+		view.facing = camera->Matrix().ZAxis();
+		view.depthScale = kMaxSortKeyDepth / camera->GetFarClip();
+	}
+	return view;
+}
+
+// Return the sort key depth of a point in the given view
+TUInt32 RenderViewDepth( const SRenderView& view, const CVector3& point )
+{
+	if (view.numPlanes == 0)
+	{
+		return 0;
+	}
+
+	TFloat32 distance = Dot( point - view.position, view.facing ) * view.depthScale;
+	if (distance >= kMaxSortKeyDepth)
+	{
+		return kMaxSortKeyDepth;
+	}
+	else if (distance > 0.0f)
+	{
+		return static_cast<TUInt32>(distance);
+	}
+	return 0;
+}
+
+
+/*-----------------------------------------------------------------------------------------
+-------------------------------------------------------------------------------------------
+	Render Snapshot Class
+-------------------------------------------------------------------------------------------
+-----------------------------------------------------------------------------------------*/
+
+// Remove all entities
+void CRenderSnapshot::Clear()
+{
+	m_Entities.clear();
+	m_Bounds.clear();
+	m_Matrices.clear();
+	m_NumEntities = 0;
+}
+
+// Set the entity in the given slot from its mesh, world bounding sphere and absolute node matrices
+void CRenderSnapshot::SetEntity( TUInt32 slot, CMesh* mesh, TAtom meshAtom,
+                                 const SBoundingSphere& bounds, const CMatrix4x4* matrices,
+                                 TUInt32 numNodes )
+{
+	if (slot >= m_Entities.size())
+	{
+		SEntity empty = { 0, kNoAtom, 0, 0, 0 };
+		SBoundingSphere noBounds = { CVector3::kOrigin, 0.0f };
+		m_Entities.resize( slot + 1, empty );
+		m_Bounds.resize( slot + 1, noBounds );
+	}
+
+	SEntity& entity = m_Entities[slot];
+	if (!entity.mesh)
+	{
+		++m_NumEntities;
+	}
+	if (numNodes > entity.maxNodes)
+	{
+		// No room for the matrices where the slot's last entity had them, put them at the end
+		entity.firstMatrix = static_cast<TUInt32>(m_Matrices.size());
+		entity.maxNodes = numNodes;
+		m_Matrices.resize( m_Matrices.size() + numNodes );
+	}
+	entity.mesh = mesh;
+	entity.meshAtom = meshAtom;
+	entity.numNodes = numNodes;
+	m_Bounds[slot] = bounds;
+	copy( matrices, matrices + numNodes, m_Matrices.begin() + entity.firstMatrix );
+}
+
+// Empty the given slot, if it holds an entity
+void CRenderSnapshot::RemoveEntity( TUInt32 slot )
+{
+	if (slot < m_Entities.size() && m_Entities[slot].mesh)
+	{
+		m_Entities[slot].mesh = 0;
+		--m_NumEntities;
+	}
+}
+
+
+// Cull the entities against the view, record and sort render commands for the visible ones
+// and execute them with the given backend. Returns the number of entities rendered. Empty slots
+// are culled along with the rest, then skipped
+TUInt32 CRenderSnapshot::Render( const SRenderView& view, CRenderBackend* backend )
+{
+	TUInt32 numEntities = static_cast<TUInt32>(m_Entities.size());
+	TUInt32 numVisible = numEntities;
+	if (view.numPlanes > 0)
+	{
+		m_VisibleEntities.resize( numEntities );
+		numVisible = MatrixCullSpheres( numEntities ? &m_Bounds[0] : 0, numEntities, view.planes,
+		                                view.numPlanes, numEntities ? &m_VisibleEntities[0] : 0 );
+	}
+
+	m_Commands.Clear();
+	TUInt32 numRendered = 0;
+	for (TUInt32 visible = 0; visible < numVisible; ++visible)
+	{
+		TUInt32 index = view.numPlanes > 0 ? m_VisibleEntities[visible] : visible;
+		const SEntity& entity = m_Entities[index];
+		if (!entity.mesh)
+		{
+			continue;
+		}
+		++numRendered;
+		TUInt32 depth = RenderViewDepth( view, m_Bounds[index].centre );
+		for (TUInt32 node = 0; node < entity.numNodes; ++node)
+		{
+			m_Commands.Add( RenderSortKey( entity.meshAtom, node, depth ), entity.mesh, node,
+			                &m_Matrices[entity.firstMatrix + node] );
+		}
+	}
+	m_Commands.Sort();
+
+	backend->BeginFrame();
+	backend->ExecuteCommands( m_Commands.Commands(), m_Commands.NumCommands() );
+	backend->EndFrame();
+	return numRendered;
+}
+
+
+} // namespace gen
@@ -0,0 +1,141 @@
+/*******************************************
+	RenderSnapshot.h
+
+	Copy of the entity transforms needed to
+	render a frame, rendered on another thread
+********************************************/
+
+#pragma once
+
+#include <vector>
+using namespace std;
+
+#include "Defines.h"
+#include "CVector3.h"
+#include "CMatrix4x4.h"
+#include "Camera.h"
+#include "StringAtoms.h"
+#include "MatrixKernels.h"
+#include "RenderCommands.h"
+#include "RenderBackend.h"
+
+namespace gen
+{
+
+/////////////////////////////////////
+//	Render views
+
+// The camera settings used to cull and sort a frame, copied so they can be used while the
+// camera moves on. With no planes nothing is culled and all depths are 0
+struct SRenderView
+{
+	SPlane   planes[6];
+	TUInt32  numPlanes;
+	CVector3 position;
+	CVector3 facing;
+	TFloat32 depthScale;
+};
+
+// Return the view of the given camera, or a view that culls nothing if there is no camera
+SRenderView MakeRenderView( CCamera* camera );
+
+// Return the sort key depth (0 to kMaxSortKeyDepth) of a point in the given view - the distance
+// along the camera's facing, scaled so the far clip distance is the largest depth
+TUInt32 RenderViewDepth( const SRenderView& view, const CVector3& point );
+
+
+/*-----------------------------------------------------------------------------------------
+-------------------------------------------------------------------------------------------
+	Render Snapshot Class
+-------------------------------------------------------------------------------------------
+-----------------------------------------------------------------------------------------*/
+
+// A render snapshot holds the mesh, world bounds and absolute node matrices of each entity at
+// one point in time (the end of an update). While it is rendered it is not changed, so it can
+// be culled, sorted and rendered on another thread while the entities themselves are updated
+// (see CEntityManager::SetPipelinedRender). Entities are held in numbered slots (the entity
+// manager uses the index of each entity's UID), so a snapshot is kept from frame to frame and
+// only the entities that have changed are copied into it again. The meshes are not owned, they
+// must stay loaded while the snapshot is in use. Memory is kept when a snapshot is cleared
+class CRenderSnapshot
+{
+/////////////////////////////////////
+//	Constructors/Destructors
+public:
+	// Constructor - empty snapshot
+	CRenderSnapshot()
+	{
+		m_NumEntities = 0;
+	}
+
+private:
+	// Prevent use of copy constructor and assignment operator (private and not defined)
+	CRenderSnapshot( const CRenderSnapshot& );
+	CRenderSnapshot& operator=( const CRenderSnapshot& );
+
+
+/////////////////////////////////////
+//	Public interface
+public:
+
+	/////////////////////////////////////
+	// Filling
+
+	// Remove all entities
+	void Clear();
+
+	// Set the entity in the given slot from its mesh (and mesh atom, see
+	// CEntityTemplate::GetMeshAtom), world bounding sphere and absolute node matrices, which
+	// are copied. Replaces any entity already in the slot
+	void SetEntity( TUInt32 slot, CMesh* mesh, TAtom meshAtom, const SBoundingSphere& bounds,
+	                const CMatrix4x4* matrices, TUInt32 numNodes );
+
+	// Empty the given slot, if it holds an entity
+	void RemoveEntity( TUInt32 slot );
+
+	// Number of slots holding entities
+	TUInt32 NumEntities()
+	{
+		return m_NumEntities;
+	}
+
+
+	/////////////////////////////////////
+	// Rendering
+
+	// Cull the entities against the view, record and sort render commands for the visible ones
+	// and execute them with the given backend. Returns the number of entities rendered. Only
+	// one thread may render a snapshot at a time, and it must not be filled meanwhile
+	TUInt32 Render( const SRenderView& view, CRenderBackend* backend );
+
+
+/////////////////////////////////////
+//	Private interface
+private:
+
+	// An entity slot in the snapshot, empty if it has no mesh. Its node matrices start at
+	// firstMatrix in m_Matrices, where there is room for maxNodes of them - the room is kept
+	// when the slot is emptied, and reused if the next entity in the slot fits
+	struct SEntity
+	{
+		CMesh*  mesh;
+		TAtom   meshAtom;
+		TUInt32 numNodes;
+		TUInt32 maxNodes;
+		TUInt32 firstMatrix;
+	};
+
+	// Entity slots, with their bounds and matrices kept in separate arrays (bounds are culled
+	// together in one pass)
+	vector<SEntity>         m_Entities;
+	vector<SBoundingSphere> m_Bounds;
+	vector<CMatrix4x4>      m_Matrices;
+	TUInt32                 m_NumEntities;
+
+	// Working space for rendering, kept to avoid reallocation
+	vector<TUInt32>    m_VisibleEntities;
+	CRenderCommandList m_Commands;
+};
+
+
+} // namespace gen
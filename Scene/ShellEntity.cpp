@@ -24,6 +24,9 @@ namespace gen
 	// Will be needed to implement the required shell behaviour in the Update function below
 	extern TEntityUID GetTankUID(int team);
 
+	// Atom for the tank type name, interned once rather than hashed on every lookup
+	static const TAtom TankType = InternAtom("Tank");
+
 
 
 	/*-----------------------------------------------------------------------------------------
@@ -38,14 +41,17 @@ namespace gen
 	(
 		CEntityTemplate* entityTemplate,
 		TEntityUID       UID,
+		CShellArchetype* archetype,
 		TEntityUID       ShooterUID,
-		const string& name /*=""*/,
+		TAtom         name /*= kNoAtom*/,
 		const CVector3& position /*= CVector3::kOrigin*/,
 		const CVector3& rotation /*= CVector3( 0.0f, 0.0f, 0.0f )*/,
 		const CVector3& scale /*= CVector3( 1.0f, 1.0f, 1.0f )*/
-	) : CEntity(entityTemplate, UID, name, position, rotation, scale)
+	) : CEntity(entityTemplate, UID, archetype, name, position, rotation, scale)
 	{
 		// Initialise any shell data you add
+		m_ShellArchetype = archetype;
+		Timer() = 0.0f;
 		shooterUID = ShooterUID;
 	}
 
@@ -55,36 +61,29 @@ namespace gen
 	// Return false if the entity is to be destroyed
 	bool CShellEntity::Update(TFloat32 updateTime)
 	{
-		m_Timer += updateTime *1;
+		Timer() += updateTime *1;
 
 
 		Matrix().MoveLocalZ(kMaxSpeed);
 
-		if (m_Timer > destructionPoint)
+		if (Timer() > destructionPoint)
 		{
 			return false;
 		}
 
-		EntityManager.BeginEnumEntities("", "", "Tank");
-		CEntity* entity = EntityManager.EnumEntity();
-		while (entity != nullptr)
+		// Only the tanks near the shell are checked, found through the spatial grid
+		CEntity* tank = EntityManager.FindEntityInRadius(GetPosition(), 8.0f, TankType, kAnyTeam,
+		                                                 shooterUID);
+		if (tank)
 		{
-			if (entity->GetUID() != shooterUID)
-			{
-
-				if (Distance(Position(), entity->Position()) < 8.0f)
-				{
-					SMessage msg;
-					msg.type = Msg_Hit;
-					msg.from = shooterUID;
-					Messenger.SendMessage(entity->GetUID(), msg);
-					dynamic_cast<CTankEntity*>(entity)->ShotBy(shooterUID);
-					return false;
-				}
-			}
-			entity = EntityManager.EnumEntity();  //Moves onto next Entity
+			// The tank records who shot it when it receives the message
+			SMessage msg;
+			msg.type = Msg_Hit;
+			msg.from = shooterUID;
+			msg.subject = shooterUID;
+			Messenger.SendMessage(tank->GetUID(), msg);
+			return false;
 		}
-		EntityManager.EndEnumEntities();
 
 		return true; // Placeholder
 	}
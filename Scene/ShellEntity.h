@@ -7,6 +7,7 @@
 #pragma once
 
 #include <string>
+#include <vector>
 using namespace std;
 
 #include "Defines.h"
@@ -19,6 +20,77 @@ namespace gen
 	//**** No need for a template class for a shell - there are no generic features for shells
 	//**** other than their mesh so they can use the base class
 
+	// Handle for templates used to create shells
+	typedef CTemplateHandle<CEntityTemplate, Kind_Shell> TShellTemplateHandle;
+
+	/*-----------------------------------------------------------------------------------------
+	-------------------------------------------------------------------------------------------
+		Shell Archetype Class
+	-------------------------------------------------------------------------------------------
+	-----------------------------------------------------------------------------------------*/
+
+	// The shell archetype adds a column for the shell lifetime timer
+	class CShellArchetype : public CEntityArchetype
+	{
+		/////////////////////////////////////
+		//	Constructors/Destructors
+	public:
+		CShellArchetype(CMatrixArena* matrixArena) : CEntityArchetype(Kind_Shell, matrixArena) {}
+
+		// No destructor needed
+
+
+	/////////////////////////////////////
+	//	Public interface
+	public:
+
+		/////////////////////////////////////
+		// Column access
+
+		TFloat32& Timer(TUInt32 row)
+		{
+			return m_Timers[row];
+		}
+
+
+		/////////////////////////////////////
+		//	Protected interface
+	protected:
+
+		/////////////////////////////////////
+		// Column management
+
+		virtual void ReserveColumns(TUInt32 numRows)
+		{
+			m_Timers.reserve(numRows);
+		}
+
+		virtual void AddColumns()
+		{
+			m_Timers.push_back(0.0f);
+		}
+
+		virtual void MoveColumns(TUInt32 from, TUInt32 to)
+		{
+			m_Timers[to] = m_Timers[from];
+		}
+
+		virtual void TruncateColumns(TUInt32 numRows)
+		{
+			m_Timers.resize(numRows);
+		}
+
+
+		/////////////////////////////////////
+		//	Private interface
+	private:
+
+		// Shell columns
+		vector<TFloat32> m_Timers;
+	};
+
+
+
 	/*-----------------------------------------------------------------------------------------
 	-------------------------------------------------------------------------------------------
 		Shell Entity Class
@@ -42,8 +114,9 @@ namespace gen
 		(
 			CEntityTemplate* entityTemplate,
 			TEntityUID       UID,
+			CShellArchetype* archetype,
 			TEntityUID       ShooterUID,
-			const string& name = "",
+			TAtom         name = kNoAtom,
 			const CVector3& position = CVector3::kOrigin,
 			const CVector3& rotation = CVector3(0.0f, 0.0f, 0.0f),
 			const CVector3& scale = CVector3(1.0f, 1.0f, 1.0f)
@@ -65,14 +138,52 @@ namespace gen
 		virtual bool Update(TFloat32 updateTime);
 
 
+		/////////////////////////////////////
+		// Snapshots
+
+		// Shell data saved in entity snapshots (see EntitySnapshot.h), in addition to the data
+		// common to all entities
+		struct SSnapshotState
+		{
+			TFloat32   timer;
+			TFloat32   destructionPoint;
+			TEntityUID shooter;
+		};
+
+		// Get or restore the shell's snapshot data
+		void SaveState(SSnapshotState& state)
+		{
+			state.timer = Timer();
+			state.destructionPoint = destructionPoint;
+			state.shooter = shooterUID;
+		}
+		void LoadState(const SSnapshotState& state)
+		{
+			Timer() = state.timer;
+			destructionPoint = state.destructionPoint;
+			shooterUID = state.shooter;
+		}
+
+
 		/////////////////////////////////////
 		//	Private interface
 	private:
 
+		/////////////////////////////////////
+		// Archetype data
+
+		// Access to the shell lifetime timer held in the shell archetype
+		TFloat32& Timer()
+		{
+			return m_ShellArchetype->Timer(GetRow());
+		}
+
+
 		/////////////////////////////////////
 		// Data
+		CShellArchetype* m_ShellArchetype;
+
 		const float kMaxSpeed = 0.5f;
-		float m_Timer = 0;
 		float destructionPoint = 2.0f;
 		TEntityUID shooterUID;
 		// Add your shell data here
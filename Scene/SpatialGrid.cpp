@@ -0,0 +1,304 @@
+/*******************************************
+	SpatialGrid.cpp
+
+	Uniform grid spatial hash of entity
+	positions for proximity queries
+********************************************/
+
+#include <cmath>
+#include "SpatialGrid.h"
+#include "Entity.h"
+
+namespace gen
+{
+
+// Cell coordinates are clamped to this range, so points at extreme or invalid positions still
+// have a cell
+const TFloat32 kMaxGridCell = 1.0e9f;
+
+
+/////////////////////////////////////
+// Constructors/Destructors
+
+// Constructor takes the cell size and the number of buckets, which is rounded up to a power of 2
+CSpatialGrid::CSpatialGrid( TFloat32 cellSize /*= kDefaultGridCellSize*/,
+                            TUInt32 numBuckets /*= kDefaultGridBuckets*/ )
+{
+	m_CellSize = cellSize;
+	m_InvCellSize = 1.0f / cellSize;
+	m_NumBuckets = 1;
+	while (m_NumBuckets < numBuckets)
+	{
+		m_NumBuckets *= 2;
+	}
+	m_Buckets.resize( m_NumBuckets );
+	m_NumEntities = 0;
+}
+
+
+/////////////////////////////////////
+// Entities
+
+// Set an entity's position, adding it to the grid if it is not already in it
+void CSpatialGrid::Update( CEntity* entity, const CVector3& position )
+{
+	TInt32 cell[3];
+	GetCell( position, cell );
+
+	CEntity::SGridEntry& gridEntry = entity->m_GridEntry;
+	if (gridEntry.bucket != kNoGridBucket)
+	{
+		SEntry& entry = m_Buckets[gridEntry.bucket][gridEntry.position];
+		if (entry.cell[0] == cell[0] && entry.cell[1] == cell[1] && entry.cell[2] == cell[2])
+		{
+			// Same cell, only the position has changed
+			entry.position = position;
+			return;
+		}
+		Remove( entity );
+	}
+	AddEntry( entity, position, cell );
+}
+
+// Remove an entity from the grid, if it is in it
+void CSpatialGrid::Remove( CEntity* entity )
+{
+	CEntity::SGridEntry& gridEntry = entity->m_GridEntry;
+	if (gridEntry.bucket == kNoGridBucket)
+	{
+		return;
+	}
+
+	TBucket& bucket = m_Buckets[gridEntry.bucket];
+	TUInt32 lastPosition = static_cast<TUInt32>(bucket.size()) - 1;
+
+	// If not removing last entity...
+	if (gridEntry.position != lastPosition)
+	{
+		// ...move the last entity into the gap and tell it its new position
+		bucket[gridEntry.position] = bucket[lastPosition];
+		bucket[gridEntry.position].entity->m_GridEntry.position = gridEntry.position;
+	}
+	bucket.pop_back();
+	--m_NumEntities;
+
+	gridEntry.bucket = kNoGridBucket;
+	gridEntry.position = 0;
+}
+
+// Empty the grid without updating the entities - only for use when all entities are being
+// destroyed
+void CSpatialGrid::Clear()
+{
+	for (TUInt32 bucket = 0; bucket < m_NumBuckets; ++bucket)
+	{
+		m_Buckets[bucket].clear();
+	}
+	m_NumEntities = 0;
+}
+
+// Change the cell size, moving all entities into their new cells
+void CSpatialGrid::SetCellSize( TFloat32 cellSize )
+{
+	// Take all the entries out, then put them back with the new size
+	vector<SEntry> entries;
+	entries.reserve( m_NumEntities );
+	for (TUInt32 bucket = 0; bucket < m_NumBuckets; ++bucket)
+	{
+		entries.insert( entries.end(), m_Buckets[bucket].begin(), m_Buckets[bucket].end() );
+		m_Buckets[bucket].clear();
+	}
+	m_NumEntities = 0;
+
+	m_CellSize = cellSize;
+	m_InvCellSize = 1.0f / cellSize;
+	for (TUInt32 entry = 0; entry < entries.size(); ++entry)
+	{
+		TInt32 cell[3];
+		GetCell( entries[entry].position, cell );
+		AddEntry( entries[entry].entity, entries[entry].position, cell );
+	}
+}
+
+
+/////////////////////////////////////
+// Queries
+
+// Find the entities within the given radius of a point
+TUInt32 CSpatialGrid::FindInRadius( const CVector3& centre, TFloat32 radius,
+                                    TAtom templateType, CEntityList* teamList,
+                                    vector<CEntity*>* found ) const
+{
+	CVector3 extent( radius, radius, radius );
+	return Find( centre - extent, centre + extent, centre, radius * radius, templateType,
+	             teamList, 0, found, 0 );
+}
+
+// Find the entities inside the box between the given minimum and maximum points
+TUInt32 CSpatialGrid::FindInBox( const CVector3& minPoint, const CVector3& maxPoint,
+                                 TAtom templateType, CEntityList* teamList,
+                                 vector<CEntity*>* found ) const
+{
+	return Find( minPoint, maxPoint, minPoint, -1.0f, templateType, teamList, 0, found, 0 );
+}
+
+// Find any one entity within the given radius of a point, other than the excluded one
+CEntity* CSpatialGrid::FindAnyInRadius( const CVector3& centre, TFloat32 radius,
+                                        TAtom templateType, CEntityList* teamList,
+                                        const CEntity* exclude ) const
+{
+	CVector3 extent( radius, radius, radius );
+	CEntity* entity = 0;
+	Find( centre - extent, centre + extent, centre, radius * radius, templateType, teamList,
+	      exclude, 0, &entity );
+	return entity;
+}
+
+
+/////////////////////////////////////
+// Private functions
+
+// Calculate the cell containing a point
+void CSpatialGrid::GetCell( const CVector3& point, TInt32 cell[3] ) const
+{
+	TFloat32 coords[3] = { point.x, point.y, point.z };
+	for (TUInt32 axis = 0; axis < 3; ++axis)
+	{
+		TFloat32 coord = floor( coords[axis] * m_InvCellSize );
+		if (!(coord > -kMaxGridCell)) // Also catches NaN
+		{
+			coord = -kMaxGridCell;
+		}
+		else if (coord > kMaxGridCell)
+		{
+			coord = kMaxGridCell;
+		}
+		cell[axis] = static_cast<TInt32>(coord);
+	}
+}
+
+// Add an entity to the end of a bucket
+void CSpatialGrid::AddEntry( CEntity* entity, const CVector3& position, const TInt32 cell[3] )
+{
+	TUInt32 bucketIndex = GetBucket( cell );
+	TBucket& bucket = m_Buckets[bucketIndex];
+
+	SEntry entry;
+	entry.entity = entity;
+	entry.position = position;
+	entry.cell[0] = cell[0];
+	entry.cell[1] = cell[1];
+	entry.cell[2] = cell[2];
+
+	entity->m_GridEntry.bucket = bucketIndex;
+	entity->m_GridEntry.position = static_cast<TUInt32>(bucket.size());
+	bucket.push_back( entry );
+	++m_NumEntities;
+}
+
+// Find the entities in the cells overlapping the box between the given points that pass the
+// given test. Each cell's bucket is searched for entries in that cell - a bucket shared by
+// several cells in the box is visited once for each, but each entry matches only one cell.
+// If the box covers more cells than there are buckets, every bucket is searched once instead
+TUInt32 CSpatialGrid::Find( const CVector3& minPoint, const CVector3& maxPoint,
+                            const CVector3& centre, TFloat32 radiusSquared, TAtom templateType,
+                            CEntityList* teamList, const CEntity* exclude,
+                            vector<CEntity*>* found, CEntity** first ) const
+{
+	if (found)
+	{
+		found->clear();
+	}
+
+	TInt32 minCell[3];
+	TInt32 maxCell[3];
+	GetCell( minPoint, minCell );
+	GetCell( maxPoint, maxCell );
+	TUInt64 numCells = 1;
+	for (TUInt32 axis = 0; axis < 3; ++axis)
+	{
+		if (maxCell[axis] < minCell[axis])
+		{
+			return 0; // Empty box
+		}
+		numCells *= static_cast<TUInt64>(maxCell[axis] - minCell[axis]) + 1;
+		if (numCells > m_NumBuckets)
+		{
+			break;
+		}
+	}
+	bool allBuckets = (numCells > m_NumBuckets);
+
+	TInt32 cell[3];
+	TUInt32 bucketIndex = 0;
+	cell[0] = minCell[0];
+	cell[1] = minCell[1];
+	cell[2] = minCell[2];
+	while (true)
+	{
+		const TBucket& bucket = m_Buckets[allBuckets ? bucketIndex : GetBucket( cell )];
+		for (TUInt32 position = 0; position < bucket.size(); ++position)
+		{
+			const SEntry& entry = bucket[position];
+			if (!allBuckets && (entry.cell[0] != cell[0] || entry.cell[1] != cell[1] ||
+			                    entry.cell[2] != cell[2]))
+			{
+				continue;
+			}
+
+			const CVector3& p = entry.position;
+			if (radiusSquared >= 0.0f)
+			{
+				CVector3 offset = p - centre;
+				if (Dot( offset, offset ) > radiusSquared)
+				{
+					continue;
+				}
+			}
+			else if (p.x < minPoint.x || p.x > maxPoint.x || p.y < minPoint.y ||
+			         p.y > maxPoint.y || p.z < minPoint.z || p.z > maxPoint.z)
+			{
+				continue;
+			}
+
+			CEntity* entity = entry.entity;
+			if (!entity->IsDestroyed() &&
+			    (templateType == kNoAtom || entity->Template()->GetTypeAtom() == templateType) &&
+			    (!teamList || entity->GetIndexList( Index_Team ) == teamList) &&
+			    entity != exclude)
+			{
+				if (first)
+				{
+					*first = entity;
+					return 1;
+				}
+				found->push_back( entity );
+			}
+		}
+
+		// Next bucket, or next cell in the box
+		if (allBuckets)
+		{
+			if (++bucketIndex == m_NumBuckets)
+			{
+				break;
+			}
+		}
+		else if (++cell[0] > maxCell[0])
+		{
+			cell[0] = minCell[0];
+			if (++cell[1] > maxCell[1])
+			{
+				cell[1] = minCell[1];
+				if (++cell[2] > maxCell[2])
+				{
+					break;
+				}
+			}
+		}
+	}
+	return found ? static_cast<TUInt32>(found->size()) : 0;
+}
+
+
+} // namespace gen
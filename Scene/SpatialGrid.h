@@ -0,0 +1,159 @@
+/*******************************************
+	SpatialGrid.h
+
+	Uniform grid spatial hash of entity
+	positions for proximity queries
+********************************************/
+
+#pragma once
+
+#include <vector>
+using namespace std;
+
+#include "Defines.h"
+#include "CVector3.h"
+#include "StringAtoms.h"
+
+namespace gen
+{
+
+class CEntity;
+class CEntityList;
+
+// Default size of the cells of a spatial grid, in world units. Best around the radius of the
+// most frequent queries
+const TFloat32 kDefaultGridCellSize = 16.0f;
+
+// Default number of buckets the cells of a spatial grid are hashed into (a power of 2)
+const TUInt32 kDefaultGridBuckets = 4096;
+
+// Bucket of an entity that is not in a spatial grid
+const TUInt32 kNoGridBucket = 0xffffffff;
+
+
+// A spatial grid divides space into cubic cells and holds the entities in each cell. Space is
+// unbounded, so cells are hashed into a fixed number of buckets - entities in different cells
+// can share a bucket, but only those in the right cell are returned. Finding the entities near
+// a point visits only the few buckets for cells overlapping the query, so cost depends on the
+// number of entities nearby rather than the total. Each entity records its bucket and its
+// position in the bucket, so adding, moving and removing entities are all O(1) - the last
+// entity in a bucket is moved into the gap left by a removed one
+// Queries may be made from several threads at once, but not while entities are being changed
+class CSpatialGrid
+{
+/////////////////////////////////////
+//	Constructors/Destructors
+public:
+	// Constructor takes the cell size and the number of buckets, which is rounded up to a
+	// power of 2
+	CSpatialGrid( TFloat32 cellSize = kDefaultGridCellSize,
+	              TUInt32 numBuckets = kDefaultGridBuckets );
+
+	// No destructor needed, the grid does not own the entities
+
+private:
+	// Prevent use of copy constructor and assignment operator (private and not defined)
+	CSpatialGrid( const CSpatialGrid& );
+	CSpatialGrid& operator=( const CSpatialGrid& );
+
+
+/////////////////////////////////////
+//	Public interface
+public:
+
+	/////////////////////////////////////
+	// Entities
+
+	// Set an entity's position, adding it to the grid if it is not already in it. An entity
+	// is only moved between buckets when its cell changes
+	void Update( CEntity* entity, const CVector3& position );
+
+	// Remove an entity from the grid, if it is in it
+	void Remove( CEntity* entity );
+
+	// Empty the grid without updating the entities - only for use when all entities are being
+	// destroyed
+	void Clear();
+
+	TUInt32 NumEntities()
+	{
+		return m_NumEntities;
+	}
+
+	// Change the cell size, moving all entities into their new cells
+	void SetCellSize( TFloat32 cellSize );
+
+	TFloat32 GetCellSize()
+	{
+		return m_CellSize;
+	}
+
+
+	/////////////////////////////////////
+	// Queries
+
+	// Find the entities within the given radius of a point, or inside the box between the
+	// given minimum and maximum points. Entities can be filtered by template type (kNoAtom for
+	// any type) and by team list (0 for any team, see CEntityManager::GetTeamEntities).
+	// Destroyed entities are skipped. The entities found replace the contents of the given
+	// vector, in no particular order, and their number is returned
+	TUInt32 FindInRadius( const CVector3& centre, TFloat32 radius, TAtom templateType,
+	                      CEntityList* teamList, vector<CEntity*>* found ) const;
+	TUInt32 FindInBox( const CVector3& minPoint, const CVector3& maxPoint, TAtom templateType,
+	                   CEntityList* teamList, vector<CEntity*>* found ) const;
+
+	// Find any one entity within the given radius of a point, other than the given entity (0
+	// to exclude none), using the same filters as FindInRadius. Returns 0 if there is none.
+	// The search stops at the first match and stores nothing, so it allocates no memory
+	CEntity* FindAnyInRadius( const CVector3& centre, TFloat32 radius, TAtom templateType,
+	                          CEntityList* teamList, const CEntity* exclude ) const;
+
+
+/////////////////////////////////////
+//	Private interface
+private:
+
+	// An entity in a bucket, with its position and cell copied so queries only look at the
+	// entity itself once it is known to be in range
+	struct SEntry
+	{
+		CEntity* entity;
+		CVector3 position;
+		TInt32   cell[3];
+	};
+	typedef vector<SEntry> TBucket;
+
+	// Calculate the cell containing a point
+	void GetCell( const CVector3& point, TInt32 cell[3] ) const;
+
+	// Return the bucket a cell is hashed into
+	TUInt32 GetBucket( const TInt32 cell[3] ) const
+	{
+		// Large primes, to spread neighbouring cells over the buckets
+		TUInt32 hash = (static_cast<TUInt32>(cell[0]) * 73856093u) ^
+		               (static_cast<TUInt32>(cell[1]) * 19349663u) ^
+		               (static_cast<TUInt32>(cell[2]) * 83492791u);
+		return hash & (m_NumBuckets - 1);
+	}
+
+	// Add an entity to the end of a bucket
+	void AddEntry( CEntity* entity, const CVector3& position, const TInt32 cell[3] );
+
+	// Find the entities in the cells overlapping the box between the given points that pass
+	// the given test - within the radius of the centre if radiusSquared is not negative,
+	// otherwise inside the box - skipping the excluded entity, if any. If first is given
+	// the search stops at the first match, which is stored there, otherwise all matches are
+	// stored in found
+	TUInt32 Find( const CVector3& minPoint, const CVector3& maxPoint, const CVector3& centre,
+	              TFloat32 radiusSquared, TAtom templateType, CEntityList* teamList,
+	              const CEntity* exclude, vector<CEntity*>* found, CEntity** first ) const;
+
+	TFloat32        m_CellSize;
+	TFloat32        m_InvCellSize;
+	TUInt32         m_NumBuckets;
+	vector<TBucket> m_Buckets;
+	TUInt32         m_NumEntities;
+};
+
+
+} // namespace gen
@@ -0,0 +1,50 @@
+/*******************************************
+	StringAtoms.cpp
+
+	Global table of interned strings, each
+	identified by a compact atom
+********************************************/
+
+#include "StringAtoms.h"
+
+namespace gen
+{
+
+// Constructor interns the empty string as kNoAtom
+CAtomTable::CAtomTable()
+{
+	Intern( "" );
+}
+
+// Return the atom for the given string, adding the string to the table if necessary
+TAtom CAtomTable::Intern( const string& text )
+{
+	// Most strings interned are already in the table, so look first without blocking readers
+	TAtom existing = Find( text );
+	if (existing != kUnknownAtom)
+	{
+		return existing;
+	}
+
+	unique_lock<shared_timed_mutex> lock( m_Mutex );
+	TAtom newAtom = static_cast<TAtom>(m_Strings.size());
+	pair<TAtomMapIter, bool> atom = m_Atoms.insert( TAtomMap::value_type( text, newAtom ) );
+	if (atom.second)
+	{
+		// New string, point the atom at the key stored in the map
+		m_Strings.push_back( &atom.first->first );
+	}
+	return atom.first->second;
+}
+
+
+// Return the global atom table. It is created on first use, so may be used during static
+// initialisation
+CAtomTable& Atoms()
+{
+	static CAtomTable atomTable;
+	return atomTable;
+}
+
+
+} // namespace gen
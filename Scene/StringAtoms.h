@@ -0,0 +1,133 @@
+/*******************************************
+	StringAtoms.h
+
+	Global table of interned strings, each
+	identified by a compact atom
+********************************************/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <shared_mutex>
+using namespace std;
+
+#include "Defines.h"
+
+namespace gen
+{
+
+/////////////////////////////////////
+//	Public types
+
+// An atom identifies an interned string. Two strings are equal if and only if their atoms are
+// equal, so names can be compared with a single integer compare. Atoms are only valid for the
+// lifetime of the program and should not be saved
+typedef TUInt32 TAtom;
+
+// The atom of the empty string, used for "no name"
+const TAtom kNoAtom = 0;
+
+// Returned when looking up a string that has never been interned - matches no atom
+const TAtom kUnknownAtom = 0xffffffff;
+
+
+/*-----------------------------------------------------------------------------------------
+-------------------------------------------------------------------------------------------
+	Atom Table Class
+-------------------------------------------------------------------------------------------
+-----------------------------------------------------------------------------------------*/
+
+// The atom table maps strings to atoms and back. Strings are never removed, so the number
+// of distinct strings interned should be bounded (template names, types, entity names)
+// The table may be used from several threads at once (e.g. entities created by name during a
+// parallel update). Lookups share a lock, interning a new string takes it exclusively
+class CAtomTable
+{
+/////////////////////////////////////
+//	Constructors/Destructors
+public:
+	// Constructor interns the empty string as kNoAtom
+	CAtomTable();
+
+	// No destructor needed
+
+private:
+	// Prevent use of copy constructor and assignment operator (private and not defined)
+	CAtomTable( const CAtomTable& );
+	CAtomTable& operator=( const CAtomTable& );
+
+
+/////////////////////////////////////
+//	Public interface
+public:
+
+	// Return the atom for the given string, adding the string to the table if necessary
+	TAtom Intern( const string& text );
+
+	// Return the atom for the given string, or kUnknownAtom if it has never been interned
+	TAtom Find( const string& text )
+	{
+		shared_lock<shared_timed_mutex> lock( m_Mutex );
+		TAtomMapIter atom = m_Atoms.find( text );
+		if (atom == m_Atoms.end())
+		{
+			return kUnknownAtom;
+		}
+		return atom->second;
+	}
+
+	// Return the string for the given atom
+	const string& GetString( TAtom atom )
+	{
+		shared_lock<shared_timed_mutex> lock( m_Mutex );
+		return *m_Strings[atom];
+	}
+
+
+/////////////////////////////////////
+//	Private interface
+private:
+
+	typedef unordered_map<string, TAtom> TAtomMap;
+	typedef TAtomMap::iterator TAtomMapIter;
+
+	// Map from strings to atoms and list of strings indexed by atom. The strings in the list
+	// point at the keys in the map, which never move
+	TAtomMap              m_Atoms;
+	vector<const string*> m_Strings;
+
+	// Held shared for lookups and exclusively while adding a string
+	shared_timed_mutex m_Mutex;
+};
+
+
+/////////////////////////////////////
+//	Global atom table
+
+// Return the global atom table. It is created on first use, so may be used during static
+// initialisation
+CAtomTable& Atoms();
+
+// Return the atom for the given string, adding the string to the global table if necessary
+inline TAtom InternAtom( const string& text )
+{
+	return Atoms().Intern( text );
+}
+
+// Return the atom for the given string, or kUnknownAtom if it has never been interned
+inline TAtom FindAtom( const string& text )
+{
+	return Atoms().Find( text );
+}
+
+// Return the string for the given atom
+inline const string& AtomString( TAtom atom )
+{
+	return Atoms().GetString( atom );
+}
+
+
+} // namespace gen
@@ -30,6 +30,7 @@
 #include "TankEntity.h"
 #include "EntityManager.h"
 #include "Messenger.h"
+#include "MatrixKernels.h"
 
 namespace gen
 {
@@ -46,6 +47,11 @@ namespace gen
 	// Will be needed to implement the required tank behaviour in the Update function below
 	extern TEntityUID GetTankUID(int team);
 
+	// Atom for the shell template name. Resolving a template from its atom is an array lookup, so
+	// it is done for each shot - the template may be created after the tank, or be destroyed and
+	// recreated, so a handle kept by the tank could be invalid or left dangling
+	static const TAtom ShellTemplate = InternAtom("Shell Type 1");
+
 
 
 	/*-----------------------------------------------------------------------------------------
@@ -60,26 +66,30 @@ namespace gen
 	(
 		CTankTemplate* tankTemplate,
 		TEntityUID      UID,
+		CTankArchetype* archetype,
 		TUInt32         team,
-		const string& name /*=""*/,
+		TAtom         name /*= kNoAtom*/,
 		const CVector3& position /*= CVector3::kOrigin*/,
 		const CVector3& rotation /*= CVector3( 0.0f, 0.0f, 0.0f )*/,
 		const CVector3& scale /*= CVector3( 1.0f, 1.0f, 1.0f )*/
-	) : CEntity(tankTemplate, UID, name, position, rotation, scale)
+	) : CEntity(tankTemplate, UID, archetype, name, position, rotation, scale)
 	{
 		m_TankTemplate = tankTemplate;
+		m_TankArchetype = archetype;
 
 		// Tanks are on teams so they know who the enemy is
-		m_Team = team;
+		Team() = team;
 
 		// Initialise other tank data and state
-		m_Speed = 0.0f;
-		m_HP = m_TankTemplate->GetMaxHP();
+		Speed() = 0.0f;
+		HP() = m_TankTemplate->GetMaxHP();
+		m_TankArchetype->FrameStartHP( GetRow() ) = HP();
 		m_Ammo = m_TankTemplate->GetStartingAmmo();
 		m_ShellDamage = m_TankTemplate->GetShellDamage();
 		m_ShotsFired = 0;
 		m_State = Inactive;
-		m_Timer = 0.0f;
+		m_Dead = false;
+		Timer() = 0.0f;
 		m_MaxTurnSpeed = 3.0f;
 	}
 
@@ -137,34 +147,32 @@ namespace gen
 			}
 			case Msg_Hit:
 			{
+				//Remember who shot us
+				m_ShotBy = msg.from;
+
 				//Take Damage
-				m_HP -= dynamic_cast<CTankEntity*>(EntityManager.GetEntity(msg.from))->GetShellDamage();
+				HP() -= dynamic_cast<CTankEntity*>(EntityManager.GetEntity(msg.from))->GetShellDamage();
 				//Ask for help
-				if (m_HP > 0)
+				if (HP() > 0)
 				{
 					if (dynamic_cast<CTankEntity*>(EntityManager.GetEntity(msg.from)) != nullptr)
 					{
-						if (dynamic_cast<CTankEntity*>(EntityManager.GetEntity(msg.from))->GetTeam() != m_Team)
+						if (dynamic_cast<CTankEntity*>(EntityManager.GetEntity(msg.from))->GetTeam() != Team())
 						{
 
-							EntityManager.BeginEnumEntities("", "", "Tank");
-							CEntity* entity = EntityManager.EnumEntity();
-							while (entity != nullptr)
+							//Only tanks on the same team are asked
+							CEntitySpan teamTanks = EntityManager.GetTeamEntities(Team());
+							for (TUInt32 tank = 0; tank < teamTanks.size(); ++tank)
 							{
-								if (entity->GetUID() != GetUID())
+								if (teamTanks[tank]->GetUID() != GetUID())
 								{
-									//CHECKS NOT ON SAME TEAM
-									if (m_Team == dynamic_cast<CTankEntity*>(entity)->GetTeam())
-									{
-										SMessage msg7;
-										msg7.type = Msg_Help;
-										msg7.from = GetUID();
-										Messenger.SendMessage(entity->GetUID(), msg7);
-									}
+									SMessage msg7;
+									msg7.type = Msg_Help;
+									msg7.from = GetUID();
+									msg7.subject = msg.from;
+									Messenger.SendMessage(teamTanks[tank]->GetUID(), msg7);
 								}
-								entity = EntityManager.EnumEntity();  //Moves onto next Entity
 							}
-							EntityManager.EndEnumEntities();
 							break;
 						}
 					}
@@ -176,27 +184,17 @@ namespace gen
 				{
 					m_NeedsHelp = msg.from;
 
-
-					EntityManager.BeginEnumEntities("", "", "Tank");
-					CEntity* entity = EntityManager.EnumEntity();
-					while (entity != nullptr)
+					//The message carries the tank that attacked it, other tanks' data may be
+					//changing during the update so it is not read directly
+					CTankEntity* helpTank = dynamic_cast<CTankEntity*>(EntityManager.GetEntity(m_NeedsHelp));
+					if (helpTank != nullptr && m_NeedsHelp != GetUID())
 					{
-						if (entity->GetUID() != GetUID())
+						if (msg.subject != GetUID())
 						{
-							//
-							if (m_NeedsHelp == dynamic_cast<CTankEntity*>(entity)->GetUID())
-							{
-								if (dynamic_cast<CTankEntity*>(entity)->GetTarget() != GetUID())
-								{
-									m_TargetTank = dynamic_cast<CTankEntity*>(entity)->GetTarget();
-									m_State = Aim;
-									break;
-								}
-							}
+							m_TargetTank = msg.subject;
+							m_State = Aim;
 						}
-						entity = EntityManager.EnumEntity();  //Moves onto next Entity
 					}
-					EntityManager.EndEnumEntities();
 				}
 				break;
 			}
@@ -207,6 +205,11 @@ namespace gen
 
 				break;
 			}
+			case Msg_Restock:
+			{
+				Restock();
+				break;
+			}
 			}
 		}
 
@@ -214,19 +217,19 @@ namespace gen
 		// Tank behaviour
 		//Health
 
-		if (m_HP <= 0)
+		if (HP() <= 0)
 		{
 			m_State = Inactive;
 
 			//resets timer
 			if (m_Dead == false)
 			{
-				m_Timer = 0;
+				Timer() = 0;
 				m_Dead == true;
 			}
 			//Flips Tank
-			m_Timer += updateTime * 1;
-			if (m_Timer < 0.5)
+			Timer() += updateTime * 1;
+			if (Timer() < 0.5)
 			{
 				//Flip Up
 				Matrix().MoveY(0.3f);
@@ -236,7 +239,7 @@ namespace gen
 			else
 			{
 				//Flip Down
-				if (Position().y > 0.5)
+				if (GetPosition().y > 0.5)
 				{
 					Matrix().MoveY(-0.3f);
 					Matrix().RotateLocalZ(0.1f);
@@ -261,7 +264,7 @@ namespace gen
 			// When reached the wander point turn and head to next point.
 			if (GetTeam() == 0)
 			{
-				if (Position().DistanceTo(m_TargetPointA) < 8.0f)
+				if (GetPosition().DistanceTo(m_TargetPointA) < 8.0f)
 				{
 					if (m_TargetPointA == m_PatrolPointA[0])
 					{
@@ -287,7 +290,7 @@ namespace gen
 			}
 			else
 			{
-				if (Position().DistanceTo(m_TargetPointA) < 8.0f)
+				if (GetPosition().DistanceTo(m_TargetPointA) < 8.0f)
 				{
 					if (m_TargetPointA == m_PatrolPointB[0])
 					{
@@ -316,26 +319,27 @@ namespace gen
 			//When within 15 either side enter aim state
 			Matrix(2).RotateLocalY(m_TankTemplate->GetTurretTurnSpeed() * 0.5f * updateTime);
 
-			CMatrix4x4 world = Matrix() * Matrix(2);
+			CMatrix4x4 world;
+			MatrixMultiply(&world, GetMatrix(), GetMatrix(2));
 			CVector3 TurretFacingVector = Normalise(CVector3(world.e20, world.e21, world.e22));
 			CVector3 TurretRightwardVector = Normalise(CVector3(world.e00, world.e01, world.e02));
 
-			EntityManager.BeginEnumEntities("", "", "Tank");
-			CEntity* entity = EntityManager.EnumEntity();
-			while (entity != nullptr)
+			for (TUInt32 team = 0; team < EntityManager.NumTeams(); ++team)
 			{
-				if (entity->GetUID() != GetUID())
+				//CHECKS NOT ON SAME TEAM
+				if (team != Team())
 				{
-					//CHECKS NOT ON SAME TEAM
-					if (m_Team != dynamic_cast<CTankEntity*>(entity)->GetTeam())
+					CEntitySpan enemyTanks = EntityManager.GetTeamEntities(team);
+					for (TUInt32 tank = 0; tank < enemyTanks.size(); ++tank)
 					{
 						//CHECKS NOT ALREADY DEAD
-						if (dynamic_cast<CTankEntity*>(entity)->GetHP() > 0)
+						CTankEntity* entity = static_cast<CTankEntity*>(enemyTanks[tank]);
+						if (entity->GetFrameStartHP() > 0)
 						{
 							m_TargetTank = entity->GetUID();
 							if (EntityManager.GetEntity(m_TargetTank) != nullptr)
 							{
-								CVector3 target = Normalise(EntityManager.GetEntity(m_TargetTank)->Position() - Position());
+								CVector3 target = Normalise(EntityManager.GetEntity(m_TargetTank)->FrameStartPosition() - GetPosition());
 								float angle = ToDegrees(acos(Dot(TurretFacingVector, target)));
 
 								if (angle < 15.0f)
@@ -344,36 +348,36 @@ namespace gen
 									//LINE EQUATIONS   y = mx + c
 
 									// Left Wall
-									float d = Position().x - -7.5f;
+									float d = GetPosition().x - -7.5f;
 									float s = d / target.x;
-									CVector3 r = Position() + target * s;
+									CVector3 r = GetPosition() + target * s;
 									if (r.z < 45.0f && r.z > 35.0f)
 									{
 										inHouse = true;
 									}
 
 									// Right Wall
-									d = Position().x - 5.0f;
+									d = GetPosition().x - 5.0f;
 									s = d / target.x;
-									r = Position() + target * s;
+									r = GetPosition() + target * s;
 									if (r.z < 45.0f && r.z > 35.0f)
 									{
 										inHouse = true;
 									}
 
 									// Top Wall
-									d = Position().z - 45.5f;
+									d = GetPosition().z - 45.5f;
 									s = d / target.z;
-									r = Position() + target * s;
+									r = GetPosition() + target * s;
 									if (r.x < -7.5f && r.x > 5.0f)
 									{
 										inHouse = true;
 									}
 
 									// Bottom Wall
-									d = Position().z - 36.0f;
+									d = GetPosition().z - 36.0f;
 									s = d / target.z;
-									r = Position() + target * s;
+									r = GetPosition() + target * s;
 									if (r.x < -7.5f && r.x > 5.0f)
 									{
 										inHouse = true;
@@ -391,41 +395,46 @@ namespace gen
 						}
 					}
 				}
-				entity = EntityManager.EnumEntity();  //Moves onto next Entity
 			}
-			EntityManager.EndEnumEntities();
 		}
 		else if (m_State == Aim)
 		{
-			m_Timer += updateTime * 1;
+			Timer() += updateTime * 1;
 			//Lock on to Target
 			if (EntityManager.GetEntity(m_TargetTank) != nullptr)
 			{
 
-				CMatrix4x4 world = Matrix() * Matrix(2);
+				CMatrix4x4 world;
+				MatrixMultiply(&world, GetMatrix(), GetMatrix(2));
 				CVector3 TurretFacingVector = Normalise(CVector3(world.e20, world.e21, world.e22));
 				CVector3 TurretRightwardVector = Normalise(CVector3(world.e00, world.e01, world.e02));
 
 
 				/*Matrix(2).RotateLocalY(m_TankTemplate->GetTurretTurnSpeed() * updateTime);*/
-				CVector3 target = Normalise(EntityManager.GetEntity(m_TargetTank)->Position() - Position());
+				CVector3 target = Normalise(EntityManager.GetEntity(m_TargetTank)->FrameStartPosition() - GetPosition());
 				float angle = ToDegrees(acos(Dot(TurretFacingVector, target)));
 				float facer = Dot(TurretRightwardVector, target);
 
 
-				if (m_Timer > 1.0f)
+				if (Timer() > 1.0f)
 				{
 					//Create Shell
 					if (m_Ammo > 0)
 					{
-						TEntityUID shell = EntityManager.CreateShell("Shell Type 1", GetUID(), "", CVector3(Matrix().Position().x + (TurretFacingVector.x), 2.5f, Matrix().Position().z + (TurretFacingVector.z * 2)));
-						EntityManager.GetEntity(shell)->Matrix().FaceDirection(TurretFacingVector);
-						m_Ammo--;
-						m_ShotsFired++;
+						// The shell is not created until the end of the update, so give it the turret's
+						// facing as a rotation rather than setting its matrix
+						CVector3 shellRotation(-asin(TurretFacingVector.y), atan2(TurretFacingVector.x, TurretFacingVector.z), 0.0f);
+						// Only spend the shot if the shell template exists
+						TEntityUID shellUID = EntityManager.CreateShell(EntityManager.ResolveShellTemplate(ShellTemplate), GetUID(), kNoAtom, CVector3(GetPosition().x + (TurretFacingVector.x), 2.5f, GetPosition().z + (TurretFacingVector.z * 2)), shellRotation);
+						if (shellUID != SystemUID)
+						{
+							m_Ammo--;
+							m_ShotsFired++;
+						}
 					}
 					//Enter Evade State
-					m_TargetPointA = CVector3(Position().x + Random(-40.0f, 40.0f), 0.5f, Position().z + Random(-40.0f, 40.0f)); //choose a point within 40 units
-					m_Timer = 0; //resets timer
+					m_TargetPointA = CVector3(GetPosition().x + Random(-40.0f, 40.0f), 0.5f, GetPosition().z + Random(-40.0f, 40.0f)); //choose a point within 40 units
+					Timer() = 0; //resets timer
 					m_State = Evade; //enter evade state
 				}
 
@@ -445,7 +454,7 @@ namespace gen
 			}
 			else
 			{
-				m_Timer = 0;
+				Timer() = 0;
 				m_State = Evade;
 			}
 
@@ -457,8 +466,8 @@ namespace gen
 
 			//Turret point at front
 
-			CVector3 TurretFacingVector = Normalise(CVector3(Matrix(2).e20, Matrix(2).e21, Matrix(2).e22));
-			CVector3 TurretRightwardVector = Normalise(CVector3(Matrix(2).e00, Matrix(2).e01, Matrix(2).e02));
+			CVector3 TurretFacingVector = Normalise(CVector3(GetMatrix(2).e20, GetMatrix(2).e21, GetMatrix(2).e22));
+			CVector3 TurretRightwardVector = Normalise(CVector3(GetMatrix(2).e00, GetMatrix(2).e01, GetMatrix(2).e02));
 			CVector3 target = CVector3(0, 0, 1);
 			float facer = Dot(TurretRightwardVector, target);
 			float angle = ToDegrees(acos(Dot(TurretFacingVector, target)));
@@ -482,7 +491,7 @@ namespace gen
 			}
 
 			//Enters patrol when reaches new point
-			if (Distance(Position(), m_TargetPointA) < 7.0f)
+			if (Distance(GetPosition(), m_TargetPointA) < 7.0f)
 			{
 				if (GetTeam() == 0)
 				{
@@ -497,12 +506,12 @@ namespace gen
 		}
 		else if (m_State == Inactive) //reduces speed to 0 and game stops
 		{
-			m_Speed = 0;
+			Speed() = 0;
 		}
 		else if (m_State == Hunting)
 		{
-			CVector3 TurretFacingVector = Normalise(CVector3(Matrix(2).e20, Matrix(2).e21, Matrix(2).e22));
-			CVector3 TurretRightwardVector = Normalise(CVector3(Matrix(2).e00, Matrix(2).e01, Matrix(2).e02));
+			CVector3 TurretFacingVector = Normalise(CVector3(GetMatrix(2).e20, GetMatrix(2).e21, GetMatrix(2).e22));
+			CVector3 TurretRightwardVector = Normalise(CVector3(GetMatrix(2).e00, GetMatrix(2).e01, GetMatrix(2).e02));
 			CVector3 target = CVector3(0, 0, 1);
 			float facer = Dot(TurretRightwardVector, target);
 			float angle = ToDegrees(acos(Dot(TurretFacingVector, target)));
@@ -526,15 +535,15 @@ namespace gen
 			}
 			if (EntityManager.GetEntity(m_TargetAmmo) != nullptr)
 			{
-				CVector3 FacingVector = Normalise(CVector3(Matrix().e20, Matrix().e21, Matrix().e22));
-				CVector3 RightwardVector = Normalise(CVector3(Matrix().e00, Matrix().e01, Matrix().e02));
-				CVector3 target = Normalise(EntityManager.GetEntity(m_TargetAmmo)->Position() - Position());
+				CVector3 FacingVector = Normalise(CVector3(GetMatrix().e20, GetMatrix().e21, GetMatrix().e22));
+				CVector3 RightwardVector = Normalise(CVector3(GetMatrix().e00, GetMatrix().e01, GetMatrix().e02));
+				CVector3 target = Normalise(EntityManager.GetEntity(m_TargetAmmo)->FrameStartPosition() - GetPosition());
 
 				float angle = ToDegrees(acos(Dot(FacingVector, target)));
 
 				if (angle < 2.0f)
 				{
-					Matrix().FaceTarget(EntityManager.GetEntity(m_TargetAmmo)->Position());
+					Matrix().FaceTarget(EntityManager.GetEntity(m_TargetAmmo)->FrameStartPosition());
 				}
 				else
 				{
@@ -556,15 +565,21 @@ namespace gen
 			}
 		}
 
+		// An inactive tank has nothing to do until it is sent a message
+		if (m_State == Inactive && HP() > 0)
+		{
+			EntityManager.SleepEntity(GetUID());
+		}
+
 		return true; // Don't destroy the entity
 	}
 
 
 	void CTankEntity::PatrolMove(TFloat32 updateTime)
 	{
-		CVector3 FacingVector = Normalise(CVector3(Matrix().e20, Matrix().e21, Matrix().e22));
-		CVector3 RightwardVector = Normalise(CVector3(Matrix().e00, Matrix().e01, Matrix().e02));
-		CVector3 target = Normalise(m_TargetPointA - Position());
+		CVector3 FacingVector = Normalise(CVector3(GetMatrix().e20, GetMatrix().e21, GetMatrix().e22));
+		CVector3 RightwardVector = Normalise(CVector3(GetMatrix().e00, GetMatrix().e01, GetMatrix().e02));
+		CVector3 target = Normalise(m_TargetPointA - GetPosition());
 
 		float angle = ToDegrees(acos(Dot(FacingVector, target)));
 
@@ -589,9 +604,9 @@ namespace gen
 	}
 	void CTankEntity::EvadeMove(TFloat32 updateTime)
 	{
-		CVector3 FacingVector = Normalise(CVector3(Matrix().e20, Matrix().e21, Matrix().e22));
-		CVector3 RightwardVector = Normalise(CVector3(Matrix().e00, Matrix().e01, Matrix().e02));
-		CVector3 target = Normalise(m_TargetPointA - Position());
+		CVector3 FacingVector = Normalise(CVector3(GetMatrix().e20, GetMatrix().e21, GetMatrix().e22));
+		CVector3 RightwardVector = Normalise(CVector3(GetMatrix().e00, GetMatrix().e01, GetMatrix().e02));
+		CVector3 target = Normalise(m_TargetPointA - GetPosition());
 
 		float angle = ToDegrees(acos(Dot(FacingVector, target)));
 
@@ -615,4 +630,50 @@ namespace gen
 
 	}
 
+	// Get the tank's data for an entity snapshot
+	void CTankEntity::SaveState(SSnapshotState& state)
+	{
+		state.speed = Speed();
+		state.HP = HP();
+		state.team = Team();
+		state.timer = Timer();
+		state.ammo = m_Ammo;
+		state.shellDamage = m_ShellDamage;
+		state.shotsFired = m_ShotsFired;
+		state.state = m_State;
+		state.dead = m_Dead ? 1 : 0;
+		state.targetPointA = m_TargetPointA;
+		state.targetPointB = m_TargetPointB;
+		state.maxTurnSpeed = m_MaxTurnSpeed;
+		state.countdown = m_Countdown;
+		state.targetTank = m_TargetTank;
+		state.targetAmmo = m_TargetAmmo;
+		state.shotBy = m_ShotBy;
+		state.needsHelp = m_NeedsHelp;
+	}
+
+	// Restore the tank's data from an entity snapshot. The team must be the one the tank was
+	// created with, as the tank is already in the index for that team
+	void CTankEntity::LoadState(const SSnapshotState& state)
+	{
+		Speed() = state.speed;
+		HP() = state.HP;
+		Team() = state.team;
+		Timer() = state.timer;
+		m_Ammo = state.ammo;
+		m_ShellDamage = state.shellDamage;
+		m_ShotsFired = state.shotsFired;
+		m_State = static_cast<EState>(state.state);
+		m_Dead = state.dead != 0;
+		m_TargetPointA = state.targetPointA;
+		m_TargetPointB = state.targetPointB;
+		m_MaxTurnSpeed = state.maxTurnSpeed;
+		m_Countdown = state.countdown;
+		m_TargetTank = state.targetTank;
+		m_TargetAmmo = state.targetAmmo;
+		m_ShotBy = state.shotBy;
+		m_NeedsHelp = state.needsHelp;
+	}
+
+
 } // namespace gen
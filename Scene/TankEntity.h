@@ -7,11 +7,13 @@
 #pragma once
 
 #include <string>
+#include <vector>
 using namespace std;
 
 #include "Defines.h"
 #include "CVector3.h"
 #include "Entity.h"
+#include "ShellEntity.h"
 
 namespace gen
 {
@@ -33,10 +35,10 @@ public:
 	// turn speed and passes the other parameters to construct the base class
 	CTankTemplate
 	(
-		const string& type, const string& name, const string& meshFilename,
+		const string& type, const string& name, const string& meshFilename, CMeshCache* meshCache,
 		TFloat32 maxSpeed, TFloat32 acceleration, TFloat32 turnSpeed,
 		TFloat32 turretTurnSpeed, TUInt32 maxHP, TUInt32 startAmmo, TUInt32 shellDamage
-	) : CEntityTemplate( type, name, meshFilename )
+	) : CEntityTemplate( type, name, meshFilename, meshCache )
 	{
 		// Set tank template values
 		m_MaxSpeed = maxSpeed;
@@ -108,6 +110,124 @@ private:
 	TUInt32  m_ShellDamage;     // HP damage caused by shells from this kind of tank
 };
 
+// Handle for templates used to create tanks, they must be tank templates
+typedef CTemplateHandle<CTankTemplate, Kind_Tank> TTankTemplateHandle;
+
+
+
+/*-----------------------------------------------------------------------------------------
+-------------------------------------------------------------------------------------------
+	Tank Archetype Class
+-------------------------------------------------------------------------------------------
+-----------------------------------------------------------------------------------------*/
+
+// The tank archetype adds columns for the tank data that is touched every frame - speed,
+// HP, team and state timer. The rest of the tank data stays in the tank entity
+class CTankArchetype : public CEntityArchetype
+{
+/////////////////////////////////////
+//	Constructors/Destructors
+public:
+	CTankArchetype( CMatrixArena* matrixArena ) : CEntityArchetype( Kind_Tank, matrixArena ) {}
+
+	// No destructor needed
+
+
+/////////////////////////////////////
+//	Public interface
+public:
+
+	/////////////////////////////////////
+	// Column access
+
+	TFloat32& Speed( TUInt32 row )
+	{
+		return m_Speeds[row];
+	}
+
+	TInt32& HP( TUInt32 row )
+	{
+		return m_HPs[row];
+	}
+
+	TInt32& FrameStartHP( TUInt32 row )
+	{
+		return m_FrameStartHPs[row];
+	}
+
+	TUInt32& Team( TUInt32 row )
+	{
+		return m_Teams[row];
+	}
+
+	TFloat32& Timer( TUInt32 row )
+	{
+		return m_Timers[row];
+	}
+
+
+/////////////////////////////////////
+//	Protected interface
+protected:
+
+	/////////////////////////////////////
+	// Column management
+
+	virtual void ReserveColumns( TUInt32 numRows )
+	{
+		m_Speeds.reserve( numRows );
+		m_HPs.reserve( numRows );
+		m_FrameStartHPs.reserve( numRows );
+		m_Teams.reserve( numRows );
+		m_Timers.reserve( numRows );
+	}
+
+	virtual void AddColumns()
+	{
+		m_Speeds.push_back( 0.0f );
+		m_HPs.push_back( 0 );
+		m_FrameStartHPs.push_back( 0 );
+		m_Teams.push_back( 0 );
+		m_Timers.push_back( 0.0f );
+	}
+
+	virtual void MoveColumns( TUInt32 from, TUInt32 to )
+	{
+		m_Speeds[to] = m_Speeds[from];
+		m_HPs[to] = m_HPs[from];
+		m_FrameStartHPs[to] = m_FrameStartHPs[from];
+		m_Teams[to] = m_Teams[from];
+		m_Timers[to] = m_Timers[from];
+	}
+
+	virtual void TruncateColumns( TUInt32 numRows )
+	{
+		m_Speeds.resize( numRows );
+		m_HPs.resize( numRows );
+		m_FrameStartHPs.resize( numRows );
+		m_Teams.resize( numRows );
+		m_Timers.resize( numRows );
+	}
+
+	// HP is the only tank column other entities read during an update
+	virtual void SaveFrameStartColumns( TUInt32 row )
+	{
+		m_FrameStartHPs[row] = m_HPs[row];
+	}
+
+
+/////////////////////////////////////
+//	Private interface
+private:
+
+	// Tank columns
+	vector<TFloat32> m_Speeds;
+	vector<TInt32>   m_HPs;
+	vector<TInt32>   m_FrameStartHPs;
+	vector<TUInt32>  m_Teams;
+	vector<TFloat32> m_Timers;
+};
+
 
 
 /*-----------------------------------------------------------------------------------------
@@ -133,8 +253,9 @@ public:
 	(
 		CTankTemplate*  tankTemplate,
 		TEntityUID      UID,
+		CTankArchetype* archetype,
 		TUInt32         team,
-		const string&   name = "",
+		TAtom           name = kNoAtom,
 		const CVector3& position = CVector3::kOrigin, 
 		const CVector3& rotation = CVector3( 0.0f, 0.0f, 0.0f ),
 		const CVector3& scale = CVector3( 1.0f, 1.0f, 1.0f )
@@ -152,12 +273,18 @@ public:
 
 	TFloat32 GetSpeed()
 	{
-		return m_Speed;
+		return Speed();
 	}
 
 	TInt32	GetHP()
 	{
-		return m_HP;
+		return HP();
+	}
+
+	// HP at the start of the current update, use this when reading other tanks in an update
+	TInt32	GetFrameStartHP()
+	{
+		return m_TankArchetype->FrameStartHP( GetRow() );
 	}
 
 	TInt32	GetAmmo()
@@ -182,7 +309,7 @@ public:
 
 	TInt32	GetTeam()
 	{
-		return m_Team;
+		return Team();
 	}
 
 	TEntityUID	GetTarget()
@@ -234,6 +361,37 @@ public:
 	//{
 	//	m_NeedsHelp = pleaTank;
 	//}
+
+
+	/////////////////////////////////////
+	// Snapshots
+
+	// Tank data saved in entity snapshots (see EntitySnapshot.h), in addition to the data
+	// common to all entities. Plain data so it can be read in place from a mapped file
+	struct SSnapshotState
+	{
+		TFloat32   speed;
+		TInt32     HP;
+		TUInt32    team;
+		TFloat32   timer;
+		TInt32     ammo;
+		TInt32     shellDamage;
+		TInt32     shotsFired;
+		TUInt32    state;
+		TUInt32    dead;
+		CVector3   targetPointA;
+		CVector3   targetPointB;
+		TFloat32   maxTurnSpeed;
+		TFloat32   countdown;
+		TEntityUID targetTank;
+		TEntityUID targetAmmo;
+		TEntityUID shotBy;
+		TEntityUID needsHelp;
+	};
+
+	// Get or restore the tank's snapshot data
+	void SaveState( SSnapshotState& state );
+	void LoadState( const SSnapshotState& state );
 	/////////////////////////////////////
 	// Update
 
@@ -265,23 +423,44 @@ private:
 	};
 
 
+	/////////////////////////////////////
+	// Archetype data
+
+	// Access to the tank data held in the tank archetype columns
+	TUInt32& Team() // Team number for tank (to know who the enemy is)
+	{
+		return m_TankArchetype->Team( GetRow() );
+	}
+	TFloat32& Speed() // Current speed (in facing direction)
+	{
+		return m_TankArchetype->Speed( GetRow() );
+	}
+	TInt32& HP() // Current hit points for the tank
+	{
+		return m_TankArchetype->HP( GetRow() );
+	}
+	TFloat32& Timer() // A timer used in the example update function
+	{
+		return m_TankArchetype->Timer( GetRow() );
+	}
+
+
 	/////////////////////////////////////
 	// Data
 
 	// The template holding common data for all tank entities
 	CTankTemplate* m_TankTemplate;
 
+	// The archetype holding the hot data for all tank entities
+	CTankArchetype* m_TankArchetype;
+
 	// Tank data
-	TUInt32  m_Team;  // Team number for tank (to know who the enemy is)
-	TFloat32 m_Speed; // Current speed (in facing direction)
-	TInt32   m_HP;    // Current hit points for the tank
 	TInt32   m_Ammo;    // Current shots fired by tank
 	TInt32   m_ShellDamage; // Stores damage for shell
 	TInt32   m_ShotsFired;
 
 	// Tank state
 	EState   m_State; // Current state
-	TFloat32 m_Timer; // A timer used in the example update function   
 	bool m_Dead; // bool if dead or not
 
 	//Movement Patrol Stuff
@@ -0,0 +1,167 @@
+/*******************************************
+	TemplateLoad.h
+
+	State of an entity template being created
+	asynchronously
+********************************************/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+using namespace std;
+
+#include "Defines.h"
+#include "MeshCache.h"
+#include "EntityArchetype.h"
+#include "EntityCommandBuffer.h"
+
+namespace gen
+{
+
+class CEntityTemplate;
+
+// Progress of an asynchronous template creation
+enum ETemplateLoadState
+{
+	TemplateLoad_Pending, // Mesh is being loaded on a worker thread
+	TemplateLoad_Loaded,  // Mesh has loaded, template not yet created
+	TemplateLoad_Ready,   // Template created and available from the entity manager
+	TemplateLoad_Failed,  // Mesh could not be loaded, no template created
+};
+
+
+// A template load tracks one template being created by CEntityManager::CreateTemplateAsync
+// (or CreateTankTemplateAsync). The mesh is loaded on a worker thread, then the entity manager
+// creates the template on the main thread and publishes it (see UpdateTemplateLoads). Callers
+// keep a TTemplateLoad to check progress; the manager and the worker keep their own references
+class CTemplateLoad
+{
+/////////////////////////////////////
+//	Constructors/Destructors
+public:
+	// Constructor takes the kind of template (Kind_Tank for tank templates, otherwise Kind_Base)
+	// and the template type, name and mesh file
+	CTemplateLoad( EEntityKind kind, const string& type, const string& name, const string& meshFilename )
+	{
+		m_Kind = kind;
+		m_Type = type;
+		m_Name = name;
+		m_MeshFilename = meshFilename;
+		m_Mesh = 0;
+		m_Template = 0;
+		m_State = TemplateLoad_Pending;
+	}
+
+	// Destructor deletes the loaded mesh if it was never handed to the mesh cache
+	~CTemplateLoad()
+	{
+		delete m_Mesh;
+	}
+
+private:
+	// Prevent use of copy constructor and assignment operator (private and not defined)
+	CTemplateLoad( const CTemplateLoad& );
+	CTemplateLoad& operator=( const CTemplateLoad& );
+
+
+/////////////////////////////////////
+//	Public interface
+public:
+
+	ETemplateLoadState GetState()
+	{
+		return m_State;
+	}
+
+	// Returns true until the template is ready or has failed
+	bool IsPending()
+	{
+		ETemplateLoadState state = m_State;
+		return state != TemplateLoad_Ready && state != TemplateLoad_Failed;
+	}
+
+	bool IsReady()
+	{
+		return m_State == TemplateLoad_Ready;
+	}
+
+	bool IsFailed()
+	{
+		return m_State == TemplateLoad_Failed;
+	}
+
+	// The created template, 0 until the load is ready
+	CEntityTemplate* GetTemplate()
+	{
+		return m_Template;
+	}
+
+	// Description of the failure if the load failed
+	const string& GetError()
+	{
+		return m_Error;
+	}
+
+
+/////////////////////////////////////
+//	Private interface
+private:
+	friend class CEntityManager;
+
+	// Load the mesh - called on a worker thread. Only touches the mesh and the state
+	void LoadMesh()
+	{
+		CMesh* mesh = new CMesh();
+		if (mesh->Load( m_MeshFilename ))
+		{
+			m_Mesh = mesh;
+			m_State = TemplateLoad_Loaded;
+		}
+		else
+		{
+			delete mesh;
+			m_Error = "Error loading mesh " + m_MeshFilename;
+			m_State = TemplateLoad_Failed;
+		}
+	}
+
+	// Template parameters
+	EEntityKind m_Kind;
+	string      m_Type;
+	string      m_Name;
+	string      m_MeshFilename;
+
+	// Tank template parameters, only used for tank templates
+	TFloat32 m_MaxSpeed;
+	TFloat32 m_Acceleration;
+	TFloat32 m_TurnSpeed;
+	TFloat32 m_TurretTurnSpeed;
+	TUInt32  m_MaxHP;
+	TUInt32  m_StartAmmo;
+	TUInt32  m_ShellDamage;
+
+	// Written by the worker thread before the state changes from pending
+	CMesh* m_Mesh;
+	string m_Error;
+
+	// Written by the main thread when the template is published
+	CEntityTemplate* m_Template;
+
+	// Another load that is loading the same mesh file, if any - this load waits for it
+	shared_ptr<CTemplateLoad> m_MeshLoad;
+
+	// Entities created with this template's name while it was pending, created when the
+	// template is ready. Main thread only
+	vector<SCreateCommand> m_QueuedCreates;
+
+	atomic<ETemplateLoadState> m_State;
+};
+
+// Template loads are shared between the caller, the entity manager and the worker thread
+typedef shared_ptr<CTemplateLoad> TTemplateLoad;
+
+
+} // namespace gen
@@ -0,0 +1,110 @@
+/*******************************************
+	EntityIndexTests.cpp
+
+	Tests for entity lists and the removal of
+	archetype rows
+********************************************/
+
+#include <vector>
+using namespace std;
+
+#include "SceneTests.h"
+#include "EntityManager.h"
+#include "EntityQuery.h"
+
+namespace gen
+{
+
+extern CEntityManager EntityManager;
+
+SCENE_TEST( EntityIndex, ListSwapRemove )
+{
+	EntityManager.DestroyAllEntities();
+	CreateTestTemplates();
+	for (TUInt32 entity = 0; entity < 6; ++entity)
+	{
+		EntityManager.CreateEntity( "Test Building" );
+	}
+
+	CEntityList* list = EntityManager.GetTypeList( "Scenery" );
+	CHECK( list && list->Size() == 6 );
+	if (!list)
+	{
+		return;
+	}
+
+	// Removing from the middle moves the last entity into the gap
+	CEntity* removed = list->GetEntity( 2 );
+	CEntity* last = list->GetEntity( 5 );
+	TEntityUID removedUID = removed->GetUID();
+	CHECK( EntityManager.DestroyEntity( removedUID ) );
+	CHECK( list->Size() == 5 );
+	CHECK( list->GetEntity( 2 ) == last );
+	for (TUInt32 position = 0; position < list->Size(); ++position)
+	{
+		CEntity* entity = list->GetEntity( position );
+		CHECK( entity->GetIndexList( Index_Type ) == list );
+		CHECK( entity->GetUID() != removedUID );
+	}
+
+	// Removing the last entity moves nothing
+	CEntity* first = list->GetEntity( 0 );
+	CHECK( EntityManager.DestroyEntity( list->GetEntity( 4 )->GetUID() ) );
+	CHECK( list->Size() == 4 && list->GetEntity( 0 ) == first && list->GetEntity( 2 ) == last );
+	EntityManager.DestroyAllEntities();
+}
+
+SCENE_TEST( EntityIndex, RemoveRows )
+{
+	EntityManager.DestroyAllEntities();
+	CreateTestTemplates();
+	const TUInt32 kNumEntities = 20;
+	vector<TEntityUID> UIDs;
+	for (TUInt32 entity = 0; entity < kNumEntities; ++entity)
+	{
+		UIDs.push_back( EntityManager.CreateEntity( "Test Building", "",
+		                                            CVector3( static_cast<TFloat32>(entity), 0.0f, 0.0f ) ) );
+	}
+	CEntityArchetype* archetype = EntityManager.GetEntity( UIDs[0] )->GetArchetype();
+	CHECK( archetype->NumRows() == kNumEntities );
+
+	// Destructions are deferred while a query is alive, then carried out together, removing
+	// all their rows in one pass. Remove every entity whose index is even or above 15
+	{
+		CEntityQuery query( EntityManager );
+		for (TUInt32 entity = 0; entity < kNumEntities; ++entity)
+		{
+			if (entity % 2 == 0 || entity > 15)
+			{
+				EntityManager.DestroyEntity( UIDs[entity] );
+			}
+		}
+		CHECK( archetype->NumRows() == kNumEntities );
+	}
+	EntityManager.UpdateAllEntities( 0.0f ); // Flushes the deferred destructions
+
+	CHECK( archetype->NumRows() == 8 );
+	for (TUInt32 entity = 0; entity < kNumEntities; ++entity)
+	{
+		bool survives = (entity % 2 == 1 && entity <= 15);
+		CHECK( (EntityManager.GetEntity( UIDs[entity] ) != 0) == survives );
+	}
+
+	// Each row holds one survivor, still with its own data
+	vector<bool> seen( kNumEntities, false );
+	for (TUInt32 row = 0; row < archetype->NumRows(); ++row)
+	{
+		CEntity* entity = archetype->GetEntity( row );
+		TUInt32 index = static_cast<TUInt32>(entity->GetPosition().x);
+		CHECK( index < kNumEntities && entity->GetUID() == UIDs[index] );
+		if (index < kNumEntities)
+		{
+			CHECK( !seen[index] );
+			seen[index] = true;
+		}
+	}
+	EntityManager.DestroyAllEntities();
+}
+
+
+} // namespace gen
@@ -0,0 +1,109 @@
+/*******************************************
+	EntitySlotMapTests.cpp
+
+	Tests for the generational slot map used
+	to look up entities by UID
+********************************************/
+
+#include "SceneTests.h"
+#include "EntitySlotMap.h"
+
+namespace gen
+{
+
+SCENE_TEST( EntitySlotMap, LookUp )
+{
+	CEntitySlotMap slots;
+	CEntity* entity = reinterpret_cast<CEntity*>(&slots); // Never dereferenced
+	TEntityUID UID = slots.AllocateUID();
+	CHECK( UID != SystemUID );
+	CHECK( slots.GetEntity( UID ) == 0 );
+	CHECK( slots.IsReserved( UID ) );
+
+	slots.SetEntity( UID, entity );
+	CHECK( slots.GetEntity( UID ) == entity );
+	CHECK( !slots.IsReserved( UID ) );
+	CHECK( slots.GetEntity( MakeEntityUID( EntityUIDIndex( UID ), EntityUIDGeneration( UID ) + 1 ) ) == 0 );
+	CHECK( slots.GetEntity( MakeEntityUID( 1000, 1 ) ) == 0 );
+
+	CHECK( slots.FreeUID( UID ) );
+	CHECK( slots.GetEntity( UID ) == 0 );
+	CHECK( !slots.FreeUID( UID ) ); // Stale
+}
+
+SCENE_TEST( EntitySlotMap, FreeListReuse )
+{
+	CEntitySlotMap slots;
+	TEntityUID UIDs[3];
+	for (TUInt32 UID = 0; UID < 3; ++UID)
+	{
+		UIDs[UID] = slots.AllocateUID();
+		CHECK( EntityUIDIndex( UIDs[UID] ) == UID );
+		CHECK( EntityUIDGeneration( UIDs[UID] ) == 1 );
+	}
+
+	// Freed slots are reused oldest first, each a generation on
+	CHECK( slots.FreeUID( UIDs[1] ) );
+	CHECK( slots.FreeUID( UIDs[0] ) );
+	TEntityUID reused1 = slots.AllocateUID();
+	TEntityUID reused0 = slots.AllocateUID();
+	TEntityUID added = slots.AllocateUID();
+	CHECK( EntityUIDIndex( reused1 ) == 1 && EntityUIDGeneration( reused1 ) == 2 );
+	CHECK( EntityUIDIndex( reused0 ) == 0 && EntityUIDGeneration( reused0 ) == 2 );
+	CHECK( EntityUIDIndex( added ) == 3 && EntityUIDGeneration( added ) == 1 );
+	CHECK( slots.IsReserved( reused1 ) && !slots.IsReserved( UIDs[1] ) );
+
+	// Batches reuse free slots first, then add new consecutive slots
+	CHECK( slots.FreeUID( UIDs[2] ) );
+	TEntityUID batch[4];
+	CHECK( slots.AllocateUIDs( 4, batch ) );
+	CHECK( EntityUIDIndex( batch[0] ) == 2 && EntityUIDGeneration( batch[0] ) == 2 );
+	CHECK( EntityUIDIndex( batch[1] ) == 4 && EntityUIDIndex( batch[2] ) == 5 && EntityUIDIndex( batch[3] ) == 6 );
+	CHECK( slots.NumSlots() == 7 );
+
+	// Freeing everything moves every slot in use on a generation
+	slots.FreeAllUIDs();
+	CHECK( !slots.IsReserved( batch[0] ) && !slots.IsReserved( added ) );
+	CHECK( EntityUIDGeneration( slots.AllocateUID() ) >= 2 );
+}
+
+SCENE_TEST( EntitySlotMap, GenerationWrap )
+{
+	// Restore a slot at the last generation rather than freeing it 2^32 times
+	CEntitySlotMap slots;
+	TUInt32 generations[2] = { 0xffffffff, 5 };
+	slots.BeginRestore( generations, 2 );
+	slots.EndRestore();
+
+	TEntityUID last = slots.AllocateUID();
+	CHECK( EntityUIDIndex( last ) == 0 && EntityUIDGeneration( last ) == 0xffffffff );
+	TEntityUID other = slots.AllocateUID();
+	CHECK( EntityUIDIndex( other ) == 1 && EntityUIDGeneration( other ) == 5 );
+
+	// The wrapped slot is retired, so a UID from long ago can never match it again
+	CHECK( slots.FreeUID( last ) );
+	CHECK( slots.FreeUID( other ) );
+	TEntityUID next = slots.AllocateUID();
+	TEntityUID added = slots.AllocateUID();
+	CHECK( EntityUIDIndex( next ) == 1 && EntityUIDGeneration( next ) == 6 );
+	CHECK( EntityUIDIndex( added ) == 2 );
+	CHECK( slots.GetEntity( MakeEntityUID( 0, 0 ) ) == 0 );
+
+	slots.FreeAllUIDs();
+	for (TUInt32 UID = 0; UID < 4; ++UID)
+	{
+		CHECK( EntityUIDIndex( slots.AllocateUID() ) != 0 );
+	}
+}
+
+SCENE_TEST( EntitySlotMap, Limit )
+{
+	CEntitySlotMap slots;
+	CHECK( !slots.Reserve( CEntitySlotMap::kMaxSlots + 1 ) );
+	CHECK( slots.Reserve( 100 ) );
+	CHECK( slots.AllocateUID() != SystemUID );
+	CHECK( slots.NumSlots() == 1 );
+}
+
+
+} // namespace gen
@@ -0,0 +1,132 @@
+/*******************************************
+	EntitySnapshotTests.cpp
+
+	Tests for saving and loading entity
+	snapshots
+********************************************/
+
+#include <cmath>
+#include <cstdio>
+
+#include "SceneTests.h"
+#include "EntityManager.h"
+#include "Messenger.h"
+
+namespace gen
+{
+
+extern CEntityManager EntityManager;
+extern CMessenger Messenger;
+
+SCENE_TEST( EntitySnapshot, RoundTrip )
+{
+	EntityManager.DestroyAllEntities();
+	CreateTestTemplates();
+
+	// One entity of each kind, with some non-default state
+	TEntityUID tank = EntityManager.CreateTank( "Test Tank", 1, "Snapshot Tank", CVector3( 1.0f, 2.0f, 3.0f ) );
+	TEntityUID sleeper = EntityManager.CreateTank( "Test Tank", 0, "", CVector3( -4.0f, 0.0f, 4.0f ) );
+	TEntityUID building = EntityManager.CreateEntity( "Test Building", "Snapshot Building", CVector3( 5.0f, 6.0f, 7.0f ) );
+	TEntityUID shell = EntityManager.CreateShell( "Test Shell", tank, "", CVector3( 0.0f, 1.0f, 0.0f ) );
+	TEntityUID ammo = EntityManager.CreateAmmo( "Test Ammo", SystemUID, "", CVector3( 0.0f, 0.5f, 9.0f ) );
+	CHECK( EntityManager.NumEntities() == 5 );
+
+	CEntity* tankEntity = EntityManager.GetEntity( tank );
+	tankEntity->SetUpdateInterval( 3 );
+	tankEntity->Matrix( 1 ).e30 += 0.25f; // Relative node matrix
+	TInt32 HP = static_cast<CTankEntity*>(tankEntity)->GetHP();
+	CHECK( EntityManager.SleepEntity( sleeper, 2.0f ) );
+	CAmmoEntity::SSnapshotState ammoState = { 1 }; // Landed
+	static_cast<CAmmoEntity*>(EntityManager.GetEntity( ammo ))->LoadState( ammoState );
+
+	CHECK( EntityManager.SaveSnapshot( "SceneTests.snap" ) );
+
+	// Replace the entities, then load them back over the new ones
+	EntityManager.DestroyAllEntities();
+	EntityManager.CreateEntity( "Test Building", "Not In Snapshot" );
+	CHECK( EntityManager.LoadSnapshot( "SceneTests.snap" ) );
+	CHECK( EntityManager.NumEntities() == 5 );
+	CHECK( EntityManager.GetEntity( "Not In Snapshot" ) == 0 );
+
+	// Same UIDs, names, positions and kind-specific state
+	CTankEntity* loadedTank = dynamic_cast<CTankEntity*>(EntityManager.GetEntity( tank ));
+	CHECK( loadedTank != 0 );
+	if (loadedTank)
+	{
+		CHECK( loadedTank->GetNameAtom() == FindAtom( "Snapshot Tank" ) );
+		CHECK( loadedTank->GetPosition().x == 1.0f && loadedTank->GetPosition().z == 3.0f );
+		CHECK( fabs( loadedTank->Matrix( 1 ).e30 - 0.25f ) < 1e-6f );
+		CHECK( loadedTank->GetHP() == HP );
+		CHECK( loadedTank->GetTeam() == 1 );
+		CHECK( loadedTank->GetUpdateInterval() == 3 );
+		CHECK( !loadedTank->IsAsleep() );
+	}
+	CEntity* loadedBuilding = EntityManager.GetEntity( "Snapshot Building" );
+	CHECK( loadedBuilding && loadedBuilding->GetUID() == building && loadedBuilding->GetPosition().y == 6.0f );
+	CHECK( dynamic_cast<CShellEntity*>(EntityManager.GetEntity( shell )) != 0 );
+
+	// Sleep state and ammo state
+	CEntity* loadedSleeper = EntityManager.GetEntity( sleeper );
+	CHECK( loadedSleeper && loadedSleeper->IsAsleep() );
+	CAmmoEntity* loadedAmmo = dynamic_cast<CAmmoEntity*>(EntityManager.GetEntity( ammo ));
+	CHECK( loadedAmmo != 0 );
+	if (loadedAmmo)
+	{
+		ammoState.landed = 0;
+		loadedAmmo->SaveState( ammoState );
+		CHECK( ammoState.landed == 1 );
+	}
+
+	// New entities don't reuse the loaded UIDs
+	TEntityUID fresh = EntityManager.CreateEntity( "Test Building" );
+	CHECK( fresh != tank && fresh != sleeper && fresh != building && fresh != shell && fresh != ammo );
+
+	// A bad file is rejected, leaving the entities in place
+	FILE* file = fopen( "SceneTestsBad.snap", "wb" );
+	if (file)
+	{
+		fputs( "not a snapshot", file );
+		fclose( file );
+	}
+	CHECK( !EntityManager.LoadSnapshot( "SceneTestsBad.snap" ) );
+	CHECK( !EntityManager.LoadSnapshot( "SceneTestsMissing.snap" ) );
+	CHECK( EntityManager.NumEntities() == 6 && EntityManager.GetEntity( tank ) != 0 );
+
+	remove( "SceneTests.snap" );
+	remove( "SceneTestsBad.snap" );
+	EntityManager.DestroyAllEntities();
+}
+
+SCENE_TEST( EntitySnapshot, SleeperWakes )
+{
+	EntityManager.DestroyAllEntities();
+	CreateTestTemplates();
+	TEntityUID sleeper = EntityManager.CreateTank( "Test Tank", 0 );
+
+	// Start the tank so it doesn't go back to sleep as soon as it wakes
+	SMessage start;
+	start.type = Msg_Start;
+	start.from = SystemUID;
+	start.subject = SystemUID;
+	Messenger.SendMessage( sleeper, start );
+	EntityManager.UpdateAllEntities( 0.0f );
+	CHECK( EntityManager.SleepEntity( sleeper, 0.5f ) );
+	CHECK( EntityManager.SaveSnapshot( "SceneTestsWake.snap" ) );
+	CHECK( EntityManager.LoadSnapshot( "SceneTestsWake.snap" ) );
+
+	// Still asleep until its wake time has passed after the load
+	CEntity* entity = EntityManager.GetEntity( sleeper );
+	CHECK( entity && entity->IsAsleep() );
+	EntityManager.UpdateAllEntities( 0.25f );
+	entity = EntityManager.GetEntity( sleeper );
+	CHECK( entity && entity->IsAsleep() );
+	EntityManager.UpdateAllEntities( 0.5f );
+	entity = EntityManager.GetEntity( sleeper );
+	CHECK( entity && !entity->IsAsleep() );
+
+	remove( "SceneTestsWake.snap" );
+	EntityManager.DestroyAllEntities();
+}
+
+
+} // namespace gen
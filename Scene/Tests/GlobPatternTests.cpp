@@ -0,0 +1,133 @@
+/*******************************************
+	GlobPatternTests.cpp
+
+	Tests for compiled wildcard patterns
+********************************************/
+
+#include "SceneTests.h"
+#include "GlobPattern.h"
+
+namespace gen
+{
+
+SCENE_TEST( GlobPattern, AnyString )
+{
+	CGlobPattern empty( "" );
+	CHECK( empty.IsAny() );
+	CHECK( empty.Match( "anything" ) );
+
+	CGlobPattern star( "*" );
+	CHECK( star.IsAny() );
+	CHECK( star.Match( "" ) );
+
+	CGlobPattern prefix( "Tank*" );
+	CHECK( !prefix.IsAny() && !prefix.IsLiteral() );
+	CHECK( prefix.Match( "Tank" ) );
+	CHECK( prefix.Match( "Tank12" ) );
+	CHECK( !prefix.Match( "Tan" ) );
+	CHECK( !prefix.Match( "ATank" ) );
+
+	CGlobPattern suffix( "*Scout" );
+	CHECK( suffix.Match( "Rogue Scout" ) );
+	CHECK( suffix.Match( "Scout" ) );
+	CHECK( !suffix.Match( "Scouts" ) );
+
+	CGlobPattern runs( "a**b" );
+	CHECK( runs.Match( "ab" ) );
+	CHECK( runs.Match( "axxb" ) );
+}
+
+SCENE_TEST( GlobPattern, AnyChar )
+{
+	CGlobPattern pattern( "Tank?" );
+	CHECK( pattern.Match( "Tank1" ) );
+	CHECK( !pattern.Match( "Tank" ) );
+	CHECK( !pattern.Match( "Tank12" ) );
+
+	CGlobPattern mixed( "?a*?" );
+	CHECK( mixed.Match( "ba1" ) );
+	CHECK( !mixed.Match( "ba" ) );
+}
+
+SCENE_TEST( GlobPattern, Classes )
+{
+	CGlobPattern listed( "[AB]-[0-9]" );
+	CHECK( listed.Match( "A-1" ) );
+	CHECK( listed.Match( "B-9" ) );
+	CHECK( !listed.Match( "C-1" ) );
+	CHECK( !listed.Match( "A-x" ) );
+
+	CGlobPattern notListed( "[!AB]x" );
+	CHECK( notListed.Match( "Cx" ) );
+	CHECK( !notListed.Match( "Ax" ) );
+	CHECK( !notListed.Match( "x" ) );
+
+	CGlobPattern caret( "[^AB]x" );
+	CHECK( caret.Match( "Cx" ) );
+	CHECK( !caret.Match( "Bx" ) );
+
+	CGlobPattern ranges( "[a-cx-z]" );
+	CHECK( ranges.Match( "b" ) );
+	CHECK( ranges.Match( "y" ) );
+	CHECK( !ranges.Match( "m" ) );
+}
+
+SCENE_TEST( GlobPattern, Escapes )
+{
+	CGlobPattern star( "\\*x" );
+	CHECK( star.Match( "*x" ) );
+	CHECK( !star.Match( "ax" ) );
+
+	CGlobPattern question( "a\\?" );
+	CHECK( question.Match( "a?" ) );
+	CHECK( !question.Match( "ab" ) );
+
+	CGlobPattern bracket( "\\[A]" );
+	CHECK( bracket.Match( "[A]" ) );
+	CHECK( !bracket.Match( "A" ) );
+}
+
+SCENE_TEST( GlobPattern, Backtracking )
+{
+	CGlobPattern pattern( "*ab*cd" );
+	CHECK( pattern.Match( "aab_xcd" ) );
+	CHECK( pattern.Match( "abcdcd" ) );
+	CHECK( !pattern.Match( "abc" ) );
+
+	// Each * must retry from later positions when the rest of the pattern fails
+	CGlobPattern repeated( "a*a*a*b" );
+	CHECK( repeated.Match( "aaaab" ) );
+	CHECK( repeated.Match( "axayazab" ) );
+	CHECK( !repeated.Match( "aaaaaaaaaaaaaaaaaaaaaaaa" ) );
+	CHECK( !repeated.Match( "aab" ) );
+}
+
+SCENE_TEST( GlobPattern, MatchAtomCache )
+{
+	CGlobPattern pattern( "Cache*" );
+	TAtom hit = InternAtom( "CacheTestHit" );
+	TAtom other = InternAtom( "CacheTestOther" );
+	CHECK( pattern.MatchAtom( hit ) );
+	CHECK( pattern.MatchAtom( hit ) ); // Cached result
+	CHECK( pattern.MatchAtom( other ) );
+	CHECK( !pattern.MatchAtom( InternAtom( "NoCacheTest" ) ) );
+	CHECK( !pattern.MatchAtom( kUnknownAtom ) );
+
+	// Recompiling clears the cached results
+	pattern.Compile( "No*" );
+	CHECK( !pattern.MatchAtom( hit ) );
+	CHECK( pattern.MatchAtom( InternAtom( "NoCacheTest" ) ) );
+
+	// A literal pattern doesn't intern its string, but matches it once it has been interned
+	CGlobPattern literal( "GlobTestLiteral" );
+	CHECK( literal.IsLiteral() );
+	CHECK( literal.GetLiteral() == kUnknownAtom );
+	CHECK( !literal.MatchAtom( kUnknownAtom ) );
+	TAtom interned = InternAtom( "GlobTestLiteral" );
+	CHECK( literal.GetLiteral() == interned );
+	CHECK( literal.MatchAtom( interned ) );
+	CHECK( !literal.MatchAtom( hit ) );
+}
+
+
+} // namespace gen
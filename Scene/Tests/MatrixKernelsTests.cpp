@@ -0,0 +1,286 @@
+/*******************************************
+	MatrixKernelsTests.cpp
+
+	Tests that the scalar, SSE and AVX2 matrix
+	kernels agree
+********************************************/
+
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+using namespace std;
+
+#include "SceneTests.h"
+#include "MatrixKernels.h"
+
+namespace gen
+{
+
+namespace
+{
+	// Results may differ in the last bits between kernel sets (e.g. fused multiply-add)
+	const TFloat32 kTolerance = 1e-4f;
+
+	TFloat32 RandomFloat( TFloat32 min, TFloat32 max )
+	{
+		return min + (max - min) * (rand() / static_cast<TFloat32>(RAND_MAX));
+	}
+
+	// Random affine matrix: rotation about each axis, non-uniform scale and a translation
+	CMatrix4x4 RandomAffine()
+	{
+		TFloat32 angleX = RandomFloat( -3.0f, 3.0f );
+		TFloat32 angleY = RandomFloat( -3.0f, 3.0f );
+		TFloat32 cx = cos( angleX ), sx = sin( angleX );
+		TFloat32 cy = cos( angleY ), sy = sin( angleY );
+		TFloat32 scale[3] = { RandomFloat( 0.5f, 2.0f ), RandomFloat( 0.5f, 2.0f ), RandomFloat( 0.5f, 2.0f ) };
+		TFloat32 rows[3][3] = { { cy, 0.0f, -sy }, { sx * sy, cx, sx * cy }, { cx * sy, -sx, cx * cy } };
+
+		CMatrix4x4 m;
+		TFloat32* e = &m.e00;
+		for (TUInt32 row = 0; row < 3; ++row)
+		{
+			for (TUInt32 col = 0; col < 3; ++col)
+			{
+				e[row * 4 + col] = rows[row][col] * scale[row];
+			}
+			e[row * 4 + 3] = 0.0f;
+		}
+		e[12] = RandomFloat( -100.0f, 100.0f );
+		e[13] = RandomFloat( -100.0f, 100.0f );
+		e[14] = RandomFloat( -100.0f, 100.0f );
+		e[15] = 1.0f;
+		return m;
+	}
+
+	bool Near( TFloat32 a, TFloat32 b )
+	{
+		return fabs( a - b ) <= kTolerance * (1.0f + fabs( a ) + fabs( b ));
+	}
+
+	bool MatricesNear( const CMatrix4x4& a, const CMatrix4x4& b )
+	{
+		const TFloat32* A = &a.e00;
+		const TFloat32* B = &b.e00;
+		for (TUInt32 element = 0; element < 16; ++element)
+		{
+			if (!Near( A[element], B[element] ))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool PointsNear( const CVector3& a, const CVector3& b )
+	{
+		return Near( a.x, b.x ) && Near( a.y, b.y ) && Near( a.z, b.z );
+	}
+
+	// Reference a * b, row vectors as CMatrix4x4
+	CMatrix4x4 ReferenceMultiply( const CMatrix4x4& a, const CMatrix4x4& b )
+	{
+		CMatrix4x4 result;
+		const TFloat32* A = &a.e00;
+		const TFloat32* B = &b.e00;
+		TFloat32* R = &result.e00;
+		for (TUInt32 row = 0; row < 4; ++row)
+		{
+			for (TUInt32 col = 0; col < 4; ++col)
+			{
+				R[row * 4 + col] = A[row * 4] * B[col] + A[row * 4 + 1] * B[4 + col] +
+				                   A[row * 4 + 2] * B[8 + col] + A[row * 4 + 3] * B[12 + col];
+			}
+		}
+		return result;
+	}
+
+	CMatrix4x4 Identity()
+	{
+		CMatrix4x4 m;
+		TFloat32* e = &m.e00;
+		for (TUInt32 element = 0; element < 16; ++element)
+		{
+			e[element] = (element % 5 == 0) ? 1.0f : 0.0f;
+		}
+		return m;
+	}
+}
+
+
+SCENE_TEST( MatrixKernels, SingleMatrices )
+{
+	srand( 1 );
+	for (TUInt32 kernels = MatrixKernels_Scalar; kernels <= SupportedMatrixKernels(); ++kernels)
+	{
+		SetMatrixKernels( static_cast<EMatrixKernels>(kernels) );
+		CHECK( GetMatrixKernels() == kernels );
+		for (TUInt32 test = 0; test < 50; ++test)
+		{
+			CMatrix4x4 a = RandomAffine();
+			CMatrix4x4 b = RandomAffine();
+
+			CMatrix4x4 product;
+			MatrixMultiply( &product, a, b );
+			CHECK( MatricesNear( product, ReferenceMultiply( a, b ) ) );
+
+			// Result may be one of the inputs
+			CMatrix4x4 inPlace = a;
+			MatrixMultiply( &inPlace, inPlace, b );
+			CHECK( MatricesNear( inPlace, product ) );
+
+			CMatrix4x4 inverse;
+			MatrixInverseAffine( &inverse, a );
+			CHECK( MatricesNear( ReferenceMultiply( a, inverse ), Identity() ) );
+			CHECK( MatricesNear( ReferenceMultiply( inverse, a ), Identity() ) );
+			MatrixInverseAffine( &inPlace, a );
+			CHECK( MatricesNear( inPlace, inverse ) );
+
+			CVector3 point( RandomFloat( -50.0f, 50.0f ), RandomFloat( -50.0f, 50.0f ),
+			                RandomFloat( -50.0f, 50.0f ) );
+			CVector3 transformed;
+			MatrixTransformPoint( &transformed, a, point );
+			CVector3 expected( point.x * a.e00 + point.y * a.e10 + point.z * a.e20 + a.e30,
+			                   point.x * a.e01 + point.y * a.e11 + point.z * a.e21 + a.e31,
+			                   point.x * a.e02 + point.y * a.e12 + point.z * a.e22 + a.e32 );
+			CHECK( PointsNear( transformed, expected ) );
+		}
+	}
+	SetMatrixKernels( SupportedMatrixKernels() );
+}
+
+SCENE_TEST( MatrixKernels, Batches )
+{
+	// Sizes that are not multiples of the SIMD widths, to test the tails
+	const TUInt32 kMaxNum = 19;
+	srand( 2 );
+	vector<CMatrix4x4> a( kMaxNum ), b( kMaxNum ), scalarProducts( kMaxNum ), products( kMaxNum );
+	vector<CVector3> points( kMaxNum ), scalarPoints( kMaxNum ), transformed( kMaxNum );
+	for (TUInt32 i = 0; i < kMaxNum; ++i)
+	{
+		a[i] = RandomAffine();
+		b[i] = RandomAffine();
+		points[i] = CVector3( RandomFloat( -50.0f, 50.0f ), RandomFloat( -50.0f, 50.0f ),
+		                      RandomFloat( -50.0f, 50.0f ) );
+	}
+
+	for (TUInt32 num = 0; num <= kMaxNum; ++num)
+	{
+		SetMatrixKernels( MatrixKernels_Scalar );
+		MatrixMultiplyBatch( &scalarProducts[0], &a[0], &b[0], num );
+		MatrixTransformPoints( &scalarPoints[0], a[0], &points[0], num );
+		for (TUInt32 kernels = MatrixKernels_Scalar; kernels <= SupportedMatrixKernels(); ++kernels)
+		{
+			SetMatrixKernels( static_cast<EMatrixKernels>(kernels) );
+
+			// Entries past num must be left alone
+			products.assign( kMaxNum, Identity() );
+			MatrixMultiplyBatch( &products[0], &a[0], &b[0], num );
+			transformed.assign( kMaxNum, CVector3( 7.0f, 7.0f, 7.0f ) );
+			MatrixTransformPoints( &transformed[0], a[0], &points[0], num );
+			for (TUInt32 i = 0; i < kMaxNum; ++i)
+			{
+				CHECK( MatricesNear( products[i], (i < num) ? scalarProducts[i] : Identity() ) );
+				CHECK( PointsNear( transformed[i], (i < num) ? scalarPoints[i] : CVector3( 7.0f, 7.0f, 7.0f ) ) );
+			}
+		}
+	}
+	SetMatrixKernels( SupportedMatrixKernels() );
+}
+
+SCENE_TEST( MatrixKernels, Hierarchy )
+{
+	// Node 0 is the root, every other node's parent comes before it
+	const TUInt32 kNumNodes = 13;
+	srand( 3 );
+	vector<CMatrix4x4> relMatrices( kNumNodes ), expected( kNumNodes ), matrices( kNumNodes );
+	vector<TUInt32> parents( kNumNodes, 0 );
+	for (TUInt32 node = 0; node < kNumNodes; ++node)
+	{
+		relMatrices[node] = RandomAffine();
+		parents[node] = (node > 0) ? rand() % node : 0;
+	}
+	expected[0] = relMatrices[0];
+	for (TUInt32 node = 1; node < kNumNodes; ++node)
+	{
+		expected[node] = ReferenceMultiply( relMatrices[node], expected[parents[node]] );
+	}
+
+	for (TUInt32 kernels = MatrixKernels_Scalar; kernels <= SupportedMatrixKernels(); ++kernels)
+	{
+		SetMatrixKernels( static_cast<EMatrixKernels>(kernels) );
+		matrices.assign( kNumNodes, Identity() );
+		matrices[0] = relMatrices[0];
+		MatrixMultiplyHierarchy( &matrices[0], &relMatrices[0], &parents[0], 1, kNumNodes );
+		for (TUInt32 node = 0; node < kNumNodes; ++node)
+		{
+			CHECK( MatricesNear( matrices[node], expected[node] ) );
+		}
+	}
+	SetMatrixKernels( SupportedMatrixKernels() );
+}
+
+SCENE_TEST( MatrixKernels, CullSpheres )
+{
+	// Axis aligned box planes and whole number centres and half unit radii, so every sphere
+	// is clearly in or out whatever the kernels' rounding
+	SPlane planes[6] =
+	{
+		{ CVector3(  1.0f,  0.0f,  0.0f ), -10.0f }, { CVector3( -1.0f,  0.0f,  0.0f ), -10.0f },
+		{ CVector3(  0.0f,  1.0f,  0.0f ), -10.0f }, { CVector3(  0.0f, -1.0f,  0.0f ), -10.0f },
+		{ CVector3(  0.0f,  0.0f,  1.0f ), -10.0f }, { CVector3(  0.0f,  0.0f, -1.0f ), -10.0f },
+	};
+
+	const TUInt32 kMaxNum = 37;
+	srand( 4 );
+	vector<SBoundingSphere> spheres( kMaxNum );
+	for (TUInt32 i = 0; i < kMaxNum; ++i)
+	{
+		spheres[i].centre = CVector3( static_cast<TFloat32>(rand() % 31 - 15),
+		                              static_cast<TFloat32>(rand() % 31 - 15),
+		                              static_cast<TFloat32>(rand() % 31 - 15) );
+		spheres[i].radius = static_cast<TFloat32>(rand() % 4) + 0.5f;
+	}
+
+	vector<TUInt32> visible( kMaxNum );
+	for (TUInt32 num = 0; num <= kMaxNum; ++num)
+	{
+		// Reference result, in order
+		vector<TUInt32> expected;
+		for (TUInt32 i = 0; i < num; ++i)
+		{
+			bool outside = false;
+			for (TUInt32 plane = 0; plane < 6; ++plane)
+			{
+				const CVector3& n = planes[plane].normal;
+				const CVector3& c = spheres[i].centre;
+				if (n.x * c.x + n.y * c.y + n.z * c.z + planes[plane].distance > spheres[i].radius)
+				{
+					outside = true;
+				}
+			}
+			if (!outside)
+			{
+				expected.push_back( i );
+			}
+		}
+
+		for (TUInt32 kernels = MatrixKernels_Scalar; kernels <= SupportedMatrixKernels(); ++kernels)
+		{
+			SetMatrixKernels( static_cast<EMatrixKernels>(kernels) );
+			TUInt32 numVisible = MatrixCullSpheres( num ? &spheres[0] : 0, num, planes, 6,
+			                                        num ? &visible[0] : 0 );
+			CHECK( numVisible == expected.size() );
+			bool same = (numVisible == expected.size());
+			for (TUInt32 i = 0; same && i < numVisible; ++i)
+			{
+				same = (visible[i] == expected[i]);
+			}
+			CHECK( same );
+		}
+	}
+	SetMatrixKernels( SupportedMatrixKernels() );
+}
+
+
+} // namespace gen
@@ -0,0 +1,91 @@
+/*******************************************
+	RenderCommandsTests.cpp
+
+	Tests for the render command list sort
+********************************************/
+
+#include <cstdlib>
+
+#include "SceneTests.h"
+#include "RenderCommands.h"
+
+namespace gen
+{
+
+namespace
+{
+	// Returns true if the commands are in key order, with commands of equal keys in the order
+	// they were added (their node is the order they were added in)
+	bool IsSorted( const CRenderCommandList& commands )
+	{
+		const SRenderCommand* command = commands.Commands();
+		for (TUInt32 i = 1; i < commands.NumCommands(); ++i)
+		{
+			if (command[i].sortKey < command[i - 1].sortKey ||
+			    (command[i].sortKey == command[i - 1].sortKey && command[i].node < command[i - 1].node))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+}
+
+
+SCENE_TEST( RenderCommands, SortKeys )
+{
+	// Mesh, then node, then depth
+	CHECK( RenderSortKey( 1, 0, 0 ) > RenderSortKey( 0, 0xffff, kMaxSortKeyDepth ) );
+	CHECK( RenderSortKey( 0, 1, 0 ) > RenderSortKey( 0, 0, kMaxSortKeyDepth ) );
+	CHECK( RenderSortKey( 0, 0, 2 ) > RenderSortKey( 0, 0, 1 ) );
+}
+
+SCENE_TEST( RenderCommands, RadixSort )
+{
+	srand( 5 );
+	CRenderCommandList commands;
+
+	// Empty and single command lists
+	commands.Sort();
+	CHECK( commands.NumCommands() == 0 );
+	commands.Add( 42, 0, 0, 0 );
+	commands.Sort();
+	CHECK( commands.NumCommands() == 1 && commands.Commands()[0].sortKey == 42 );
+
+	// Few distinct meshes and nodes so there are many equal keys, and depths in full
+	const TUInt32 kNumCommands = 2000;
+	commands.Clear();
+	for (TUInt32 command = 0; command < kNumCommands; ++command)
+	{
+		TUInt32 depth = (command % 3 == 0) ? 0 : ((static_cast<TUInt32>(rand()) << 8) ^ rand()) & kMaxSortKeyDepth;
+		commands.Add( RenderSortKey( rand() % 5, rand() % 3, depth ), 0, command, 0 );
+	}
+	commands.Sort();
+	CHECK( commands.NumCommands() == kNumCommands );
+	CHECK( IsSorted( commands ) );
+
+	// Keys differing only in their top byte, and in every byte
+	commands.Clear();
+	for (TUInt32 command = 0; command < 300; ++command)
+	{
+		commands.Add( static_cast<TUInt64>(rand() % 7) << 56, 0, command, 0 );
+	}
+	commands.Sort();
+	CHECK( IsSorted( commands ) );
+
+	commands.Clear();
+	for (TUInt32 command = 0; command < 300; ++command)
+	{
+		TUInt64 key = 0;
+		for (TUInt32 byte = 0; byte < 8; ++byte)
+		{
+			key = (key << 8) | (rand() & 0x3);
+		}
+		commands.Add( key, 0, command, 0 );
+	}
+	commands.Sort();
+	CHECK( IsSorted( commands ) );
+}
+
+
+} // namespace gen
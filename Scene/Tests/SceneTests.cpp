@@ -0,0 +1,138 @@
+/*******************************************
+	SceneTests.cpp
+
+	Test program for the headless scene
+	library
+********************************************/
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+using namespace std;
+
+#include "SceneTests.h"
+#include "EntityManager.h"
+
+namespace gen
+{
+
+// The entity classes expect the application to provide the entity manager and the tank UID
+// helper (normally in TankAssignment.cpp)
+CEntityManager EntityManager;
+
+TEntityUID GetTankUID( int /*team*/ )
+{
+	return SystemUID;
+}
+
+
+/////////////////////////////////////
+// Test registry
+
+namespace
+{
+	struct STest
+	{
+		const char*   group;
+		const char*   name;
+		TTestFunction function;
+	};
+
+	// Function-local so tests can register from static initialisers in any file
+	vector<STest>& Tests()
+	{
+		static vector<STest> tests;
+		return tests;
+	}
+
+	TUInt32 NumChecks = 0;
+	TUInt32 NumFailures = 0;
+
+
+	// Write a text .x mesh file with a root frame and the given number of child frames, each
+	// offset one unit up from its parent
+	void WriteTestMesh( const char* fileName, TUInt32 numFrames )
+	{
+		FILE* file = fopen( fileName, "wb" );
+		if (!file)
+		{
+			return;
+		}
+		fputs( "xof 0303txt 0032\n", file );
+		for (TUInt32 frame = 0; frame < numFrames; ++frame)
+		{
+			fprintf( file, "Frame Node%u {\n FrameTransformMatrix { 1.0,0.0,0.0,0.0, 0.0,1.0,0.0,0.0, "
+			               "0.0,0.0,1.0,0.0, 0.0,%.1f,0.0,1.0;; }\n", frame, frame ? 1.0f : 0.0f );
+		}
+		for (TUInt32 frame = 0; frame < numFrames; ++frame)
+		{
+			fputs( "}\n", file );
+		}
+		fclose( file );
+	}
+}
+
+// Register a test, used by SCENE_TEST
+bool RegisterTest( const char* group, const char* name, TTestFunction function )
+{
+	STest test = { group, name, function };
+	Tests().push_back( test );
+	return true;
+}
+
+// Record the result of a check, used by CHECK
+void CheckResult( bool passed, const char* condition, const char* file, int line )
+{
+	++NumChecks;
+	if (!passed)
+	{
+		++NumFailures;
+		printf( "%s(%d): check failed: %s\n", file, line, condition );
+	}
+}
+
+// Create the templates used by the entity tests, if not already created
+void CreateTestTemplates()
+{
+	if (EntityManager.GetTemplate( "Test Tank" ))
+	{
+		return;
+	}
+	WriteTestMesh( "TestTank.x", 2 );
+	WriteTestMesh( "TestPart.x", 1 );
+	EntityManager.CreateTankTemplate( "Tank", "Test Tank", "TestTank.x", 24.0f, 2.2f, 2.0f,
+	                                  kfPi / 3, 100, 20, 20 );
+	EntityManager.CreateTemplate( "Projectile", "Test Shell", "TestPart.x" );
+	EntityManager.CreateTemplate( "Ammo", "Test Ammo", "TestPart.x" );
+	EntityManager.CreateTemplate( "Scenery", "Test Building", "TestPart.x" );
+}
+
+
+} // namespace gen
+
+
+/////////////////////////////////////
+// Program entry
+
+// Run the tests in the group given on the command line, or all tests
+int main( int argc, char* argv[] )
+{
+	using namespace gen;
+
+	const char* group = (argc > 1) ? argv[1] : 0;
+	TUInt32 numRun = 0;
+	for (TUInt32 test = 0; test < Tests().size(); ++test)
+	{
+		if (!group || strcmp( group, Tests()[test].group ) == 0)
+		{
+			TUInt32 failuresBefore = NumFailures;
+			Tests()[test].function();
+			printf( "%s %s.%s\n", NumFailures == failuresBefore ? "passed" : "FAILED",
+			        Tests()[test].group, Tests()[test].name );
+			++numRun;
+		}
+	}
+
+	printf( "%u tests, %u checks, %u failed\n", numRun, NumChecks, NumFailures );
+	return (numRun == 0 || NumFailures > 0) ? 1 : 0;
+}
@@ -0,0 +1,46 @@
+/*******************************************
+	SceneTests.h
+
+	Minimal test framework for the headless
+	scene tests
+********************************************/
+
+#pragma once
+
+#include "Defines.h"
+
+namespace gen
+{
+
+// Tests are functions declared with SCENE_TEST, giving a group and a test name. The test
+// program runs the tests of the group named on its command line, or every test if no group is
+// named, and returns non-zero if any CHECK failed. CMakeLists.txt adds one CTest test for each
+// group. Tests using entities share the global entity manager, so each starts by destroying
+// all entities
+
+typedef void (*TTestFunction)();
+
+// Register a test, used by SCENE_TEST. Returns true so it can initialise a static
+bool RegisterTest( const char* group, const char* name, TTestFunction function );
+
+// Record the result of a check, used by CHECK. Failures are reported with the condition and
+// where it is
+void CheckResult( bool passed, const char* condition, const char* file, int line );
+
+// Create the templates used by the entity tests, if not already created, writing their mesh
+// files to the working directory:
+//     "Test Tank"     - tank template, type "Tank", three nodes
+//     "Test Shell"    - type "Projectile", two nodes
+//     "Test Ammo"     - type "Ammo", two nodes
+//     "Test Building" - type "Scenery", two nodes
+void CreateTestTemplates();
+
+#define SCENE_TEST( group, name ) \
+	static void group##_##name(); \
+	static bool group##_##name##_Registered = RegisterTest( #group, #name, group##_##name ); \
+	static void group##_##name()
+
+#define CHECK( condition ) CheckResult( (condition) ? true : false, #condition, __FILE__, __LINE__ )
+
+
+} // namespace gen
@@ -0,0 +1,110 @@
+/*******************************************
+	WorkerPool.cpp
+
+	Background worker threads running queued
+	tasks
+********************************************/
+
+#include "WorkerPool.h"
+
+namespace gen
+{
+
+// Constructor takes the number of threads to use, 0 for one less than the number of
+// hardware threads (at least one)
+CWorkerPool::CWorkerPool( TUInt32 numThreads /*= 0*/ )
+{
+	if (numThreads == 0)
+	{
+		// Leave one hardware thread for the main thread
+		numThreads = thread::hardware_concurrency();
+		numThreads = (numThreads > 1) ? numThreads - 1 : 1;
+	}
+	m_NumThreads = numThreads;
+	m_NumUnfinished = 0;
+	m_Stopping = false;
+}
+
+// Destructor waits for all submitted tasks to finish, then stops the threads
+CWorkerPool::~CWorkerPool()
+{
+	WaitIdle();
+	{
+		lock_guard<mutex> lock( m_Mutex );
+		m_Stopping = true;
+	}
+	m_TaskAdded.notify_all();
+	for (TUInt32 worker = 0; worker < m_Threads.size(); ++worker)
+	{
+		m_Threads[worker].join();
+	}
+}
+
+
+// Queue a task to be run on a worker thread
+void CWorkerPool::Submit( const TTask& task )
+{
+	if (m_Threads.empty())
+	{
+		Start();
+	}
+	{
+		lock_guard<mutex> lock( m_Mutex );
+		m_Tasks.push_back( task );
+		++m_NumUnfinished;
+	}
+	m_TaskAdded.notify_one();
+}
+
+// Wait until all submitted tasks have finished
+void CWorkerPool::WaitIdle()
+{
+	unique_lock<mutex> lock( m_Mutex );
+	while (m_NumUnfinished > 0)
+	{
+		m_TaskFinished.wait( lock );
+	}
+}
+
+
+// Start the worker threads
+void CWorkerPool::Start()
+{
+	for (TUInt32 worker = 0; worker < m_NumThreads; ++worker)
+	{
+		m_Threads.push_back( thread( &CWorkerPool::WorkerMain, this ) );
+	}
+}
+
+// Thread function for each worker - runs tasks until the pool is stopped
+void CWorkerPool::WorkerMain()
+{
+	unique_lock<mutex> lock( m_Mutex );
+	while (true)
+	{
+		while (m_Tasks.empty() && !m_Stopping)
+		{
+			m_TaskAdded.wait( lock );
+		}
+		if (m_Tasks.empty())
+		{
+			return; // Stopping and no more work
+		}
+
+		TTask task = m_Tasks.front();
+		m_Tasks.pop_front();
+
+		// Run the task without holding the lock
+		lock.unlock();
+		task();
+		lock.lock();
+
+		if (--m_NumUnfinished == 0)
+		{
+			m_TaskFinished.notify_all();
+		}
+	}
+}
+
+
+} // namespace gen
@@ -0,0 +1,82 @@
+/*******************************************
+	WorkerPool.h
+
+	Background worker threads running queued
+	tasks
+********************************************/
+
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+using namespace std;
+
+#include "Defines.h"
+
+namespace gen
+{
+
+// A worker pool runs tasks on a set of background threads. Tasks are run in the order they
+// are submitted, but several may run at once so they must not depend on each other. The
+// threads are started on the first submission rather than on construction, so a pool that is
+// never used costs nothing. Submit and WaitIdle must be called from one thread (the owner)
+class CWorkerPool
+{
+/////////////////////////////////////
+//	Constructors/Destructors
+public:
+	// Constructor takes the number of threads to use, 0 for one less than the number of
+	// hardware threads (at least one)
+	CWorkerPool( TUInt32 numThreads = 0 );
+
+	// Destructor waits for all submitted tasks to finish, then stops the threads
+	~CWorkerPool();
+
+private:
+	// Prevent use of copy constructor and assignment operator (private and not defined)
+	CWorkerPool( const CWorkerPool& );
+	CWorkerPool& operator=( const CWorkerPool& );
+
+
+/////////////////////////////////////
+//	Public interface
+public:
+
+	// A task is any function object taking no parameters
+	typedef function<void()> TTask;
+
+	// Queue a task to be run on a worker thread
+	void Submit( const TTask& task );
+
+	// Wait until all submitted tasks have finished
+	void WaitIdle();
+
+
+/////////////////////////////////////
+//	Private interface
+private:
+
+	// Start the worker threads
+	void Start();
+
+	// Thread function for each worker - runs tasks until the pool is stopped
+	void WorkerMain();
+
+	TUInt32        m_NumThreads;
+	vector<thread> m_Threads;
+
+	// Queued tasks and number of tasks submitted but not finished, guarded by the mutex
+	mutex              m_Mutex;
+	condition_variable m_TaskAdded;
+	condition_variable m_TaskFinished;
+	deque<TTask>       m_Tasks;
+	TUInt32            m_NumUnfinished;
+	bool               m_Stopping;
+};
+
+
+} // namespace gen